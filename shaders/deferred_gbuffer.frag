@@ -0,0 +1,46 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_GOOGLE_include_directive : require
+
+// g-buffer subpass of the deferred render pass, same inputs as simple_shader.frag
+// lights are added by deferred_lighting.frag, once per pixel
+layout (location = 0) in vec3 fragColor;
+layout (location = 1) in vec3 fragPosWorld;
+layout (location = 2) in vec3 fragNormalWorld;
+layout (location = 3) in vec2 fragUv;
+
+// swap chain image, the part of the color that doesn't depend on lights
+layout (location = 0) out vec4 outColor;
+// NreSwapChain::GBUFFER_ALBEDO_FORMAT, rgb albedo, a specular strength
+layout (location = 1) out vec4 outAlbedo;
+// NreSwapChain::GBUFFER_NORMAL_FORMAT, xyz world space normal, w shininess
+layout (location = 2) out vec4 outNormal;
+
+layout(set = 0, binding = 0)  uniform GlobalUbo {
+    mat4 projection;
+    mat4 view;
+    vec4 ambientLightColor;
+    vec4 lightPosition;
+    vec4 lightColor;
+    vec4 cameraPosition;
+} ubo;
+
+#include "material.glsl"
+
+layout(push_constant) uniform Push {
+    mat4 modelMatrix;
+    mat4 normalMatrix; // [3].x holds the material index bits
+} push;
+
+void main() {
+    Material material = materials[floatBitsToUint(push.normalMatrix[3].x)];
+    vec4 baseColor = material.baseColorFactor * sampleBaseColor(material, fragUv);
+    vec3 albedo = fragColor * baseColor.rgb;
+
+    vec3 ambientLight = ubo.ambientLightColor.xyz * ubo.ambientLightColor.w;
+    outColor = vec4(ambientLight * albedo + material.emission.rgb, baseColor.a);
+    // the specular color is folded into one channel, MTL files mostly have grey Ks
+    float specular = max(max(material.specular.r, material.specular.g), material.specular.b);
+    outAlbedo = vec4(albedo, specular);
+    outNormal = vec4(normalize(fragNormalWorld), max(material.specular.w, 1.0));
+}
@@ -0,0 +1,51 @@
+#version 450
+
+// lighting subpass of the deferred render pass, the g-buffer is read at this pixel
+// only, so it never has to leave tile memory
+layout (input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput gBufferAlbedo;
+layout (input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput gBufferNormal;
+layout (input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput gBufferDepth;
+
+// added onto what the g-buffer subpass wrote
+layout (location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 0)  uniform GlobalUbo {
+    mat4 projection;
+    mat4 view;
+    vec4 ambientLightColor;
+    vec4 lightPosition;
+    vec4 lightColor;
+    vec4 cameraPosition;
+} ubo;
+
+layout(push_constant) uniform Push {
+    mat4 inverseViewProjection;
+    vec4 inverseExtent; // xy
+} push;
+
+void main() {
+    float depth = subpassLoad(gBufferDepth).r;
+    // cleared, nothing was drawn here
+    if (depth >= 1.0) {
+        discard;
+    }
+    vec2 ndc = gl_FragCoord.xy * push.inverseExtent.xy * 2.0 - 1.0;
+    vec4 position = push.inverseViewProjection * vec4(ndc, depth, 1.0);
+    vec3 fragPosWorld = position.xyz / position.w;
+
+    vec4 albedo = subpassLoad(gBufferAlbedo);
+    vec4 normalShininess = subpassLoad(gBufferNormal);
+    vec3 normal = normalShininess.xyz;
+
+    // same as simple_shader.frag, without the ambient and emission the g-buffer subpass wrote
+    vec3 directionToLight = ubo.lightPosition.xyz - fragPosWorld;
+    float attentuation = 1.0 / dot(directionToLight, directionToLight); // distance squared
+    vec3 lightColor = ubo.lightColor.xyz * ubo.lightColor.w * attentuation;
+    vec3 diffuseLight = lightColor * max(dot(normal, normalize(directionToLight)), 0);
+
+    vec3 halfAngle = normalize(normalize(directionToLight) + normalize(ubo.cameraPosition.xyz - fragPosWorld));
+    float specular = pow(max(dot(normal, halfAngle), 0), normalShininess.w);
+    vec3 specularLight = lightColor * albedo.a * specular;
+
+    outColor = vec4(diffuseLight * albedo.rgb + specularLight, 0.0);
+}
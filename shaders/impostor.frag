@@ -0,0 +1,48 @@
+#version 450
+
+layout(location = 0) in vec2 fragUv;
+layout(location = 1) in vec3 fragPosWorld;
+layout(location = 2) in vec3 fragFrameDirWorld;
+layout(location = 3) in float fragRadius;
+layout(location = 4) flat in vec2 fragYaw;
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 0, binding = 0) uniform GlobalUbo {
+    mat4 projection;
+    mat4 view;
+    vec4 ambientLightColor;
+    vec4 lightPosition;
+    vec4 lightColor;
+} ubo;
+
+layout(set = 1, binding = 0) uniform sampler2D colorAtlas;
+layout(set = 1, binding = 1) uniform sampler2D normalDepthAtlas;
+
+vec3 toWorld(vec3 v, vec2 yaw) {
+    return vec3(yaw.x * v.x + yaw.y * v.z, v.y, -yaw.y * v.x + yaw.x * v.z);
+}
+
+void main() {
+    vec4 color = texture(colorAtlas, fragUv);
+    if (color.a < 0.5) {
+        discard;
+    }
+    vec4 normalDepth = texture(normalDepthAtlas, fragUv);
+
+    // push the quad back to the baked surface so impostors intersect the
+    // scene like the mesh would
+    vec3 surfaceWorld = fragPosWorld + fragFrameDirWorld * fragRadius * (1.0 - 2.0 * normalDepth.w);
+    vec4 clip = ubo.projection * ubo.view * vec4(surfaceWorld, 1.0);
+    gl_FragDepth = clip.z / clip.w;
+
+    // same lighting as simple_shader.frag
+    vec3 normalWorld = normalize(toWorld(normalDepth.xyz * 2.0 - 1.0, fragYaw));
+    vec3 directionToLight = ubo.lightPosition.xyz - surfaceWorld;
+    float attentuation = 1.0 / dot(directionToLight, directionToLight);
+    vec3 lightColor = ubo.lightColor.xyz * ubo.lightColor.w * attentuation;
+    vec3 ambientLight = ubo.ambientLightColor.xyz * ubo.ambientLightColor.w;
+    vec3 diffuseLight = lightColor * max(dot(normalWorld, normalize(directionToLight)), 0);
+
+    outColor = vec4((diffuseLight + ambientLight) * color.rgb, 1.0);
+}
@@ -0,0 +1,76 @@
+#version 450
+
+// per instance, see ImpostorSystem
+layout(location = 0) in vec4 instanceCenterRadius; // world space bounding sphere
+layout(location = 1) in vec2 instanceYaw; // cos, sin of the rotation around y
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec3 fragPosWorld;
+layout(location = 2) out vec3 fragFrameDirWorld;
+layout(location = 3) out float fragRadius;
+layout(location = 4) flat out vec2 fragYaw;
+
+layout(set = 0, binding = 0) uniform GlobalUbo {
+    mat4 projection;
+    mat4 view;
+    vec4 ambientLightColor;
+    vec4 lightPosition;
+    vec4 lightColor;
+} ubo;
+
+layout(push_constant) uniform Push {
+    vec4 cameraPosition;
+    vec4 atlas; // x: frames per side
+} push;
+
+const vec2 OFFSETS[6] = vec2[](
+    vec2(-1.0, -1.0),
+    vec2(-1.0, 1.0),
+    vec2(1.0, -1.0),
+    vec2(1.0, -1.0),
+    vec2(-1.0, 1.0),
+    vec2(1.0, 1.0)
+);
+
+// instances only rotate around y, same convention as TransformComponent
+vec3 toObject(vec3 v, vec2 yaw) {
+    return vec3(yaw.x * v.x - yaw.y * v.z, v.y, yaw.y * v.x + yaw.x * v.z);
+}
+
+vec3 toWorld(vec3 v, vec2 yaw) {
+    return vec3(yaw.x * v.x + yaw.y * v.z, v.y, -yaw.y * v.x + yaw.x * v.z);
+}
+
+void main() {
+    float frames = push.atlas.x;
+    vec3 center = instanceCenterRadius.xyz;
+    float radius = instanceCenterRadius.w;
+
+    // hemi-octahedral frame closest to the view direction, -y is up and views
+    // from below use the horizon frames, must match NreImpostor::frameDirection
+    vec3 toCamera = toObject(normalize(push.cameraPosition.xyz - center), instanceYaw);
+    toCamera.y = min(toCamera.y, 0.0);
+    toCamera /= max(abs(toCamera.x) + abs(toCamera.y) + abs(toCamera.z), 1e-6);
+    vec2 p = vec2(toCamera.x + toCamera.z, toCamera.x - toCamera.z);
+    vec2 cell = clamp(floor((p * 0.5 + 0.5) * frames), vec2(0.0), vec2(frames - 1.0));
+
+    vec2 c = (cell + 0.5) / frames * 2.0 - 1.0;
+    vec2 q = vec2(c.x + c.y, c.x - c.y) * 0.5;
+    vec3 frameDir = normalize(vec3(q.x, -(1.0 - abs(q.x) - abs(q.y)), q.y));
+
+    // the quad spans the frame's view plane, with the basis NreCamera::setViewDirection used
+    vec3 w = -frameDir;
+    vec3 up = abs(frameDir.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, -1.0, 0.0);
+    vec3 u = normalize(cross(w, up));
+    vec3 v = cross(w, u);
+
+    vec2 offset = OFFSETS[gl_VertexIndex];
+    vec3 positionWorld = center + toWorld(radius * (offset.x * u + offset.y * v), instanceYaw);
+
+    fragUv = (cell + offset * 0.5 + 0.5) / frames;
+    fragPosWorld = positionWorld;
+    fragFrameDirWorld = toWorld(frameDir, instanceYaw);
+    fragRadius = radius;
+    fragYaw = instanceYaw;
+    gl_Position = ubo.projection * ubo.view * vec4(positionWorld, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 450
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragNormal;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outNormalDepth;
+
+void main() {
+    outColor = vec4(fragColor, 1.0);
+    // orthographic, so depth is linear from the front to the back of the bounding sphere
+    outNormalDepth = vec4(normalize(fragNormal) * 0.5 + 0.5, gl_FragCoord.z);
+}
@@ -0,0 +1,31 @@
+#version 450
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 color;
+layout(location = 2) in vec3 normal;
+layout(location = 3) in vec2 uv;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragNormal;
+
+// one orthographic view per atlas frame, see NreImpostor::bake
+layout(push_constant) uniform Push {
+    mat4 transform;
+} push;
+
+layout(constant_id = 0) const bool OCT_NORMALS = false;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    gl_Position = push.transform * vec4(position, 1.0);
+    // normals stay in object space, instances rotate them when drawn
+    fragNormal = OCT_NORMALS ? octDecode(normal.xy) : normal;
+    fragColor = color;
+}
@@ -0,0 +1,103 @@
+// materials and textures of NreBindlessTable plus the virtual texture feedback
+// buffer, for the fragment shaders drawing models
+// included, not compiled on its own
+
+// NreVirtualTextureSystem reads one page request per FEEDBACK_SCALE^2 pixels
+// back from here, NO_TEXTURE where nothing asked
+layout(std430, set = 0, binding = 1) buffer Feedback {
+    uint width;
+    // picks the pixel of each block that reports
+    uint frame;
+    uint padding0;
+    uint padding1;
+    uint requests[];
+} feedback;
+
+// GpuMaterial in nre_bindless.hpp
+struct Material {
+    vec4 baseColorFactor;
+    vec4 specular; // w is the shininess exponent
+    vec4 emission;
+    vec4 baseColorUvTransform; // xy scale, zw offset into an atlas page
+    uint baseColorTexture;
+    uint pageTableTexture;
+    uint physicalTexture;
+};
+
+const uint NO_TEXTURE = 0xFFFFFFFFu;
+
+// NreBindlessTable, bound once for every draw
+layout(std430, set = 1, binding = 0) readonly buffer Materials {
+    Material materials[];
+};
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+// the same array, for the RGBA8_UINT page tables of virtual textures
+layout(set = 1, binding = 1) uniform usampler2D pageTables[];
+
+// NreVirtualTextureSystem
+const uint PAGE_CONTENT = 120;
+const uint PAGE_BORDER = 4;
+const uint PAGE_SIZE = 128;
+const uint FEEDBACK_SCALE = 8;
+
+// uv repeats, pages missing from the cache are stood in for by the coarser
+// page their page table entry points at
+vec4 sampleVirtual(Material material, vec2 uv) {
+    uint table = material.pageTableTexture;
+    ivec2 pages = textureSize(pageTables[nonuniformEXT(table)], 0);
+    int levels = textureQueryLevels(pageTables[nonuniformEXT(table)]);
+
+    vec2 texels = uv * vec2(pages) * float(PAGE_CONTENT);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    int level = clamp(int(floor(lod)), 0, levels - 1);
+
+    vec2 wrapped = fract(uv);
+    ivec2 levelPages = max(pages >> level, ivec2(1));
+    ivec2 page = min(ivec2(wrapped * vec2(levelPages)), levelPages - 1);
+
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    uint jitter = feedback.frame % (FEEDBACK_SCALE * FEEDBACK_SCALE);
+    ivec2 cell = pixel / int(FEEDBACK_SCALE);
+    // width is 0 while the buffer is only a header, ie: the first frame after
+    // the first virtual texture was added
+    if (all(equal(pixel % int(FEEDBACK_SCALE),
+                  ivec2(jitter % FEEDBACK_SCALE, jitter / FEEDBACK_SCALE))) &&
+        uint(cell.x) < feedback.width) {
+        feedback.requests[cell.y * feedback.width + cell.x] =
+            table << 20 | uint(level) << 16 | uint(page.y) << 8 | uint(page.x);
+    }
+
+    // x and y of the physical page, the level it holds
+    uvec4 entry = texelFetch(pageTables[nonuniformEXT(table)], page, level);
+    ivec2 mappedPages = max(pages >> int(entry.z), ivec2(1));
+    vec2 inPage = fract(wrapped * vec2(mappedPages));
+    vec2 physicalSize = vec2(textureSize(textures[nonuniformEXT(material.physicalTexture)], 0));
+    vec2 physicalUv = (vec2(entry.xy) * float(PAGE_SIZE) + float(PAGE_BORDER) +
+        inPage * float(PAGE_CONTENT)) / physicalSize;
+    return textureLod(textures[nonuniformEXT(material.physicalTexture)], physicalUv, 0.0);
+}
+
+// textures packed into an atlas page can't use the sampler's repeat, uv wraps
+// here and the derivatives come from the unwrapped uv so the seam keeps its
+// mip level, the guard band around the entry covers the filter footprint
+vec4 sampleAtlas(Material material, vec2 uv) {
+    vec2 scale = material.baseColorUvTransform.xy;
+    vec2 atlasUv = fract(uv) * scale + material.baseColorUvTransform.zw;
+    return textureGrad(textures[nonuniformEXT(material.baseColorTexture)], atlasUv,
+        dFdx(uv) * scale, dFdy(uv) * scale);
+}
+
+// base color texture of the material, white without one
+vec4 sampleBaseColor(Material material, vec2 uv) {
+    if (material.pageTableTexture != NO_TEXTURE) {
+        return sampleVirtual(material, uv);
+    } else if (material.baseColorTexture != NO_TEXTURE &&
+               material.baseColorUvTransform != vec4(1.0, 1.0, 0.0, 0.0)) {
+        return sampleAtlas(material, uv);
+    } else if (material.baseColorTexture != NO_TEXTURE) {
+        return texture(textures[nonuniformEXT(material.baseColorTexture)], uv);
+    }
+    return vec4(1.0);
+}
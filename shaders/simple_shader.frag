@@ -1,8 +1,11 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_GOOGLE_include_directive : require
 
 layout (location = 0) in vec3 fragColor;
 layout (location = 1) in vec3 fragPosWorld;
 layout (location = 2) in vec3 fragNormalWorld;
+layout (location = 3) in vec2 fragUv;
 
 layout (location = 0) out vec4 outColor;
 
@@ -12,11 +15,14 @@ layout(set = 0, binding = 0)  uniform GlobalUbo {
     vec4 ambientLightColor;
     vec4 lightPosition;
     vec4 lightColor;
+    vec4 cameraPosition;
 } ubo;
 
+#include "material.glsl"
+
 layout(push_constant) uniform Push {
     mat4 modelMatrix;
-    mat4 normalMatrix;
+    mat4 normalMatrix; // [3].x holds the material index bits
 } push;
 
 void main() {
@@ -29,7 +35,17 @@ void main() {
 
     vec3 lightColor = ubo.lightColor.xyz * ubo.lightColor.w * attentuation;
     vec3 ambientLight = ubo.ambientLightColor.xyz * ubo.ambientLightColor.w;
-    vec3 diffuseLight = lightColor * max(dot(normalize(fragNormalWorld), normalize(directionToLight)), 0);
+    vec3 normal = normalize(fragNormalWorld);
+    vec3 diffuseLight = lightColor * max(dot(normal, normalize(directionToLight)), 0);
+
+    Material material = materials[floatBitsToUint(push.normalMatrix[3].x)];
+    vec4 baseColor = material.baseColorFactor * sampleBaseColor(material, fragUv);
+
+    // blinn-phong, MTL files without Ks leave it black
+    vec3 halfAngle = normalize(normalize(directionToLight) + normalize(ubo.cameraPosition.xyz - fragPosWorld));
+    float specular = pow(max(dot(normal, halfAngle), 0), max(material.specular.w, 1.0));
+    vec3 specularLight = lightColor * material.specular.rgb * specular;
 
-    outColor = vec4((diffuseLight + ambientLight) * fragColor, 1.0);
+    vec3 color = (diffuseLight + ambientLight) * fragColor * baseColor.rgb + specularLight + material.emission.rgb;
+    outColor = vec4(color, baseColor.a);
 } 
\ No newline at end of file
@@ -11,6 +11,7 @@ layout(location = 3) in vec2 uv;
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec3 fragPosWorld;
 layout(location = 2) out vec3 fragNormalWorld;
+layout(location = 3) out vec2 fragUv;
 
 layout(set = 0, binding = 0)  uniform GlobalUbo {
     mat4 projection;
@@ -27,8 +28,20 @@ layout(push_constant) uniform Push {
     mat4 normalMatrix;
 } push;
 
+// set per vertex format by SimpleRenderSystem, the unused branch is compiled out
+layout(constant_id = 0) const bool OCT_NORMALS = false;
+
 const float AMBIENT = 0.02;
 
+// compact vertex formats store normals octahedral encoded in two snorm components
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main() {
     vec4 positionWorld = push.modelMatrix * vec4(position, 1.0);
     gl_Position = ubo.projection * ubo.view * positionWorld;
@@ -46,9 +59,11 @@ void main() {
     // mat3 modelMatrix = transpose(inverse(mat3(push.modelMatrix)));
     // vec3 normalWorldSpace = normalize(mat3(push.modelMatrix) * normal);
 
-    fragNormalWorld = normalize(mat3(push.normalMatrix) * normal);
+    vec3 objectNormal = OCT_NORMALS ? octDecode(normal.xy) : normal;
+    fragNormalWorld = normalize(mat3(push.normalMatrix) * objectNormal);
     fragPosWorld = positionWorld.xyz;
     fragColor = color;
+    fragUv = uv;
 }
 
 // only 1 push constant block can be used for shader entry point
\ No newline at end of file
@@ -3,6 +3,12 @@
 #include "keyboard_movement_controller.hpp"
 #include "nre_buffer.hpp"
 #include "nre_camera.hpp"
+#include "nre_static_batcher.hpp"
+#include "systems/deferred_lighting_system.hpp"
+#include "systems/hlod_system.hpp"
+#include "systems/impostor_system.hpp"
+#include "systems/lod_system.hpp"
+#include "systems/meshlet_cull_system.hpp"
 #include "systems/point_light_system.hpp"
 #include "systems/simple_render_system.hpp"
 
@@ -14,8 +20,11 @@
 // std
 #include <array>
 #include <chrono>
+#include <cstddef>
+#include <iostream>
 #include <numeric>
 #include <stdexcept>
+#include <utility>
 
 namespace nre {
 
@@ -25,14 +34,25 @@ struct GlobalUbo {
   glm::vec4 ambientLightColor{1.f, 1.f, 1.f, .02f};
   glm::vec4 lightPosition{-1.f};
   glm::vec4 lightColor{1.f}; // w is light intensity
+  glm::vec4 cameraPosition{0.f};
+};
+
+struct GlobalDescriptors {
+  VkDescriptorBufferInfo ubo;
+  VkDescriptorBufferInfo virtualTextureFeedback;
 };
 
 FirstApp::FirstApp() {
-  globalPool = NreDescriptorPool::Builder(nreDevice)
-                   .setMaxSets(NreSwapChain::MAX_FRAMES_IN_FLIGHT)
-                   .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                                NreSwapChain::MAX_FRAMES_IN_FLIGHT)
-                   .build();
+  frameAllocators.resize(NreSwapChain::MAX_FRAMES_IN_FLIGHT);
+  for (auto &allocator : frameAllocators) {
+    allocator = NreDescriptorAllocator::Builder(nreDevice)
+                    .addPoolRatio(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.f)
+                    .addPoolRatio(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.f)
+                    .addPoolRatio(
+                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.f)
+                    .addPoolRatio(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1.f)
+                    .build();
+  }
   loadGameObjects();
 }
 
@@ -49,26 +69,58 @@ void FirstApp::run() {
     uboBuffers[i]->map();
   }
 
-  auto globalSetLayout = NreDescriptorSetLayout::Builder(nreDevice)
-                             .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                                         VK_SHADER_STAGE_ALL_GRAPHICS)
-                             .build();
-
-  std::vector<VkDescriptorSet> globalDescriptorSets(
-      NreSwapChain::MAX_FRAMES_IN_FLIGHT);
-  for (int i = 0; i < globalDescriptorSets.size(); i++) {
-    auto bufferInfo = uboBuffers[i]->descriptorInfo();
-    NreDescriptorWriter(*globalSetLayout, *globalPool)
-        .writeBuffer(0, &bufferInfo)
-        .build(globalDescriptorSets[i]);
-  }
+  NreDescriptorSetLayout &globalSetLayout =
+      NreDescriptorSetLayout::Builder(nreDevice)
+          .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                      VK_SHADER_STAGE_ALL_GRAPHICS)
+          .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                      VK_SHADER_STAGE_FRAGMENT_BIT)
+          .build(layoutCache);
+  // global set is allocated fresh every frame, written in a single call
+  auto globalSetTemplate =
+      NreDescriptorUpdateTemplate::Builder(nreDevice, globalSetLayout)
+          .addBuffer(0, offsetof(GlobalDescriptors, ubo))
+          .addBuffer(1, offsetof(GlobalDescriptors, virtualTextureFeedback))
+          .build();
 
   SimpleRenderSystem SimpleRenderSystem{
-      nreDevice, nreRenderer.getSwapChainRenderPass(),
-      globalSetLayout->getDescriptorSetLayout()};
+      nreDevice, pipelineManager, nreRenderer.getSwapChainRenderTarget(),
+      globalSetLayout.getDescriptorSetLayout(), bindlessTable};
   PointLightSystem pointLightSystem{nreDevice,
-                                    nreRenderer.getSwapChainRenderPass(),
-                                    globalSetLayout->getDescriptorSetLayout()};
+                                    nreRenderer.getSwapChainRenderTarget(),
+                                    globalSetLayout.getDescriptorSetLayout()};
+  ImpostorSystem impostorSystem{nreDevice,
+                                nreRenderer.getSwapChainRenderTarget(),
+                                globalSetLayout.getDescriptorSetLayout()};
+  // deferred path, one render pass: the g-buffer subpass draws the same
+  // objects with a shader that only writes materials, the lighting subpass
+  // shades every pixel once, impostors and lights are drawn forward after
+  // (qualified, the SimpleRenderSystem local above hides the type)
+  nre::SimpleRenderSystem gBufferRenderSystem{
+      nreDevice,
+      pipelineManager,
+      nreRenderer.getDeferredRenderTarget(NreSwapChain::GBUFFER_SUBPASS),
+      globalSetLayout.getDescriptorSetLayout(),
+      bindlessTable,
+      "shaders/deferred_gbuffer.frag.spv",
+      3};
+  DeferredLightingSystem deferredLightingSystem{
+      nreDevice,
+      nreRenderer.getDeferredRenderTarget(NreSwapChain::LIGHTING_SUBPASS),
+      globalSetLayout.getDescriptorSetLayout()};
+  PointLightSystem deferredPointLightSystem{
+      nreDevice,
+      nreRenderer.getDeferredRenderTarget(NreSwapChain::FORWARD_SUBPASS),
+      globalSetLayout.getDescriptorSetLayout()};
+  uint32_t deferredImpostorTarget = impostorSystem.addRenderTarget(
+      nreRenderer.getDeferredRenderTarget(NreSwapChain::FORWARD_SUBPASS));
+  bool deferredShading = false;
+  bool toggleKeyWasDown = false;
+
+  HlodSystem hlodSystem{std::move(hlodClusters)};
+  LodSystem lodSystem{};
+  MeshletCullSystem meshletCullSystem{nreDevice};
+  NreRenderGraph renderGraph{nreDevice};
   NreCamera camera{};
   // camera.setViewDirection(glm::vec3(0.f), glm::vec3(1.f, 0.f, 1.f));
   camera.setViewTarget(glm::vec3(-1.f, -2.f, -2.f), glm::vec3(0.f, 0.f, 2.5f));
@@ -96,6 +148,13 @@ void FirstApp::run() {
 
     cameraController.moveInPlaneXZ(nreWindow.getGLFWwindow(), frameTime,
                                    viewerObject);
+    // switches between forward and deferred shading on press
+    bool toggleKeyDown = glfwGetKey(nreWindow.getGLFWwindow(),
+                                    TOGGLE_DEFERRED_KEY) == GLFW_PRESS;
+    if (toggleKeyDown && !toggleKeyWasDown) {
+      deferredShading = !deferredShading;
+    }
+    toggleKeyWasDown = toggleKeyDown;
     camera.setViewYXZ(viewerObject.transform.translation,
                       viewerObject.transform.rotation);
 
@@ -110,25 +169,122 @@ void FirstApp::run() {
     // ie: multiple renderPass(es) for reflection, shadow, post-processing
     if (auto commandBuffer = nreRenderer.beginFrame()) {
       int frameIndex = nreRenderer.getFrameIndex();
+      // beginFrame waited on this frame's fence, its old sets are unused now
+      NreDescriptorAllocator &frameDescriptors = *frameAllocators[frameIndex];
+      frameDescriptors.resetPools();
+      // slots other frames repointed since this one last ran
+      bindlessTable.beginFrame(frameIndex);
+      // reads back the page requests this frame index wrote last time
+      // and records the pages that finished loading, before anything samples
+      virtualTextures.update(commandBuffer, frameIndex,
+                             nreRenderer.getSwapChainExtent());
+      VkDescriptorSet globalDescriptorSet =
+          frameDescriptors.allocate(globalSetLayout.getDescriptorSetLayout());
+      GlobalDescriptors globalDescriptors{
+          uboBuffers[frameIndex]->descriptorInfo(),
+          virtualTextures.getFeedbackInfo(frameIndex)};
+      globalSetTemplate->update(globalDescriptorSet, &globalDescriptors);
+
       FrameInfo frameInfo{frameIndex,
                           frameTime,
                           commandBuffer,
                           camera,
-                          globalDescriptorSets[frameIndex],
-                          gameObjects};
+                          globalDescriptorSet,
+                          gameObjects,
+                          nreRenderer.getSwapChainExtent(),
+                          frameDescriptors};
 
       // update
+      hlodSystem.update(frameInfo);
+      lodSystem.update(frameInfo);
+      // before anything sampling textures is recorded
+      textureStreamer.update(frameInfo);
+      impostorSystem.update(frameInfo);
       GlobalUbo ubo{};
       ubo.projection = camera.getProjection();
       ubo.view = camera.getView();
+      ubo.cameraPosition = glm::vec4{camera.getPosition(), 1.f};
       uboBuffers[frameIndex]->writeToBuffer(&ubo);
       uboBuffers[frameIndex]->flush();
 
-      // render
-      nreRenderer.beginSwapChainRenderPass(commandBuffer);
-      SimpleRenderSystem.renderGameObjects(frameInfo);
-      pointLightSystem.render(frameInfo);
-      nreRenderer.endSwapChainRenderPass(commandBuffer);
+      // the graph puts the barriers between culling and the indirect draws
+      renderGraph.reset(frameIndex);
+      RenderGraphResource meshletDraws = renderGraph.importBuffer(
+          "meshlet draws", meshletCullSystem.getDrawBuffer(frameIndex));
+      RenderGraphResource meshletCounts = renderGraph.importBuffer(
+          "meshlet counts", meshletCullSystem.getCountBuffer(frameIndex));
+      renderGraph.addPass(
+          "meshlet cull",
+          [&](NreRenderGraph::PassBuilder &pass) {
+            pass.write(meshletDraws, RenderGraphAccess::StorageCompute);
+            pass.write(meshletCounts, RenderGraphAccess::TransferDst);
+            pass.write(meshletCounts, RenderGraphAccess::StorageCompute);
+          },
+          [&](VkCommandBuffer) { meshletCullSystem.cull(frameInfo); });
+
+      if (deferredShading) {
+        // input attachments need subpasses, so this is always a render pass
+        // that takes care of its attachments itself
+        renderGraph.addPass(
+            "deferred",
+            [&](NreRenderGraph::PassBuilder &pass) {
+              pass.read(meshletDraws, RenderGraphAccess::IndirectRead);
+              pass.read(meshletCounts, RenderGraphAccess::IndirectRead);
+              pass.sideEffects();
+            },
+            [&](VkCommandBuffer commandBuffer) {
+              nreRenderer.beginDeferredRenderPass(commandBuffer);
+              gBufferRenderSystem.renderGameObjects(frameInfo);
+              vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+              deferredLightingSystem.render(frameInfo,
+                                            nreRenderer.getGBufferViews());
+              vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+              impostorSystem.render(frameInfo, deferredImpostorTarget);
+              deferredPointLightSystem.render(frameInfo);
+              nreRenderer.endDeferredRenderPass(commandBuffer);
+            });
+      } else {
+        // without dynamic rendering the swap chain render pass takes care of
+        // its attachments itself
+        bool dynamicRendering = nreRenderer.usesDynamicRendering();
+        RenderGraphResource swapChainImage = 0;
+        RenderGraphResource depthImage = 0;
+        if (dynamicRendering) {
+          swapChainImage = renderGraph.importImage(
+              "swap chain", nreRenderer.getSwapChainImage());
+          depthImage =
+              renderGraph.importImage("depth", nreRenderer.getDepthImage());
+        }
+        renderGraph.addPass(
+            "forward",
+            [&](NreRenderGraph::PassBuilder &pass) {
+              pass.read(meshletDraws, RenderGraphAccess::IndirectRead);
+              pass.read(meshletCounts, RenderGraphAccess::IndirectRead);
+              if (dynamicRendering) {
+                pass.colorAttachment(swapChainImage);
+                pass.depthAttachment(depthImage);
+              } else {
+                pass.sideEffects();
+              }
+            },
+            // runs after this scope is gone
+            [&, dynamicRendering](VkCommandBuffer commandBuffer) {
+              if (!dynamicRendering) {
+                nreRenderer.beginSwapChainRenderPass(commandBuffer);
+              }
+              SimpleRenderSystem.renderGameObjects(frameInfo);
+              impostorSystem.render(frameInfo);
+              pointLightSystem.render(frameInfo);
+              if (!dynamicRendering) {
+                nreRenderer.endSwapChainRenderPass(commandBuffer);
+              }
+            });
+      }
+
+      renderGraph.compile();
+      renderGraph.execute(commandBuffer);
+      // read back by virtualTextures.update once this frame's fence signals
+      virtualTextures.recordFeedbackBarrier(commandBuffer, frameIndex);
       nreRenderer.endFrame();
     }
   }
@@ -138,26 +294,66 @@ void FirstApp::run() {
 }
 
 void FirstApp::loadGameObjects() {
-  std::shared_ptr<NreModel> nreModel =
-      NreModel::createModelFromFile(nreDevice, "models/flat_vase.obj");
+  // quantized positions/normals/colors/uvs, 20 byte vertices
+  // positions get their own 8 byte stream for position only passes
+  constexpr auto compactFormat =
+      NreModel::VertexFormat::compact().withLayout<PositionSplitLayout>();
+
+  // static scenery keeps its mesh data so it can be merged into batches below
+  NreModel::ImportOptions staticOptions{};
+  staticOptions.format = compactFormat;
+  staticOptions.keepMeshData = true;
+
+  std::shared_ptr<NreModel> nreModel = NreModel::createModelFromFile(
+      nreDevice, "models/flat_vase.obj", staticOptions);
+  // before batching, batches are split by material
+  nreModel->assignMaterials(bindlessTable, &textureCache);
   auto flatVase = NreGameObject::createGameObject();
   flatVase.model = nreModel;
+  flatVase.isStatic = true;
   flatVase.transform.translation = {-.5f, .5f, 0.f};
   flatVase.transform.scale = glm::vec3(3.f);
   gameObjects.emplace(flatVase.getId(), std::move(flatVase));
 
-  nreModel = NreModel::createModelFromFile(nreDevice, "models/smooth_vase.obj");
+  // meshlets so the GPU only draws the parts of the vase that can be seen
+  NreModel::ImportOptions smoothVaseOptions{};
+  smoothVaseOptions.format = compactFormat;
+  smoothVaseOptions.meshlets = true;
+  nreModel = NreModel::createModelFromFile(nreDevice, "models/smooth_vase.obj",
+                                           smoothVaseOptions);
+  nreModel->assignMaterials(bindlessTable, &textureCache);
   auto smoothVase = NreGameObject::createGameObject();
   smoothVase.model = nreModel;
   smoothVase.transform.translation = {.5f, .5f, 0.f};
   smoothVase.transform.scale = glm::vec3(3.f);
+  // a single quad once the vase is smaller on screen than the atlas frames
+  smoothVase.impostor = std::make_shared<NreImpostor>(nreDevice, *nreModel);
   gameObjects.emplace(smoothVase.getId(), std::move(smoothVase));
 
-  nreModel = NreModel::createModelFromFile(nreDevice, "models/quad.obj");
+  nreModel = NreModel::createModelFromFile(nreDevice, "models/quad.obj",
+                                           staticOptions);
+  nreModel->assignMaterials(bindlessTable, &textureCache);
   auto floor = NreGameObject::createGameObject();
   floor.model = nreModel;
+  floor.isStatic = true;
   floor.transform.translation = {0.f, .5f, 0.f};
   floor.transform.scale = glm::vec3(3.f, 1.f, 3.f);
   gameObjects.emplace(floor.getId(), std::move(floor));
+
+  // batches keep their meshes to be simplified into HLOD proxies
+  StaticBatchSettings batchSettings{};
+  batchSettings.keepMeshData = true;
+  StaticBatchStats batchStats =
+      batchStaticObjects(nreDevice, gameObjects, batchSettings);
+  HlodStats hlodStats{};
+  hlodClusters = buildHlodClusters(nreDevice, gameObjects, {}, &hlodStats);
+
+  const TextureStats &textureStats = textureCache.getStats();
+  std::cout << "static batching: " << batchStats.sourceObjects
+            << " objects -> " << batchStats.batches << " batches, hlod: "
+            << hlodStats.clusters << " clusters, " << hlodStats.sourceTriangles
+            << " -> " << hlodStats.proxyTriangles << " triangles, textures: "
+            << textureStats.textures << " in "
+            << textureStats.memoryBytes / (1024 * 1024) << " MiB\n";
 };
 } // namespace nre
\ No newline at end of file
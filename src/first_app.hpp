@@ -1,9 +1,15 @@
 #pragma once
 
 #include "nre_window.hpp"
+#include "nre_bindless.hpp"
 #include "nre_device.hpp"
 #include "nre_game_object.hpp"
+#include "nre_hlod.hpp"
+#include "nre_pipeline_manager.hpp"
 #include "nre_renderer.hpp"
+#include "nre_texture.hpp"
+#include "nre_texture_streamer.hpp"
+#include "nre_virtual_texture.hpp"
 #include "nre_descriptors.hpp"
 
 // std
@@ -18,6 +24,8 @@ namespace nre
     public:
         static constexpr int WIDTH = 800;
         static constexpr int HEIGHT = 600;
+        // forward or deferred shading, forward to start with
+        static constexpr int TOGGLE_DEFERRED_KEY = GLFW_KEY_G;
 
         FirstApp();
         ~FirstApp();
@@ -32,11 +40,24 @@ namespace nre
 
         NreWindow nreWindow{WIDTH, HEIGHT, "Nebula Rendering Engine"};
         NreDevice nreDevice{nreWindow};
+        // compiles pipelines off the render thread, destroyed before the device
+        NrePipelineManager pipelineManager{nreDevice};
         NreRenderer nreRenderer{nreWindow, nreDevice};
+        // every material and texture, bound once per frame
+        NreBindlessTable bindlessTable{nreDevice};
+        // mip levels of the cache's textures follow what is on screen
+        NreTextureStreamer textureStreamer{nreDevice, bindlessTable};
+        NreTextureCache textureCache{nreDevice, bindlessTable, &textureStreamer};
+        // textures bigger than any image, paged through a fixed size cache
+        NreVirtualTextureSystem virtualTextures{nreDevice, bindlessTable};
 
         // declaration order matters
-        std::unique_ptr<NreDescriptorPool> globalPool{};
+        NreDescriptorLayoutCache layoutCache{nreDevice};
+        // one per frame in flight, reset once the frame's fence has signaled
+        std::vector<std::unique_ptr<NreDescriptorAllocator>> frameAllocators;
         NreGameObject::Map gameObjects;
+        // handed to HlodSystem once the game loop starts
+        std::vector<HlodCluster> hlodClusters;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "nre_bindless.hpp"
+
+// std
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <stdexcept>
+
+namespace nre {
+
+NreBindlessTable::NreBindlessTable(NreDevice &device, uint32_t maxTextures,
+                                   uint32_t maxMaterials)
+    : nreDevice{device},
+      maxTextures{std::min(maxTextures, device.getMaxBindlessSampledImages())},
+      maxMaterials{maxMaterials} {
+  // NreDevice only picks devices that have it
+  assert(device.supportsDescriptorIndexing() &&
+         "bindless table: device has no descriptor indexing support");
+
+  for (auto &materialBuffer : materialBuffers) {
+    materialBuffer = std::make_unique<NreBuffer>(
+        nreDevice, sizeof(GpuMaterial), maxMaterials,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    materialBuffer->map();
+  }
+
+  createSetLayout();
+  createDescriptorSets();
+  createDefaultSampler();
+
+  addMaterial(GpuMaterial{});
+}
+
+NreBindlessTable::~NreBindlessTable() {
+  vkDestroySampler(nreDevice.device(), defaultSampler, nullptr);
+  // frees the sets with it
+  vkDestroyDescriptorPool(nreDevice.device(), descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(nreDevice.device(), setLayout, nullptr);
+}
+
+void NreBindlessTable::createSetLayout() {
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+  bindings[0].binding = MATERIAL_BINDING;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+  bindings[1].binding = TEXTURE_BINDING;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[1].descriptorCount = maxTextures;
+  bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  // slots never written are fine as long as no shader reads them, and the
+  // array is sized at allocation time
+  std::array<VkDescriptorBindingFlags, 2> bindingFlags{
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+          VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+          VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT};
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+  flagsInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  flagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+  flagsInfo.pBindingFlags = bindingFlags.data();
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.pNext = &flagsInfo;
+  layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  if (vkCreateDescriptorSetLayout(nreDevice.device(), &layoutInfo, nullptr,
+                                  &setLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless set layout!");
+  }
+}
+
+void NreBindlessTable::createDescriptorSets() {
+  const uint32_t frames = NreSwapChain::MAX_FRAMES_IN_FLIGHT;
+  std::array<VkDescriptorPoolSize, 2> poolSizes{};
+  poolSizes[0] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames};
+  poolSizes[1] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                  frames * maxTextures};
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.maxSets = frames;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  if (vkCreateDescriptorPool(nreDevice.device(), &poolInfo, nullptr,
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless descriptor pool!");
+  }
+
+  std::array<uint32_t, NreSwapChain::MAX_FRAMES_IN_FLIGHT> counts{};
+  std::array<VkDescriptorSetLayout, NreSwapChain::MAX_FRAMES_IN_FLIGHT>
+      layouts{};
+  counts.fill(maxTextures);
+  layouts.fill(setLayout);
+  VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+  countInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+  countInfo.descriptorSetCount = frames;
+  countInfo.pDescriptorCounts = counts.data();
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.pNext = &countInfo;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = frames;
+  allocInfo.pSetLayouts = layouts.data();
+  if (vkAllocateDescriptorSets(nreDevice.device(), &allocInfo,
+                               descriptorSets.data()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate bindless descriptor set!");
+  }
+
+  // the buffers never change, only their contents
+  for (size_t frame = 0; frame < descriptorSets.size(); frame++) {
+    VkDescriptorBufferInfo bufferInfo =
+        materialBuffers[frame]->descriptorInfo();
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSets[frame];
+    write.dstBinding = MATERIAL_BINDING;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.descriptorCount = 1;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(nreDevice.device(), 1, &write, 0, nullptr);
+  }
+}
+
+void NreBindlessTable::createDefaultSampler() {
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  // enabled on every device NreDevice accepts
+  samplerInfo.anisotropyEnable = VK_TRUE;
+  samplerInfo.maxAnisotropy = nreDevice.properties.limits.maxSamplerAnisotropy;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.minLod = 0.f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+  if (vkCreateSampler(nreDevice.device(), &samplerInfo, nullptr,
+                      &defaultSampler) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless default sampler!");
+  }
+}
+
+uint32_t NreBindlessTable::addTexture(VkImageView view, VkSampler sampler) {
+  uint32_t slot;
+  if (!freeTextureSlots.empty()) {
+    slot = freeTextureSlots.back();
+    freeTextureSlots.pop_back();
+  } else {
+    if (textureCount == maxTextures) {
+      throw std::runtime_error("bindless table: out of texture slots");
+    }
+    slot = textureCount++;
+  }
+  // no frame samples a new (or freed) slot, so every set can take it now, and
+  // older writes still queued for a freed slot must not land on top
+  TextureWrite texture{slot, view, sampler};
+  for (size_t frame = 0; frame < descriptorSets.size(); frame++) {
+    auto &pending = pendingWrites[frame];
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [slot](const TextureWrite &write) {
+                                   return write.slot == slot;
+                                 }),
+                  pending.end());
+    writeTexture(descriptorSets[frame], texture);
+  }
+  return slot;
+}
+
+void NreBindlessTable::updateTexture(int frameIndex, uint32_t slot,
+                                     VkImageView view, VkSampler sampler) {
+  assert(slot < textureCount && "Texture slot was never added");
+  TextureWrite texture{slot, view, sampler};
+  for (size_t frame = 0; frame < descriptorSets.size(); frame++) {
+    if (static_cast<int>(frame) == frameIndex) {
+      writeTexture(descriptorSets[frame], texture);
+    } else {
+      pendingWrites[frame].push_back(texture);
+    }
+  }
+}
+
+void NreBindlessTable::beginFrame(int frameIndex) {
+  for (const auto &texture : pendingWrites[frameIndex]) {
+    writeTexture(descriptorSets[frameIndex], texture);
+  }
+  pendingWrites[frameIndex].clear();
+  for (const auto &material : pendingMaterialWrites[frameIndex]) {
+    writeMaterial(frameIndex, material);
+  }
+  pendingMaterialWrites[frameIndex].clear();
+}
+
+void NreBindlessTable::writeTexture(VkDescriptorSet set,
+                                    const TextureWrite &texture) {
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.sampler =
+      texture.sampler != VK_NULL_HANDLE ? texture.sampler : defaultSampler;
+  imageInfo.imageView = texture.view;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  // update after bind, valid even while the set is bound in recorded command
+  // buffers, but not while a submitted one may still sample the slot
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set;
+  write.dstBinding = TEXTURE_BINDING;
+  write.dstArrayElement = texture.slot;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.descriptorCount = 1;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(nreDevice.device(), 1, &write, 0, nullptr);
+}
+
+void NreBindlessTable::removeTexture(uint32_t slot) {
+  assert(slot < textureCount && "Texture slot was never added");
+  // the stale descriptor stays, partially bound makes that fine as long as no
+  // material points at it
+  freeTextureSlots.push_back(slot);
+}
+
+uint32_t NreBindlessTable::addMaterial(const GpuMaterial &material) {
+  if (materialCount == maxMaterials) {
+    throw std::runtime_error("bindless table: out of material slots");
+  }
+  // no frame reads a new material yet, so every buffer can take it now
+  uint32_t index = materialCount++;
+  for (size_t frame = 0; frame < materialBuffers.size(); frame++) {
+    writeMaterial(static_cast<int>(frame), {index, material});
+  }
+  return index;
+}
+
+void NreBindlessTable::updateMaterial(int frameIndex, uint32_t material,
+                                      const GpuMaterial &gpuMaterial) {
+  assert(material < materialCount && "Material was never added");
+  MaterialWrite write{material, gpuMaterial};
+  for (size_t frame = 0; frame < materialBuffers.size(); frame++) {
+    if (static_cast<int>(frame) == frameIndex) {
+      writeMaterial(frameIndex, write);
+    } else {
+      pendingMaterialWrites[frame].push_back(write);
+    }
+  }
+}
+
+void NreBindlessTable::writeMaterial(int frameIndex,
+                                     const MaterialWrite &material) {
+  materialBuffers[frameIndex]->writeToIndex(
+      const_cast<GpuMaterial *>(&material.values),
+      static_cast<int>(material.material));
+}
+
+void NreBindlessTable::bind(VkCommandBuffer commandBuffer,
+                            VkPipelineLayout pipelineLayout, uint32_t set,
+                            int frameIndex) const {
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelineLayout, set, 1, &descriptorSets[frameIndex],
+                          0, nullptr);
+}
+
+} // namespace nre
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "nre_buffer.hpp"
+#include "nre_device.hpp"
+#include "nre_swap_chain.hpp"
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace nre {
+
+// one entry of the material buffer, std430 layout of Material in
+// shaders/material.glsl
+struct GpuMaterial {
+  static constexpr uint32_t NO_TEXTURE = ~0u;
+
+  glm::vec4 baseColorFactor{1.f};
+  // rgb specular color, a shininess exponent
+  glm::vec4 specular{0.f};
+  // rgb, a unused
+  glm::vec4 emission{0.f};
+  // maps UVs into baseColorTexture (xy scale, zw offset), anything but the
+  // identity means an atlas page and the shader wraps UVs itself
+  glm::vec4 baseColorUvTransform{1.f, 1.f, 0.f, 0.f};
+  // slot in NreBindlessTable's texture array
+  uint32_t baseColorTexture = NO_TEXTURE;
+  // set by NreVirtualTextureSystem::applyTo, sampled instead of
+  // baseColorTexture
+  uint32_t pageTableTexture = NO_TEXTURE;
+  uint32_t physicalTexture = NO_TEXTURE;
+  uint32_t padding = 0;
+};
+
+// a descriptor set holding every material and texture, bound once per frame
+// and indexed by shaders with the material id of the draw
+// bindings are update after bind and partially bound, so adding a texture or
+// editing a material never touches command buffers or rebinds anything
+// there is one set and material buffer per frame in flight, a slot or
+// material can only be changed in those of the frame being recorded, the
+// others pick it up in their beginFrame
+// needs NreDevice::supportsDescriptorIndexing()
+class NreBindlessTable {
+public:
+  // material buffer binding, then the texture array (a variable count binding
+  // has to be the last one)
+  static constexpr uint32_t MATERIAL_BINDING = 0;
+  static constexpr uint32_t TEXTURE_BINDING = 1;
+  // white, untextured, used by anything without a material of its own
+  static constexpr uint32_t DEFAULT_MATERIAL = 0;
+
+  // maxTextures is clamped to what the device allows in one set
+  explicit NreBindlessTable(NreDevice &device, uint32_t maxTextures = 4096,
+                            uint32_t maxMaterials = 1024);
+  ~NreBindlessTable();
+
+  NreBindlessTable(const NreBindlessTable &) = delete;
+  NreBindlessTable &operator=(const NreBindlessTable &) = delete;
+
+  VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+  VkDescriptorSet getDescriptorSet(int frameIndex) const {
+    return descriptorSets[frameIndex];
+  }
+  // linear filtering, repeat addressing and every mip level
+  VkSampler getDefaultSampler() const { return defaultSampler; }
+
+  // returns the slot shaders sample with, the view has to stay alive until the
+  // slot is removed
+  // view is expected in SHADER_READ_ONLY_OPTIMAL, a null sampler picks the
+  // default one
+  uint32_t addTexture(VkImageView view, VkSampler sampler = VK_NULL_HANDLE);
+  // points an existing slot at another view, ie: a streamed texture that got
+  // more or fewer mip levels
+  // frameIndex's set changes right away, the other frames still sample the
+  // old view until their next beginFrame, so it has to stay alive until then
+  void updateTexture(int frameIndex, uint32_t slot, VkImageView view,
+                     VkSampler sampler = VK_NULL_HANDLE);
+  // the slot is reused by the next addTexture, so only call once no frame in
+  // flight samples it anymore
+  void removeTexture(uint32_t slot);
+
+  uint32_t addMaterial(const GpuMaterial &material);
+  // frameIndex's buffer changes right away, frames still in flight keep the
+  // old values and the others get the new ones in their beginFrame
+  void updateMaterial(int frameIndex, uint32_t material,
+                      const GpuMaterial &gpuMaterial);
+  uint32_t getMaterialCount() const { return materialCount; }
+
+  // once the frame's fence signaled, applies the updateTexture and
+  // updateMaterial calls other frames made since
+  void beginFrame(int frameIndex);
+
+  void bind(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout,
+            uint32_t set, int frameIndex) const;
+
+private:
+  struct TextureWrite {
+    uint32_t slot;
+    VkImageView view;
+    VkSampler sampler;
+  };
+
+  struct MaterialWrite {
+    uint32_t material;
+    GpuMaterial values;
+  };
+
+  void createSetLayout();
+  void createDescriptorSets();
+  void createDefaultSampler();
+  void writeTexture(VkDescriptorSet set, const TextureWrite &texture);
+  void writeMaterial(int frameIndex, const MaterialWrite &material);
+
+  NreDevice &nreDevice;
+  uint32_t maxTextures;
+  uint32_t maxMaterials;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  std::array<VkDescriptorSet, NreSwapChain::MAX_FRAMES_IN_FLIGHT>
+      descriptorSets{};
+  // per frame index, waiting for its beginFrame
+  std::array<std::vector<TextureWrite>, NreSwapChain::MAX_FRAMES_IN_FLIGHT>
+      pendingWrites{};
+  std::array<std::vector<MaterialWrite>, NreSwapChain::MAX_FRAMES_IN_FLIGHT>
+      pendingMaterialWrites{};
+  VkSampler defaultSampler = VK_NULL_HANDLE;
+  // one per frame in flight like the sets, host visible and coherent, edits
+  // are plain writes
+  std::array<std::unique_ptr<NreBuffer>, NreSwapChain::MAX_FRAMES_IN_FLIGHT>
+      materialBuffers{};
+
+  uint32_t textureCount = 0;
+  std::vector<uint32_t> freeTextureSlots;
+  uint32_t materialCount = 0;
+};
+
+} // namespace nre
@@ -85,4 +85,37 @@ namespace nre
         viewMatrix[3][2] = -glm::dot(w, position);
     }
 
-}
\ No newline at end of file
+
+    float NreCamera::projectedSize(const glm::vec3 &worldCenter, float worldSize, float viewportHeight) const
+    {
+        // clip space w, view depth for perspective and 1 for orthographic projections
+        glm::vec4 clip = projectionMatrix * (viewMatrix * glm::vec4{worldCenter, 1.f});
+        if (clip.w <= std::numeric_limits<float>::epsilon())
+        {
+            // at or behind the camera plane
+            return std::numeric_limits<float>::max();
+        }
+        return worldSize * glm::abs(projectionMatrix[1][1]) / clip.w * viewportHeight * .5f;
+    }
+
+    std::array<glm::vec4, 6> NreCamera::getFrustumPlanes() const
+    {
+        // Gribb & Hartmann, rows of the view projection matrix, 0 to 1 depth
+        glm::mat4 m = projectionMatrix * viewMatrix;
+        auto row = [&](int i)
+        { return glm::vec4{m[0][i], m[1][i], m[2][i], m[3][i]}; };
+
+        std::array<glm::vec4, 6> planes{
+            row(3) + row(0),
+            row(3) - row(0),
+            row(3) + row(1),
+            row(3) - row(1),
+            row(2),
+            row(3) - row(2)};
+        for (auto &plane : planes)
+        {
+            plane = plane / glm::length(glm::vec3{plane});
+        }
+        return planes;
+    }
+}
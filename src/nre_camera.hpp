@@ -4,6 +4,9 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 
+// std
+#include <array>
+
 namespace nre
 {
 
@@ -21,6 +24,16 @@ namespace nre
 
         void setPerspectiveProjection(float fovy, float aspect, float near, float far);
 
+        // height in pixels of something worldSize across at worldCenter
+        // used for screen size based decisions like LOD selection
+        float projectedSize(const glm::vec3 &worldCenter, float worldSize, float viewportHeight) const;
+
+        // world space planes (xyz normal pointing inside, w distance), in order
+        // left, right, bottom, top, near, far
+        // a sphere is outside if dot(plane.xyz, center) + plane.w < -radius
+        std::array<glm::vec4, 6> getFrustumPlanes() const;
+
+        glm::vec3 getPosition() const { return glm::vec3{glm::inverse(viewMatrix)[3]}; }
         const glm::mat4 &getProjection() const { return projectionMatrix; }
         const glm::mat4 &getView() const { return viewMatrix; }
 
@@ -30,4 +43,15 @@ namespace nre
         // will store camera transform
         glm::mat4 viewMatrix{1.f};
     };
+
+    // false once the sphere is entirely outside one of the planes of NreCamera::getFrustumPlanes
+    inline bool sphereInFrustum(const std::array<glm::vec4, 6> &planes, const glm::vec3 &center, float radius)
+    {
+        for (const auto &plane : planes)
+        {
+            if (glm::dot(glm::vec3{plane}, center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
 }
\ No newline at end of file
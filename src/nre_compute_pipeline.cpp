@@ -0,0 +1,55 @@
+#include "nre_compute_pipeline.hpp"
+
+#include "nre_pipeline.hpp"
+
+// std
+#include <cassert>
+#include <stdexcept>
+
+namespace nre {
+
+NreComputePipeline::NreComputePipeline(NreDevice &device,
+                                       const std::string &compFilepath,
+                                       VkPipelineLayout pipelineLayout)
+    : nreDevice{device} {
+  assert(pipelineLayout != VK_NULL_HANDLE &&
+         ">> compute pipeline not created - no pipelineLayout provided");
+
+  auto compCode = NrePipeline::readFile(compFilepath);
+
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = compCode.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t *>(compCode.data());
+  if (vkCreateShaderModule(nreDevice.device(), &moduleInfo, nullptr,
+                           &compShaderModule) != VK_SUCCESS) {
+    throw std::runtime_error(">> failed to create shader module");
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = compShaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  if (vkCreateComputePipelines(nreDevice.device(),
+                               nreDevice.getPipelineCache(), 1, &pipelineInfo,
+                               nullptr, &computePipeline) != VK_SUCCESS) {
+    throw std::runtime_error(">> failed to create compute pipeline");
+  }
+}
+
+NreComputePipeline::~NreComputePipeline() {
+  vkDestroyShaderModule(nreDevice.device(), compShaderModule, nullptr);
+  vkDestroyPipeline(nreDevice.device(), computePipeline, nullptr);
+}
+
+void NreComputePipeline::bind(VkCommandBuffer commandBuffer) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    computePipeline);
+}
+
+} // namespace nre
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "nre_device.hpp"
+
+// std
+#include <string>
+
+namespace nre {
+
+// a single compute shader, the layout is owned by whoever creates the pipeline
+// (same as graphics pipelines)
+class NreComputePipeline {
+public:
+  NreComputePipeline(NreDevice &device, const std::string &compFilepath,
+                     VkPipelineLayout pipelineLayout);
+  ~NreComputePipeline();
+
+  NreComputePipeline(const NreComputePipeline &) = delete;
+  NreComputePipeline &operator=(const NreComputePipeline &) = delete;
+
+  void bind(VkCommandBuffer commandBuffer);
+
+private:
+  NreDevice &nreDevice;
+  VkPipeline computePipeline;
+  VkShaderModule compShaderModule;
+};
+
+} // namespace nre
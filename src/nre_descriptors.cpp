@@ -1,12 +1,68 @@
 #include "nre_descriptors.hpp"
 
+#include "nre_utils.hpp"
+
 // std
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
 namespace nre
 {
 
+    namespace
+    {
+        using BindingMap = std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding>;
+
+        // immutable samplers aren't used, so they're left out
+        bool sameBinding(const VkDescriptorSetLayoutBinding &a, const VkDescriptorSetLayoutBinding &b)
+        {
+            return a.binding == b.binding && a.descriptorType == b.descriptorType &&
+                   a.descriptorCount == b.descriptorCount && a.stageFlags == b.stageFlags;
+        }
+
+        size_t hashBindings(const BindingMap &bindings)
+        {
+            // map iteration order isn't stable between equal maps
+            std::vector<uint32_t> keys;
+            for (const auto &kv : bindings)
+            {
+                keys.push_back(kv.first);
+            }
+            std::sort(keys.begin(), keys.end());
+
+            size_t seed = 0;
+            for (uint32_t key : keys)
+            {
+                const auto &binding = bindings.at(key);
+                hashCombine(
+                    seed,
+                    binding.binding,
+                    static_cast<int>(binding.descriptorType),
+                    binding.descriptorCount,
+                    binding.stageFlags);
+            }
+            return seed;
+        }
+
+        bool sameBindings(const BindingMap &a, const BindingMap &b)
+        {
+            if (a.size() != b.size())
+            {
+                return false;
+            }
+            for (const auto &kv : a)
+            {
+                auto it = b.find(kv.first);
+                if (it == b.end() || !sameBinding(kv.second, it->second))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
     // *************** Descriptor Set Layout Builder ******************
 
     // checks if a binding at a specific index hasn't already been added
@@ -32,6 +88,11 @@ namespace nre
         return std::make_unique<NreDescriptorSetLayout>(nreDevice, bindings);
     }
 
+    NreDescriptorSetLayout &NreDescriptorSetLayout::Builder::build(NreDescriptorLayoutCache &cache) const
+    {
+        return cache.getLayout(bindings);
+    }
+
     // *************** Descriptor Set Layout *********************
 
     NreDescriptorSetLayout::NreDescriptorSetLayout(
@@ -64,6 +125,22 @@ namespace nre
         vkDestroyDescriptorSetLayout(nreDevice.device(), descriptorSetLayout, nullptr);
     }
 
+    // *************** Descriptor Layout Cache *********************
+
+    NreDescriptorSetLayout &NreDescriptorLayoutCache::getLayout(const BindingMap &bindings)
+    {
+        auto &candidates = layouts[hashBindings(bindings)];
+        for (auto &layout : candidates)
+        {
+            if (sameBindings(layout->bindings, bindings))
+            {
+                return *layout;
+            }
+        }
+        candidates.push_back(std::make_unique<NreDescriptorSetLayout>(nreDevice, bindings));
+        return *candidates.back();
+    }
+
     // *************** Descriptor Pool Builder *********************
 
     NreDescriptorPool::Builder &NreDescriptorPool::Builder::addPoolSize(
@@ -150,6 +227,174 @@ namespace nre
         vkResetDescriptorPool(nreDevice.device(), descriptorPool, 0);
     }
 
+    // *************** Descriptor Allocator Builder *********************
+
+    NreDescriptorAllocator::Builder &NreDescriptorAllocator::Builder::addPoolRatio(
+        VkDescriptorType descriptorType, float ratio)
+    {
+        poolRatios.push_back({descriptorType, ratio});
+        return *this;
+    }
+
+    NreDescriptorAllocator::Builder &NreDescriptorAllocator::Builder::setSetsPerPool(uint32_t count)
+    {
+        setsPerPool = count;
+        return *this;
+    }
+
+    NreDescriptorAllocator::Builder &NreDescriptorAllocator::Builder::setMaxSetsPerPool(uint32_t count)
+    {
+        maxSetsPerPool = count;
+        return *this;
+    }
+
+    std::unique_ptr<NreDescriptorAllocator> NreDescriptorAllocator::Builder::build() const
+    {
+        return std::make_unique<NreDescriptorAllocator>(nreDevice, setsPerPool, maxSetsPerPool, poolRatios);
+    }
+
+    // *************** Descriptor Allocator *********************
+
+    NreDescriptorAllocator::NreDescriptorAllocator(
+        NreDevice &nreDevice,
+        uint32_t setsPerPool,
+        uint32_t maxSetsPerPool,
+        const std::vector<std::pair<VkDescriptorType, float>> &poolRatios)
+        : nreDevice{nreDevice},
+          poolRatios{poolRatios},
+          setsPerPool{std::max(setsPerPool, 1u)},
+          maxSetsPerPool{std::max(maxSetsPerPool, setsPerPool)}
+    {
+    }
+
+    VkDescriptorSet NreDescriptorAllocator::allocate(VkDescriptorSetLayout descriptorSetLayout)
+    {
+        if (currentPool == nullptr)
+        {
+            currentPool = takePool();
+        }
+
+        VkDescriptorSet set;
+        if (currentPool->allocateDescriptor(descriptorSetLayout, set))
+        {
+            return set;
+        }
+
+        // out of sets or descriptors, retire the pool until the next reset
+        fullPools.push_back(std::move(currentPool));
+        currentPool = takePool();
+        if (!currentPool->allocateDescriptor(descriptorSetLayout, set))
+        {
+            throw std::runtime_error("descriptor allocator: set doesn't fit an empty pool, missing a pool ratio?");
+        }
+        return set;
+    }
+
+    void NreDescriptorAllocator::resetPools()
+    {
+        if (currentPool != nullptr)
+        {
+            fullPools.push_back(std::move(currentPool));
+        }
+        for (auto &pool : fullPools)
+        {
+            pool->resetPool();
+            readyPools.push_back(std::move(pool));
+        }
+        fullPools.clear();
+    }
+
+    std::unique_ptr<NreDescriptorPool> NreDescriptorAllocator::takePool()
+    {
+        if (!readyPools.empty())
+        {
+            auto pool = std::move(readyPools.back());
+            readyPools.pop_back();
+            return pool;
+        }
+
+        NreDescriptorPool::Builder builder{nreDevice};
+        builder.setMaxSets(setsPerPool);
+        for (const auto &ratio : poolRatios)
+        {
+            builder.addPoolSize(
+                ratio.first, std::max(1u, static_cast<uint32_t>(ratio.second * setsPerPool)));
+        }
+        auto pool = builder.build();
+        // fewer pools to chain when allocations keep growing
+        setsPerPool = std::min(setsPerPool * 2, maxSetsPerPool);
+        return pool;
+    }
+
+    // *************** Descriptor Update Template Builder *********************
+
+    NreDescriptorUpdateTemplate::Builder &NreDescriptorUpdateTemplate::Builder::addBuffer(
+        uint32_t binding, size_t offset)
+    {
+        entries.push_back(makeEntry(setLayout, binding, offset, sizeof(VkDescriptorBufferInfo)));
+        return *this;
+    }
+
+    NreDescriptorUpdateTemplate::Builder &NreDescriptorUpdateTemplate::Builder::addImage(
+        uint32_t binding, size_t offset)
+    {
+        entries.push_back(makeEntry(setLayout, binding, offset, sizeof(VkDescriptorImageInfo)));
+        return *this;
+    }
+
+    std::unique_ptr<NreDescriptorUpdateTemplate> NreDescriptorUpdateTemplate::Builder::build() const
+    {
+        return std::make_unique<NreDescriptorUpdateTemplate>(nreDevice, setLayout, entries);
+    }
+
+    // *************** Descriptor Update Template *********************
+
+    NreDescriptorUpdateTemplate::NreDescriptorUpdateTemplate(
+        NreDevice &nreDevice,
+        const NreDescriptorSetLayout &setLayout,
+        const std::vector<VkDescriptorUpdateTemplateEntry> &entries)
+        : nreDevice{nreDevice}
+    {
+        VkDescriptorUpdateTemplateCreateInfo templateInfo{};
+        templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+        templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+        templateInfo.pDescriptorUpdateEntries = entries.data();
+        templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+        templateInfo.descriptorSetLayout = setLayout.getDescriptorSetLayout();
+
+        if (vkCreateDescriptorUpdateTemplate(nreDevice.device(), &templateInfo, nullptr, &updateTemplate) !=
+            VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create descriptor update template!");
+        }
+    }
+
+    NreDescriptorUpdateTemplate::~NreDescriptorUpdateTemplate()
+    {
+        vkDestroyDescriptorUpdateTemplate(nreDevice.device(), updateTemplate, nullptr);
+    }
+
+    void NreDescriptorUpdateTemplate::update(VkDescriptorSet set, const void *data) const
+    {
+        vkUpdateDescriptorSetWithTemplate(nreDevice.device(), set, updateTemplate, data);
+    }
+
+    VkDescriptorUpdateTemplateEntry NreDescriptorUpdateTemplate::makeEntry(
+        const NreDescriptorSetLayout &setLayout, uint32_t binding, size_t offset, size_t stride)
+    {
+        assert(setLayout.bindings.count(binding) == 1 && "Layout does not contain specified binding");
+        const auto &bindingDescription = setLayout.bindings.at(binding);
+
+        VkDescriptorUpdateTemplateEntry entry{};
+        entry.dstBinding = binding;
+        entry.dstArrayElement = 0;
+        entry.descriptorCount = bindingDescription.descriptorCount;
+        entry.descriptorType = bindingDescription.descriptorType;
+        entry.offset = offset;
+        entry.stride = stride;
+        return entry;
+    }
+
     // *************** Descriptor Writer *********************
 
     NreDescriptorWriter::NreDescriptorWriter(NreDescriptorSetLayout &setLayout, NreDescriptorPool &pool)
@@ -178,22 +423,22 @@ namespace nre
     }
 
     NreDescriptorWriter &NreDescriptorWriter::writeImage(
-        uint32_t binding, VkDescriptorImageInfo *imageInfo)
+        uint32_t binding, VkDescriptorImageInfo *imageInfo, uint32_t count)
     {
         assert(setLayout.bindings.count(binding) == 1 && "Layout does not contain specified binding");
 
         auto &bindingDescription = setLayout.bindings[binding];
 
         assert(
-            bindingDescription.descriptorCount == 1 &&
-            "Binding single descriptor info, but binding expects multiple");
+            bindingDescription.descriptorCount == count &&
+            "Descriptor info count does not match the binding's descriptor count");
 
         VkWriteDescriptorSet write{};
         write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         write.descriptorType = bindingDescription.descriptorType;
         write.dstBinding = binding;
         write.pImageInfo = imageInfo;
-        write.descriptorCount = 1;
+        write.descriptorCount = count;
 
         writes.push_back(write);
         return *this;
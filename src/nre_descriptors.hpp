@@ -12,6 +12,8 @@
 namespace nre
 {
 
+    class NreDescriptorLayoutCache;
+
     class NreDescriptorSetLayout
     {
     public:
@@ -30,6 +32,8 @@ namespace nre
                 VkShaderStageFlags stageFlags,
                 uint32_t count = 1);
             std::unique_ptr<NreDescriptorSetLayout> build() const;
+            // shared with every other layout built from the same bindings, owned by the cache
+            NreDescriptorSetLayout &build(NreDescriptorLayoutCache &cache) const;
 
         private:
             NreDevice &nreDevice;
@@ -50,6 +54,26 @@ namespace nre
         std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings;
 
         friend class NreDescriptorWriter;
+        friend class NreDescriptorLayoutCache;
+        friend class NreDescriptorUpdateTemplate;
+    };
+
+    // hands out one layout per distinct set of bindings instead of a new one per build
+    class NreDescriptorLayoutCache
+    {
+    public:
+        NreDescriptorLayoutCache(NreDevice &nreDevice) : nreDevice{nreDevice} {}
+        NreDescriptorLayoutCache(const NreDescriptorLayoutCache &) = delete;
+        NreDescriptorLayoutCache &operator=(const NreDescriptorLayoutCache &) = delete;
+
+        // layouts stay alive as long as the cache
+        NreDescriptorSetLayout &getLayout(
+            const std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> &bindings);
+
+    private:
+        NreDevice &nreDevice;
+        // keyed by hashed bindings, the vector only grows past 1 on a hash collision
+        std::unordered_map<size_t, std::vector<std::unique_ptr<NreDescriptorSetLayout>>> layouts;
     };
 
     class NreDescriptorPool
@@ -95,13 +119,108 @@ namespace nre
         friend class NreDescriptorWriter;
     };
 
+    // allocation never fails: when a pool runs out the next one is chained, each new pool twice
+    // the size of the last (up to maxSetsPerPool)
+    // resetPools() recycles every pool at once, so a per frame allocator is reset right after the
+    // frame's fence has signaled
+    class NreDescriptorAllocator
+    {
+    public:
+        class Builder
+        {
+        public:
+            Builder(NreDevice &nreDevice) : nreDevice{nreDevice} {}
+
+            // descriptors of this type per set, eg: 2 for sets with two storage buffers
+            Builder &addPoolRatio(VkDescriptorType descriptorType, float ratio);
+            Builder &setSetsPerPool(uint32_t count);
+            Builder &setMaxSetsPerPool(uint32_t count);
+            std::unique_ptr<NreDescriptorAllocator> build() const;
+
+        private:
+            NreDevice &nreDevice;
+            std::vector<std::pair<VkDescriptorType, float>> poolRatios{};
+            uint32_t setsPerPool = 16;
+            uint32_t maxSetsPerPool = 4096;
+        };
+
+        NreDescriptorAllocator(
+            NreDevice &nreDevice,
+            uint32_t setsPerPool,
+            uint32_t maxSetsPerPool,
+            const std::vector<std::pair<VkDescriptorType, float>> &poolRatios);
+        NreDescriptorAllocator(const NreDescriptorAllocator &) = delete;
+        NreDescriptorAllocator &operator=(const NreDescriptorAllocator &) = delete;
+
+        VkDescriptorSet allocate(VkDescriptorSetLayout descriptorSetLayout);
+
+        // every set allocated so far becomes invalid, the GPU has to be done with them
+        void resetPools();
+
+    private:
+        std::unique_ptr<NreDescriptorPool> takePool();
+
+        NreDevice &nreDevice;
+        std::vector<std::pair<VkDescriptorType, float>> poolRatios;
+        uint32_t setsPerPool;
+        uint32_t maxSetsPerPool;
+
+        std::unique_ptr<NreDescriptorPool> currentPool;
+        std::vector<std::unique_ptr<NreDescriptorPool>> fullPools;
+        // reset and empty, used before creating new ones
+        std::vector<std::unique_ptr<NreDescriptorPool>> readyPools;
+    };
+
+    // writes all bindings of a set in one call from a struct of descriptor infos, cheaper than
+    // building VkWriteDescriptorSet arrays for sets rewritten every frame
+    class NreDescriptorUpdateTemplate
+    {
+    public:
+        class Builder
+        {
+        public:
+            Builder(NreDevice &nreDevice, NreDescriptorSetLayout &setLayout)
+                : nreDevice{nreDevice}, setLayout{setLayout} {}
+
+            // offset of the binding's VkDescriptorBufferInfo in the data passed to update(), arrays
+            // are tightly packed
+            Builder &addBuffer(uint32_t binding, size_t offset);
+            // same for VkDescriptorImageInfo
+            Builder &addImage(uint32_t binding, size_t offset);
+            std::unique_ptr<NreDescriptorUpdateTemplate> build() const;
+
+        private:
+            NreDevice &nreDevice;
+            NreDescriptorSetLayout &setLayout;
+            std::vector<VkDescriptorUpdateTemplateEntry> entries{};
+        };
+
+        NreDescriptorUpdateTemplate(
+            NreDevice &nreDevice,
+            const NreDescriptorSetLayout &setLayout,
+            const std::vector<VkDescriptorUpdateTemplateEntry> &entries);
+        ~NreDescriptorUpdateTemplate();
+        NreDescriptorUpdateTemplate(const NreDescriptorUpdateTemplate &) = delete;
+        NreDescriptorUpdateTemplate &operator=(const NreDescriptorUpdateTemplate &) = delete;
+
+        void update(VkDescriptorSet set, const void *data) const;
+
+    private:
+        static VkDescriptorUpdateTemplateEntry makeEntry(
+            const NreDescriptorSetLayout &setLayout, uint32_t binding, size_t offset, size_t stride);
+
+        NreDevice &nreDevice;
+        VkDescriptorUpdateTemplate updateTemplate;
+    };
+
     class NreDescriptorWriter
     {
     public:
         NreDescriptorWriter(NreDescriptorSetLayout &setLayout, NreDescriptorPool &pool);
 
         NreDescriptorWriter &writeBuffer(uint32_t binding, VkDescriptorBufferInfo *bufferInfo);
-        NreDescriptorWriter &writeImage(uint32_t binding, VkDescriptorImageInfo *imageInfo);
+        // count > 1 fills an array binding, imageInfo points at count infos
+        NreDescriptorWriter &writeImage(uint32_t binding, VkDescriptorImageInfo *imageInfo, uint32_t count = 1);
 
         bool build(VkDescriptorSet &set);
         void overwrite(VkDescriptorSet &set);
@@ -4,10 +4,16 @@
 
 // std headers
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <set>
 #include <unordered_set>
 
+#ifndef ENGINE_DIR
+#define ENGINE_DIR "../"
+#endif
+
 namespace nre
 {
 
@@ -65,10 +71,13 @@ namespace nre
         pickPhysicalDevice();
         createLogicalDevice();
         createCommandPool();
+        createPipelineCache();
     }
 
     NreDevice::~NreDevice()
     {
+        savePipelineCache();
+        vkDestroyPipelineCache(device_, pipelineCache, nullptr);
         vkDestroyCommandPool(device_, commandPool, nullptr);
         vkDestroyDevice(device_, nullptr);
 
@@ -81,6 +90,87 @@ namespace nre
         vkDestroyInstance(instance, nullptr);
     }
 
+    // not part of the repo, every machine builds its own
+    static const std::string PIPELINE_CACHE_PATH = ENGINE_DIR "pipeline_cache.bin";
+
+    void NreDevice::createPipelineCache()
+    {
+        std::vector<char> data{};
+        std::ifstream file{PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary};
+        if (file.is_open())
+        {
+            data.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(data.data(), data.size());
+            if (!file || !isPipelineCacheCompatible(data))
+            {
+                // stale (driver update, other GPU) or corrupt, drivers may not reject it themselves
+                std::cout << "pipeline cache: ignoring " << PIPELINE_CACHE_PATH << "\n";
+                data.clear();
+            }
+        }
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = data.size();
+        cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+        if (vkCreatePipelineCache(device_, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+        std::cout << "pipeline cache: " << data.size() << " bytes loaded\n";
+    }
+
+    bool NreDevice::isPipelineCacheCompatible(const std::vector<char> &data)
+    {
+        VkPipelineCacheHeaderVersionOne header{};
+        if (data.size() < sizeof(header))
+        {
+            return false;
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        return header.headerSize >= sizeof(header) &&
+               header.headerSize <= data.size() &&
+               header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+               header.vendorID == properties.vendorID &&
+               header.deviceID == properties.deviceID &&
+               std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    void NreDevice::savePipelineCache()
+    {
+        size_t size = 0;
+        if (vkGetPipelineCacheData(device_, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0)
+        {
+            return;
+        }
+        std::vector<char> data(size);
+        if (vkGetPipelineCacheData(device_, pipelineCache, &size, data.data()) != VK_SUCCESS)
+        {
+            return;
+        }
+
+        // a failed save only costs the next launch its warm start, so it isn't fatal
+        const std::string tmpPath = PIPELINE_CACHE_PATH + ".tmp";
+        {
+            std::ofstream file{tmpPath, std::ios::binary | std::ios::trunc};
+            file.write(data.data(), size);
+            file.flush();
+            if (!file)
+            {
+                std::cerr << "pipeline cache: failed to write " << tmpPath << std::endl;
+                return;
+            }
+        }
+        std::error_code error{};
+        std::filesystem::rename(tmpPath, PIPELINE_CACHE_PATH, error);
+        if (error)
+        {
+            std::cerr << "pipeline cache: failed to replace " << PIPELINE_CACHE_PATH << ": " << error.message() << std::endl;
+            std::filesystem::remove(tmpPath, error);
+        }
+    }
+
     void NreDevice::createInstance()
     {
         if (enableValidationLayers && !checkValidationLayerSupport())
@@ -94,7 +184,9 @@ namespace nre
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "No Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        // 1.2 for vkCmdDrawIndexedIndirectCount, 1.3 for dynamic rendering,
+        // older devices still work with the features they report
+        appInfo.apiVersion = VK_API_VERSION_1_3;
 
         VkInstanceCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -175,18 +267,127 @@ namespace nre
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
         VkPhysicalDeviceFeatures deviceFeatures = {};
         deviceFeatures.samplerAnisotropy = VK_TRUE;
+        deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+        multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+        // desktop GPUs, BCn textures fail to load without it
+        deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        textureCompressionBCSupported = supportedFeatures.textureCompressionBC == VK_TRUE;
+        // the compute downsampler writes every mip level through one formatless image array
+        deviceFeatures.shaderStorageImageWriteWithoutFormat =
+            supportedFeatures.shaderStorageImageWriteWithoutFormat;
+        deviceFeatures.shaderStorageImageArrayDynamicIndexing =
+            supportedFeatures.shaderStorageImageArrayDynamicIndexing;
+        // virtual texture feedback is written from the forward pass, shaders/material.glsl
+        // always has the store, so isDeviceSuitable requires it
+        deviceFeatures.fragmentStoresAndAtomics = VK_TRUE;
+        formatlessStorageWritesSupported =
+            supportedFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE &&
+            supportedFeatures.shaderStorageImageArrayDynamicIndexing == VK_TRUE;
+
+        // every suitable device is 1.2 with descriptor indexing (see hasDescriptorIndexing), the
+        // rest is optional: gpu culling falls back to fixed size indirect draws without
+        // drawIndirectCount
+        VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceVulkan12Features supported12 = {};
+        supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supported = {};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supported.pNext = &supported12;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+
+        vulkan12Features.drawIndirectCount = supported12.drawIndirectCount;
+        drawIndirectCountSupported = supported12.drawIndirectCount == VK_TRUE;
+
+        descriptorIndexingSupported = true;
+        vulkan12Features.descriptorIndexing = supported12.descriptorIndexing;
+        vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+        vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+        vulkan12Features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+
+        VkPhysicalDeviceVulkan12Properties properties12 = {};
+        properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &properties12;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+        maxBindlessSampledImages = properties12.maxDescriptorSetUpdateAfterBindSampledImages;
+
+        // optional, pipelines are compiled whole without it
+        std::vector<const char *> enabledExtensions = deviceExtensions;
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures = {};
+        pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+        if (properties.apiVersion >= VK_API_VERSION_1_2 &&
+            hasDeviceExtension(physicalDevice, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+            hasDeviceExtension(physicalDevice, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME))
+        {
+            VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT supportedLibrary = {};
+            supportedLibrary.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+            VkPhysicalDeviceFeatures2 supported = {};
+            supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supported.pNext = &supportedLibrary;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+
+            // without fast linking a link costs about as much as a full compile, no point then
+            VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties = {};
+            libraryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2 properties2 = {};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &libraryProperties;
+            vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+            if (supportedLibrary.graphicsPipelineLibrary == VK_TRUE &&
+                libraryProperties.graphicsPipelineLibraryFastLinking == VK_TRUE)
+            {
+                pipelineLibraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+                vulkan12Features.pNext = &pipelineLibraryFeatures;
+                enabledExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+                enabledExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+                graphicsPipelineLibrarySupported = true;
+            }
+        }
+
+        // optional, the swap chain render pass is used without it
+        VkPhysicalDeviceVulkan13Features vulkan13Features = {};
+        vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        if (properties.apiVersion >= VK_API_VERSION_1_3)
+        {
+            VkPhysicalDeviceVulkan13Features supported13 = {};
+            supported13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+            VkPhysicalDeviceFeatures2 supported = {};
+            supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supported.pNext = &supported13;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+
+            vulkan13Features.dynamicRendering = supported13.dynamicRendering;
+            dynamicRenderingSupported = supported13.dynamicRendering == VK_TRUE;
+            vulkan13Features.synchronization2 = supported13.synchronization2;
+            synchronization2Supported = supported13.synchronization2 == VK_TRUE;
+            // extended dynamic state is core in 1.3, there's no feature to enable
+            extendedDynamicStateSupported = true;
+
+            vulkan13Features.pNext = vulkan12Features.pNext;
+            vulkan12Features.pNext = &vulkan13Features;
+        }
 
         VkDeviceCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &vulkan12Features;
 
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
         createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
         // might not really be necessary anymore because device specific validation layers
         // have been deprecated
@@ -244,7 +445,33 @@ namespace nre
         vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
         return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-               supportedFeatures.samplerAnisotropy;
+               supportedFeatures.samplerAnisotropy && supportedFeatures.fragmentStoresAndAtomics &&
+               hasDescriptorIndexing(device);
+    }
+
+    bool NreDevice::hasDescriptorIndexing(VkPhysicalDevice device)
+    {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
+        {
+            return false;
+        }
+
+        VkPhysicalDeviceVulkan12Features supported12 = {};
+        supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supported = {};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supported.pNext = &supported12;
+        vkGetPhysicalDeviceFeatures2(device, &supported);
+
+        // what NreBindlessTable needs, required by 1.3 but optional before
+        return supported12.runtimeDescriptorArray == VK_TRUE &&
+               supported12.shaderSampledImageArrayNonUniformIndexing == VK_TRUE &&
+               supported12.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE &&
+               supported12.descriptorBindingStorageBufferUpdateAfterBind == VK_TRUE &&
+               supported12.descriptorBindingPartiallyBound == VK_TRUE &&
+               supported12.descriptorBindingVariableDescriptorCount == VK_TRUE;
     }
 
     void NreDevice::populateDebugMessengerCreateInfo(
@@ -368,6 +595,28 @@ namespace nre
         return requiredExtensions.empty();
     }
 
+    bool NreDevice::hasDeviceExtension(VkPhysicalDevice device, const char *extension)
+    {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(
+            device,
+            nullptr,
+            &extensionCount,
+            availableExtensions.data());
+
+        for (const auto &available : availableExtensions)
+        {
+            if (std::strcmp(available.extensionName, extension) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     QueueFamilyIndices NreDevice::findQueueFamilies(VkPhysicalDevice device)
     {
         QueueFamilyIndices indices;
@@ -76,6 +76,29 @@ namespace nre
             VkImage &image,
             VkDeviceMemory &imageMemory);
 
+        // optional features, enabled when the physical device has them
+        bool supportsDrawIndirectCount() const { return drawIndirectCountSupported; }
+        bool supportsMultiDrawIndirect() const { return multiDrawIndirectSupported; }
+        bool supportsTextureCompressionBC() const { return textureCompressionBCSupported; }
+        // storage image writes without a format qualifier, see NreDownsampler
+        bool supportsFormatlessStorageWrites() const { return formatlessStorageWritesSupported; }
+        // Vulkan 1.3, pipelines without render passes and state like cull mode set per draw
+        bool supportsDynamicRendering() const { return dynamicRenderingSupported; }
+        bool supportsExtendedDynamicState() const { return extendedDynamicStateSupported; }
+        // Vulkan 1.3, vkCmdPipelineBarrier2, NreRenderGraph falls back to vkCmdPipelineBarrier without it
+        bool supportsSynchronization2() const { return synchronization2Supported; }
+        // VK_EXT_graphics_pipeline_library with fast linking, see NrePipelineLibrary
+        bool supportsGraphicsPipelineLibrary() const { return graphicsPipelineLibrarySupported; }
+        // update after bind, partially bound and variable count arrays, see NreBindlessTable
+        bool supportsDescriptorIndexing() const { return descriptorIndexingSupported; }
+        uint32_t getMaxBindlessSampledImages() const { return maxBindlessSampledImages; }
+
+        // shared by every pipeline, loaded from disk at startup and written back by the destructor
+        VkPipelineCache getPipelineCache() { return pipelineCache; }
+        // writes to a temporary file first and renames it over the old cache, so a crash
+        // mid-write never leaves a truncated cache behind
+        void savePipelineCache();
+
         VkPhysicalDeviceProperties properties;
 
     private:
@@ -85,15 +108,21 @@ namespace nre
         void pickPhysicalDevice();
         void createLogicalDevice();
         void createCommandPool();
+        void createPipelineCache();
 
         // helper functions
         bool isDeviceSuitable(VkPhysicalDevice device);
+        // Vulkan 1.2 and the descriptor indexing features NreBindlessTable uses, required
+        bool hasDescriptorIndexing(VkPhysicalDevice device);
+        // true if data was written by this driver for this device
+        bool isPipelineCacheCompatible(const std::vector<char> &data);
         std::vector<const char *> getRequiredExtensions();
         bool checkValidationLayerSupport();
         QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
         void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
         void hasGflwRequiredInstanceExtensions();
         bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+        bool hasDeviceExtension(VkPhysicalDevice device, const char *extension);
         SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 
         VkInstance instance;
@@ -101,12 +130,24 @@ namespace nre
         VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
         NreWindow &window;
         VkCommandPool commandPool;
+        VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 
         VkDevice device_;
         VkSurfaceKHR surface_;
         VkQueue graphicsQueue_;
         VkQueue presentQueue_;
 
+        bool drawIndirectCountSupported = false;
+        bool multiDrawIndirectSupported = false;
+        bool textureCompressionBCSupported = false;
+        bool formatlessStorageWritesSupported = false;
+        bool graphicsPipelineLibrarySupported = false;
+        bool dynamicRenderingSupported = false;
+        bool extendedDynamicStateSupported = false;
+        bool synchronization2Supported = false;
+        bool descriptorIndexingSupported = false;
+        uint32_t maxBindlessSampledImages = 0;
+
         const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
         const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
     };
@@ -0,0 +1,213 @@
+#include "nre_downsampler.hpp"
+
+// std
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <stdexcept>
+
+namespace nre {
+
+namespace {
+
+// matches Push in shaders/downsample.comp
+struct DownsamplePushConstantData {
+  int32_t sourceWidth = 0;
+  int32_t sourceHeight = 0;
+  uint32_t groupCountX = 0;
+  uint32_t groupCountY = 0;
+  uint32_t levelCount = 0;
+  uint32_t reduction = 0;
+};
+
+// texels of level 0 one workgroup reduces per side
+constexpr uint32_t TILE_SIZE = 64;
+constexpr uint32_t WRITTEN_LEVELS = NreDownsampler::MAX_MIP_LEVELS - 1;
+// finishedGroups and its padding in front of the level 6 texels
+constexpr VkDeviceSize SCRATCH_HEADER_SIZE = 16;
+
+} // namespace
+
+// *************** Downsampler Target *********************
+
+NreDownsampler::Target::Target(NreDevice &device, NreDownsampler &downsampler,
+                               VkImage image, VkFormat format, uint32_t width,
+                               uint32_t height, uint32_t mipLevels)
+    : nreDevice{device}, image{image}, width{width}, height{height},
+      mipLevels{std::min(mipLevels, MAX_MIP_LEVELS)},
+      groupCountX{(width + TILE_SIZE - 1) / TILE_SIZE},
+      groupCountY{(height + TILE_SIZE - 1) / TILE_SIZE} {
+  assert(this->mipLevels > 1 && "Nothing to downsample");
+
+  for (uint32_t level = 0; level < this->mipLevels; level++) {
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = level;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+    if (vkCreateImageView(device.device(), &viewInfo, nullptr, &view) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create downsampler image view!");
+    }
+    views.push_back(view);
+  }
+
+  // finishedGroups starts at 0, the last group resets it after every dispatch
+  VkDeviceSize scratchSize = SCRATCH_HEADER_SIZE + VkDeviceSize{groupCountX} *
+                                                       groupCountY *
+                                                       4 * sizeof(float);
+  scratchBuffer = std::make_unique<NreBuffer>(
+      device, scratchSize, 1, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  scratchBuffer->map();
+  uint32_t zero = 0;
+  scratchBuffer->writeToBuffer(&zero, sizeof(zero));
+  scratchBuffer->unmap();
+
+  descriptorPool =
+      NreDescriptorPool::Builder(device)
+          .setMaxSets(1)
+          .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1)
+          .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, WRITTEN_LEVELS)
+          .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+          .build();
+
+  VkDescriptorImageInfo sourceInfo{};
+  sourceInfo.sampler = downsampler.sampler;
+  sourceInfo.imageView = views[0];
+  sourceInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  // every element has to be valid, the ones past the last level repeat it
+  std::array<VkDescriptorImageInfo, WRITTEN_LEVELS> levelInfos{};
+  for (uint32_t i = 0; i < WRITTEN_LEVELS; i++) {
+    levelInfos[i].imageView = views[std::min(i + 1, this->mipLevels - 1)];
+    levelInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  }
+  auto scratchInfo = scratchBuffer->descriptorInfo();
+
+  NreDescriptorWriter(*downsampler.setLayout, *descriptorPool)
+      .writeImage(0, &sourceInfo)
+      .writeImage(1, levelInfos.data(), WRITTEN_LEVELS)
+      .writeBuffer(2, &scratchInfo)
+      .build(descriptorSet);
+}
+
+NreDownsampler::Target::~Target() {
+  for (VkImageView view : views) {
+    vkDestroyImageView(nreDevice.device(), view, nullptr);
+  }
+}
+
+// *************** Downsampler *********************
+
+NreDownsampler::NreDownsampler(NreDevice &device) : nreDevice{device} {
+  if (!device.supportsFormatlessStorageWrites()) {
+    throw std::runtime_error(
+        "downsampler: device can't write storage images without a format");
+  }
+  createSetLayout();
+  createSampler();
+  createPipeline();
+}
+
+NreDownsampler::~NreDownsampler() {
+  vkDestroyPipelineLayout(nreDevice.device(), pipelineLayout, nullptr);
+  vkDestroySampler(nreDevice.device(), sampler, nullptr);
+}
+
+uint32_t NreDownsampler::mipLevelsFor(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+    levels++;
+  }
+  return levels;
+}
+
+void NreDownsampler::createSetLayout() {
+  setLayout = NreDescriptorSetLayout::Builder(nreDevice)
+                  .addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                              VK_SHADER_STAGE_COMPUTE_BIT)
+                  .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                              VK_SHADER_STAGE_COMPUTE_BIT, WRITTEN_LEVELS)
+                  .addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                              VK_SHADER_STAGE_COMPUTE_BIT)
+                  .build();
+}
+
+void NreDownsampler::createSampler() {
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxAnisotropy = 1.f;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+  if (vkCreateSampler(nreDevice.device(), &samplerInfo, nullptr, &sampler) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create downsampler sampler!");
+  }
+}
+
+void NreDownsampler::createPipeline() {
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(DownsamplePushConstantData);
+
+  VkDescriptorSetLayout descriptorSetLayout =
+      setLayout->getDescriptorSetLayout();
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout(nreDevice.device(), &pipelineLayoutInfo, nullptr,
+                             &pipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline layout");
+  }
+
+  pipeline = std::make_unique<NreComputePipeline>(
+      nreDevice, "shaders/downsample.comp.spv", pipelineLayout);
+}
+
+std::unique_ptr<NreDownsampler::Target>
+NreDownsampler::createTarget(VkImage image, VkFormat format, uint32_t width,
+                             uint32_t height, uint32_t mipLevels) {
+  return std::make_unique<Target>(nreDevice, *this, image, format, width,
+                                  height, mipLevels);
+}
+
+void NreDownsampler::dispatch(VkCommandBuffer commandBuffer, Target &target,
+                              Reduction reduction) {
+  DownsamplePushConstantData push{};
+  push.sourceWidth = static_cast<int32_t>(target.width);
+  push.sourceHeight = static_cast<int32_t>(target.height);
+  push.groupCountX = target.groupCountX;
+  push.groupCountY = target.groupCountY;
+  push.levelCount = target.mipLevels - 1;
+  push.reduction = static_cast<uint32_t>(reduction);
+
+  pipeline->bind(commandBuffer);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 0, 1, &target.descriptorSet, 0,
+                          nullptr);
+  vkCmdPushConstants(commandBuffer, pipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(DownsamplePushConstantData), &push);
+  vkCmdDispatch(commandBuffer, target.groupCountX, target.groupCountY, 1);
+}
+
+} // namespace nre
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "nre_buffer.hpp"
+#include "nre_compute_pipeline.hpp"
+#include "nre_descriptors.hpp"
+#include "nre_device.hpp"
+
+// std
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace nre {
+
+// generates a whole mip chain in one compute dispatch (shaders/downsample.comp)
+// instead of a blit and a barrier per level
+// averages for textures, min or max for depth pyramids
+// levels are box filtered from the one above, an odd edge row is dropped, so
+// depth pyramids that have to stay conservative want power of two sizes
+// needs NreDevice::supportsFormatlessStorageWrites(), the image needs STORAGE
+// and SAMPLED usage and a format that supports storage (not sRGB)
+class NreDownsampler {
+public:
+  enum class Reduction : uint32_t { Average = 0, Min = 1, Max = 2 };
+
+  // level 0 plus the 12 the shader writes, enough for 4096x4096
+  static constexpr uint32_t MAX_MIP_LEVELS = 13;
+
+  // per image state: one view per level, the descriptor set and the scratch
+  // buffer the workgroups hand level 6 over in
+  // has to outlive the command buffers it was dispatched in
+  class Target {
+  public:
+    Target(NreDevice &device, NreDownsampler &downsampler, VkImage image,
+           VkFormat format, uint32_t width, uint32_t height,
+           uint32_t mipLevels);
+    ~Target();
+
+    Target(const Target &) = delete;
+    Target &operator=(const Target &) = delete;
+
+    VkImage getImage() const { return image; }
+    uint32_t getMipLevels() const { return mipLevels; }
+
+  private:
+    NreDevice &nreDevice;
+    VkImage image;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t groupCountX;
+    uint32_t groupCountY;
+
+    std::vector<VkImageView> views;
+    std::unique_ptr<NreBuffer> scratchBuffer;
+    std::unique_ptr<NreDescriptorPool> descriptorPool;
+    VkDescriptorSet descriptorSet;
+
+    friend class NreDownsampler;
+  };
+
+  explicit NreDownsampler(NreDevice &device);
+  ~NreDownsampler();
+
+  NreDownsampler(const NreDownsampler &) = delete;
+  NreDownsampler &operator=(const NreDownsampler &) = delete;
+
+  // full chain down to 1x1
+  static uint32_t mipLevelsFor(uint32_t width, uint32_t height);
+
+  // mipLevels is clamped to MAX_MIP_LEVELS
+  std::unique_ptr<Target> createTarget(VkImage image, VkFormat format,
+                                       uint32_t width, uint32_t height,
+                                       uint32_t mipLevels);
+
+  // reads level 0 and writes every other level, the whole image has to be in
+  // GENERAL layout, the caller syncs before and after
+  void dispatch(VkCommandBuffer commandBuffer, Target &target,
+                Reduction reduction = Reduction::Average);
+
+private:
+  void createSetLayout();
+  void createSampler();
+  void createPipeline();
+
+  NreDevice &nreDevice;
+  std::unique_ptr<NreDescriptorSetLayout> setLayout;
+  // nearest, texelFetch ignores it anyway
+  VkSampler sampler;
+  VkPipelineLayout pipelineLayout;
+  std::unique_ptr<NreComputePipeline> pipeline;
+};
+
+} // namespace nre
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "nre_camera.hpp"
+#include "nre_descriptors.hpp"
 #include "nre_game_object.hpp"
 
 // lib
@@ -16,5 +17,9 @@ namespace nre
         NreCamera &camera;
         VkDescriptorSet globalDescriptorSet;
         NreGameObject::Map &gameObjects;
+        // size of what is rendered into, for screen size dependent work
+        VkExtent2D extent;
+        // for sets only needed this frame, reset when the frame index comes around again
+        NreDescriptorAllocator &frameDescriptors;
     };
 } // namespace nre
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "nre_impostor.hpp"
 #include "nre_model.hpp"
 
 // libs
@@ -25,6 +26,16 @@ namespace nre
         glm::mat3 normalMatrix();
     };
 
+    // level of detail state, written by LodSystem and read by render systems
+    struct LodComponent
+    {
+        uint32_t level = 0;
+        // too small on screen to be drawn at all
+        bool culled = false;
+        // far enough to be drawn as a quad by ImpostorSystem instead of the mesh
+        bool useImpostor = false;
+    };
+
     // a game object is anything with properties and methods
     class NreGameObject
     {
@@ -50,8 +61,21 @@ namespace nre
         const id_t getId() { return id; }
 
         std::shared_ptr<NreModel> model{};
+        // baked from model, used once the object is small on screen
+        std::shared_ptr<NreImpostor> impostor{};
         glm::vec3 color{};
+        // index into NreBindlessTable's materials, read by the shaders
+        uint32_t material = 0;
         TransformComponent transform{};
+        LodComponent lod{};
+        // never moves after loading, may be merged into a static batch
+        bool isStatic = false;
+        // hidden objects stay around (picking, gameplay) but no system draws them
+        // ie: the sources of a static batch
+        bool visible = true;
+        // this frame's GPU culled meshlet draws, written by MeshletCullSystem
+        // a null drawBuffer means the object is drawn the regular way
+        NreModel::IndirectDraws meshletDraws{};
 
     private:
         NreGameObject(id_t objId) : id{objId} {}
@@ -0,0 +1,112 @@
+#include "nre_hlod.hpp"
+
+#include "nre_mesh_simplifier.hpp"
+#include "nre_static_batcher.hpp"
+
+// std
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace nre {
+
+namespace {
+// (vertex format key, material, grid cell)
+using CellKey = std::tuple<uint32_t, uint32_t, int32_t, int32_t, int32_t>;
+
+// drops the vertices no index refers to anymore
+void compactVertices(NreModel::Builder &builder) {
+  std::vector<uint32_t> remap(builder.vertices.size(), ~0u);
+  std::vector<NreModel::Vertex> vertices{};
+  for (uint32_t &index : builder.indices) {
+    if (remap[index] == ~0u) {
+      remap[index] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(builder.vertices[index]);
+    }
+    index = remap[index];
+  }
+  builder.vertices.swap(vertices);
+}
+} // namespace
+
+std::vector<HlodCluster> buildHlodClusters(NreDevice &device,
+                                           NreGameObject::Map &gameObjects,
+                                           const HlodBuildSettings &settings,
+                                           HlodStats *stats) {
+  std::map<CellKey, std::vector<NreGameObject::id_t>> cells{};
+  for (auto &kv : gameObjects) {
+    auto &obj = kv.second;
+    // a proxy is drawn with a single material like a static batch, so multi
+    // material models stay on their own
+    if (!obj.isStatic || !obj.visible || obj.model == nullptr ||
+        obj.model->getMeshData() == nullptr || obj.model->hasMeshlets() ||
+        !obj.model->hasSingleMaterial()) {
+      continue;
+    }
+    const auto &sphere = obj.model->getBoundingSphere();
+    glm::vec3 center{obj.transform.mat4() * glm::vec4{sphere.center, 1.f}};
+    glm::vec3 cell = glm::floor(center / settings.cellSize);
+    cells[CellKey{obj.model->getVertexFormat().key(),
+                  obj.model->getSubmeshMaterial(0, obj.material),
+                  static_cast<int32_t>(cell.x), static_cast<int32_t>(cell.y),
+                  static_cast<int32_t>(cell.z)}]
+        .push_back(kv.first);
+  }
+
+  std::vector<HlodCluster> clusters{};
+  size_t sourceTriangles = 0;
+  size_t proxyTriangles = 0;
+  for (auto &kv : cells) {
+    auto &ids = kv.second;
+    std::sort(ids.begin(), ids.end());
+
+    NreModel::Builder proxy{};
+    for (NreGameObject::id_t id : ids) {
+      auto &member = gameObjects.at(id);
+      proxy.format = member.model->getVertexFormat();
+      appendWorldSpace(proxy, *member.model->getMeshData(), member.transform);
+    }
+
+    HlodCluster cluster{};
+    cluster.bounds = proxy.computeBoundingSphere();
+
+    std::vector<glm::vec3> positions(proxy.vertices.size());
+    for (size_t i = 0; i < proxy.vertices.size(); i++) {
+      positions[i] = proxy.vertices[i].position;
+    }
+    size_t targetIndexCount = std::max<size_t>(
+        3, static_cast<size_t>(proxy.indices.size() / 3 * settings.reduction) *
+               3);
+    std::vector<uint32_t> simplified =
+        simplifyMesh(proxy.indices, positions, targetIndexCount,
+                     settings.maxError * cluster.bounds.radius, &cluster.error);
+    // nothing left to draw, the members stay in charge at every distance
+    if (simplified.empty()) {
+      continue;
+    }
+    sourceTriangles += proxy.indices.size() / 3;
+    proxyTriangles += simplified.size() / 3;
+    proxy.indices.swap(simplified);
+    compactVertices(proxy);
+
+    auto proxyObject = NreGameObject::createGameObject();
+    proxyObject.model = std::make_shared<NreModel>(device, proxy);
+    proxyObject.color = gameObjects.at(ids[0]).color;
+    proxyObject.material = std::get<1>(kv.first);
+    proxyObject.isStatic = true;
+    proxyObject.visible = false;
+    cluster.proxy = proxyObject.getId();
+    cluster.members = std::move(ids);
+    gameObjects.emplace(proxyObject.getId(), std::move(proxyObject));
+    clusters.push_back(std::move(cluster));
+  }
+
+  if (stats != nullptr) {
+    stats->clusters = static_cast<uint32_t>(clusters.size());
+    stats->sourceTriangles = sourceTriangles;
+    stats->proxyTriangles = proxyTriangles;
+  }
+  return clusters;
+}
+
+} // namespace nre
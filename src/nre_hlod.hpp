@@ -0,0 +1,55 @@
+#pragma once
+
+#include "nre_device.hpp"
+#include "nre_game_object.hpp"
+#include "nre_model.hpp"
+
+// std
+#include <cstdint>
+#include <vector>
+
+// hierarchical LOD: nearby static objects are merged and simplified into a
+// single proxy that replaces the whole group far away, see HlodSystem
+namespace nre {
+
+struct HlodBuildSettings {
+  // objects are grouped by the grid cell (world units) their bounds center
+  // falls into, should be a few times StaticBatchSettings::cellSize
+  float cellSize = 32.f;
+  // proxies aim for this fraction of their group's triangles
+  float reduction = .05f;
+  // relative to the group's bounding sphere radius, simplification stops
+  // early once it would have to exceed it
+  float maxError = .05f;
+};
+
+struct HlodCluster {
+  // hidden until HlodSystem switches to it
+  NreGameObject::id_t proxy = 0;
+  std::vector<NreGameObject::id_t> members{};
+  // world space
+  NreModel::BoundingSphere bounds{};
+  // how far (world units) the proxy surface may be from the members
+  float error = 0.f;
+  bool useProxy = false;
+};
+
+struct HlodStats {
+  uint32_t clusters = 0;
+  // over all groups, before and after simplification
+  size_t sourceTriangles = 0;
+  size_t proxyTriangles = 0;
+};
+
+// groups every visible, static object whose model kept its mesh data (see
+// ImportOptions::keepMeshData), has no meshlets and a single material by
+// cell, vertex format and material, each group gets a simplified world space
+// proxy object with the group's material added to gameObjects
+// run after batchStaticObjects with StaticBatchSettings::keepMeshData, then
+// the batches are the members, stats (optional) receives the totals
+std::vector<HlodCluster>
+buildHlodClusters(NreDevice &device, NreGameObject::Map &gameObjects,
+                  const HlodBuildSettings &settings = {},
+                  HlodStats *stats = nullptr);
+
+} // namespace nre
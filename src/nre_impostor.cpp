@@ -0,0 +1,326 @@
+#include "nre_impostor.hpp"
+
+#include "nre_camera.hpp"
+#include "nre_pipeline.hpp"
+
+// std
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+namespace nre {
+
+namespace {
+
+// matches Push in shaders/impostor_bake.vert
+// impostors store object space normals, so there's no normal matrix
+struct BakePushConstantData {
+  glm::mat4 transform{1.f};
+};
+
+// constant_id values in shaders/impostor_bake.vert
+constexpr uint32_t OCT_NORMALS_CONSTANT = 0;
+
+void createAttachment(NreDevice &device, VkFormat format,
+                      VkImageUsageFlags usage, VkImageAspectFlags aspect,
+                      uint32_t size, VkImage &image, VkDeviceMemory &memory,
+                      VkImageView &view) {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = size;
+  imageInfo.extent.height = size;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = usage;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             image, memory);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = aspect;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+  if (vkCreateImageView(device.device(), &viewInfo, nullptr, &view) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create impostor image view!");
+  }
+}
+
+void destroyAttachment(NreDevice &device, VkImage image, VkDeviceMemory memory,
+                       VkImageView view) {
+  vkDestroyImageView(device.device(), view, nullptr);
+  vkDestroyImage(device.device(), image, nullptr);
+  vkFreeMemory(device.device(), memory, nullptr);
+}
+
+} // namespace
+
+NreImpostor::NreImpostor(NreDevice &device, NreModel &model,
+                         const ImpostorBakeSettings &settings)
+    : nreDevice{device}, settings{settings},
+      bounds{model.getBoundingSphere()},
+      atlasSize{settings.framesPerSide * settings.frameResolution} {
+  assert(settings.framesPerSide > 0 && settings.frameResolution > 0 &&
+         "impostor needs at least one frame");
+  createAtlas();
+  createSampler();
+  bake(model);
+}
+
+NreImpostor::~NreImpostor() {
+  vkDestroySampler(nreDevice.device(), sampler, nullptr);
+  destroyAttachment(nreDevice, colorImage, colorImageMemory, colorImageView);
+  destroyAttachment(nreDevice, normalDepthImage, normalDepthImageMemory,
+                    normalDepthImageView);
+}
+
+glm::vec3 NreImpostor::frameDirection(uint32_t x, uint32_t y,
+                                      uint32_t framesPerSide) {
+  // frame center in [-1, 1]^2, rotated 45 degrees onto the octahedron's upper
+  // half, -y is up
+  const float frames = static_cast<float>(framesPerSide);
+  glm::vec2 p{(x + .5f) / frames * 2.f - 1.f, (y + .5f) / frames * 2.f - 1.f};
+  glm::vec2 q{(p.x + p.y) * .5f, (p.x - p.y) * .5f};
+  float height = 1.f - glm::abs(q.x) - glm::abs(q.y);
+  return glm::normalize(glm::vec3{q.x, -height, q.y});
+}
+
+VkDescriptorImageInfo NreImpostor::colorDescriptorInfo() const {
+  return VkDescriptorImageInfo{sampler, colorImageView,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+VkDescriptorImageInfo NreImpostor::normalDepthDescriptorInfo() const {
+  return VkDescriptorImageInfo{sampler, normalDepthImageView,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+void NreImpostor::createAtlas() {
+  const VkImageUsageFlags usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  createAttachment(nreDevice, COLOR_FORMAT, usage, VK_IMAGE_ASPECT_COLOR_BIT,
+                   atlasSize, colorImage, colorImageMemory, colorImageView);
+  createAttachment(nreDevice, NORMAL_DEPTH_FORMAT, usage,
+                   VK_IMAGE_ASPECT_COLOR_BIT, atlasSize, normalDepthImage,
+                   normalDepthImageMemory, normalDepthImageView);
+}
+
+void NreImpostor::createSampler() {
+  // clamped so the outer frames don't pick up the opposite side of the atlas
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = 0.f;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+  if (vkCreateSampler(nreDevice.device(), &samplerInfo, nullptr, &sampler) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create impostor sampler!");
+  }
+}
+
+void NreImpostor::bake(NreModel &model) {
+  VkFormat depthFormat = nreDevice.findSupportedFormat(
+      {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
+       VK_FORMAT_D24_UNORM_S8_UINT},
+      VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+  VkImage depthImage;
+  VkDeviceMemory depthImageMemory;
+  VkImageView depthImageView;
+  createAttachment(nreDevice, depthFormat,
+                   VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                   VK_IMAGE_ASPECT_DEPTH_BIT, atlasSize, depthImage,
+                   depthImageMemory, depthImageView);
+
+  // render pass, both atlases end up ready to be sampled
+  std::array<VkAttachmentDescription, 3> attachments{};
+  for (int i = 0; i < 2; i++) {
+    attachments[i].format = i == 0 ? COLOR_FORMAT : NORMAL_DEPTH_FORMAT;
+    attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  attachments[2].format = depthFormat;
+  attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+  attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  std::array<VkAttachmentReference, 2> colorRefs{
+      VkAttachmentReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+      VkAttachmentReference{1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}};
+  VkAttachmentReference depthRef{
+      2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+  subpass.pColorAttachments = colorRefs.data();
+  subpass.pDepthStencilAttachment = &depthRef;
+
+  // the atlases are only read by fragment shaders after this
+  VkSubpassDependency dependency{};
+  dependency.srcSubpass = 0;
+  dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderPassInfo.pAttachments = attachments.data();
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 1;
+  renderPassInfo.pDependencies = &dependency;
+  VkRenderPass renderPass;
+  if (vkCreateRenderPass(nreDevice.device(), &renderPassInfo, nullptr,
+                         &renderPass) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create impostor render pass!");
+  }
+
+  std::array<VkImageView, 3> views{colorImageView, normalDepthImageView,
+                                   depthImageView};
+  VkFramebufferCreateInfo framebufferInfo{};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = renderPass;
+  framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+  framebufferInfo.pAttachments = views.data();
+  framebufferInfo.width = atlasSize;
+  framebufferInfo.height = atlasSize;
+  framebufferInfo.layers = 1;
+  VkFramebuffer framebuffer;
+  if (vkCreateFramebuffer(nreDevice.device(), &framebufferInfo, nullptr,
+                          &framebuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create impostor framebuffer!");
+  }
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(BakePushConstantData);
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 0;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  VkPipelineLayout pipelineLayout;
+  if (vkCreatePipelineLayout(nreDevice.device(), &pipelineLayoutInfo, nullptr,
+                             &pipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline layout");
+  }
+
+  const auto &format = model.getVertexFormat();
+  PipelineConfigInfo pipelineConfig{};
+  NrePipeline::defaultPipelineConfigInfo(pipelineConfig);
+  pipelineConfig.bindingDescriptions = format.getBindingDescriptions();
+  pipelineConfig.attributeDescriptions = format.getAttributeDescriptions();
+  pipelineConfig.vertSpecialization.set(
+      OCT_NORMALS_CONSTANT,
+      format.normal == NreModel::VertexFormat::Normal::Octahedral16);
+  std::array<VkPipelineColorBlendAttachmentState, 2> blendAttachments{
+      pipelineConfig.colorBlendAttachment, pipelineConfig.colorBlendAttachment};
+  pipelineConfig.colorBlendInfo.attachmentCount =
+      static_cast<uint32_t>(blendAttachments.size());
+  pipelineConfig.colorBlendInfo.pAttachments = blendAttachments.data();
+  pipelineConfig.renderPass = renderPass;
+  pipelineConfig.pipelineLayout = pipelineLayout;
+
+  {
+    NrePipeline bakePipeline{nreDevice, "shaders/impostor_bake.vert.spv",
+                             "shaders/impostor_bake.frag.spv", pipelineConfig};
+
+    VkCommandBuffer commandBuffer = nreDevice.beginSingleTimeCommands();
+
+    std::array<VkClearValue, 3> clearValues{};
+    clearValues[0].color = {{0.f, 0.f, 0.f, 0.f}};
+    clearValues[1].color = {{.5f, .5f, .5f, 1.f}};
+    clearValues[2].depthStencil = {1.f, 0};
+
+    VkRenderPassBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    beginInfo.renderPass = renderPass;
+    beginInfo.framebuffer = framebuffer;
+    beginInfo.renderArea.offset = {0, 0};
+    beginInfo.renderArea.extent = {atlasSize, atlasSize};
+    beginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    beginInfo.pClearValues = clearValues.data();
+    vkCmdBeginRenderPass(commandBuffer, &beginInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+
+    bakePipeline.bind(commandBuffer);
+    model.bind(commandBuffer);
+
+    const float radius = std::max(bounds.radius, 1e-4f);
+    const uint32_t frames = settings.framesPerSide;
+    const float resolution = static_cast<float>(settings.frameResolution);
+    for (uint32_t y = 0; y < frames; y++) {
+      for (uint32_t x = 0; x < frames; x++) {
+        VkViewport viewport{x * resolution, y * resolution, resolution,
+                            resolution, 0.f, 1.f};
+        VkRect2D scissor{
+            {static_cast<int32_t>(x * settings.frameResolution),
+             static_cast<int32_t>(y * settings.frameResolution)},
+            {settings.frameResolution, settings.frameResolution}};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        // orthographic, the sphere exactly fills the frame and its front and
+        // back map to depth 0 and 1
+        glm::vec3 direction = frameDirection(x, y, frames);
+        glm::vec3 up = glm::abs(direction.y) > .999f ? glm::vec3{0.f, 0.f, 1.f}
+                                                     : glm::vec3{0.f, -1.f, 0.f};
+        NreCamera camera{};
+        camera.setViewDirection(bounds.center + direction * radius, -direction,
+                                up);
+        camera.setOrthographicProjection(-radius, radius, -radius, radius, 0.f,
+                                         2.f * radius);
+
+        BakePushConstantData push{};
+        push.transform = camera.getProjection() * camera.getView() *
+                         model.getPositionDequantization();
+        vkCmdPushConstants(commandBuffer, pipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT, 0,
+                           sizeof(BakePushConstantData), &push);
+        model.draw(commandBuffer, 0);
+      }
+    }
+
+    vkCmdEndRenderPass(commandBuffer);
+    nreDevice.endSingleTimeCommands(commandBuffer);
+  }
+
+  vkDestroyPipelineLayout(nreDevice.device(), pipelineLayout, nullptr);
+  vkDestroyFramebuffer(nreDevice.device(), framebuffer, nullptr);
+  vkDestroyRenderPass(nreDevice.device(), renderPass, nullptr);
+  destroyAttachment(nreDevice, depthImage, depthImageMemory, depthImageView);
+}
+
+} // namespace nre
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "nre_device.hpp"
+#include "nre_model.hpp"
+
+// libs
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+
+namespace nre {
+
+struct ImpostorBakeSettings {
+  // views over the upper hemisphere on a hemi-octahedral grid,
+  // framesPerSide * framesPerSide of them
+  uint32_t framesPerSide = 8;
+  // pixels per frame side, also the on screen size below which ImpostorSystem
+  // switches to the impostor
+  uint32_t frameResolution = 128;
+};
+
+// a model pre-rendered from many directions into an atlas, drawn far away as
+// a single quad showing the frame closest to the view direction
+// color atlas: vertex color, alpha = coverage
+// normal/depth atlas: object space normal * .5 + .5, depth along the view
+// direction from the front (0) to the back (1) of the bounding sphere
+class NreImpostor {
+public:
+  static constexpr VkFormat COLOR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+  static constexpr VkFormat NORMAL_DEPTH_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+  // bakes right away, blocks until the GPU is done
+  NreImpostor(NreDevice &device, NreModel &model,
+              const ImpostorBakeSettings &settings = ImpostorBakeSettings{});
+  ~NreImpostor();
+
+  NreImpostor(const NreImpostor &) = delete;
+  NreImpostor &operator=(const NreImpostor &) = delete;
+
+  // object space sphere every frame is fitted to
+  const NreModel::BoundingSphere &getBounds() const { return bounds; }
+  uint32_t getFramesPerSide() const { return settings.framesPerSide; }
+  uint32_t getFrameResolution() const { return settings.frameResolution; }
+
+  VkDescriptorImageInfo colorDescriptorInfo() const;
+  VkDescriptorImageInfo normalDepthDescriptorInfo() const;
+
+  // unit vector (object space, center towards the viewer) frame x, y was
+  // rendered from, shaders/impostor.vert picks frames the same way
+  static glm::vec3 frameDirection(uint32_t x, uint32_t y,
+                                  uint32_t framesPerSide);
+
+private:
+  void createAtlas();
+  void createSampler();
+  void bake(NreModel &model);
+
+  NreDevice &nreDevice;
+  ImpostorBakeSettings settings;
+  NreModel::BoundingSphere bounds;
+  uint32_t atlasSize;
+
+  VkImage colorImage;
+  VkDeviceMemory colorImageMemory;
+  VkImageView colorImageView;
+  VkImage normalDepthImage;
+  VkDeviceMemory normalDepthImageMemory;
+  VkImageView normalDepthImageView;
+  VkSampler sampler;
+};
+
+} // namespace nre
@@ -0,0 +1,134 @@
+#include "nre_ktx2.hpp"
+
+#include "nre_texture.hpp"
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace nre {
+
+namespace {
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K',  'T',  'X', ' ',  '2',
+                                     '0',  0xBB, '\r', '\n', 0x1A, '\n'};
+
+// everything up to the level index, little endian like every platform this
+// engine runs on
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header has to be packed");
+
+struct Ktx2LevelIndex {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+} // namespace
+
+Ktx2File Ktx2File::open(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open texture: " + path);
+  }
+
+  Ktx2Header header{};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file ||
+      std::memcmp(header.identifier, KTX2_IDENTIFIER,
+                  sizeof(KTX2_IDENTIFIER)) != 0) {
+    throw std::runtime_error("not a KTX2 file: " + path);
+  }
+  if (header.vkFormat == VK_FORMAT_UNDEFINED ||
+      header.supercompressionScheme != 0) {
+    throw std::runtime_error("supercompressed KTX2 isn't supported: " + path);
+  }
+  if (header.pixelWidth == 0 || header.pixelHeight == 0 ||
+      header.pixelDepth > 1 || header.layerCount > 1 ||
+      header.faceCount != 1) {
+    throw std::runtime_error("only 2D KTX2 textures are supported: " + path);
+  }
+  TextureFormatInfo info = TextureFormatInfo::of(
+      static_cast<VkFormat>(header.vkFormat));
+  if (info.blockBytes == 0) {
+    throw std::runtime_error("unsupported KTX2 format in " + path);
+  }
+  // never more levels than a full chain down to 1x1
+  uint32_t maxLevels = 1;
+  while ((std::max(header.pixelWidth, header.pixelHeight) >> maxLevels) > 0) {
+    maxLevels++;
+  }
+  if (header.levelCount > maxLevels) {
+    throw std::runtime_error("KTX2 level count doesn't fit the size: " + path);
+  }
+
+  Ktx2File ktx{};
+  ktx.path = path;
+  ktx.format = static_cast<VkFormat>(header.vkFormat);
+  ktx.width = header.pixelWidth;
+  ktx.height = header.pixelHeight;
+
+  // 0 asks the loader to generate mips, there's only the base level then
+  uint32_t levelCount = std::max(header.levelCount, 1u);
+  std::vector<Ktx2LevelIndex> index(levelCount);
+  file.read(reinterpret_cast<char *>(index.data()),
+            sizeof(Ktx2LevelIndex) * levelCount);
+  if (!file) {
+    throw std::runtime_error("truncated KTX2 level index: " + path);
+  }
+  file.seekg(0, std::ios::end);
+  const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+
+  // the loaders copy whole levels into the image, so every level has to hold
+  // at least that many bytes and lie within the file
+  for (uint32_t i = 0; i < levelCount; i++) {
+    Level level{};
+    level.offset = index[i].byteOffset;
+    level.size = index[i].byteLength;
+    level.width = std::max(ktx.width >> i, 1u);
+    level.height = std::max(ktx.height >> i, 1u);
+    uint64_t required =
+        static_cast<uint64_t>((level.width + info.blockWidth - 1) /
+                              info.blockWidth) *
+        ((level.height + info.blockHeight - 1) / info.blockHeight) *
+        info.blockBytes;
+    if (level.size < required || level.offset > fileSize ||
+        level.size > fileSize - level.offset) {
+      throw std::runtime_error("KTX2 level " + std::to_string(i) +
+                               " is out of bounds: " + path);
+    }
+    ktx.levels.push_back(level);
+  }
+  return ktx;
+}
+
+void Ktx2File::readLevel(uint32_t level, void *dst) const {
+  std::ifstream file{path, std::ios::binary};
+  file.seekg(static_cast<std::streamoff>(levels[level].offset));
+  file.read(static_cast<char *>(dst),
+            static_cast<std::streamsize>(levels[level].size));
+  if (!file) {
+    throw std::runtime_error("failed to read KTX2 level of " + path);
+  }
+}
+
+} // namespace nre
@@ -0,0 +1,41 @@
+#pragma once
+
+// libs
+#include <vulkan/vulkan.h>
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nre {
+
+// a KTX2 container opened for reading, only the header and level index are
+// read up front so single levels can be loaded later on
+// supports what offline texture tools write for this engine: 2D, one layer,
+// one face, no supercompression, vkFormat set (so no Basis Universal)
+struct Ktx2File {
+  struct Level {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+  };
+
+  std::string path;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // level 0 is the full resolution one
+  std::vector<Level> levels;
+
+  // throws std::runtime_error on anything it can't read, and on headers that
+  // don't add up: more levels than the size allows, a format TextureFormatInfo
+  // doesn't know, levels smaller than their size needs or past the file's end
+  static Ktx2File open(const std::string &path);
+
+  // copies the level's bytes to dst, which has room for levels[level].size
+  void readLevel(uint32_t level, void *dst) const;
+};
+
+} // namespace nre
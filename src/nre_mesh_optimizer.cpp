@@ -0,0 +1,480 @@
+#include "nre_mesh_optimizer.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace nre {
+
+namespace {
+
+// simulated FIFO post-transform vertex cache
+class FifoCache {
+public:
+  FifoCache(uint32_t vertexCount, uint32_t cacheSize)
+      : timestamps(vertexCount, 0), cacheSize{cacheSize} {}
+
+  // returns true on a miss
+  bool access(uint32_t vertex) {
+    // a vertex is in the cache if fewer than cacheSize misses happened since
+    // it was last loaded
+    if (timestamps[vertex] != 0 && time - timestamps[vertex] < cacheSize) {
+      return false;
+    }
+    timestamps[vertex] = ++time;
+    return true;
+  }
+
+  void reset() { time += cacheSize + 1; }
+
+private:
+  std::vector<uint32_t> timestamps;
+  uint32_t cacheSize;
+  uint32_t time = 0;
+};
+
+// Forsyth scoring constants, from "Linear-Speed Vertex Cache Optimisation"
+constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+constexpr float CACHE_DECAY_POWER = 1.5f;
+constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float VALENCE_BOOST_SCALE = 2.0f;
+constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+float forsythVertexScore(int cachePosition, uint32_t remainingTriangles) {
+  if (remainingTriangles == 0) {
+    return -1.f;
+  }
+
+  float score = 0.f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // the triangle just drawn, avoid trivially rewarding reuse of its verts
+      score = LAST_TRIANGLE_SCORE;
+    } else {
+      const float scaler = 1.f / (FORSYTH_CACHE_SIZE - 3);
+      score = 1.f - (cachePosition - 3) * scaler;
+      score = std::pow(score, CACHE_DECAY_POWER);
+    }
+  }
+
+  // bonus for vertices with few triangles left, finishes them off
+  float valenceBoost = std::pow(static_cast<float>(remainingTriangles),
+                                -VALENCE_BOOST_POWER);
+  return score + VALENCE_BOOST_SCALE * valenceBoost;
+}
+
+glm::vec3 triangleNormal(const glm::vec3 &a, const glm::vec3 &b,
+                         const glm::vec3 &c) {
+  // not normalized, length is twice the area
+  return glm::cross(b - a, c - a);
+}
+
+} // namespace
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices,
+                                         uint32_t vertexCount,
+                                         uint32_t cacheSize) {
+  VertexCacheStatistics stats{};
+  if (indices.empty()) {
+    return stats;
+  }
+
+  FifoCache cache{vertexCount, cacheSize};
+  std::vector<bool> referenced(vertexCount, false);
+  uint32_t uniqueVertices = 0;
+  for (uint32_t index : indices) {
+    if (cache.access(index)) {
+      stats.vertexTransforms++;
+    }
+    if (!referenced[index]) {
+      referenced[index] = true;
+      uniqueVertices++;
+    }
+  }
+
+  stats.acmr = static_cast<float>(stats.vertexTransforms) /
+               static_cast<float>(indices.size() / 3);
+  stats.atvr = static_cast<float>(stats.vertexTransforms) /
+               static_cast<float>(uniqueVertices);
+  return stats;
+}
+
+OverdrawStatistics analyzeOverdraw(const std::vector<uint32_t> &indices,
+                                   const std::vector<glm::vec3> &positions) {
+  constexpr int RESOLUTION = 256;
+  OverdrawStatistics stats{};
+  if (indices.empty()) {
+    return stats;
+  }
+
+  glm::vec3 minPos{std::numeric_limits<float>::max()};
+  glm::vec3 maxPos{std::numeric_limits<float>::lowest()};
+  for (uint32_t index : indices) {
+    minPos = glm::min(minPos, positions[index]);
+    maxPos = glm::max(maxPos, positions[index]);
+  }
+  glm::vec3 extent = maxPos - minPos;
+  float scale = (RESOLUTION - 1) /
+                std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+
+  std::vector<float> depthBuffer(RESOLUTION * RESOLUTION);
+  std::vector<bool> covered(RESOLUTION * RESOLUTION);
+
+  // 3 axes, looked at from both sides
+  for (int view = 0; view < 6; view++) {
+    int axis = view / 2;
+    bool flip = view % 2 == 1;
+    std::fill(depthBuffer.begin(), depthBuffer.end(), 1.f);
+    std::fill(covered.begin(), covered.end(), false);
+
+    auto project = [&](const glm::vec3 &p) {
+      glm::vec3 n = (p - minPos) * scale;
+      glm::vec3 s{n[(axis + 1) % 3], n[(axis + 2) % 3], n[axis]};
+      if (flip) {
+        s.x = (RESOLUTION - 1) - s.x;
+        s.z = (RESOLUTION - 1) - s.z;
+      }
+      s.z /= RESOLUTION;
+      return s;
+    };
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      glm::vec3 v0 = project(positions[indices[i + 0]]);
+      glm::vec3 v1 = project(positions[indices[i + 1]]);
+      glm::vec3 v2 = project(positions[indices[i + 2]]);
+
+      // counter clockwise (obj convention) triangles facing this view end up
+      // with negative area in screen space, swap them to positive winding
+      float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+      // back facing in this view, or degenerate
+      if (area >= 0.f) {
+        continue;
+      }
+      std::swap(v1, v2);
+      area = -area;
+
+      int minX = std::max(0, static_cast<int>(std::floor(std::min({v0.x, v1.x, v2.x}))));
+      int maxX = std::min(RESOLUTION - 1, static_cast<int>(std::ceil(std::max({v0.x, v1.x, v2.x}))));
+      int minY = std::max(0, static_cast<int>(std::floor(std::min({v0.y, v1.y, v2.y}))));
+      int maxY = std::min(RESOLUTION - 1, static_cast<int>(std::ceil(std::max({v0.y, v1.y, v2.y}))));
+
+      for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+          float px = x + .5f;
+          float py = y + .5f;
+          float w0 = (v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (px - v1.x);
+          float w1 = (v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (px - v2.x);
+          float w2 = (v1.x - v0.x) * (py - v0.y) - (v1.y - v0.y) * (px - v0.x);
+          if (w0 < 0.f || w1 < 0.f || w2 < 0.f) {
+            continue;
+          }
+
+          float depth = (w0 * v0.z + w1 * v1.z + w2 * v2.z) / area;
+          int pixel = y * RESOLUTION + x;
+          // early depth test, only passing fragments get shaded
+          if (depth < depthBuffer[pixel]) {
+            depthBuffer[pixel] = depth;
+            stats.pixelsShaded++;
+            if (!covered[pixel]) {
+              covered[pixel] = true;
+              stats.pixelsCovered++;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  stats.overdraw = stats.pixelsCovered == 0
+                       ? 0.f
+                       : static_cast<float>(stats.pixelsShaded) /
+                             static_cast<float>(stats.pixelsCovered);
+  return stats;
+}
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount) {
+  assert(indices.size() % 3 == 0 && "index count must be a multiple of 3");
+  const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+  if (triangleCount == 0) {
+    return;
+  }
+
+  // vertex -> triangle adjacency
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (uint32_t index : indices) {
+    adjacencyOffsets[index + 1]++;
+  }
+  std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(),
+                   adjacencyOffsets.begin());
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                               adjacencyOffsets.end() - 1);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+      for (int k = 0; k < 3; k++) {
+        adjacency[fill[indices[t * 3 + k]]++] = t;
+      }
+    }
+  }
+
+  std::vector<uint32_t> remainingTriangles(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; v++) {
+    remainingTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+  }
+  std::vector<float> vertexScore(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; v++) {
+    vertexScore[v] = forsythVertexScore(-1, remainingTriangles[v]);
+  }
+
+  std::vector<bool> emitted(triangleCount, false);
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> newCache;
+  cache.reserve(FORSYTH_CACHE_SIZE + 3);
+  newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+  uint32_t nextCandidate = 0; // linear scan cursor when the cache runs dry
+  int64_t bestTriangle = -1;
+
+  for (uint32_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+    if (bestTriangle < 0) {
+      // nothing left adjacent to the cache, restart at the first remaining
+      // triangle in input order, the cursor keeps this linear overall
+      bestTriangle = nextCandidate;
+    }
+    assert(!emitted[bestTriangle]);
+
+    uint32_t tri = static_cast<uint32_t>(bestTriangle);
+    emitted[tri] = true;
+    while (nextCandidate < triangleCount && emitted[nextCandidate]) {
+      nextCandidate++;
+    }
+
+    // move the triangle's vertices to the front of the LRU cache
+    newCache.clear();
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = indices[tri * 3 + k];
+      result.push_back(v);
+      newCache.push_back(v);
+
+      // remove the triangle from the vertex's remaining list
+      uint32_t begin = adjacencyOffsets[v];
+      uint32_t end = begin + remainingTriangles[v];
+      for (uint32_t a = begin; a < end; a++) {
+        if (adjacency[a] == tri) {
+          std::swap(adjacency[a], adjacency[end - 1]);
+          break;
+        }
+      }
+      remainingTriangles[v]--;
+    }
+    for (uint32_t v : cache) {
+      if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+        newCache.push_back(v);
+      }
+    }
+
+    // vertices pushed past the end fall out of the cache
+    for (size_t i = FORSYTH_CACHE_SIZE; i < newCache.size(); i++) {
+      vertexScore[newCache[i]] =
+          forsythVertexScore(-1, remainingTriangles[newCache[i]]);
+    }
+    if (newCache.size() > FORSYTH_CACHE_SIZE) {
+      newCache.resize(FORSYTH_CACHE_SIZE);
+    }
+    for (size_t i = 0; i < newCache.size(); i++) {
+      vertexScore[newCache[i]] =
+          forsythVertexScore(static_cast<int>(i), remainingTriangles[newCache[i]]);
+    }
+    cache.swap(newCache);
+
+    // rescore triangles touching the cache, the next one comes from there
+    bestTriangle = -1;
+    float bestScore = -1.f;
+    for (uint32_t v : cache) {
+      uint32_t begin = adjacencyOffsets[v];
+      uint32_t end = begin + remainingTriangles[v];
+      for (uint32_t a = begin; a < end; a++) {
+        uint32_t t = adjacency[a];
+        float score = vertexScore[indices[t * 3 + 0]] +
+                      vertexScore[indices[t * 3 + 1]] +
+                      vertexScore[indices[t * 3 + 2]];
+        if (score > bestScore) {
+          bestScore = score;
+          bestTriangle = t;
+        }
+      }
+    }
+  }
+
+  indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<uint32_t> &indices,
+                      const std::vector<glm::vec3> &positions,
+                      float threshold) {
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0) {
+    return;
+  }
+  const uint32_t vertexCount = static_cast<uint32_t>(positions.size());
+  constexpr uint32_t CACHE_SIZE = 16;
+
+  // hard boundaries: triangles that miss on all 3 vertices, the cache
+  // optimizer started over there so the order can change freely
+  std::vector<size_t> clusters{0};
+  {
+    FifoCache cache{vertexCount, CACHE_SIZE};
+    for (size_t t = 0; t < triangleCount; t++) {
+      int misses = 0;
+      for (int k = 0; k < 3; k++) {
+        misses += cache.access(indices[t * 3 + k]) ? 1 : 0;
+      }
+      if (misses == 3 && t != 0) {
+        clusters.push_back(t);
+      }
+    }
+  }
+  clusters.push_back(triangleCount);
+
+  // soft boundaries: split hard clusters further wherever the ACMR so far is
+  // already within threshold of the whole cluster's ACMR
+  std::vector<size_t> softClusters{};
+  {
+    FifoCache cache{vertexCount, CACHE_SIZE};
+    for (size_t c = 0; c + 1 < clusters.size(); c++) {
+      size_t begin = clusters[c];
+      size_t end = clusters[c + 1];
+
+      cache.reset();
+      uint32_t clusterMisses = 0;
+      for (size_t i = begin * 3; i < end * 3; i++) {
+        clusterMisses += cache.access(indices[i]) ? 1 : 0;
+      }
+      float clusterAcmr =
+          static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+      softClusters.push_back(begin);
+      cache.reset();
+      uint32_t misses = 0;
+      size_t start = begin;
+      for (size_t t = begin; t < end; t++) {
+        for (int k = 0; k < 3; k++) {
+          misses += cache.access(indices[t * 3 + k]) ? 1 : 0;
+        }
+        float acmr =
+            static_cast<float>(misses) / static_cast<float>(t + 1 - start);
+        if (t + 1 < end && acmr <= clusterAcmr * threshold) {
+          softClusters.push_back(t + 1);
+          start = t + 1;
+          misses = 0;
+          cache.reset();
+        }
+      }
+    }
+    softClusters.push_back(triangleCount);
+  }
+
+  glm::vec3 meshCentroid{0.f};
+  float meshArea = 0.f;
+  for (size_t t = 0; t < triangleCount; t++) {
+    const glm::vec3 &a = positions[indices[t * 3 + 0]];
+    const glm::vec3 &b = positions[indices[t * 3 + 1]];
+    const glm::vec3 &c = positions[indices[t * 3 + 2]];
+    float area = glm::length(triangleNormal(a, b, c));
+    meshCentroid += (a + b + c) * (area / 3.f);
+    meshArea += area;
+  }
+  meshCentroid /= std::max(meshArea, 1e-12f);
+
+  // outward facing clusters first, they are likely to occlude the rest
+  const size_t clusterCount = softClusters.size() - 1;
+  std::vector<float> sortKeys(clusterCount);
+  for (size_t c = 0; c < clusterCount; c++) {
+    glm::vec3 centroid{0.f};
+    glm::vec3 normal{0.f};
+    float area = 0.f;
+    for (size_t t = softClusters[c]; t < softClusters[c + 1]; t++) {
+      const glm::vec3 &a = positions[indices[t * 3 + 0]];
+      const glm::vec3 &b = positions[indices[t * 3 + 1]];
+      const glm::vec3 &v2 = positions[indices[t * 3 + 2]];
+      glm::vec3 n = triangleNormal(a, b, v2);
+      float triangleArea = glm::length(n);
+      centroid += (a + b + v2) * (triangleArea / 3.f);
+      normal += n;
+      area += triangleArea;
+    }
+    centroid /= std::max(area, 1e-12f);
+    float normalLength = glm::length(normal);
+    normal = normalLength > 0.f ? normal / normalLength : glm::vec3{0.f};
+    sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+  }
+
+  std::vector<size_t> order(clusterCount);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sortKeys[a] > sortKeys[b];
+  });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (size_t c : order) {
+    result.insert(result.end(), indices.begin() + softClusters[c] * 3,
+                  indices.begin() + softClusters[c + 1] * 3);
+  }
+  indices.swap(result);
+}
+
+std::vector<uint32_t> optimizeVertexFetchRemap(std::vector<uint32_t> &indices,
+                                               uint32_t &vertexCount) {
+  std::vector<uint32_t> remap(vertexCount, ~0u);
+  uint32_t next = 0;
+  for (uint32_t &index : indices) {
+    if (remap[index] == ~0u) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+  vertexCount = next;
+  return remap;
+}
+
+std::vector<uint32_t> weldPositions(const std::vector<glm::vec3> &positions,
+                                    std::vector<uint32_t> &representatives) {
+  struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const {
+      // + 0 turns -0 into +0 so equal positions hash the same
+      glm::vec3 q = p + glm::vec3{0.f};
+      uint32_t bits[3];
+      std::memcpy(bits, &q, sizeof(bits));
+      return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^
+             (bits[2] * 83492791u);
+    }
+  };
+
+  std::vector<uint32_t> canonical(positions.size());
+  representatives.clear();
+  std::unordered_map<glm::vec3, uint32_t, PositionHash> welded{};
+  for (uint32_t v = 0; v < positions.size(); v++) {
+    auto it = welded.find(positions[v]);
+    if (it == welded.end()) {
+      it = welded
+               .emplace(positions[v],
+                        static_cast<uint32_t>(representatives.size()))
+               .first;
+      representatives.push_back(v);
+    }
+    canonical[v] = it->second;
+  }
+  return canonical;
+}
+
+} // namespace nre
@@ -0,0 +1,78 @@
+#pragma once
+
+// libs
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+// import time triangle/vertex reordering for indexed triangle lists
+// none of these change the rendered result, only the order things are fetched
+// and shaded in
+namespace nre {
+
+struct VertexCacheStatistics {
+  uint32_t vertexTransforms = 0; // cache misses == vertex shader invocations
+  float acmr = 0.f; // average cache miss ratio, transforms per triangle (0.5 - 3)
+  float atvr = 0.f; // average transform to vertex ratio, 1 is optimal
+};
+
+struct OverdrawStatistics {
+  uint64_t pixelsCovered = 0;
+  uint64_t pixelsShaded = 0;
+  float overdraw = 0.f; // shaded / covered, 1 is optimal
+};
+
+// simulates a FIFO post-transform cache of cacheSize entries
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices,
+                                         uint32_t vertexCount,
+                                         uint32_t cacheSize = 16);
+
+// rasterizes the mesh in index order with a depth test from the 6 axis
+// directions and counts how many times covered pixels get shaded
+// slow (6 software rasterized 256x256 views), meant for checking the
+// optimizer rather than for every import
+OverdrawStatistics analyzeOverdraw(const std::vector<uint32_t> &indices,
+                                   const std::vector<glm::vec3> &positions);
+
+// Forsyth's linear speed vertex cache optimization, reorders triangles
+void optimizeVertexCache(std::vector<uint32_t> &indices, uint32_t vertexCount);
+
+// splits vertex cache optimized triangles into clusters and sorts the
+// clusters so outward facing ones are drawn first (Sander et al. 2007)
+// threshold bounds how much ACMR may degrade, 1.05 allows 5%
+// run after optimizeVertexCache
+void optimizeOverdraw(std::vector<uint32_t> &indices,
+                      const std::vector<glm::vec3> &positions,
+                      float threshold = 1.05f);
+
+// returns remap[oldVertex] = newVertex so vertices are stored in the order
+// the index buffer first references them, and rewrites indices accordingly
+// unreferenced vertices get ~0u, the new vertex count is returned in
+// vertexCount
+std::vector<uint32_t> optimizeVertexFetchRemap(std::vector<uint32_t> &indices,
+                                               uint32_t &vertexCount);
+
+// maps every vertex to an id shared by all vertices at the same position, so
+// vertices that only differ in normal/uv/color count as one for topology
+// representatives[id] receives the first vertex with that position
+std::vector<uint32_t> weldPositions(const std::vector<glm::vec3> &positions,
+                                    std::vector<uint32_t> &representatives);
+
+// applies a remap produced by optimizeVertexFetchRemap to any vertex array
+template <typename T>
+void remapVertices(std::vector<T> &vertices, const std::vector<uint32_t> &remap,
+                   uint32_t newVertexCount) {
+  std::vector<T> remapped(newVertexCount);
+  for (size_t i = 0; i < vertices.size(); i++) {
+    if (remap[i] != ~0u) {
+      remapped[remap[i]] = vertices[i];
+    }
+  }
+  vertices.swap(remapped);
+}
+
+} // namespace nre
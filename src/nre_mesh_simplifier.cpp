@@ -0,0 +1,301 @@
+#include "nre_mesh_simplifier.hpp"
+
+#include "nre_mesh_optimizer.hpp"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace nre {
+
+namespace {
+
+// symmetric 4x4 error quadric, only the upper triangle is stored
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+  double weight = 0;
+
+  static Quadric fromPlane(const glm::dvec3 &n, double d, double w) {
+    Quadric q{};
+    q.a00 = w * n.x * n.x;
+    q.a01 = w * n.x * n.y;
+    q.a02 = w * n.x * n.z;
+    q.a03 = w * n.x * d;
+    q.a11 = w * n.y * n.y;
+    q.a12 = w * n.y * n.z;
+    q.a13 = w * n.y * d;
+    q.a22 = w * n.z * n.z;
+    q.a23 = w * n.z * d;
+    q.a33 = w * d * d;
+    q.weight = w;
+    return q;
+  }
+
+  Quadric &operator+=(const Quadric &o) {
+    a00 += o.a00, a01 += o.a01, a02 += o.a02, a03 += o.a03;
+    a11 += o.a11, a12 += o.a12, a13 += o.a13;
+    a22 += o.a22, a23 += o.a23;
+    a33 += o.a33;
+    weight += o.weight;
+    return *this;
+  }
+
+  // squared distance to the accumulated planes, area weighted average
+  double error(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+               a11 * y * y + 2 * a12 * y * z + 2 * a13 * y + a22 * z * z +
+               2 * a23 * z + a33;
+    return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  double error;
+};
+
+} // namespace
+
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices,
+                                   const std::vector<glm::vec3> &positions,
+                                   size_t targetIndexCount, float targetError,
+                                   float *resultError) {
+  if (resultError) {
+    *resultError = 0.f;
+  }
+  if (indices.size() <= targetIndexCount) {
+    return indices;
+  }
+
+  // weld vertices that only differ in attributes, collapses happen on these
+  std::vector<uint32_t> representative{};
+  std::vector<uint32_t> canonical = weldPositions(positions, representative);
+  const size_t weldedCount = representative.size();
+  auto position = [&](uint32_t w) -> const glm::vec3 & {
+    return positions[representative[w]];
+  };
+
+  // collapse forest, remap[w] == w while w is alive
+  std::vector<uint32_t> remap(weldedCount);
+  for (uint32_t w = 0; w < weldedCount; w++) {
+    remap[w] = w;
+  }
+  auto resolve = [&](uint32_t w) {
+    uint32_t root = w;
+    while (remap[root] != root) {
+      root = remap[root];
+    }
+    while (remap[w] != root) {
+      uint32_t next = remap[w];
+      remap[w] = root;
+      w = next;
+    }
+    return root;
+  };
+
+  std::vector<Quadric> quadrics(weldedCount);
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    uint32_t w0 = canonical[indices[i + 0]];
+    uint32_t w1 = canonical[indices[i + 1]];
+    uint32_t w2 = canonical[indices[i + 2]];
+    glm::dvec3 p0{position(w0)};
+    glm::dvec3 p1{position(w1)};
+    glm::dvec3 p2{position(w2)};
+    glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+    double area = glm::length(n);
+    if (area <= 0.0) {
+      continue;
+    }
+    n /= area;
+    Quadric q = Quadric::fromPlane(n, -glm::dot(n, p0), area);
+    quadrics[w0] += q;
+    quadrics[w1] += q;
+    quadrics[w2] += q;
+  }
+
+  // vertices on open or non-manifold edges never move
+  std::vector<bool> locked(weldedCount, false);
+  {
+    std::unordered_map<uint64_t, uint32_t> edgeCounts{};
+    auto edgeKey = [](uint32_t a, uint32_t b) {
+      return a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+    };
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = canonical[indices[i + k]];
+        uint32_t b = canonical[indices[i + (k + 1) % 3]];
+        if (a != b) {
+          edgeCounts[edgeKey(a, b)]++;
+        }
+      }
+    }
+    for (const auto &kv : edgeCounts) {
+      if (kv.second != 2) {
+        locked[kv.first >> 32] = true;
+        locked[kv.first & 0xffffffffu] = true;
+      }
+    }
+  }
+
+  const double maxError = static_cast<double>(targetError) * targetError;
+  const size_t targetTriangles = targetIndexCount / 3;
+  double worstError = 0.0;
+
+  std::vector<uint32_t> live{};
+  std::vector<uint32_t> adjacencyOffsets{};
+  std::vector<uint32_t> adjacency{};
+  std::vector<Collapse> collapses{};
+  std::vector<bool> touched(weldedCount);
+
+  // each pass collapses a batch of independent edges, cheapest first
+  while (true) {
+    live.clear();
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      uint32_t w0 = resolve(canonical[indices[i + 0]]);
+      uint32_t w1 = resolve(canonical[indices[i + 1]]);
+      uint32_t w2 = resolve(canonical[indices[i + 2]]);
+      if (w0 != w1 && w1 != w2 && w0 != w2) {
+        live.insert(live.end(), {w0, w1, w2});
+      }
+    }
+    size_t liveTriangles = live.size() / 3;
+    if (liveTriangles <= targetTriangles) {
+      break;
+    }
+
+    adjacencyOffsets.assign(weldedCount + 1, 0);
+    for (uint32_t w : live) {
+      adjacencyOffsets[w + 1]++;
+    }
+    for (size_t w = 0; w < weldedCount; w++) {
+      adjacencyOffsets[w + 1] += adjacencyOffsets[w];
+    }
+    adjacency.resize(live.size());
+    {
+      std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                                 adjacencyOffsets.end() - 1);
+      for (uint32_t t = 0; t < liveTriangles; t++) {
+        for (int k = 0; k < 3; k++) {
+          adjacency[fill[live[t * 3 + k]]++] = t;
+        }
+      }
+    }
+
+    collapses.clear();
+    for (uint32_t t = 0; t < liveTriangles; t++) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = live[t * 3 + k];
+        uint32_t b = live[t * 3 + (k + 1) % 3];
+        // every interior edge shows up twice, keep one direction
+        if (a > b) {
+          continue;
+        }
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        double costAB = locked[a] ? -1.0 : q.error(position(b));
+        double costBA = locked[b] ? -1.0 : q.error(position(a));
+        if (costAB < 0.0 && costBA < 0.0) {
+          continue;
+        }
+        if (costBA < 0.0 || (costAB >= 0.0 && costAB <= costBA)) {
+          collapses.push_back({a, b, costAB});
+        } else {
+          collapses.push_back({b, a, costBA});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &l, const Collapse &r) {
+                return l.error < r.error;
+              });
+
+    std::fill(touched.begin(), touched.end(), false);
+    size_t removed = 0;
+    size_t performed = 0;
+    for (const Collapse &c : collapses) {
+      if (c.error > maxError || liveTriangles - removed <= targetTriangles) {
+        break;
+      }
+      if (touched[c.from] || touched[c.to]) {
+        continue;
+      }
+
+      // reject collapses that flip or squash a surviving triangle
+      bool valid = true;
+      size_t collapsedTriangles = 0;
+      for (uint32_t a = adjacencyOffsets[c.from];
+           a < adjacencyOffsets[c.from + 1] && valid; a++) {
+        const uint32_t *tri = &live[adjacency[a] * 3];
+        if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+          collapsedTriangles++;
+          continue;
+        }
+        glm::vec3 before[3];
+        glm::vec3 after[3];
+        for (int k = 0; k < 3; k++) {
+          before[k] = position(tri[k]);
+          after[k] = tri[k] == c.from ? position(c.to) : before[k];
+        }
+        glm::vec3 nBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 nAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        float lengthBefore = glm::length(nBefore);
+        float lengthAfter = glm::length(nAfter);
+        if (lengthAfter <= 1e-12f ||
+            glm::dot(nBefore, nAfter) < .25f * lengthBefore * lengthAfter) {
+          valid = false;
+        }
+      }
+      if (!valid) {
+        continue;
+      }
+
+      remap[c.from] = c.to;
+      quadrics[c.to] += quadrics[c.from];
+      worstError = std::max(worstError, c.error);
+      removed += collapsedTriangles;
+      performed++;
+
+      // the neighbourhood changed, leave it alone for the rest of this pass
+      for (uint32_t a = adjacencyOffsets[c.from]; a < adjacencyOffsets[c.from + 1];
+           a++) {
+        const uint32_t *tri = &live[adjacency[a] * 3];
+        touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+      }
+    }
+
+    if (performed == 0) {
+      break;
+    }
+  }
+
+  // back to original vertex ids, vertices that stayed put keep their own
+  // attributes, moved ones take the attributes of their collapse target
+  std::vector<uint32_t> result{};
+  result.reserve(indices.size());
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    uint32_t tri[3];
+    uint32_t welded[3];
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = indices[i + k];
+      welded[k] = resolve(canonical[v]);
+      tri[k] = welded[k] == canonical[v] ? v : representative[welded[k]];
+    }
+    if (welded[0] != welded[1] && welded[1] != welded[2] &&
+        welded[0] != welded[2]) {
+      result.insert(result.end(), {tri[0], tri[1], tri[2]});
+    }
+  }
+
+  if (resultError) {
+    *resultError = static_cast<float>(std::sqrt(worstError));
+  }
+  return result;
+}
+
+} // namespace nre
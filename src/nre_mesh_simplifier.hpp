@@ -0,0 +1,28 @@
+#pragma once
+
+// libs
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+namespace nre {
+
+// quadric error metric edge collapse (Garland & Heckbert 1997)
+// works on the position welded topology, so uv/normal seams collapse together,
+// and only ever outputs indices into the existing vertex array, which lets
+// every LOD share one vertex buffer
+// open borders are locked so silhouettes of non-closed meshes don't erode
+//
+// stops at targetIndexCount or once the next collapse would move the surface
+// by more than targetError (object space units), whichever comes first
+// resultError receives the largest error actually introduced
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices,
+                                   const std::vector<glm::vec3> &positions,
+                                   size_t targetIndexCount, float targetError,
+                                   float *resultError = nullptr);
+
+} // namespace nre
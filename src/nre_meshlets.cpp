@@ -0,0 +1,244 @@
+#include "nre_meshlets.hpp"
+
+#include "nre_mesh_optimizer.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+namespace nre {
+
+std::vector<MeshletRange> buildMeshlets(std::vector<uint32_t> &indices,
+                                        const std::vector<glm::vec3> &positions,
+                                        uint32_t maxVertices,
+                                        uint32_t maxTriangles) {
+  assert(maxVertices >= 3 && maxTriangles >= 1 && "meshlet limits too small");
+  std::vector<MeshletRange> meshlets{};
+  const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+  if (triangleCount == 0) {
+    return meshlets;
+  }
+
+  // flat shaded meshes share no vertices between faces, so neighbours are
+  // found through positions
+  std::vector<uint32_t> representatives{};
+  std::vector<uint32_t> canonical = weldPositions(positions, representatives);
+  const size_t weldedCount = representatives.size();
+
+  // welded vertex -> triangles using it
+  std::vector<uint32_t> adjacencyOffsets(weldedCount + 1, 0);
+  std::vector<uint32_t> adjacency(triangleCount * 3);
+  for (uint32_t index : indices) {
+    adjacencyOffsets[canonical[index] + 1]++;
+  }
+  for (size_t w = 0; w < weldedCount; w++) {
+    adjacencyOffsets[w + 1] += adjacencyOffsets[w];
+  }
+  {
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                               adjacencyOffsets.end() - 1);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+      for (int k = 0; k < 3; k++) {
+        adjacency[fill[canonical[indices[t * 3 + k]]]++] = t;
+      }
+    }
+  }
+
+  std::vector<glm::vec3> normals(triangleCount);
+  for (uint32_t t = 0; t < triangleCount; t++) {
+    const glm::vec3 &a = positions[indices[t * 3 + 0]];
+    const glm::vec3 &b = positions[indices[t * 3 + 1]];
+    const glm::vec3 &c = positions[indices[t * 3 + 2]];
+    glm::vec3 n = glm::cross(b - a, c - a);
+    float length = glm::length(n);
+    normals[t] = length > 0.f ? n / length : glm::vec3{0.f};
+  }
+
+  // last meshlet a vertex / welded vertex was added to
+  std::vector<uint32_t> vertexMeshlet(positions.size(), ~0u);
+  std::vector<uint32_t> weldedMeshlet(weldedCount, ~0u);
+  std::vector<bool> emitted(triangleCount, false);
+
+  std::vector<uint32_t> result{};
+  result.reserve(indices.size());
+  std::vector<uint32_t> meshletWelded{};
+  uint32_t cursor = 0;
+
+  while (true) {
+    while (cursor < triangleCount && emitted[cursor]) {
+      cursor++;
+    }
+    if (cursor == triangleCount) {
+      break;
+    }
+
+    const uint32_t meshletId = static_cast<uint32_t>(meshlets.size());
+    MeshletRange meshlet{};
+    meshlet.firstIndex = static_cast<uint32_t>(result.size());
+    meshletWelded.clear();
+    glm::vec3 normalSum{0.f};
+    uint32_t triangles = 0;
+
+    uint32_t next = cursor;
+    while (next != ~0u) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = indices[next * 3 + k];
+        if (vertexMeshlet[v] != meshletId) {
+          vertexMeshlet[v] = meshletId;
+          meshlet.vertexCount++;
+        }
+        uint32_t w = canonical[v];
+        if (weldedMeshlet[w] != meshletId) {
+          weldedMeshlet[w] = meshletId;
+          meshletWelded.push_back(w);
+        }
+        result.push_back(v);
+      }
+      emitted[next] = true;
+      normalSum += normals[next];
+      if (++triangles == maxTriangles) {
+        break;
+      }
+
+      // fewest new vertices first, then the one closest to the average
+      // normal so the normal cone stays tight
+      float normalLength = glm::length(normalSum);
+      glm::vec3 axis =
+          normalLength > 0.f ? normalSum / normalLength : glm::vec3{0.f};
+      float bestScore = std::numeric_limits<float>::max();
+      next = ~0u;
+      for (uint32_t w : meshletWelded) {
+        for (uint32_t a = adjacencyOffsets[w]; a < adjacencyOffsets[w + 1];
+             a++) {
+          uint32_t t = adjacency[a];
+          if (emitted[t]) {
+            continue;
+          }
+          uint32_t newVertices = 0;
+          for (int k = 0; k < 3; k++) {
+            newVertices += vertexMeshlet[indices[t * 3 + k]] != meshletId;
+          }
+          if (meshlet.vertexCount + newVertices > maxVertices) {
+            continue;
+          }
+          // the normal term is in [0, 1] and only breaks ties
+          float score = 2.f * newVertices +
+                        .5f * (1.f - glm::dot(normals[t], axis));
+          if (score < bestScore) {
+            bestScore = score;
+            next = t;
+          }
+        }
+      }
+    }
+
+    meshlet.indexCount =
+        static_cast<uint32_t>(result.size()) - meshlet.firstIndex;
+    meshlets.push_back(meshlet);
+  }
+
+  indices.swap(result);
+  return meshlets;
+}
+
+bool isClosedMesh(const std::vector<uint32_t> &indices,
+                  const std::vector<glm::vec3> &positions) {
+  std::vector<uint32_t> representatives{};
+  std::vector<uint32_t> canonical = weldPositions(positions, representatives);
+
+  // directed edges, a closed consistently wound surface has every edge once
+  // in each direction
+  std::unordered_map<uint64_t, int32_t> edges{};
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    for (int k = 0; k < 3; k++) {
+      uint32_t a = canonical[indices[i + k]];
+      uint32_t b = canonical[indices[i + (k + 1) % 3]];
+      if (a == b) {
+        continue;
+      }
+      uint64_t key = a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+      edges[key] += a < b ? 1 : -1;
+    }
+  }
+  for (const auto &kv : edges) {
+    if (kv.second != 0) {
+      return false;
+    }
+  }
+  return !edges.empty();
+}
+
+MeshletBounds computeMeshletBounds(const uint32_t *indices, size_t indexCount,
+                                   const std::vector<glm::vec3> &positions) {
+  MeshletBounds bounds{};
+  if (indexCount < 3) {
+    return bounds;
+  }
+
+  glm::vec3 minPos = positions[indices[0]];
+  glm::vec3 maxPos = positions[indices[0]];
+  for (size_t i = 1; i < indexCount; i++) {
+    minPos = glm::min(minPos, positions[indices[i]]);
+    maxPos = glm::max(maxPos, positions[indices[i]]);
+  }
+  bounds.center = (minPos + maxPos) * .5f;
+  for (size_t i = 0; i < indexCount; i++) {
+    bounds.radius = std::max(
+        bounds.radius, glm::length(positions[indices[i]] - bounds.center));
+  }
+
+  std::vector<glm::vec3> normals{};
+  normals.reserve(indexCount / 3);
+  glm::vec3 normalSum{0.f};
+  for (size_t i = 0; i + 2 < indexCount; i += 3) {
+    const glm::vec3 &a = positions[indices[i + 0]];
+    const glm::vec3 &b = positions[indices[i + 1]];
+    const glm::vec3 &c = positions[indices[i + 2]];
+    glm::vec3 n = glm::cross(b - a, c - a);
+    float length = glm::length(n);
+    if (length > 0.f) {
+      normals.push_back(n / length);
+      normalSum += n / length;
+    }
+  }
+  float axisLength = glm::length(normalSum);
+  if (normals.empty() || axisLength <= 0.f) {
+    return bounds;
+  }
+  glm::vec3 axis = normalSum / axisLength;
+
+  float minDot = 1.f;
+  for (const glm::vec3 &n : normals) {
+    minDot = std::min(minDot, glm::dot(axis, n));
+  }
+  // wider than ~85 degrees, the cone test would almost never pass
+  if (minDot <= .1f) {
+    return bounds;
+  }
+
+  // move the apex back along the axis until every triangle plane is in front
+  // of it, then the cone test is conservative for the whole meshlet
+  float maxT = 0.f;
+  size_t n = 0;
+  for (size_t i = 0; i + 2 < indexCount; i += 3) {
+    const glm::vec3 &a = positions[indices[i + 0]];
+    const glm::vec3 &b = positions[indices[i + 1]];
+    const glm::vec3 &c = positions[indices[i + 2]];
+    if (glm::length(glm::cross(b - a, c - a)) <= 0.f) {
+      continue;
+    }
+    const glm::vec3 &normal = normals[n++];
+    float t = glm::dot(bounds.center - a, normal) / glm::dot(axis, normal);
+    maxT = std::max(maxT, t);
+  }
+
+  bounds.coneApex = bounds.center - axis * maxT;
+  bounds.coneAxis = axis;
+  bounds.coneCutoff = std::sqrt(1.f - minDot * minDot);
+  return bounds;
+}
+
+} // namespace nre
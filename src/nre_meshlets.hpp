@@ -0,0 +1,52 @@
+#pragma once
+
+// libs
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <vector>
+
+// partitions indexed triangle lists into small clusters (meshlets) that can be
+// culled on their own, each meshlet is a contiguous range of the index buffer
+namespace nre {
+
+struct MeshletRange {
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+  uint32_t vertexCount = 0; // unique vertices referenced
+};
+
+struct MeshletBounds {
+  glm::vec3 center{};
+  float radius = 0.f;
+  // the meshlet is entirely backfacing for every viewer with
+  // dot(normalize(coneApex - viewer), coneAxis) >= coneCutoff
+  // coneCutoff > 1 when the normals are too spread out to ever cull
+  glm::vec3 coneApex{};
+  glm::vec3 coneAxis{0.f, 0.f, 1.f};
+  float coneCutoff = 2.f;
+};
+
+// greedily grows meshlets over shared vertices, preferring triangles that add
+// the fewest new vertices and face the same way as the meshlet so far
+// reorders the triangles of indices in place so every meshlet is contiguous
+// run after optimizeVertexCache, meshlets are seeded in index order
+std::vector<MeshletRange> buildMeshlets(std::vector<uint32_t> &indices,
+                                        const std::vector<glm::vec3> &positions,
+                                        uint32_t maxVertices = 64,
+                                        uint32_t maxTriangles = 124);
+
+// true if every edge (by position) is walked as often in one direction as in
+// the other, ie: the surface has no holes or open borders
+// only then are back faces always hidden behind front faces, which is what
+// makes cone culling safe for pipelines that don't cull back faces
+bool isClosedMesh(const std::vector<uint32_t> &indices,
+                  const std::vector<glm::vec3> &positions);
+
+MeshletBounds computeMeshletBounds(const uint32_t *indices, size_t indexCount,
+                                   const std::vector<glm::vec3> &positions);
+
+} // namespace nre
@@ -1,5 +1,8 @@
 #include "nre_model.hpp"
 
+#include "nre_mesh_optimizer.hpp"
+#include "nre_meshlets.hpp"
+#include "nre_mesh_simplifier.hpp"
 #include "nre_utils.hpp"
 
 // libs
@@ -7,10 +10,14 @@
 #include <tiny_obj_loader.h>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
 
 // std
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <unordered_map>
 
 #ifndef ENGINE_DIR
@@ -29,151 +36,638 @@ template <> struct hash<nre::NreModel::Vertex> {
 } // namespace std
 
 namespace nre {
+
+namespace {
+// octahedral normal encoding, maps the unit sphere onto the [-1, 1] square
+glm::vec2 octEncode(glm::vec3 n) {
+  float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+  if (l1 == 0.f) {
+    return glm::vec2{0.f};
+  }
+  n /= l1;
+  if (n.z >= 0.f) {
+    return {n.x, n.y};
+  }
+  return {(1.f - glm::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f),
+          (1.f - glm::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f)};
+}
+
+std::vector<glm::vec3> positionsOf(const std::vector<NreModel::Vertex> &vertices) {
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    positions[i] = vertices[i].position;
+  }
+  return positions;
+}
+
+// a builder without submeshes is one submesh over all of its indices
+std::vector<NreModel::Submesh>
+submeshesOrWhole(const NreModel::Builder &builder) {
+  if (!builder.submeshes.empty()) {
+    return builder.submeshes;
+  }
+  NreModel::Submesh whole{};
+  whole.indexCount = static_cast<uint32_t>(builder.indices.size());
+  return {whole};
+}
+
+// runs fn on one submesh at a time with its vertices renumbered to 0..n-1, so
+// per vertex work in the mesh optimizer scales with the submesh instead of
+// the whole mesh
+// fn may reorder the local indices but not add or remove any
+template <typename Fn>
+void forEachSubmesh(std::vector<uint32_t> &indices,
+                    const std::vector<NreModel::Submesh> &submeshes,
+                    const std::vector<glm::vec3> &positions, Fn &&fn) {
+  std::vector<uint32_t> localIds(positions.size(), ~0u);
+  std::vector<uint32_t> globalIds{};
+  std::vector<uint32_t> localIndices{};
+  std::vector<glm::vec3> localPositions{};
+  for (const auto &submesh : submeshes) {
+    globalIds.clear();
+    localIndices.clear();
+    localPositions.clear();
+    for (uint32_t i = 0; i < submesh.indexCount; i++) {
+      uint32_t v = indices[submesh.firstIndex + i];
+      if (localIds[v] == ~0u) {
+        localIds[v] = static_cast<uint32_t>(globalIds.size());
+        globalIds.push_back(v);
+        localPositions.push_back(positions[v]);
+      }
+      localIndices.push_back(localIds[v]);
+    }
+
+    fn(submesh, localIndices, localPositions);
+    assert(localIndices.size() == submesh.indexCount &&
+           "submesh pass changed the index count");
+
+    for (uint32_t i = 0; i < submesh.indexCount; i++) {
+      indices[submesh.firstIndex + i] = globalIds[localIndices[i]];
+    }
+    for (uint32_t v : globalIds) {
+      localIds[v] = ~0u;
+    }
+  }
+}
+
+// simplifyMesh on the triangles of one submesh, renumbered like in
+// forEachSubmesh so the per vertex state scales with the submesh
+// localIds has one ~0u per vertex and is left that way
+std::vector<uint32_t> simplifySubmesh(const uint32_t *indices,
+                                      size_t indexCount,
+                                      const std::vector<glm::vec3> &positions,
+                                      std::vector<uint32_t> &localIds,
+                                      size_t targetIndexCount,
+                                      float targetError, float *resultError) {
+  std::vector<uint32_t> globalIds{};
+  std::vector<uint32_t> localIndices{};
+  std::vector<glm::vec3> localPositions{};
+  for (size_t i = 0; i < indexCount; i++) {
+    uint32_t v = indices[i];
+    if (localIds[v] == ~0u) {
+      localIds[v] = static_cast<uint32_t>(globalIds.size());
+      globalIds.push_back(v);
+      localPositions.push_back(positions[v]);
+    }
+    localIndices.push_back(localIds[v]);
+  }
+  for (uint32_t v : globalIds) {
+    localIds[v] = ~0u;
+  }
+
+  std::vector<uint32_t> simplified =
+      simplifyMesh(localIndices, localPositions, targetIndexCount,
+                   targetError, resultError);
+  optimizeVertexCache(simplified,
+                      static_cast<uint32_t>(localPositions.size()));
+  for (uint32_t &index : simplified) {
+    index = globalIds[index];
+  }
+  return simplified;
+}
+} // namespace
+
 NreModel::NreModel(NreDevice &device, const NreModel::Builder &builder)
-    : nreDevice{device} {
+    : nreDevice{device}, vertexFormat{builder.format} {
   createVertexBuffers(builder.vertices);
   createIndexBuffers(builder.indices);
+
+  createMeshletBuffer(builder.meshlets);
+
+  boundingSphere = builder.computeBoundingSphere();
+  closed = builder.closed;
+  importStats = builder.stats;
+  lods = builder.lods;
+  if (lods.empty()) {
+    lods.push_back({0, indexCount, 0.f});
+  }
+  submeshes = builder.submeshes;
+  if (submeshes.empty()) {
+    submeshes.push_back({0, lods[0].indexCount, -1, boundingSphere, 0,
+                         static_cast<uint32_t>(builder.meshlets.size())});
+  }
+  lodSubmeshes = builder.lodSubmeshes;
+  // levels made without generateLods are a single range each
+  if (lodSubmeshes.empty() && submeshes.size() == 1) {
+    for (uint32_t lod = 1; lod < getLodCount(); lod++) {
+      Submesh level = submeshes[0];
+      level.firstIndex = lods[lod].firstIndex;
+      level.indexCount = lods[lod].indexCount;
+      lodSubmeshes.push_back(level);
+    }
+  }
+  assert(lodSubmeshes.size() == (lods.size() - 1) * submeshes.size() &&
+         "every coarser level needs one range per submesh");
+  materials = builder.materials;
+  for (const auto &submesh : submeshes) {
+    singleMaterial =
+        singleMaterial && submesh.materialId == submeshes[0].materialId;
+  }
+}
+
+void NreModel::assignMaterials(NreBindlessTable &bindlessTable,
+                               NreTextureCache *textures) {
+  assert(materialSlots.empty() && "materials already assigned");
+
+  // one upload for every texture of the model
+  std::vector<std::string> texturePaths;
+  for (const auto &material : materials) {
+    if (!material.diffuseTexture.empty()) {
+      texturePaths.push_back(material.diffuseTexture);
+    }
+  }
+  std::vector<uint32_t> loadedSlots;
+  if (textures != nullptr && !texturePaths.empty()) {
+    loadedSlots = textures->loadAll(texturePaths);
+  }
+  for (uint32_t slot : loadedSlots) {
+    if (slot != GpuMaterial::NO_TEXTURE &&
+        std::find(textureSlots.begin(), textureSlots.end(), slot) ==
+            textureSlots.end()) {
+      textureSlots.push_back(slot);
+    }
+  }
+
+  size_t texture = 0;
+  for (const auto &material : materials) {
+    GpuMaterial gpuMaterial{};
+    gpuMaterial.baseColorFactor = glm::vec4{material.diffuse, material.opacity};
+    gpuMaterial.specular = glm::vec4{material.specular, material.shininess};
+    gpuMaterial.emission = glm::vec4{material.emission, 0.f};
+    if (!material.diffuseTexture.empty()) {
+      if (texture < loadedSlots.size()) {
+        gpuMaterial.baseColorTexture = loadedSlots[texture];
+        gpuMaterial.baseColorUvTransform =
+            textures->getUvTransform(material.diffuseTexture);
+      }
+      texture++;
+    }
+    materialSlots.push_back(bindlessTable.addMaterial(gpuMaterial));
+  }
+}
+
+uint32_t NreModel::getSubmeshMaterial(uint32_t submesh,
+                                      uint32_t fallback) const {
+  int materialId = submeshes[submesh].materialId;
+  if (materialId < 0 || materialId >= static_cast<int>(materialSlots.size())) {
+    return fallback;
+  }
+  return materialSlots[materialId];
+}
+
+const NreModel::Submesh &NreModel::getSubmesh(uint32_t submesh,
+                                              uint32_t lod) const {
+  lod = std::min(lod, getLodCount() - 1);
+  if (lod == 0) {
+    return submeshes[submesh];
+  }
+  return lodSubmeshes[(lod - 1) * submeshes.size() + submesh];
 }
 
 NreModel::~NreModel() {}
 
 std::unique_ptr<NreModel>
 NreModel::createModelFromFile(NreDevice &device, const std::string &filepath) {
+  return createModelFromFile(device, filepath, ImportOptions{});
+}
+
+std::unique_ptr<NreModel>
+NreModel::createModelFromFile(NreDevice &device, const std::string &filepath,
+                              const VertexFormat &format) {
+  ImportOptions options{};
+  options.format = format;
+  return createModelFromFile(device, filepath, options);
+}
+
+std::unique_ptr<NreModel>
+NreModel::createModelFromFile(NreDevice &device, const std::string &filepath,
+                              const ImportOptions &options) {
   Builder builder{};
+  builder.format = options.format;
   builder.loadModel(ENGINE_DIR + filepath);
-  std::cout << "vertex count: " << builder.vertices.size() << "\n";
+  if (options.optimize) {
+    builder.optimize(options.analyzeOverdraw);
+  }
+  if (options.meshlets) {
+    builder.buildMeshlets(options.meshletMaxVertices,
+                          options.meshletMaxTriangles);
+  }
+  builder.generateLods(options.lodCount, options.lodReduction,
+                       options.lodMaxError);
+  std::cout << "vertex count: " << builder.vertices.size() << " ("
+            << options.format.vertexSize() << " bytes each)\n";
+  if (options.keepMeshData) {
+    return createWithMeshData(device, std::move(builder));
+  }
   return std::make_unique<NreModel>(device, builder);
 }
 
+std::unique_ptr<NreModel> NreModel::createWithMeshData(NreDevice &device,
+                                                       Builder &&builder) {
+  auto model = std::make_unique<NreModel>(device, builder);
+  model->meshData = std::make_shared<const Builder>(std::move(builder));
+  return model;
+}
+
 void NreModel::createVertexBuffers(const std::vector<Vertex> &vertices) {
   vertexCount = static_cast<uint32_t>(vertices.size());
   assert(vertexCount >= 3 && "Vertex count must be at least 3");
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount;
-  uint32_t vertexSize = sizeof(vertices[0]);
+  std::vector<std::vector<uint8_t>> streams = encodeVertices(vertices);
+
+  vertexBuffers.clear();
+  for (uint32_t stream = 0; stream < streams.size(); stream++) {
+    uint32_t vertexSize = vertexFormat.stride(stream);
+    VkDeviceSize bufferSize =
+        static_cast<VkDeviceSize>(vertexSize) * vertexCount;
+
+    NreBuffer stagingBuffer{
+        nreDevice,
+        vertexSize,
+        vertexCount,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+
+    stagingBuffer.map();
+    stagingBuffer.writeToBuffer((void *)streams[stream].data());
+
+    auto vertexBuffer = std::make_unique<NreBuffer>(
+        nreDevice, vertexSize, vertexCount,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    nreDevice.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer->getBuffer(),
+                         bufferSize);
+    vertexBuffers.push_back(std::move(vertexBuffer));
+  }
+}
+
+void NreModel::createIndexBuffers(const std::vector<uint32_t> &indices) {
+  indexCount = static_cast<uint32_t>(indices.size());
+  hasIndexBuffer = indexCount > 0;
+
+  if (!hasIndexBuffer) {
+    return;
+  }
+
+  // halves index memory for every mesh under 65536 vertices
+  std::vector<uint16_t> indices16{};
+  const void *indexData = indices.data();
+  uint32_t indexSize = sizeof(uint32_t);
+  indexType = VK_INDEX_TYPE_UINT32;
+  if (vertexCount <= std::numeric_limits<uint16_t>::max() + 1u) {
+    indices16.assign(indices.begin(), indices.end());
+    indexData = indices16.data();
+    indexSize = sizeof(uint16_t);
+    indexType = VK_INDEX_TYPE_UINT16;
+  }
+  VkDeviceSize bufferSize = static_cast<VkDeviceSize>(indexSize) * indexCount;
 
   NreBuffer stagingBuffer{
       nreDevice,
-      vertexSize,
-      vertexCount,
+      indexSize,
+      indexCount,
       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
   };
 
   stagingBuffer.map();
-  stagingBuffer.writeToBuffer((void *)vertices.data());
+  stagingBuffer.writeToBuffer(const_cast<void *>(indexData));
 
-  vertexBuffer = std::make_unique<NreBuffer>(
-      nreDevice, vertexSize, vertexCount,
-      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+  indexBuffer = std::make_unique<NreBuffer>(
+      nreDevice, indexSize, indexCount,
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-  // unused because of lines 65 and 66
-  // void *data;
-  // vkMapMemory(nreDevice.device(), stagingBufferMemory, 0, bufferSize, 0,
-  // &data); memcpy(data, vertices.data(), static_cast<size_t>(bufferSize));
-  // vkUnmapMemory(nreDevice.device(), stagingBufferMemory);
-
-  nreDevice.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer->getBuffer(),
+  nreDevice.copyBuffer(stagingBuffer.getBuffer(), indexBuffer->getBuffer(),
                        bufferSize);
 }
 
-void NreModel::createIndexBuffers(const std::vector<uint32_t> &indices) {
-  indexCount = static_cast<uint32_t>(indices.size());
-  hasIndexBuffer = indexCount > 0;
-
-  if (!hasIndexBuffer) {
+void NreModel::createMeshletBuffer(const std::vector<Meshlet> &meshlets) {
+  meshletCount = static_cast<uint32_t>(meshlets.size());
+  if (meshletCount == 0) {
     return;
   }
-
-  VkDeviceSize bufferSize = sizeof(indices[0]) * indexCount;
-  uint32_t indexSize = sizeof(indices[0]);
+  static_assert(sizeof(Meshlet) == 64, "Meshlet has to match the std430 layout");
+  uint32_t meshletSize = sizeof(Meshlet);
+  VkDeviceSize bufferSize = static_cast<VkDeviceSize>(meshletSize) * meshletCount;
 
   NreBuffer stagingBuffer{
       nreDevice,
-      indexSize,
-      indexCount,
+      meshletSize,
+      meshletCount,
       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
   };
 
   stagingBuffer.map();
-  stagingBuffer.writeToBuffer((void *)indices.data());
+  stagingBuffer.writeToBuffer((void *)meshlets.data());
 
-  indexBuffer = std::make_unique<NreBuffer>(
-      nreDevice, indexSize, indexCount,
-      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+  meshletBuffer = std::make_unique<NreBuffer>(
+      nreDevice, meshletSize, meshletCount,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-  nreDevice.copyBuffer(stagingBuffer.getBuffer(), indexBuffer->getBuffer(),
+  nreDevice.copyBuffer(stagingBuffer.getBuffer(), meshletBuffer->getBuffer(),
                        bufferSize);
 }
 
-void NreModel::draw(VkCommandBuffer commandBuffer) {
+void NreModel::draw(VkCommandBuffer commandBuffer) { draw(commandBuffer, 0); }
+
+void NreModel::draw(VkCommandBuffer commandBuffer, uint32_t lod) {
   if (hasIndexBuffer) {
-    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+    const Lod &level = lods[std::min(lod, getLodCount() - 1)];
+    vkCmdDrawIndexed(commandBuffer, level.indexCount, 1, level.firstIndex, 0,
+                     0);
   } else {
     vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
   }
 }
 
+void NreModel::drawSubmesh(VkCommandBuffer commandBuffer, uint32_t submesh) {
+  assert(hasIndexBuffer && "submeshes need an index buffer");
+  const Submesh &range = submeshes[submesh];
+  vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, 0, 0);
+}
+
+void NreModel::drawSubmesh(VkCommandBuffer commandBuffer, uint32_t submesh,
+                           uint32_t lod) {
+  assert(hasIndexBuffer && "submeshes need an index buffer");
+  const Submesh &range = getSubmesh(submesh, lod);
+  if (range.indexCount > 0) {
+    vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, 0,
+                     0);
+  }
+}
+
+void NreModel::drawIndirect(VkCommandBuffer commandBuffer,
+                            const IndirectDraws &draws) {
+  assert(hasIndexBuffer && "indirect draws need an index buffer");
+  const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  if (draws.countBuffer != VK_NULL_HANDLE) {
+    vkCmdDrawIndexedIndirectCount(commandBuffer, draws.drawBuffer,
+                                  draws.drawOffset, draws.countBuffer,
+                                  draws.countOffset, draws.maxDrawCount,
+                                  stride);
+  } else if (nreDevice.supportsMultiDrawIndirect()) {
+    vkCmdDrawIndexedIndirect(commandBuffer, draws.drawBuffer, draws.drawOffset,
+                             draws.maxDrawCount, stride);
+  } else {
+    for (uint32_t i = 0; i < draws.maxDrawCount; i++) {
+      vkCmdDrawIndexedIndirect(commandBuffer, draws.drawBuffer,
+                               draws.drawOffset + i * stride, 1, stride);
+    }
+  }
+}
+
+void NreModel::drawSubmeshIndirect(VkCommandBuffer commandBuffer,
+                                   const IndirectDraws &draws,
+                                   uint32_t submesh) {
+  // the cull shader gives every submesh the draws from its firstMeshlet on and
+  // a count of its own
+  const Submesh &range = submeshes[submesh];
+  IndirectDraws submeshDraws = draws;
+  submeshDraws.drawOffset +=
+      range.firstMeshlet * sizeof(VkDrawIndexedIndirectCommand);
+  submeshDraws.countOffset += submesh * sizeof(uint32_t);
+  submeshDraws.maxDrawCount = range.meshletCount;
+  if (submeshDraws.maxDrawCount > 0) {
+    drawIndirect(commandBuffer, submeshDraws);
+  }
+}
+
 void NreModel::bind(VkCommandBuffer commandBuffer) {
-  VkBuffer buffers[] = {vertexBuffer->getBuffer()};
+  std::array<VkBuffer, VERTEX_SEMANTIC_COUNT> buffers{};
+  std::array<VkDeviceSize, VERTEX_SEMANTIC_COUNT> offsets{};
+  for (size_t i = 0; i < vertexBuffers.size(); i++) {
+    buffers[i] = vertexBuffers[i]->getBuffer();
+  }
+  vkCmdBindVertexBuffers(commandBuffer, 0,
+                         static_cast<uint32_t>(vertexBuffers.size()),
+                         buffers.data(), offsets.data());
+
+  if (hasIndexBuffer) {
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0,
+                         indexType);
+  }
+}
+
+void NreModel::bindPositions(VkCommandBuffer commandBuffer) {
+  uint32_t stream = vertexFormat.layout.bindingOf(VertexSemantic::Position);
+  VkBuffer buffers[] = {vertexBuffers[stream]->getBuffer()};
   VkDeviceSize offsets[] = {0};
   vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
 
   if (hasIndexBuffer) {
     vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0,
-                         VK_INDEX_TYPE_UINT32);
+                         indexType);
   }
 }
 
-// corresponds to a single Vertex Buffer
-// occupies first binding at index 0
+std::vector<std::vector<uint8_t>>
+NreModel::encodeVertices(const std::vector<Vertex> &vertices) {
+  auto attributes = vertexFormat.attributeDescriptionArray();
+
+  // snorm positions are normalized to the mesh bounds, the inverse mapping is
+  // handed to the render systems through positionDequantization
+  glm::vec3 center{0.f};
+  glm::vec3 extent{1.f};
+  positionDequantization = glm::mat4{1.f};
+  if (vertexFormat.position == VertexFormat::Position::Snorm16) {
+    glm::vec3 minPos = vertices[0].position;
+    glm::vec3 maxPos = vertices[0].position;
+    for (const auto &vertex : vertices) {
+      minPos = glm::min(minPos, vertex.position);
+      maxPos = glm::max(maxPos, vertex.position);
+    }
+    center = (minPos + maxPos) * .5f;
+    extent = glm::max((maxPos - minPos) * .5f, glm::vec3{1e-6f});
+
+    positionDequantization[0][0] = extent.x;
+    positionDequantization[1][1] = extent.y;
+    positionDequantization[2][2] = extent.z;
+    positionDequantization[3] = glm::vec4{center, 1.f};
+  }
+
+  std::vector<std::vector<uint8_t>> streams(vertexFormat.streamCount());
+  for (uint32_t stream = 0; stream < streams.size(); stream++) {
+    streams[stream].resize(static_cast<size_t>(vertexFormat.stride(stream)) *
+                           vertices.size());
+  }
+  // start of attribute a for vertex i in its stream
+  auto attributeData = [&](uint32_t a, size_t i) {
+    uint32_t stream = attributes[a].binding;
+    return streams[stream].data() + i * vertexFormat.stride(stream) +
+           attributes[a].offset;
+  };
+
+  for (size_t i = 0; i < vertices.size(); i++) {
+    const Vertex &vertex = vertices[i];
+
+    uint8_t *position = attributeData(0, i);
+    if (vertexFormat.position == VertexFormat::Position::Float32) {
+      std::memcpy(position, &vertex.position, sizeof(glm::vec3));
+    } else if (vertexFormat.position == VertexFormat::Position::Float16) {
+      uint64_t packed = glm::packHalf4x16(glm::vec4{vertex.position, 1.f});
+      std::memcpy(position, &packed, sizeof(packed));
+    } else {
+      uint64_t packed = glm::packSnorm4x16(
+          glm::vec4{(vertex.position - center) / extent, 1.f});
+      std::memcpy(position, &packed, sizeof(packed));
+    }
+
+    uint8_t *color = attributeData(1, i);
+    if (vertexFormat.color == VertexFormat::Color::Float32) {
+      std::memcpy(color, &vertex.color, sizeof(glm::vec3));
+    } else {
+      uint32_t packed = glm::packUnorm4x8(glm::vec4{vertex.color, 1.f});
+      std::memcpy(color, &packed, sizeof(packed));
+    }
+
+    uint8_t *normal = attributeData(2, i);
+    if (vertexFormat.normal == VertexFormat::Normal::Float32) {
+      std::memcpy(normal, &vertex.normal, sizeof(glm::vec3));
+    } else {
+      uint32_t packed = glm::packSnorm2x16(octEncode(vertex.normal));
+      std::memcpy(normal, &packed, sizeof(packed));
+    }
+
+    uint8_t *uv = attributeData(3, i);
+    if (vertexFormat.uv == VertexFormat::Uv::Float32) {
+      std::memcpy(uv, &vertex.uv, sizeof(glm::vec2));
+    } else {
+      uint32_t packed = glm::packHalf2x16(vertex.uv);
+      std::memcpy(uv, &packed, sizeof(packed));
+    }
+  }
+  return streams;
+}
+
+// one binding per stream of the layout
 std::vector<VkVertexInputBindingDescription>
-NreModel::Vertex::getBindingDescriptions() {
-  std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
-  bindingDescriptions[0].binding = 0;
-  bindingDescriptions[0].stride = sizeof(Vertex);
-  bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+NreModel::VertexFormat::getBindingDescriptions() const {
+  std::vector<VkVertexInputBindingDescription> bindingDescriptions(
+      streamCount());
+  for (uint32_t stream = 0; stream < streamCount(); stream++) {
+    bindingDescriptions[stream].binding = stream;
+    bindingDescriptions[stream].stride = stride(stream);
+    bindingDescriptions[stream].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  }
   return bindingDescriptions;
 }
 
+// the shader inputs stay the same for every format since the fixed function
+// fetch expands them to floats
 std::vector<VkVertexInputAttributeDescription>
-NreModel::Vertex::getAttributeDescriptions() {
-  std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+NreModel::VertexFormat::getAttributeDescriptions() const {
+  auto attributes = attributeDescriptionArray();
+  return {attributes.begin(), attributes.end()};
+}
 
-  attributeDescriptions.push_back(
-      {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position)});
-  attributeDescriptions.push_back(
-      {1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color)});
-  attributeDescriptions.push_back(
-      {2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal)});
-  attributeDescriptions.push_back(
-      {3, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv)});
+std::vector<VkVertexInputBindingDescription>
+NreModel::VertexFormat::getPositionBindingDescriptions() const {
+  uint32_t stream = layout.bindingOf(VertexSemantic::Position);
+  return {{0, stride(stream), VK_VERTEX_INPUT_RATE_VERTEX}};
+}
+
+std::vector<VkVertexInputAttributeDescription>
+NreModel::VertexFormat::getPositionAttributeDescriptions() const {
+  auto position = attributeDescriptionArray()[0];
+  position.binding = 0;
+  return {position};
+}
+
+std::vector<VkVertexInputBindingDescription>
+NreModel::Vertex::getBindingDescriptions() {
+  return VertexFormat{}.getBindingDescriptions();
+}
 
-  return attributeDescriptions;
+std::vector<VkVertexInputAttributeDescription>
+NreModel::Vertex::getAttributeDescriptions() {
+  return VertexFormat{}.getAttributeDescriptions();
 }
 
 // stores results of reading .obj
 void NreModel::Builder::loadModel(const std::string &filepath) {
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
+  std::vector<tinyobj::material_t> objMaterials;
   std::string warn, err;
 
-  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-                        filepath.c_str())) {
+  // MTL files are looked up next to the OBJ
+  size_t slash = filepath.find_last_of("/\\");
+  std::string baseDir =
+      slash == std::string::npos ? "" : filepath.substr(0, slash + 1);
+  if (!tinyobj::LoadObj(&attrib, &shapes, &objMaterials, &warn, &err,
+                        filepath.c_str(), baseDir.c_str())) {
     throw std::runtime_error(warn + err);
   }
 
+  materials.clear();
+  for (const auto &objMaterial : objMaterials) {
+    Material material{};
+    material.name = objMaterial.name;
+    material.diffuse = {objMaterial.diffuse[0], objMaterial.diffuse[1],
+                        objMaterial.diffuse[2]};
+    material.opacity = objMaterial.dissolve;
+    material.specular = {objMaterial.specular[0], objMaterial.specular[1],
+                         objMaterial.specular[2]};
+    material.shininess = objMaterial.shininess;
+    material.emission = {objMaterial.emission[0], objMaterial.emission[1],
+                         objMaterial.emission[2]};
+    if (!objMaterial.diffuse_texname.empty()) {
+      material.diffuseTexture = baseDir + objMaterial.diffuse_texname;
+    }
+    materials.push_back(material);
+  }
+
   vertices.clear();
   indices.clear();
+  submeshes.clear();
 
   std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-  for (const auto shape : shapes) {
-    for (const auto &index : shape.mesh.indices) {
+  for (const auto &shape : shapes) {
+    for (size_t i = 0; i < shape.mesh.indices.size(); i++) {
+      const auto &index = shape.mesh.indices[i];
+
+      // a new submesh per shape and wherever the material changes, faces are
+      // triangulated by LoadObj so face i / 3 owns index i
+      size_t face = i / 3;
+      if (i % 3 == 0) {
+        int materialId = face < shape.mesh.material_ids.size()
+                             ? shape.mesh.material_ids[face]
+                             : -1;
+        if (i == 0 || submeshes.back().materialId != materialId) {
+          Submesh submesh{};
+          submesh.firstIndex = static_cast<uint32_t>(indices.size());
+          submesh.materialId = materialId;
+          submeshes.push_back(submesh);
+        }
+      }
+
       Vertex vertex{};
 
       // vertex index: first value of the face element that says which position
@@ -204,8 +698,8 @@ void NreModel::Builder::loadModel(const std::string &filepath) {
       // uv's are onky two components
       if (index.texcoord_index >= 0) {
         vertex.uv = {
-            attrib.texcoords[2 * index.normal_index + 0],
-            attrib.texcoords[2 * index.normal_index + 1],
+            attrib.texcoords[2 * index.texcoord_index + 0],
+            attrib.texcoords[2 * index.texcoord_index + 1],
         };
       }
 
@@ -216,6 +710,221 @@ void NreModel::Builder::loadModel(const std::string &filepath) {
       indices.push_back(uniqueVertices[vertex]);
     }
   }
+
+  for (size_t s = 0; s < submeshes.size(); s++) {
+    Submesh &submesh = submeshes[s];
+    uint32_t end = s + 1 < submeshes.size()
+                       ? submeshes[s + 1].firstIndex
+                       : static_cast<uint32_t>(indices.size());
+    submesh.indexCount = end - submesh.firstIndex;
+
+    glm::vec3 minPos = vertices[indices[submesh.firstIndex]].position;
+    glm::vec3 maxPos = minPos;
+    for (uint32_t i = submesh.firstIndex; i < end; i++) {
+      minPos = glm::min(minPos, vertices[indices[i]].position);
+      maxPos = glm::max(maxPos, vertices[indices[i]].position);
+    }
+    submesh.bounds.center = (minPos + maxPos) * .5f;
+    for (uint32_t i = submesh.firstIndex; i < end; i++) {
+      submesh.bounds.radius =
+          glm::max(submesh.bounds.radius,
+                   glm::length(vertices[indices[i]].position -
+                               submesh.bounds.center));
+    }
+  }
+}
+
+void NreModel::Builder::optimize(bool analyzeOverdraw) {
+  if (indices.empty()) {
+    return;
+  }
+
+  uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+  std::vector<glm::vec3> positions = positionsOf(vertices);
+
+  auto cacheBefore = analyzeVertexCache(indices, vertexCount);
+  OverdrawStatistics overdrawBefore{};
+  if (analyzeOverdraw) {
+    overdrawBefore = nre::analyzeOverdraw(indices, positions);
+  }
+
+  // triangles never leave their submesh
+  forEachSubmesh(indices, submeshesOrWhole(*this), positions,
+                 [](const Submesh &, std::vector<uint32_t> &local,
+                    const std::vector<glm::vec3> &localPositions) {
+                   optimizeVertexCache(
+                       local, static_cast<uint32_t>(localPositions.size()));
+                   optimizeOverdraw(local, localPositions);
+                 });
+
+  auto cacheAfter = analyzeVertexCache(indices, vertexCount);
+  OverdrawStatistics overdrawAfter{};
+  if (analyzeOverdraw) {
+    overdrawAfter = nre::analyzeOverdraw(indices, positions);
+  }
+
+  // last, only renames vertices so the stats above are unaffected
+  auto remap = optimizeVertexFetchRemap(indices, vertexCount);
+  remapVertices(vertices, remap, vertexCount);
+
+  stats.cacheBefore = cacheBefore;
+  stats.cacheAfter = cacheAfter;
+  stats.overdrawBefore = overdrawBefore;
+  stats.overdrawAfter = overdrawAfter;
+}
+
+void NreModel::Builder::buildMeshlets(uint32_t maxVertices,
+                                      uint32_t maxTriangles) {
+  assert(lods.empty() && "build meshlets before generating lods");
+  meshlets.clear();
+  if (indices.empty()) {
+    return;
+  }
+
+  std::vector<glm::vec3> positions = positionsOf(vertices);
+  closed = isClosedMesh(indices, positions);
+
+  // meshlets never straddle submeshes, so each one gets a contiguous run
+  std::vector<MeshletRange> ranges{};
+  std::vector<uint32_t> rangeSubmeshes{};
+  uint32_t submeshIndex = 0;
+  forEachSubmesh(indices, submeshesOrWhole(*this), positions,
+                 [&](const Submesh &submesh, std::vector<uint32_t> &local,
+                     const std::vector<glm::vec3> &localPositions) {
+                   auto submeshRanges = nre::buildMeshlets(
+                       local, localPositions, maxVertices, maxTriangles);
+                   for (auto &range : submeshRanges) {
+                     range.firstIndex += submesh.firstIndex;
+                     ranges.push_back(range);
+                     rangeSubmeshes.push_back(submeshIndex);
+                   }
+                   submeshIndex++;
+                 });
+  for (auto &submesh : submeshes) {
+    submesh.meshletCount = 0;
+  }
+  meshlets.reserve(ranges.size());
+  size_t vertexReferences = 0;
+  for (size_t r = 0; r < ranges.size(); r++) {
+    const MeshletRange &range = ranges[r];
+    uint32_t submesh = rangeSubmeshes[r];
+    if (!submeshes.empty()) {
+      if (submeshes[submesh].meshletCount == 0) {
+        submeshes[submesh].firstMeshlet = static_cast<uint32_t>(r);
+      }
+      submeshes[submesh].meshletCount++;
+    }
+    MeshletBounds bounds = computeMeshletBounds(
+        indices.data() + range.firstIndex, range.indexCount, positions);
+    Meshlet meshlet{};
+    meshlet.center = bounds.center;
+    meshlet.radius = bounds.radius;
+    meshlet.coneApex = bounds.coneApex;
+    meshlet.coneCutoff = bounds.coneCutoff;
+    meshlet.coneAxis = bounds.coneAxis;
+    meshlet.firstIndex = range.firstIndex;
+    meshlet.indexCount = range.indexCount;
+    meshlet.submesh = submesh;
+    meshlet.submeshFirstMeshlet =
+        submeshes.empty() ? 0 : submeshes[submesh].firstMeshlet;
+    meshlets.push_back(meshlet);
+    vertexReferences += range.vertexCount;
+  }
+
+  stats.meshletVertices = vertexReferences;
+}
+
+void NreModel::Builder::generateLods(uint32_t lodCount, float reduction,
+                                     float maxError) {
+  lods.clear();
+  lodSubmeshes.clear();
+  if (indices.empty()) {
+    return;
+  }
+  lods.push_back({0, static_cast<uint32_t>(indices.size()), 0.f});
+
+  std::vector<glm::vec3> positions = positionsOf(vertices);
+  std::vector<uint32_t> localIds(positions.size(), ~0u);
+  const float errorLimit = maxError * computeBoundingSphere().radius;
+  const std::vector<Submesh> fullLevel = submeshesOrWhole(*this);
+
+  // every level simplifies the previous one, errors add up along the chain
+  // submeshes are simplified apart, the borders between them are open to the
+  // simplifier and stay locked, so materials never bleed across levels
+  std::vector<std::vector<uint32_t>> previous(fullLevel.size());
+  for (size_t s = 0; s < fullLevel.size(); s++) {
+    const uint32_t *first = indices.data() + fullLevel[s].firstIndex;
+    previous[s].assign(first, first + fullLevel[s].indexCount);
+  }
+  size_t previousSize = indices.size();
+  float previousError = 0.f;
+  for (uint32_t level = 1; level < lodCount; level++) {
+    if (previousError >= errorLimit) {
+      break;
+    }
+    std::vector<std::vector<uint32_t>> simplified(fullLevel.size());
+    size_t simplifiedSize = 0;
+    float levelError = 0.f;
+    for (size_t s = 0; s < fullLevel.size(); s++) {
+      size_t target =
+          static_cast<size_t>(previous[s].size() / 3 * reduction) * 3;
+      float submeshError = 0.f;
+      simplified[s] = simplifySubmesh(
+          previous[s].data(), previous[s].size(), positions, localIds, target,
+          errorLimit - previousError, &submeshError);
+      simplifiedSize += simplified[s].size();
+      levelError = std::max(levelError, submeshError);
+    }
+
+    // not worth a level of its own
+    if (simplifiedSize == 0 || simplifiedSize > previousSize * 9 / 10) {
+      break;
+    }
+
+    Lod lod{};
+    lod.firstIndex = static_cast<uint32_t>(indices.size());
+    lod.indexCount = static_cast<uint32_t>(simplifiedSize);
+    lod.error = previousError + levelError;
+    lods.push_back(lod);
+    for (size_t s = 0; s < fullLevel.size(); s++) {
+      Submesh range = fullLevel[s];
+      range.firstIndex = static_cast<uint32_t>(indices.size());
+      range.indexCount = static_cast<uint32_t>(simplified[s].size());
+      range.firstMeshlet = 0;
+      range.meshletCount = 0;
+      lodSubmeshes.push_back(range);
+      indices.insert(indices.end(), simplified[s].begin(),
+                     simplified[s].end());
+    }
+
+    previous.swap(simplified);
+    previousSize = simplifiedSize;
+    previousError = lod.error;
+  }
+
+  // without submeshes the model makes the coarser ranges itself
+  if (submeshes.empty()) {
+    lodSubmeshes.clear();
+  }
+}
+
+NreModel::BoundingSphere NreModel::Builder::computeBoundingSphere() const {
+  BoundingSphere sphere{};
+  if (vertices.empty()) {
+    return sphere;
+  }
+  glm::vec3 minPos = vertices[0].position;
+  glm::vec3 maxPos = vertices[0].position;
+  for (const auto &vertex : vertices) {
+    minPos = glm::min(minPos, vertex.position);
+    maxPos = glm::max(maxPos, vertex.position);
+  }
+  sphere.center = (minPos + maxPos) * .5f;
+  for (const auto &vertex : vertices) {
+    sphere.radius =
+        glm::max(sphere.radius, glm::length(vertex.position - sphere.center));
+  }
+  return sphere;
 }
 
-} // namespace nre
\ No newline at end of file
+} // namespace nre
@@ -1,14 +1,20 @@
 #pragma once
 
 #include "nre_device.hpp"
+#include "nre_bindless.hpp"
 #include "nre_buffer.hpp"
+#include "nre_mesh_optimizer.hpp"
+#include "nre_texture.hpp"
+#include "nre_vertex_layout.hpp"
 
 #define GLM_FORCE_RADIANS // no matter the system, GLM expects radians
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 
 // std
+#include <array>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace nre
@@ -18,6 +24,162 @@ namespace nre
     class NreModel
     {
     public:
+        // per-attribute storage formats for the uploaded vertex buffer
+        // the CPU side always works with full precision Vertex data, quantization
+        // only happens when the buffer is created
+        struct VertexFormat
+        {
+            enum class Position : uint8_t
+            {
+                Float32,
+                Float16, // RGBA16_SFLOAT, stored as is
+                Snorm16  // RGBA16_SNORM, normalized to the mesh bounds
+            };
+            enum class Normal : uint8_t
+            {
+                Float32,
+                Octahedral16 // RG16_SNORM, decoded in the vertex shader
+            };
+            enum class Color : uint8_t
+            {
+                Float32,
+                Unorm8 // RGBA8_UNORM
+            };
+            enum class Uv : uint8_t
+            {
+                Float32,
+                Float16 // RG16_SFLOAT
+            };
+
+            Position position = Position::Float32;
+            Normal normal = Normal::Float32;
+            Color color = Color::Float32;
+            Uv uv = Uv::Float32;
+
+            // which vertex buffer every attribute is stored in
+            VertexLayoutInfo layout = InterleavedLayout::info();
+
+            // 20 bytes per vertex instead of 44
+            static constexpr VertexFormat compact()
+            {
+                VertexFormat format{};
+                format.position = Position::Snorm16;
+                format.normal = Normal::Octahedral16;
+                format.color = Color::Unorm8;
+                format.uv = Uv::Float16;
+                return format;
+            }
+
+            // same formats with the attributes split into the streams of Layout
+            // ie: VertexFormat::compact().withLayout<PositionSplitLayout>()
+            template <typename Layout>
+            constexpr VertexFormat withLayout() const
+            {
+                VertexFormat format = *this;
+                format.layout = Layout::info();
+                return format;
+            }
+
+            constexpr uint32_t attributeSize(VertexSemantic semantic) const
+            {
+                switch (semantic)
+                {
+                case VertexSemantic::Position:
+                    return position == Position::Float32 ? 12 : 8;
+                case VertexSemantic::Color:
+                    return color == Color::Float32 ? 12 : 4;
+                case VertexSemantic::Normal:
+                    return normal == Normal::Float32 ? 12 : 4;
+                case VertexSemantic::Uv:
+                    return uv == Uv::Float32 ? 8 : 4;
+                }
+                return 0;
+            }
+
+            constexpr VkFormat attributeFormat(VertexSemantic semantic) const
+            {
+                switch (semantic)
+                {
+                case VertexSemantic::Position:
+                    if (position == Position::Float16)
+                        return VK_FORMAT_R16G16B16A16_SFLOAT;
+                    if (position == Position::Snorm16)
+                        return VK_FORMAT_R16G16B16A16_SNORM;
+                    return VK_FORMAT_R32G32B32_SFLOAT;
+                case VertexSemantic::Color:
+                    return color == Color::Float32 ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R8G8B8A8_UNORM;
+                case VertexSemantic::Normal:
+                    return normal == Normal::Float32 ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R16G16_SNORM;
+                case VertexSemantic::Uv:
+                    return uv == Uv::Float32 ? VK_FORMAT_R32G32_SFLOAT : VK_FORMAT_R16G16_SFLOAT;
+                }
+                return VK_FORMAT_UNDEFINED;
+            }
+
+            constexpr uint32_t streamCount() const { return layout.streamCount; }
+
+            // bytes per vertex in one stream
+            constexpr uint32_t stride(uint32_t stream) const
+            {
+                uint32_t size = 0;
+                for (uint32_t i = 0; i < VERTEX_SEMANTIC_COUNT; i++)
+                {
+                    auto semantic = static_cast<VertexSemantic>(i);
+                    if (layout.bindingOf(semantic) == stream)
+                        size += attributeSize(semantic);
+                }
+                return size;
+            }
+
+            // bytes per vertex over all streams
+            constexpr uint32_t vertexSize() const
+            {
+                uint32_t size = 0;
+                for (uint32_t i = 0; i < VERTEX_SEMANTIC_COUNT; i++)
+                    size += attributeSize(static_cast<VertexSemantic>(i));
+                return size;
+            }
+
+            // unique per combination, used to look up pipelines per format
+            constexpr uint32_t key() const
+            {
+                return static_cast<uint32_t>(position) |
+                       static_cast<uint32_t>(normal) << 4 |
+                       static_cast<uint32_t>(color) << 8 |
+                       static_cast<uint32_t>(uv) << 12 |
+                       layout.key() << 16;
+            }
+
+            // attribute i is at location i, tightly packed in location order inside its stream
+            // usable at compile time: constexpr auto attributes = format.attributeDescriptionArray();
+            constexpr std::array<VkVertexInputAttributeDescription, VERTEX_SEMANTIC_COUNT> attributeDescriptionArray() const
+            {
+                std::array<VkVertexInputAttributeDescription, VERTEX_SEMANTIC_COUNT> attributes{};
+                std::array<uint32_t, VERTEX_SEMANTIC_COUNT> streamOffsets{};
+                for (uint32_t i = 0; i < VERTEX_SEMANTIC_COUNT; i++)
+                {
+                    auto semantic = static_cast<VertexSemantic>(i);
+                    uint32_t binding = layout.bindingOf(semantic);
+                    attributes[i].location = i;
+                    attributes[i].binding = binding;
+                    attributes[i].format = attributeFormat(semantic);
+                    attributes[i].offset = streamOffsets[binding];
+                    streamOffsets[binding] += attributeSize(semantic);
+                }
+                return attributes;
+            }
+
+            std::vector<VkVertexInputBindingDescription> getBindingDescriptions() const;
+            std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() const;
+
+            // just the position stream at binding 0, for depth only / shadow pipelines
+            // paired with NreModel::bindPositions
+            std::vector<VkVertexInputBindingDescription> getPositionBindingDescriptions() const;
+            std::vector<VkVertexInputAttributeDescription> getPositionAttributeDescriptions() const;
+
+            constexpr bool operator==(const VertexFormat &other) const { return key() == other.key(); }
+        };
+
         struct Vertex
         {
             glm::vec3 position;
@@ -36,12 +198,159 @@ namespace nre
             }
         };
 
+        struct BoundingSphere
+        {
+            glm::vec3 center{};
+            float radius = 0.f;
+        };
+
+        // a level of detail is a range of the shared index buffer
+        struct Lod
+        {
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+            // how far (object space) the surface may be from the full mesh
+            float error = 0.f;
+        };
+
+        // what an OBJ's MTL file says about a material, packed into a GpuMaterial by
+        // assignMaterials
+        struct Material
+        {
+            std::string name;
+            glm::vec3 diffuse{1.f};  // Kd
+            float opacity = 1.f;     // d
+            glm::vec3 specular{0.f}; // Ks
+            float shininess = 0.f;   // Ns
+            glm::vec3 emission{0.f}; // Ke
+            // map_Kd, relative to the MTL file, empty without one
+            std::string diffuseTexture;
+        };
+
+        // one OBJ shape (split further where the material changes), a range of the
+        // full detail level so parts of composite models can be culled on their own
+        struct Submesh
+        {
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+            // index into the model's materials, -1 without one
+            int materialId = -1;
+            BoundingSphere bounds{};
+            // the submesh's meshlets, contiguous since meshlets never straddle submeshes
+            uint32_t firstMeshlet = 0;
+            uint32_t meshletCount = 0;
+        };
+
+        // one cluster of the full detail mesh, matches Meshlet in shaders/meshlet_cull.comp
+        // 64 bytes, std430 layout
+        struct Meshlet
+        {
+            glm::vec3 center{};
+            float radius = 0.f;
+            // backfacing for every viewer with dot(normalize(coneApex - viewer), coneAxis) >= coneCutoff
+            glm::vec3 coneApex{};
+            float coneCutoff = 2.f;
+            glm::vec3 coneAxis{};
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+            // the submesh it belongs to and that submesh's firstMeshlet, so the cull shader
+            // can keep the draws of every submesh (and so every material) apart
+            uint32_t submesh = 0;
+            uint32_t submeshFirstMeshlet = 0;
+            uint32_t padding = 0;
+        };
+
+        // indirect draws written on the GPU, see MeshletCullSystem
+        struct IndirectDraws
+        {
+            VkBuffer drawBuffer = VK_NULL_HANDLE;
+            VkDeviceSize drawOffset = 0;
+            // null when the draw count isn't known on the CPU side, then all
+            // maxDrawCount commands are issued and culled ones have indexCount 0
+            VkBuffer countBuffer = VK_NULL_HANDLE;
+            // the first submesh's count, the others follow it
+            VkDeviceSize countOffset = 0;
+            uint32_t maxDrawCount = 0;
+        };
+
+        struct ImportOptions
+        {
+            VertexFormat format{};
+            bool optimize = true;
+            // also report overdraw before and after optimize, rasterizes the mesh from 6 sides
+            // twice, so it's for checking the optimizer, not for every import
+            bool analyzeOverdraw = false;
+            // levels including the full mesh, each one aims for lodReduction of the
+            // previous level's triangles, 1 disables the chain
+            uint32_t lodCount = 5;
+            float lodReduction = .5f;
+            // relative to the bounding sphere radius, the chain stops early
+            // once a level would have to exceed it
+            float lodMaxError = .1f;
+            // split the full detail mesh into meshlets for GPU culling, worth it
+            // for large meshes that fill a good part of the screen
+            bool meshlets = false;
+            uint32_t meshletMaxVertices = 64;
+            uint32_t meshletMaxTriangles = 124;
+            // keep the CPU side mesh after upload, needed to merge the model
+            // into static batches or to pick against its triangles
+            bool keepMeshData = false;
+        };
+
+        // measured while importing, lod and meshlet counts are on the model itself
+        struct ImportStats
+        {
+            // before and after optimize, zero when it didn't run
+            VertexCacheStatistics cacheBefore{};
+            VertexCacheStatistics cacheAfter{};
+            // only with ImportOptions::analyzeOverdraw
+            OverdrawStatistics overdrawBefore{};
+            OverdrawStatistics overdrawAfter{};
+            // summed over all meshlets, divide by the meshlet count for the average
+            size_t meshletVertices = 0;
+        };
+
         struct Builder
         {
             std::vector<Vertex> vertices{};
             std::vector<uint32_t> indices{};
+            VertexFormat format{};
+            // empty means a single level covering all indices
+            std::vector<Lod> lods{};
+            // ranges of the full detail level, optimize and buildMeshlets only
+            // reorder triangles inside a submesh so the ranges stay valid
+            std::vector<Submesh> submeshes{};
+            // the same ranges for every coarser level, submeshes.size() per level in the same
+            // order (level l starts at (l - 1) * submeshes.size()), filled by generateLods
+            std::vector<Submesh> lodSubmeshes{};
+            // ranges of the full detail level, empty when not built
+            std::vector<Meshlet> meshlets{};
+            // parsed from the OBJ's MTL file, indexed by Submesh::materialId
+            std::vector<Material> materials{};
+            // no open borders, meshlet cone culling is only safe then
+            bool closed = false;
+            // filled by optimize and buildMeshlets
+            ImportStats stats{};
 
             void loadModel(const std::string &filepath);
+
+            // reorders triangles for the post-transform cache and overdraw, then
+            // vertices for fetch locality, measures ACMR/ATVR before and after into stats,
+            // overdraw too when analyzeOverdraw is set (see ImportOptions::analyzeOverdraw)
+            // has to run before generateLods
+            void optimize(bool analyzeOverdraw = false);
+
+            // reorders the triangles into meshlets with bounds and normal cones
+            // run after optimize and before generateLods
+            void buildMeshlets(uint32_t maxVertices, uint32_t maxTriangles);
+
+            // simplifies the mesh into up to lodCount levels and appends their
+            // indices after the full mesh, vertices are shared by all levels
+            // submeshes are simplified on their own with their borders locked, so every level
+            // keeps the material ranges (see lodSubmeshes) without cracks between them
+            void generateLods(uint32_t lodCount, float reduction, float maxError);
+
+            BoundingSphere computeBoundingSphere() const;
         };
 
         NreModel(NreDevice &device, const NreModel::Builder &builder);
@@ -51,21 +360,109 @@ namespace nre
         NreModel &operator=(const NreModel &) = delete;
 
         static std::unique_ptr<NreModel> createModelFromFile(NreDevice &device, const std::string &filepath);
+        static std::unique_ptr<NreModel> createModelFromFile(
+            NreDevice &device, const std::string &filepath, const VertexFormat &format);
+        static std::unique_ptr<NreModel> createModelFromFile(
+            NreDevice &device, const std::string &filepath, const ImportOptions &options);
+        // keeps builder as the model's mesh data, see ImportOptions::keepMeshData
+        static std::unique_ptr<NreModel> createWithMeshData(NreDevice &device, Builder &&builder);
 
+        // binds every stream, bindings follow the stream order of the layout
         void bind(VkCommandBuffer commandBuffer);
+        // binds only the stream holding positions to binding 0
+        void bindPositions(VkCommandBuffer commandBuffer);
         void draw(VkCommandBuffer commandBuffer);
+        // lod is clamped to the coarsest available level
+        void draw(VkCommandBuffer commandBuffer, uint32_t lod);
+        // one submesh of the full detail level
+        void drawSubmesh(VkCommandBuffer commandBuffer, uint32_t submesh);
+        // one submesh of a level, lod is clamped like in draw
+        void drawSubmesh(VkCommandBuffer commandBuffer, uint32_t submesh, uint32_t lod);
+        // uses the draw count on the GPU when the device supports it
+        void drawIndirect(VkCommandBuffer commandBuffer, const IndirectDraws &draws);
+        // only the draws of the submesh's meshlets, see Meshlet::submesh
+        void drawSubmeshIndirect(VkCommandBuffer commandBuffer, const IndirectDraws &draws, uint32_t submesh);
+
+        uint32_t getLodCount() const { return static_cast<uint32_t>(lods.size()); }
+        const Lod &getLod(uint32_t lod) const { return lods[lod]; }
+        const BoundingSphere &getBoundingSphere() const { return boundingSphere; }
+
+        // at least one, covering the full detail level
+        uint32_t getSubmeshCount() const { return static_cast<uint32_t>(submeshes.size()); }
+        const Submesh &getSubmesh(uint32_t submesh) const { return submeshes[submesh]; }
+        // same materialId and bounds as the full detail submesh, indexCount may be 0
+        const Submesh &getSubmesh(uint32_t submesh, uint32_t lod) const;
+
+        const std::vector<Material> &getMaterials() const { return materials; }
+        // adds the model's materials to the table, once per model
+        // diffuse textures are loaded through textures in one batch, without a cache (or when
+        // one fails to load) the material is drawn untextured
+        void assignMaterials(NreBindlessTable &bindlessTable, NreTextureCache *textures = nullptr);
+        // the table slot the submesh is shaded with, fallback when it has no material or
+        // assignMaterials wasn't called
+        uint32_t getSubmeshMaterial(uint32_t submesh, uint32_t fallback) const;
+        // bindless slots of the textures the materials sample, for texture streaming
+        const std::vector<uint32_t> &getTextureSlots() const { return textureSlots; }
+        // every submesh uses the same material, so a whole level can be drawn at once
+        bool hasSingleMaterial() const { return singleMaterial; }
+
+        bool hasMeshlets() const { return meshletCount > 0; }
+        uint32_t getMeshletCount() const { return meshletCount; }
+        // storage buffer of Meshlet, null without meshlets
+        NreBuffer *getMeshletBuffer() const { return meshletBuffer.get(); }
+        bool isClosed() const { return closed; }
+
+        // what the import steps measured, the app decides whether to log it
+        const ImportStats &getImportStats() const { return importStats; }
+
+        const VertexFormat &getVertexFormat() const { return vertexFormat; }
+
+        // the builder the model was created from, null unless imported with keepMeshData
+        const Builder *getMeshData() const { return meshData.get(); }
+
+        // maps quantized positions back to object space, identity unless positions are Snorm16
+        // render systems fold this into the model matrix
+        const glm::mat4 &getPositionDequantization() const { return positionDequantization; }
 
     private:
         void createVertexBuffers(const std::vector<Vertex> &vertices);
         void createIndexBuffers(const std::vector<uint32_t> &indices);
+        void createMeshletBuffer(const std::vector<Meshlet> &meshlets);
+
+        // packs vertices into the streams described by vertexFormat, one byte array per stream
+        std::vector<std::vector<uint8_t>> encodeVertices(const std::vector<Vertex> &vertices);
 
         NreDevice &nreDevice;
 
-        std::unique_ptr<NreBuffer> vertexBuffer;
+        VertexFormat vertexFormat;
+        glm::mat4 positionDequantization{1.f};
+
+        // one buffer per stream of vertexFormat.layout
+        std::vector<std::unique_ptr<NreBuffer>> vertexBuffers;
         uint32_t vertexCount;
 
         bool hasIndexBuffer = false;
         std::unique_ptr<NreBuffer> indexBuffer;
         uint32_t indexCount;
+        std::vector<Lod> lods;
+        std::vector<Submesh> submeshes;
+        // see Builder::lodSubmeshes
+        std::vector<Submesh> lodSubmeshes;
+        BoundingSphere boundingSphere;
+
+        std::vector<Material> materials;
+        // bindless table slot per material, empty until assignMaterials
+        std::vector<uint32_t> materialSlots;
+        // loaded ones only, no duplicates
+        std::vector<uint32_t> textureSlots;
+        bool singleMaterial = true;
+
+        std::unique_ptr<NreBuffer> meshletBuffer;
+        uint32_t meshletCount = 0;
+        bool closed = false;
+        ImportStats importStats{};
+        std::shared_ptr<const Builder> meshData;
+        // 16 bit whenever every index fits
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
     };
 } // namespace nre
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "nre_pipeline.hpp"
 #include "nre_device.hpp"
 #include "nre_model.hpp"
+#include "nre_utils.hpp"
 
 // std
 #include <cassert>
@@ -24,6 +25,9 @@ NrePipeline::NrePipeline(NreDevice &device, const std::string &vertFilepath,
   createGraphicsPipeline(vertFilepath, fragFilepath, configInfo);
 }
 
+NrePipeline::NrePipeline(NreDevice &device, VkPipeline pipeline)
+    : nreDevice(device), graphicsPipeline(pipeline) {}
+
 NrePipeline::~NrePipeline() {
   // In Vulkan, anything created must be manually destroyed
   // technically, shader modules can be destroyed right after pipeline creation
@@ -66,8 +70,11 @@ void NrePipeline::createGraphicsPipeline(const std::string &vertFilepath,
   // argument validation
   assert(configInfo.pipelineLayout != VK_NULL_HANDLE &&
          ">> pipeline not created - pipelineLayout not provided in configInfo");
-  assert(configInfo.renderPass != VK_NULL_HANDLE &&
-         ">> pipeline not created - renderPass not provided in configInfo");
+  assert((configInfo.renderPass != VK_NULL_HANDLE ||
+          !configInfo.colorAttachmentFormats.empty() ||
+          configInfo.depthAttachmentFormat != VK_FORMAT_UNDEFINED) &&
+         ">> pipeline not created - neither renderPass nor attachment formats "
+         "provided in configInfo");
 
   // load shader bytecode
   auto vertCode = readFile(vertFilepath);
@@ -93,14 +100,20 @@ void NrePipeline::createGraphicsPipeline(const std::string &vertFilepath,
   shaderStages[0].pNext = nullptr;
 
   // compile-time constants injectable into shaders, null = none
-  shaderStages[0].pSpecializationInfo = nullptr;
+  VkSpecializationInfo vertSpecialization =
+      configInfo.vertSpecialization.info();
+  shaderStages[0].pSpecializationInfo =
+      configInfo.vertSpecialization.empty() ? nullptr : &vertSpecialization;
   shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
   shaderStages[1].module = fragShaderModule;
   shaderStages[1].pName = "main";
   shaderStages[1].flags = 0;
   shaderStages[1].pNext = nullptr;
-  shaderStages[1].pSpecializationInfo = nullptr;
+  VkSpecializationInfo fragSpecialization =
+      configInfo.fragSpecialization.info();
+  shaderStages[1].pSpecializationInfo =
+      configInfo.fragSpecialization.empty() ? nullptr : &fragSpecialization;
 
   auto &bindingDescriptions = configInfo.bindingDescriptions;
   auto &attributeDescriptions = configInfo.attributeDescriptions;
@@ -156,9 +169,21 @@ void NrePipeline::createGraphicsPipeline(const std::string &vertFilepath,
   pipelineInfo.basePipelineIndex = -1;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-  if (vkCreateGraphicsPipelines(nreDevice.device(), VK_NULL_HANDLE, 1,
-                                &pipelineInfo, nullptr,
-                                &graphicsPipeline) != VK_SUCCESS) {
+  // dynamic rendering, no render pass to be compatible with, only formats
+  VkPipelineRenderingCreateInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  renderingInfo.colorAttachmentCount =
+      static_cast<uint32_t>(configInfo.colorAttachmentFormats.size());
+  renderingInfo.pColorAttachmentFormats =
+      configInfo.colorAttachmentFormats.data();
+  renderingInfo.depthAttachmentFormat = configInfo.depthAttachmentFormat;
+  if (configInfo.renderPass == VK_NULL_HANDLE) {
+    pipelineInfo.pNext = &renderingInfo;
+  }
+
+  if (vkCreateGraphicsPipelines(nreDevice.device(),
+                                nreDevice.getPipelineCache(), 1, &pipelineInfo,
+                                nullptr, &graphicsPipeline) != VK_SUCCESS) {
     throw std::runtime_error(">> pipeline not created");
   }
 }
@@ -183,6 +208,62 @@ void NrePipeline::bind(VkCommandBuffer commandBuffer) {
                     graphicsPipeline);
 }
 
+VkSpecializationInfo SpecializationConstants::info() const {
+  VkSpecializationInfo specializationInfo{};
+  specializationInfo.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+  specializationInfo.pMapEntries = mapEntries.data();
+  specializationInfo.dataSize = data.size() * sizeof(uint32_t);
+  specializationInfo.pData = data.data();
+  return specializationInfo;
+}
+
+size_t SpecializationConstants::hash() const {
+  // summed, so it doesn't depend on the order the constants were set in
+  size_t sum = 0;
+  for (size_t i = 0; i < mapEntries.size(); i++) {
+    size_t seed = 0;
+    hashCombine(seed, mapEntries[i].constantID, data[i]);
+    sum += seed;
+  }
+  return sum;
+}
+
+void PipelineRenderTarget::apply(PipelineConfigInfo &configInfo) const {
+  configInfo.renderPass = renderPass;
+  configInfo.subpass = subpass;
+  configInfo.colorAttachmentFormats = colorAttachmentFormats;
+  configInfo.depthAttachmentFormat = depthAttachmentFormat;
+}
+
+void RasterState::apply(VkCommandBuffer commandBuffer) const {
+  vkCmdSetCullMode(commandBuffer, cullMode);
+  vkCmdSetFrontFace(commandBuffer, frontFace);
+  vkCmdSetPrimitiveTopology(commandBuffer, topology);
+  vkCmdSetDepthTestEnable(commandBuffer, depthTestEnable);
+  vkCmdSetDepthWriteEnable(commandBuffer, depthWriteEnable);
+  vkCmdSetDepthCompareOp(commandBuffer, depthCompareOp);
+}
+
+void NrePipeline::enableExtendedDynamicState(PipelineConfigInfo &configInfo) {
+  configInfo.dynamicStateEnables.insert(
+      configInfo.dynamicStateEnables.end(),
+      {VK_DYNAMIC_STATE_CULL_MODE, VK_DYNAMIC_STATE_FRONT_FACE,
+       VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY, VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+       VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP});
+  configInfo.dynamicStateInfo.pDynamicStates =
+      configInfo.dynamicStateEnables.data();
+  configInfo.dynamicStateInfo.dynamicStateCount =
+      static_cast<uint32_t>(configInfo.dynamicStateEnables.size());
+
+  // baked values are ignored now, reset so they don't split cache keys
+  configInfo.rasterizationInfo.cullMode = VK_CULL_MODE_NONE;
+  configInfo.rasterizationInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  configInfo.inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  configInfo.depthStencilInfo.depthTestEnable = VK_TRUE;
+  configInfo.depthStencilInfo.depthWriteEnable = VK_TRUE;
+  configInfo.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+}
+
 void NrePipeline::defaultPipelineConfigInfo(PipelineConfigInfo &configInfo) {
   // draw triangles, no primitve restart
   configInfo.inputAssemblyInfo.sType =
@@ -7,11 +7,53 @@
 #include "nre_device.hpp"
 
 // standard libraries for file paths and dynamic arrays
+#include <cstring>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace nre {
 
+// values for a shader stage's layout(constant_id = N) constants, branches on
+// them are compiled out per variant instead of needing separate shader files
+// every supported type (bool, int, uint, float) is 4 bytes in SPIR-V
+struct SpecializationConstants {
+  std::vector<VkSpecializationMapEntry> mapEntries{};
+  std::vector<uint32_t> data{};
+
+  // replaces the value if the id was already set, bools are stored as VkBool32
+  template <typename T>
+  SpecializationConstants &set(uint32_t constantId, T value) {
+    static_assert(std::is_same<T, bool>::value || sizeof(T) == sizeof(uint32_t),
+                  "specialization constants have to be bool or 4 bytes");
+    uint32_t word;
+    if constexpr (std::is_same<T, bool>::value) {
+      word = value ? VK_TRUE : VK_FALSE;
+    } else {
+      std::memcpy(&word, &value, sizeof(word));
+    }
+
+    for (size_t i = 0; i < mapEntries.size(); i++) {
+      if (mapEntries[i].constantID == constantId) {
+        data[i] = word;
+        return *this;
+      }
+    }
+    mapEntries.push_back({constantId,
+                          static_cast<uint32_t>(data.size() * sizeof(uint32_t)),
+                          sizeof(uint32_t)});
+    data.push_back(word);
+    return *this;
+  }
+
+  bool empty() const { return mapEntries.empty(); }
+  // points into this object
+  VkSpecializationInfo info() const;
+  // order independent, so the same values set in a different order give the
+  // same permutation
+  size_t hash() const;
+};
+
 // PipelineConfigInfo struct: all the settings for pipeline behavior
 struct PipelineConfigInfo {
   PipelineConfigInfo(const PipelineConfigInfo &) = delete;
@@ -60,6 +102,42 @@ struct PipelineConfigInfo {
 
   // which subpass within the render pass
   uint32_t subpass = 0;
+
+  // per stage, so pipelines only differing in fragment constants can share
+  // their vertex stage (see NrePipelineLibrary)
+  SpecializationConstants vertSpecialization{};
+  SpecializationConstants fragSpecialization{};
+
+  // dynamic rendering: when renderPass is left null the pipeline is only tied
+  // to the formats of the attachments it renders into
+  std::vector<VkFormat> colorAttachmentFormats{};
+  VkFormat depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+};
+
+// what a pipeline renders into: a render pass, or with dynamic rendering just
+// the attachment formats, so systems don't need to know which one is in use
+struct PipelineRenderTarget {
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  uint32_t subpass = 0;
+  std::vector<VkFormat> colorAttachmentFormats{};
+  VkFormat depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+
+  void apply(PipelineConfigInfo &configInfo) const;
+};
+
+// the state NrePipeline::enableExtendedDynamicState takes out of the pipeline
+// defaults match defaultPipelineConfigInfo
+struct RasterState {
+  VkCullModeFlags cullMode = VK_CULL_MODE_NONE;
+  VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+  // only within the topology class the pipeline was built with (triangles)
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkBool32 depthTestEnable = VK_TRUE;
+  VkBool32 depthWriteEnable = VK_TRUE;
+  VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+
+  // has to be called after binding such a pipeline, before drawing
+  void apply(VkCommandBuffer commandBuffer) const;
 };
 class NrePipeline {
   // PIPELINE:
@@ -68,6 +146,9 @@ public:
   NrePipeline(NreDevice &device, const std::string &vertFilepath,
               const std::string &fragFilepath,
               const PipelineConfigInfo &configInfo);
+  // takes ownership of a pipeline built elsewhere, eg: linked by
+  // NrePipelineLibrary
+  NrePipeline(NreDevice &device, VkPipeline pipeline);
 
   // cleans up Vulkan objects
   ~NrePipeline();
@@ -84,11 +165,16 @@ public:
 
   // passing by reference avoids copying a big struct
   static void defaultPipelineConfigInfo(PipelineConfigInfo &configInfo);
+  // cull mode, front face, topology and depth test/write/compare become
+  // command buffer state (see RasterState), so pipelines differing only in
+  // those collapse into one, the baked values are reset to the defaults
+  // needs NreDevice::supportsExtendedDynamicState()
+  static void enableExtendedDynamicState(PipelineConfigInfo &configInfo);
 
-private:
-  // reads shader bytcode from disk
+  // reads shader bytcode from disk, relative to ENGINE_DIR
   static std::vector<char> readFile(const std::string &filePath);
 
+private:
   // handles pipeline creation, called by constructor
   void createGraphicsPipeline(const std::string &vertFilepath,
                               const std::string &fragFilepath,
@@ -100,7 +186,7 @@ private:
 
   NreDevice &nreDevice;
   VkPipeline graphicsPipeline;
-  VkShaderModule vertShaderModule;
-  VkShaderModule fragShaderModule;
+  VkShaderModule vertShaderModule = VK_NULL_HANDLE;
+  VkShaderModule fragShaderModule = VK_NULL_HANDLE;
 };
 } // namespace nre
\ No newline at end of file
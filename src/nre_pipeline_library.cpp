@@ -0,0 +1,326 @@
+#include "nre_pipeline_library.hpp"
+
+#include "nre_utils.hpp"
+
+// std
+#include <stdexcept>
+#include <vector>
+
+namespace nre {
+
+namespace {
+
+// field by field, padding bytes of Vulkan structs aren't guaranteed to be zero
+void hashTarget(size_t &seed, const PipelineConfigInfo &config) {
+  hashCombine(seed, reinterpret_cast<uintptr_t>(config.renderPass),
+              config.subpass);
+  for (VkFormat format : config.colorAttachmentFormats) {
+    hashCombine(seed, static_cast<int>(format));
+  }
+  hashCombine(seed, static_cast<int>(config.depthAttachmentFormat));
+  for (VkDynamicState state : config.dynamicStateEnables) {
+    hashCombine(seed, static_cast<int>(state));
+  }
+}
+
+void hashMultisample(size_t &seed, const PipelineConfigInfo &config) {
+  const auto &multisample = config.multisampleInfo;
+  hashCombine(seed, static_cast<int>(multisample.rasterizationSamples),
+              multisample.sampleShadingEnable, multisample.minSampleShading,
+              multisample.alphaToCoverageEnable, multisample.alphaToOneEnable);
+}
+
+} // namespace
+
+NrePipelineLibrary::NrePipelineLibrary(NreDevice &device) : nreDevice{device} {
+  if (!device.supportsGraphicsPipelineLibrary()) {
+    throw std::runtime_error(
+        "pipeline library: device has no graphics pipeline library support");
+  }
+}
+
+NrePipelineLibrary::~NrePipelineLibrary() {
+  for (auto &kv : parts) {
+    vkDestroyPipeline(nreDevice.device(), kv.second, nullptr);
+  }
+}
+
+bool NrePipelineLibrary::hasShaderParts(const std::string &vertFilepath,
+                                        const std::string &fragFilepath,
+                                        const PipelineConfigInfo &configInfo) {
+  std::lock_guard<std::mutex> lock{mutex};
+  for (Part part : {PreRasterization, FragmentShader}) {
+    if (parts.find(partKey(part, vertFilepath, fragFilepath, configInfo)) ==
+        parts.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<NrePipeline>
+NrePipelineLibrary::link(const std::string &vertFilepath,
+                         const std::string &fragFilepath,
+                         const PipelineConfigInfo &configInfo, bool optimize) {
+  VkPipeline libraries[PartCount];
+  for (int part = 0; part < PartCount; part++) {
+    libraries[part] = getPart(static_cast<Part>(part), vertFilepath,
+                              fragFilepath, configInfo);
+  }
+
+  VkPipelineLibraryCreateInfoKHR libraryInfo{};
+  libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+  libraryInfo.libraryCount = PartCount;
+  libraryInfo.pLibraries = libraries;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.pNext = &libraryInfo;
+  pipelineInfo.flags =
+      optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+  pipelineInfo.layout = configInfo.pipelineLayout;
+  pipelineInfo.basePipelineIndex = -1;
+
+  VkPipeline pipeline;
+  if (vkCreateGraphicsPipelines(nreDevice.device(),
+                                nreDevice.getPipelineCache(), 1, &pipelineInfo,
+                                nullptr, &pipeline) != VK_SUCCESS) {
+    throw std::runtime_error("pipeline library: failed to link pipeline");
+  }
+  return std::make_unique<NrePipeline>(nreDevice, pipeline);
+}
+
+size_t NrePipelineLibrary::partKey(Part part, const std::string &vertFilepath,
+                                   const std::string &fragFilepath,
+                                   const PipelineConfigInfo &config) {
+  size_t seed = 0;
+  hashCombine(seed, static_cast<int>(part));
+  switch (part) {
+  case VertexInput: {
+    for (const auto &binding : config.bindingDescriptions) {
+      hashCombine(seed, binding.binding, binding.stride,
+                  static_cast<int>(binding.inputRate));
+    }
+    for (const auto &attribute : config.attributeDescriptions) {
+      hashCombine(seed, attribute.location, attribute.binding,
+                  static_cast<int>(attribute.format), attribute.offset);
+    }
+    const auto &assembly = config.inputAssemblyInfo;
+    hashCombine(seed, static_cast<int>(assembly.topology),
+                assembly.primitiveRestartEnable);
+    for (VkDynamicState state : config.dynamicStateEnables) {
+      hashCombine(seed, static_cast<int>(state));
+    }
+    break;
+  }
+  case PreRasterization: {
+    const auto &raster = config.rasterizationInfo;
+    hashCombine(seed, vertFilepath, config.vertSpecialization.hash(),
+                reinterpret_cast<uintptr_t>(config.pipelineLayout),
+                raster.depthClampEnable, raster.rasterizerDiscardEnable,
+                static_cast<int>(raster.polygonMode), raster.cullMode,
+                static_cast<int>(raster.frontFace), raster.depthBiasEnable,
+                raster.depthBiasConstantFactor, raster.depthBiasClamp,
+                raster.depthBiasSlopeFactor, raster.lineWidth);
+    hashTarget(seed, config);
+    break;
+  }
+  case FragmentShader: {
+    const auto &depth = config.depthStencilInfo;
+    hashCombine(seed, fragFilepath, config.fragSpecialization.hash(),
+                reinterpret_cast<uintptr_t>(config.pipelineLayout),
+                depth.depthTestEnable, depth.depthWriteEnable,
+                static_cast<int>(depth.depthCompareOp),
+                depth.depthBoundsTestEnable, depth.stencilTestEnable);
+    hashMultisample(seed, config);
+    hashTarget(seed, config);
+    break;
+  }
+  case FragmentOutput: {
+    const auto &blend = config.colorBlendInfo;
+    hashCombine(seed, blend.logicOpEnable, static_cast<int>(blend.logicOp),
+                blend.attachmentCount);
+    for (uint32_t i = 0; i < blend.attachmentCount; i++) {
+      const auto &attachment = blend.pAttachments[i];
+      hashCombine(seed, attachment.blendEnable,
+                  static_cast<int>(attachment.srcColorBlendFactor),
+                  static_cast<int>(attachment.dstColorBlendFactor),
+                  static_cast<int>(attachment.colorBlendOp),
+                  static_cast<int>(attachment.srcAlphaBlendFactor),
+                  static_cast<int>(attachment.dstAlphaBlendFactor),
+                  static_cast<int>(attachment.alphaBlendOp),
+                  attachment.colorWriteMask);
+    }
+    hashMultisample(seed, config);
+    hashTarget(seed, config);
+    break;
+  }
+  default:
+    break;
+  }
+  return seed;
+}
+
+VkPipeline NrePipelineLibrary::getPart(Part part,
+                                       const std::string &vertFilepath,
+                                       const std::string &fragFilepath,
+                                       const PipelineConfigInfo &configInfo) {
+  size_t key = partKey(part, vertFilepath, fragFilepath, configInfo);
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = parts.find(key);
+    if (it != parts.end()) {
+      return it->second;
+    }
+  }
+
+  // compiled without the lock so workers building different shaders don't
+  // queue up behind each other, whoever loses a race drops its copy
+  VkPipeline created =
+      createPart(part, vertFilepath, fragFilepath, configInfo);
+  std::lock_guard<std::mutex> lock{mutex};
+  auto inserted = parts.emplace(key, created);
+  if (!inserted.second) {
+    vkDestroyPipeline(nreDevice.device(), created, nullptr);
+  }
+  return inserted.first->second;
+}
+
+VkPipeline NrePipelineLibrary::createPart(Part part,
+                                          const std::string &vertFilepath,
+                                          const std::string &fragFilepath,
+                                          const PipelineConfigInfo &config) {
+  VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+  libraryInfo.sType =
+      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.pNext = &libraryInfo;
+  // retained so the optimized link can still optimize across parts
+  pipelineInfo.flags =
+      VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+      VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+  pipelineInfo.pDynamicState = &config.dynamicStateInfo;
+  pipelineInfo.basePipelineIndex = -1;
+
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+  vertexInputInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputInfo.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(config.bindingDescriptions.size());
+  vertexInputInfo.pVertexBindingDescriptions =
+      config.bindingDescriptions.data();
+  vertexInputInfo.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(config.attributeDescriptions.size());
+  vertexInputInfo.pVertexAttributeDescriptions =
+      config.attributeDescriptions.data();
+
+  // same as NrePipeline, viewport and scissor are dynamic
+  VkPipelineViewportStateCreateInfo viewportInfo{};
+  viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportInfo.viewportCount = 1;
+  viewportInfo.scissorCount = 1;
+
+  // dynamic rendering, every part but vertex input needs the formats
+  VkPipelineRenderingCreateInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  renderingInfo.colorAttachmentCount =
+      static_cast<uint32_t>(config.colorAttachmentFormats.size());
+  renderingInfo.pColorAttachmentFormats = config.colorAttachmentFormats.data();
+  renderingInfo.depthAttachmentFormat = config.depthAttachmentFormat;
+  if (config.renderPass == VK_NULL_HANDLE && part != VertexInput) {
+    libraryInfo.pNext = &renderingInfo;
+  }
+
+  VkShaderModule shaderModule = VK_NULL_HANDLE;
+  VkSpecializationInfo specializationInfo{};
+  VkPipelineShaderStageCreateInfo shaderStage{};
+  shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStage.pName = "main";
+
+  switch (part) {
+  case VertexInput:
+    libraryInfo.flags =
+        VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &config.inputAssemblyInfo;
+    break;
+  case PreRasterization:
+    libraryInfo.flags =
+        VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+    shaderModule = createShaderModule(vertFilepath);
+    shaderStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStage.module = shaderModule;
+    if (!config.vertSpecialization.empty()) {
+      specializationInfo = config.vertSpecialization.info();
+      shaderStage.pSpecializationInfo = &specializationInfo;
+    }
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = &shaderStage;
+    pipelineInfo.pViewportState = &viewportInfo;
+    pipelineInfo.pRasterizationState = &config.rasterizationInfo;
+    pipelineInfo.layout = config.pipelineLayout;
+    pipelineInfo.renderPass = config.renderPass;
+    pipelineInfo.subpass = config.subpass;
+    break;
+  case FragmentShader:
+    libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+    shaderModule = createShaderModule(fragFilepath);
+    shaderStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStage.module = shaderModule;
+    if (!config.fragSpecialization.empty()) {
+      specializationInfo = config.fragSpecialization.info();
+      shaderStage.pSpecializationInfo = &specializationInfo;
+    }
+    pipelineInfo.stageCount = 1;
+    pipelineInfo.pStages = &shaderStage;
+    pipelineInfo.pDepthStencilState = &config.depthStencilInfo;
+    pipelineInfo.pMultisampleState = &config.multisampleInfo;
+    pipelineInfo.layout = config.pipelineLayout;
+    pipelineInfo.renderPass = config.renderPass;
+    pipelineInfo.subpass = config.subpass;
+    break;
+  case FragmentOutput:
+    libraryInfo.flags =
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+    pipelineInfo.pColorBlendState = &config.colorBlendInfo;
+    pipelineInfo.pMultisampleState = &config.multisampleInfo;
+    pipelineInfo.renderPass = config.renderPass;
+    pipelineInfo.subpass = config.subpass;
+    break;
+  default:
+    break;
+  }
+
+  VkPipeline pipeline;
+  VkResult result =
+      vkCreateGraphicsPipelines(nreDevice.device(), nreDevice.getPipelineCache(),
+                                1, &pipelineInfo, nullptr, &pipeline);
+  // the library keeps its own copy of the compiled code
+  vkDestroyShaderModule(nreDevice.device(), shaderModule, nullptr);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("pipeline library: failed to create part");
+  }
+  return pipeline;
+}
+
+VkShaderModule
+NrePipelineLibrary::createShaderModule(const std::string &filepath) {
+  std::vector<char> code = NrePipeline::readFile(filepath);
+
+  VkShaderModuleCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = code.size();
+  createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(nreDevice.device(), &createInfo, nullptr,
+                           &shaderModule) != VK_SUCCESS) {
+    throw std::runtime_error(
+        "pipeline library: failed to create shader module");
+  }
+  return shaderModule;
+}
+
+} // namespace nre
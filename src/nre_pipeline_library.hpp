@@ -0,0 +1,72 @@
+#pragma once
+
+#include "nre_device.hpp"
+#include "nre_pipeline.hpp"
+
+// std
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace nre {
+
+// builds graphics pipelines out of VK_EXT_graphics_pipeline_library parts:
+// vertex input, pre-rasterization (vertex shader), fragment shader and fragment
+// output are each compiled once and cached, a new combination is then only a
+// link of four existing parts
+// only usable when NreDevice::supportsGraphicsPipelineLibrary(), safe to use
+// from several threads
+class NrePipelineLibrary {
+public:
+  explicit NrePipelineLibrary(NreDevice &device);
+  ~NrePipelineLibrary();
+
+  NrePipelineLibrary(const NrePipelineLibrary &) = delete;
+  NrePipelineLibrary &operator=(const NrePipelineLibrary &) = delete;
+
+  // true when both shader parts of this combination are already compiled
+  // the other two parts have no shaders and are cheap to build, so link() on
+  // such a combination takes microseconds
+  bool hasShaderParts(const std::string &vertFilepath,
+                      const std::string &fragFilepath,
+                      const PipelineConfigInfo &configInfo);
+
+  // compiles the missing parts, then links them
+  // a fast link skips cross stage optimization and is meant to be drawn with
+  // right away, an optimized link costs about as much as a full compile
+  std::unique_ptr<NrePipeline> link(const std::string &vertFilepath,
+                                    const std::string &fragFilepath,
+                                    const PipelineConfigInfo &configInfo,
+                                    bool optimize = false);
+
+private:
+  enum Part {
+    VertexInput,
+    PreRasterization,
+    FragmentShader,
+    FragmentOutput,
+    PartCount
+  };
+
+  // hash of the shader (if any) and the config state the part is built from
+  static size_t partKey(Part part, const std::string &vertFilepath,
+                        const std::string &fragFilepath,
+                        const PipelineConfigInfo &configInfo);
+
+  VkPipeline getPart(Part part, const std::string &vertFilepath,
+                     const std::string &fragFilepath,
+                     const PipelineConfigInfo &configInfo);
+  VkPipeline createPart(Part part, const std::string &vertFilepath,
+                        const std::string &fragFilepath,
+                        const PipelineConfigInfo &configInfo);
+  VkShaderModule createShaderModule(const std::string &filepath);
+
+  NreDevice &nreDevice;
+
+  std::mutex mutex;
+  std::unordered_map<size_t, VkPipeline> parts;
+};
+
+} // namespace nre
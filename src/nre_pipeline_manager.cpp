@@ -0,0 +1,333 @@
+#include "nre_pipeline_manager.hpp"
+
+// std
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace nre {
+
+namespace {
+
+// appends value's bytes, only for scalars so no padding ends up in the key
+template <typename T> void appendKey(std::string &key, T value) {
+  static_assert(std::is_scalar<T>::value, "only scalars have no padding");
+  key.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void appendKey(std::string &key, const std::string &value) {
+  appendKey(key, value.size());
+  key.append(value);
+}
+
+// sorted by id, the same values set in a different order give the same key
+void appendKey(std::string &key, const SpecializationConstants &constants) {
+  std::vector<std::pair<uint32_t, uint32_t>> values{};
+  for (size_t i = 0; i < constants.mapEntries.size(); i++) {
+    values.emplace_back(constants.mapEntries[i].constantID, constants.data[i]);
+  }
+  std::sort(values.begin(), values.end());
+  appendKey(key, values.size());
+  for (const auto &value : values) {
+    appendKey(key, value.first);
+    appendKey(key, value.second);
+  }
+}
+
+// every piece of state createGraphicsPipeline reads from the config, field by
+// field since padding bytes of Vulkan structs aren't guaranteed to be zero
+// counts are written before every array so no two configs share a key
+std::string pipelineKey(const std::string &vertFilepath,
+                        const std::string &fragFilepath,
+                        const PipelineConfigInfo &config) {
+  std::string key{};
+  appendKey(key, vertFilepath);
+  appendKey(key, fragFilepath);
+  appendKey(key, config.vertSpecialization);
+  appendKey(key, config.fragSpecialization);
+  appendKey(key, config.bindingDescriptions.size());
+  for (const auto &binding : config.bindingDescriptions) {
+    appendKey(key, binding.binding);
+    appendKey(key, binding.stride);
+    appendKey(key, binding.inputRate);
+  }
+  appendKey(key, config.attributeDescriptions.size());
+  for (const auto &attribute : config.attributeDescriptions) {
+    appendKey(key, attribute.location);
+    appendKey(key, attribute.binding);
+    appendKey(key, attribute.format);
+    appendKey(key, attribute.offset);
+  }
+
+  const auto &assembly = config.inputAssemblyInfo;
+  appendKey(key, assembly.topology);
+  appendKey(key, assembly.primitiveRestartEnable);
+
+  const auto &raster = config.rasterizationInfo;
+  appendKey(key, raster.depthClampEnable);
+  appendKey(key, raster.rasterizerDiscardEnable);
+  appendKey(key, raster.polygonMode);
+  appendKey(key, raster.cullMode);
+  appendKey(key, raster.frontFace);
+  appendKey(key, raster.depthBiasEnable);
+  appendKey(key, raster.depthBiasConstantFactor);
+  appendKey(key, raster.depthBiasClamp);
+  appendKey(key, raster.depthBiasSlopeFactor);
+  appendKey(key, raster.lineWidth);
+
+  const auto &multisample = config.multisampleInfo;
+  appendKey(key, multisample.rasterizationSamples);
+  appendKey(key, multisample.sampleShadingEnable);
+  appendKey(key, multisample.minSampleShading);
+  appendKey(key, multisample.alphaToCoverageEnable);
+  appendKey(key, multisample.alphaToOneEnable);
+
+  const auto &blend = config.colorBlendInfo;
+  appendKey(key, blend.logicOpEnable);
+  appendKey(key, blend.logicOp);
+  appendKey(key, blend.attachmentCount);
+  for (uint32_t i = 0; i < blend.attachmentCount; i++) {
+    const auto &attachment = blend.pAttachments[i];
+    appendKey(key, attachment.blendEnable);
+    appendKey(key, attachment.srcColorBlendFactor);
+    appendKey(key, attachment.dstColorBlendFactor);
+    appendKey(key, attachment.colorBlendOp);
+    appendKey(key, attachment.srcAlphaBlendFactor);
+    appendKey(key, attachment.dstAlphaBlendFactor);
+    appendKey(key, attachment.alphaBlendOp);
+    appendKey(key, attachment.colorWriteMask);
+  }
+
+  const auto &depth = config.depthStencilInfo;
+  appendKey(key, depth.depthTestEnable);
+  appendKey(key, depth.depthWriteEnable);
+  appendKey(key, depth.depthCompareOp);
+  appendKey(key, depth.depthBoundsTestEnable);
+  appendKey(key, depth.stencilTestEnable);
+
+  appendKey(key, config.dynamicStateEnables.size());
+  for (VkDynamicState state : config.dynamicStateEnables) {
+    appendKey(key, state);
+  }
+  appendKey(key, config.pipelineLayout);
+  appendKey(key, config.renderPass);
+  appendKey(key, config.subpass);
+  appendKey(key, config.colorAttachmentFormats.size());
+  for (VkFormat format : config.colorAttachmentFormats) {
+    appendKey(key, format);
+  }
+  appendKey(key, config.depthAttachmentFormat);
+  return key;
+}
+
+} // namespace
+
+NrePipelineManager::NrePipelineManager(NreDevice &device, uint32_t workerCount,
+                                       bool optimizeLinked)
+    : nreDevice{device}, optimizeLinked{optimizeLinked} {
+  if (device.supportsGraphicsPipelineLibrary()) {
+    library = std::make_unique<NrePipelineLibrary>(device);
+  }
+  if (workerCount == 0) {
+    // the render thread keeps a core to itself
+    uint32_t threads = std::thread::hardware_concurrency();
+    workerCount = threads > 1 ? threads - 1 : 1;
+  }
+  for (uint32_t i = 0; i < workerCount; i++) {
+    workers.emplace_back(&NrePipelineManager::workerLoop, this);
+  }
+}
+
+NrePipelineManager::~NrePipelineManager() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+    queue.clear();
+  }
+  workAvailable.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+NrePipelineManager::Handle
+NrePipelineManager::request(const std::string &vertFilepath,
+                            const std::string &fragFilepath,
+                            const PipelineConfigInfo &configInfo) {
+  std::string key = pipelineKey(vertFilepath, fragFilepath, configInfo);
+
+  std::unique_lock<std::mutex> lock{mutex};
+  // the hash only picks the first slot to look at, a different pipeline
+  // hashing the same moves on to the next one
+  Handle handle = std::hash<std::string>{}(key);
+  for (auto it = entries.find(handle); it != entries.end();
+       it = entries.find(++handle)) {
+    if (it->second->key == key) {
+      return handle;
+    }
+  }
+
+  auto entry = std::make_unique<Entry>();
+  entry->key = std::move(key);
+  entry->vertFilepath = vertFilepath;
+  entry->fragFilepath = fragFilepath;
+
+  // PipelineConfigInfo can't be copied as a whole since it points into itself
+  PipelineConfigInfo &config = entry->configInfo;
+  config.bindingDescriptions = configInfo.bindingDescriptions;
+  config.attributeDescriptions = configInfo.attributeDescriptions;
+  config.viewportInfo = configInfo.viewportInfo;
+  config.inputAssemblyInfo = configInfo.inputAssemblyInfo;
+  config.rasterizationInfo = configInfo.rasterizationInfo;
+  config.multisampleInfo = configInfo.multisampleInfo;
+  config.colorBlendAttachment = configInfo.colorBlendAttachment;
+  config.colorBlendInfo = configInfo.colorBlendInfo;
+  config.depthStencilInfo = configInfo.depthStencilInfo;
+  config.dynamicStateEnables = configInfo.dynamicStateEnables;
+  config.dynamicStateInfo = configInfo.dynamicStateInfo;
+  config.pipelineLayout = configInfo.pipelineLayout;
+  config.renderPass = configInfo.renderPass;
+  config.subpass = configInfo.subpass;
+  config.vertSpecialization = configInfo.vertSpecialization;
+  config.fragSpecialization = configInfo.fragSpecialization;
+  config.colorAttachmentFormats = configInfo.colorAttachmentFormats;
+  config.depthAttachmentFormat = configInfo.depthAttachmentFormat;
+
+  entry->blendAttachments.assign(configInfo.colorBlendInfo.pAttachments,
+                                 configInfo.colorBlendInfo.pAttachments +
+                                     configInfo.colorBlendInfo.attachmentCount);
+  config.colorBlendInfo.pAttachments = entry->blendAttachments.data();
+  config.dynamicStateInfo.pDynamicStates = config.dynamicStateEnables.data();
+  config.dynamicStateInfo.dynamicStateCount =
+      static_cast<uint32_t>(config.dynamicStateEnables.size());
+
+  Entry *reserved = entry.get();
+  entries.emplace(handle, std::move(entry));
+
+  // shaders already compiled as library parts, linking is cheap enough to do
+  // right here and only the optimized link is left for the workers
+  // the slot is taken, so requests for the same pipeline return right away
+  // and get() sees nothing yet while the lock is released for the link
+  if (library != nullptr && library->hasShaderParts(vertFilepath, fragFilepath,
+                                                   reserved->configInfo)) {
+    lock.unlock();
+    std::unique_ptr<NrePipeline> linked;
+    std::exception_ptr error;
+    try {
+      linked = library->link(vertFilepath, fragFilepath, reserved->configInfo);
+    } catch (const std::exception &) {
+      // the worker links it again and reports the error
+      error = std::current_exception();
+    }
+    lock.lock();
+    if (!error && !optimizeLinked) {
+      reserved->pipeline = std::move(linked);
+      reserved->done = true;
+      lock.unlock();
+      workDone.notify_all();
+      return handle;
+    }
+    reserved->linked = std::move(linked);
+  }
+
+  queue.push_back(reserved);
+  pending++;
+  lock.unlock();
+  workAvailable.notify_one();
+  return handle;
+}
+
+NrePipeline *NrePipelineManager::get(Handle handle) {
+  std::lock_guard<std::mutex> lock{mutex};
+  auto it = entries.find(handle);
+  if (it == entries.end()) {
+    return nullptr;
+  }
+  // pipeline is only set once done
+  Entry &entry = *it->second;
+  return entry.pipeline != nullptr ? entry.pipeline.get() : entry.linked.get();
+}
+
+NrePipeline *NrePipelineManager::getOr(Handle handle, Handle fallback) {
+  if (NrePipeline *pipeline = get(handle)) {
+    return pipeline;
+  }
+  return get(fallback);
+}
+
+NrePipeline &NrePipelineManager::wait(Handle handle) {
+  std::unique_lock<std::mutex> lock{mutex};
+  auto it = entries.find(handle);
+  if (it == entries.end()) {
+    throw std::runtime_error("pipeline manager: unknown pipeline handle");
+  }
+  Entry &entry = *it->second;
+  workDone.wait(lock, [&]() { return entry.done; });
+  if (entry.error) {
+    std::rethrow_exception(entry.error);
+  }
+  return *entry.pipeline;
+}
+
+uint32_t NrePipelineManager::pendingCount() {
+  std::lock_guard<std::mutex> lock{mutex};
+  return pending;
+}
+
+void NrePipelineManager::workerLoop() {
+  while (true) {
+    Entry *entry = nullptr;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      workAvailable.wait(lock, [&]() { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      entry = queue.front();
+      queue.pop_front();
+    }
+
+    // the entry isn't touched by anyone else until done is set, and the
+    // device's pipeline cache is internally synchronized
+    std::unique_ptr<NrePipeline> pipeline;
+    std::exception_ptr error;
+    try {
+      if (library == nullptr) {
+        pipeline = std::make_unique<NrePipeline>(
+            nreDevice, entry->vertFilepath, entry->fragFilepath,
+            entry->configInfo);
+      } else if (!optimizeLinked) {
+        pipeline = library->link(entry->vertFilepath, entry->fragFilepath,
+                                 entry->configInfo);
+      } else {
+        if (entry->linked == nullptr) {
+          // compiles the parts, drawable as soon as this returns
+          auto linked = library->link(entry->vertFilepath,
+                                      entry->fragFilepath, entry->configInfo);
+          std::lock_guard<std::mutex> lock{mutex};
+          entry->linked = std::move(linked);
+        }
+        pipeline = library->link(entry->vertFilepath, entry->fragFilepath,
+                                 entry->configInfo, true);
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "pipeline manager: " << entry->vertFilepath << " + "
+                << entry->fragFilepath << ": " << e.what() << std::endl;
+      error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      entry->pipeline = std::move(pipeline);
+      entry->error = error;
+      entry->done = true;
+      pending--;
+    }
+    workDone.notify_all();
+  }
+}
+
+} // namespace nre
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "nre_device.hpp"
+#include "nre_pipeline.hpp"
+#include "nre_pipeline_library.hpp"
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace nre {
+
+// compiles graphics pipelines on worker threads so no frame waits on the
+// driver, callers get a handle right away and poll it until the pipeline
+// exists
+// identical requests (same shaders and same config state) share one pipeline
+// with graphics pipeline library support, combinations whose shaders were seen
+// before are fast linked on the spot and optionally swapped for an optimized
+// link once a worker has built it
+class NrePipelineManager {
+public:
+  // hash of the shaders and every pipeline state in the config, the next free
+  // value when another pipeline already hashed the same
+  using Handle = uint64_t;
+
+  // 0 workers picks one less than the hardware threads, at least 1
+  // optimizeLinked only matters with pipeline libraries, without it the fast
+  // linked pipeline is kept for good
+  explicit NrePipelineManager(NreDevice &device, uint32_t workerCount = 0,
+                              bool optimizeLinked = true);
+  // waits for the pipelines being compiled, drops the queued ones
+  ~NrePipelineManager();
+
+  NrePipelineManager(const NrePipelineManager &) = delete;
+  NrePipelineManager &operator=(const NrePipelineManager &) = delete;
+
+  // config is copied, including the blend attachments and dynamic states it
+  // points to, so it can go out of scope right after
+  Handle request(const std::string &vertFilepath,
+                 const std::string &fragFilepath,
+                 const PipelineConfigInfo &configInfo);
+
+  // null until the pipeline is compiled (or fast linked) or when compiling it
+  // failed, never blocks on compilation
+  NrePipeline *get(Handle handle);
+  // handle's pipeline once ready, the fallback's until then (null if neither)
+  // the fallback has to be compatible with whatever is drawn, ie: the same
+  // vertex input and pipeline layout
+  NrePipeline *getOr(Handle handle, Handle fallback);
+  // blocks until the final pipeline is compiled, for load time only
+  // rethrows whatever compiling the pipeline threw
+  NrePipeline &wait(Handle handle);
+
+  uint32_t pendingCount();
+
+private:
+  struct Entry {
+    // every field the handle hashes, to tell apart pipelines hashing the same
+    std::string key;
+    std::string vertFilepath;
+    std::string fragFilepath;
+    PipelineConfigInfo configInfo{};
+    // storage configInfo's pointers refer to
+    std::vector<VkPipelineColorBlendAttachmentState> blendAttachments;
+
+    std::unique_ptr<NrePipeline> pipeline;
+    // fast linked stand in until pipeline exists, kept afterwards since
+    // frames in flight may still use it
+    std::unique_ptr<NrePipeline> linked;
+    std::exception_ptr error;
+    bool done = false;
+  };
+
+  void workerLoop();
+
+  NreDevice &nreDevice;
+  bool optimizeLinked;
+  // null without graphics pipeline library support
+  std::unique_ptr<NrePipelineLibrary> library;
+
+  std::mutex mutex;
+  // signals queued work to the workers and finished work to wait()
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+  std::unordered_map<Handle, std::unique_ptr<Entry>> entries;
+  std::deque<Entry *> queue;
+  uint32_t pending = 0;
+  bool stopping = false;
+
+  std::vector<std::thread> workers;
+};
+
+} // namespace nre
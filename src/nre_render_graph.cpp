@@ -0,0 +1,861 @@
+#include "nre_render_graph.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace nre {
+
+namespace {
+
+struct AccessInfo {
+  VkPipelineStageFlags2 stages;
+  VkAccessFlags2 readAccess;
+  VkAccessFlags2 writeAccess;
+  VkImageLayout layout;
+  VkImageUsageFlags usage;
+};
+
+// stage and access bits all have the same value as their legacy flags, so
+// barriers can fall back to vkCmdPipelineBarrier without synchronization2
+AccessInfo accessInfo(RenderGraphAccess access) {
+  constexpr VkPipelineStageFlags2 fragmentTests =
+      VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+      VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+  switch (access) {
+  case RenderGraphAccess::ColorAttachment:
+    return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT,
+            VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+  case RenderGraphAccess::DepthAttachment:
+    return {fragmentTests, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  case RenderGraphAccess::DepthRead:
+    return {fragmentTests, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  case RenderGraphAccess::InputAttachment:
+    return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+            VK_ACCESS_2_INPUT_ATTACHMENT_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT};
+  case RenderGraphAccess::SampledFragment:
+    return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+            VK_ACCESS_2_SHADER_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_SAMPLED_BIT};
+  case RenderGraphAccess::SampledCompute:
+    return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_SAMPLED_BIT};
+  case RenderGraphAccess::StorageCompute:
+    return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_READ_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+  case RenderGraphAccess::StorageFragment:
+    return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+            VK_ACCESS_2_SHADER_READ_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+  case RenderGraphAccess::UniformRead:
+    return {VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT |
+                VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_UNIFORM_READ_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+  case RenderGraphAccess::VertexInput:
+    return {VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT,
+            VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT,
+            0, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+  case RenderGraphAccess::IndirectRead:
+    return {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_UNDEFINED, 0};
+  case RenderGraphAccess::TransferSrc:
+    return {VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+  case RenderGraphAccess::TransferDst:
+    return {VK_PIPELINE_STAGE_2_TRANSFER_BIT, 0,
+            VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+  }
+  return {};
+}
+
+bool isDepthFormat(VkFormat format) {
+  return format == VK_FORMAT_D32_SFLOAT ||
+         format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+         format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D16_UNORM;
+}
+
+VkImageAspectFlags aspectFor(VkFormat format) {
+  if (!isDepthFormat(format)) {
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+  VkImageAspectFlags aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  if (format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+      format == VK_FORMAT_D24_UNORM_S8_UINT) {
+    aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+  }
+  return aspect;
+}
+
+constexpr VkImageUsageFlags ATTACHMENT_USAGE =
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// every access a pass makes to one resource, folded together
+struct MergedUse {
+  VkPipelineStageFlags2 stages = 0;
+  VkAccessFlags2 access = 0;
+  VkAccessFlags2 writeAccess = 0;
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  bool read = false;
+  bool write = false;
+};
+
+} // namespace
+
+RenderGraphResource
+NreRenderGraph::PassBuilder::createImage(const std::string &name,
+                                         const RenderGraphImageDesc &desc) {
+  Resource resource{};
+  resource.name = name;
+  resource.desc = desc;
+  graph.resources.push_back(resource);
+  return static_cast<RenderGraphResource>(graph.resources.size() - 1);
+}
+
+void NreRenderGraph::PassBuilder::read(RenderGraphResource resource,
+                                       RenderGraphAccess access) {
+  assert(resource < graph.resources.size() && "Unknown resource");
+  assert(accessInfo(access).readAccess != 0 && "Access doesn't read");
+  graph.passes[pass].uses.push_back({resource, access, true, false});
+  graph.resources[resource].usage |= accessInfo(access).usage;
+}
+
+void NreRenderGraph::PassBuilder::write(RenderGraphResource resource,
+                                        RenderGraphAccess access) {
+  assert(resource < graph.resources.size() && "Unknown resource");
+  assert(accessInfo(access).writeAccess != 0 && "Access doesn't write");
+  graph.passes[pass].uses.push_back({resource, access, false, true});
+  graph.resources[resource].usage |= accessInfo(access).usage;
+}
+
+void NreRenderGraph::PassBuilder::colorAttachment(
+    RenderGraphResource resource, VkAttachmentLoadOp loadOp,
+    VkClearColorValue clear, VkAttachmentStoreOp storeOp) {
+  write(resource, RenderGraphAccess::ColorAttachment);
+  if (loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) {
+    read(resource, RenderGraphAccess::ColorAttachment);
+  }
+  Attachment attachment{resource, loadOp, storeOp, {}};
+  attachment.clear.color = clear;
+  graph.passes[pass].colorAttachments.push_back(attachment);
+}
+
+void NreRenderGraph::PassBuilder::depthAttachment(
+    RenderGraphResource resource, VkAttachmentLoadOp loadOp,
+    VkClearDepthStencilValue clear, VkAttachmentStoreOp storeOp) {
+  // depth tests read whatever the load left there
+  write(resource, RenderGraphAccess::DepthAttachment);
+  if (loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) {
+    read(resource, RenderGraphAccess::DepthAttachment);
+  }
+  Pass &target = graph.passes[pass];
+  assert(!target.hasDepthAttachment && "Pass already has a depth attachment");
+  target.hasDepthAttachment = true;
+  target.depthAttachment = {resource, loadOp, storeOp, {}};
+  target.depthAttachment.clear.depthStencil = clear;
+}
+
+void NreRenderGraph::PassBuilder::sideEffects() {
+  graph.passes[pass].sideEffects = true;
+}
+
+NreRenderGraph::NreRenderGraph(NreDevice &device) : nreDevice{device} {}
+
+NreRenderGraph::~NreRenderGraph() {
+  for (auto &kv : frames) {
+    destroyFrameImages(kv.second);
+  }
+}
+
+void NreRenderGraph::reset(int frameIndex) {
+  this->frameIndex = frameIndex;
+  compiled = false;
+  passes.clear();
+  resources.clear();
+  order.clear();
+}
+
+RenderGraphResource
+NreRenderGraph::importImage(const std::string &name,
+                            const RenderGraphImportedImage &image) {
+  Resource resource{};
+  resource.name = name;
+  resource.imported = true;
+  resource.desc = {image.format, image.extent};
+  resource.image = image.image;
+  resource.view = image.view;
+  resource.initialLayout = image.initialLayout;
+  resource.finalLayout = image.finalLayout;
+  resource.initialStages = image.initialStages;
+  resource.initialAccess = image.initialAccess;
+  resources.push_back(resource);
+  return static_cast<RenderGraphResource>(resources.size() - 1);
+}
+
+RenderGraphResource NreRenderGraph::importBuffer(const std::string &name,
+                                                 VkBuffer buffer) {
+  Resource resource{};
+  resource.name = name;
+  resource.isImage = false;
+  resource.imported = true;
+  resource.buffer = buffer;
+  resources.push_back(resource);
+  return static_cast<RenderGraphResource>(resources.size() - 1);
+}
+
+void NreRenderGraph::addPass(const std::string &name,
+                             const SetupFunction &setup,
+                             ExecuteFunction execute) {
+  assert(!compiled && "Passes have to be added before compile");
+  Pass pass{};
+  pass.name = name;
+  pass.execute = std::move(execute);
+  passes.push_back(std::move(pass));
+  PassBuilder builder{*this, static_cast<uint32_t>(passes.size() - 1)};
+  setup(builder);
+
+  const Pass &added = passes.back();
+  if ((!added.colorAttachments.empty() || added.hasDepthAttachment) &&
+      !nreDevice.supportsDynamicRendering()) {
+    throw std::runtime_error("render graph pass " + name +
+                             " has attachments but dynamic rendering isn't "
+                             "supported");
+  }
+}
+
+void NreRenderGraph::compile() {
+  assert(!compiled && "Render graph already compiled");
+  cullPasses();
+  orderPasses();
+  computeLifetimes();
+  createTransientImages();
+  compiled = true;
+}
+
+void NreRenderGraph::cullPasses() {
+  // walks backwards keeping track of which resources still have a reader
+  // waiting on their contents, imported ones are read after the frame
+  std::vector<bool> live(resources.size(), false);
+  for (size_t i = 0; i < resources.size(); i++) {
+    live[i] = resources[i].imported;
+  }
+
+  stats.passes = 0;
+  stats.culledPasses = 0;
+  for (size_t i = passes.size(); i-- > 0;) {
+    Pass &pass = passes[i];
+    bool needed = pass.sideEffects;
+    for (const Use &use : pass.uses) {
+      needed = needed || (use.write && live[use.resource]);
+    }
+    pass.culled = !needed;
+    if (pass.culled) {
+      stats.culledPasses++;
+      continue;
+    }
+    stats.passes++;
+
+    // a write the pass doesn't also read overwrites the resource, whatever
+    // was there before isn't needed anymore
+    for (const Use &use : pass.uses) {
+      if (use.write) {
+        bool alsoRead = std::any_of(
+            pass.uses.begin(), pass.uses.end(), [&](const Use &other) {
+              return other.resource == use.resource && other.read;
+            });
+        if (!alsoRead) {
+          live[use.resource] = false;
+        }
+      }
+    }
+    for (const Use &use : pass.uses) {
+      if (use.read) {
+        live[use.resource] = true;
+      }
+    }
+  }
+}
+
+void NreRenderGraph::orderPasses() {
+  // dependencies between kept passes, in declaration order: reads after
+  // writes, writes after reads and writes after writes
+  std::vector<std::vector<uint32_t>> successors(passes.size());
+  std::vector<uint32_t> dependencies(passes.size(), 0);
+  auto addEdge = [&](uint32_t from, uint32_t to) {
+    if (from == to || std::find(successors[from].begin(),
+                                successors[from].end(),
+                                to) != successors[from].end()) {
+      return;
+    }
+    successors[from].push_back(to);
+    dependencies[to]++;
+  };
+
+  constexpr uint32_t NO_PASS = ~0u;
+  std::vector<uint32_t> lastWriter(resources.size(), NO_PASS);
+  std::vector<std::vector<uint32_t>> readers(resources.size());
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (passes[i].culled) {
+      continue;
+    }
+    for (const Use &use : passes[i].uses) {
+      if (lastWriter[use.resource] != NO_PASS) {
+        addEdge(lastWriter[use.resource], i);
+      }
+      if (use.read) {
+        readers[use.resource].push_back(i);
+      }
+    }
+    for (const Use &use : passes[i].uses) {
+      if (use.write) {
+        for (uint32_t reader : readers[use.resource]) {
+          addEdge(reader, i);
+        }
+        readers[use.resource].clear();
+        lastWriter[use.resource] = i;
+      }
+    }
+  }
+
+  // topological order, declaration order breaks ties
+  // a ready pass that doesn't depend on the one just scheduled goes first, it
+  // puts distance between dependent passes and lets their barriers share a
+  // batch
+  std::vector<uint32_t> ready;
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (!passes[i].culled && dependencies[i] == 0) {
+      ready.push_back(i);
+    }
+  }
+  uint32_t previous = NO_PASS;
+  while (!ready.empty()) {
+    std::sort(ready.begin(), ready.end());
+    auto next = ready.begin();
+    if (previous != NO_PASS) {
+      auto independent =
+          std::find_if(ready.begin(), ready.end(), [&](uint32_t candidate) {
+            return std::find(successors[previous].begin(),
+                             successors[previous].end(),
+                             candidate) == successors[previous].end();
+          });
+      if (independent != ready.end()) {
+        next = independent;
+      }
+    }
+    uint32_t pass = *next;
+    ready.erase(next);
+    order.push_back(pass);
+    for (uint32_t successor : successors[pass]) {
+      if (--dependencies[successor] == 0) {
+        ready.push_back(successor);
+      }
+    }
+    previous = pass;
+  }
+}
+
+void NreRenderGraph::computeLifetimes() {
+  for (uint32_t position = 0; position < order.size(); position++) {
+    for (const Use &use : passes[order[position]].uses) {
+      Resource &resource = resources[use.resource];
+      resource.firstUse = std::min(resource.firstUse, position);
+      resource.lastUse = std::max(resource.lastUse, position);
+    }
+  }
+}
+
+void NreRenderGraph::createTransientImages() {
+  std::vector<RenderGraphResource> transients;
+  std::vector<uint64_t> key;
+  for (RenderGraphResource i = 0; i < resources.size(); i++) {
+    const Resource &resource = resources[i];
+    // images only culled passes used don't need to exist
+    if (resource.imported || !resource.isImage || resource.firstUse == ~0u) {
+      continue;
+    }
+    transients.push_back(i);
+    key.push_back(static_cast<uint64_t>(resource.desc.format) |
+                  static_cast<uint64_t>(resource.usage) << 32);
+    key.push_back(static_cast<uint64_t>(resource.desc.extent.width) |
+                  static_cast<uint64_t>(resource.desc.extent.height) << 32);
+    key.push_back(static_cast<uint64_t>(resource.firstUse) |
+                  static_cast<uint64_t>(resource.lastUse) << 32);
+  }
+
+  FrameImages &frame = frames[frameIndex];
+  if (frame.key != key) {
+    // beginFrame waited on this frame's fence, nothing uses them anymore
+    destroyFrameImages(frame);
+    frame.key = key;
+    frame.images.resize(transients.size());
+
+    struct Placement {
+      size_t transient;
+      VkDeviceSize offset;
+      VkDeviceSize size;
+    };
+    std::vector<VkMemoryRequirements> requirements(transients.size());
+    std::vector<uint32_t> memoryTypes(transients.size());
+    stats.unaliasedBytes = 0;
+    for (size_t t = 0; t < transients.size(); t++) {
+      Resource &resource = resources[transients[t]];
+      VkImageCreateInfo imageInfo{};
+      imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType = VK_IMAGE_TYPE_2D;
+      imageInfo.extent = {resource.desc.extent.width,
+                          resource.desc.extent.height, 1};
+      imageInfo.mipLevels = 1;
+      imageInfo.arrayLayers = 1;
+      imageInfo.format = resource.desc.format;
+      imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      imageInfo.usage = resource.usage;
+      // only ever an attachment, tile based GPUs can keep it in tile memory
+      bool attachmentOnly = (resource.usage & ~ATTACHMENT_USAGE) == 0;
+      if (attachmentOnly) {
+        imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+      }
+      imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      if (vkCreateImage(nreDevice.device(), &imageInfo, nullptr,
+                        &frame.images[t].image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render graph image " +
+                                 resource.name);
+      }
+      vkGetImageMemoryRequirements(nreDevice.device(), frame.images[t].image,
+                                   &requirements[t]);
+      memoryTypes[t] = memoryTypeFor(requirements[t].memoryTypeBits,
+                                     attachmentOnly);
+      stats.unaliasedBytes += requirements[t].size;
+    }
+
+    // biggest first, each at the lowest offset that doesn't overlap an image
+    // alive at the same time
+    // one allocation per memory type the images need
+    std::vector<size_t> bySize(transients.size());
+    for (size_t t = 0; t < transients.size(); t++) {
+      bySize[t] = t;
+    }
+    std::stable_sort(bySize.begin(), bySize.end(), [&](size_t a, size_t b) {
+      return requirements[a].size > requirements[b].size;
+    });
+    std::map<uint32_t, std::vector<Placement>> heaps;
+    for (size_t t : bySize) {
+      const Resource &resource = resources[transients[t]];
+      std::vector<Placement> &heap = heaps[memoryTypes[t]];
+      VkDeviceSize size = requirements[t].size;
+      VkDeviceSize offset = 0;
+      bool moved = true;
+      while (moved) {
+        moved = false;
+        for (const Placement &other : heap) {
+          const Resource &placed = resources[transients[other.transient]];
+          bool aliveTogether = placed.firstUse <= resource.lastUse &&
+                               resource.firstUse <= placed.lastUse;
+          bool overlaps = other.offset < offset + size &&
+                          offset < other.offset + other.size;
+          if (aliveTogether && overlaps) {
+            offset =
+                alignUp(other.offset + other.size, requirements[t].alignment);
+            moved = true;
+          }
+        }
+      }
+      heap.push_back({t, offset, size});
+    }
+
+    stats.transientBytes = 0;
+    for (auto &kv : heaps) {
+      VkDeviceSize heapSize = 0;
+      for (const Placement &placement : kv.second) {
+        heapSize = std::max(heapSize, placement.offset + placement.size);
+      }
+      VkMemoryAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocInfo.allocationSize = heapSize;
+      allocInfo.memoryTypeIndex = kv.first;
+      VkDeviceMemory memory;
+      if (vkAllocateMemory(nreDevice.device(), &allocInfo, nullptr, &memory) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate render graph memory!");
+      }
+      frame.memory.push_back(memory);
+      stats.transientBytes += heapSize;
+
+      for (const Placement &placement : kv.second) {
+        TransientImage &image = frame.images[placement.transient];
+        vkBindImageMemory(nreDevice.device(), image.image, memory,
+                          placement.offset);
+        // whatever had this memory before the image is first used
+        const Resource &resource = resources[transients[placement.transient]];
+        for (const Placement &other : kv.second) {
+          const Resource &previous = resources[transients[other.transient]];
+          if (previous.lastUse < resource.firstUse &&
+              other.offset < placement.offset + placement.size &&
+              placement.offset < other.offset + other.size) {
+            image.aliases.push_back(static_cast<uint32_t>(other.transient));
+          }
+        }
+      }
+    }
+
+    for (size_t t = 0; t < transients.size(); t++) {
+      const Resource &resource = resources[transients[t]];
+      VkImageViewCreateInfo viewInfo{};
+      viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image = frame.images[t].image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format = resource.desc.format;
+      // depth only, views of depth/stencil formats can't be sampled with both
+      viewInfo.subresourceRange.aspectMask =
+          isDepthFormat(resource.desc.format) ? VK_IMAGE_ASPECT_DEPTH_BIT
+                                              : VK_IMAGE_ASPECT_COLOR_BIT;
+      viewInfo.subresourceRange.baseMipLevel = 0;
+      viewInfo.subresourceRange.levelCount = 1;
+      viewInfo.subresourceRange.baseArrayLayer = 0;
+      viewInfo.subresourceRange.layerCount = 1;
+      if (vkCreateImageView(nreDevice.device(), &viewInfo, nullptr,
+                            &frame.images[t].view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render graph image view " +
+                                 resource.name);
+      }
+    }
+
+    stats.transientImages = static_cast<uint32_t>(transients.size());
+  }
+
+  for (size_t t = 0; t < transients.size(); t++) {
+    Resource &resource = resources[transients[t]];
+    resource.image = frame.images[t].image;
+    resource.view = frame.images[t].view;
+    resource.aliases.clear();
+    for (uint32_t alias : frame.images[t].aliases) {
+      resource.aliases.push_back(transients[alias]);
+    }
+  }
+}
+
+uint32_t NreRenderGraph::memoryTypeFor(uint32_t memoryTypeBits,
+                                       bool transientAttachment) {
+  if (transientAttachment) {
+    try {
+      return nreDevice.findMemoryType(memoryTypeBits,
+                                      VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+    } catch (const std::exception &) {
+      // desktop GPUs mostly, no lazily allocated memory
+    }
+  }
+  return nreDevice.findMemoryType(memoryTypeBits,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void NreRenderGraph::destroyFrameImages(FrameImages &frame) {
+  for (auto &image : frame.images) {
+    vkDestroyImageView(nreDevice.device(), image.view, nullptr);
+    vkDestroyImage(nreDevice.device(), image.image, nullptr);
+  }
+  for (VkDeviceMemory memory : frame.memory) {
+    vkFreeMemory(nreDevice.device(), memory, nullptr);
+  }
+  frame.key.clear();
+  frame.images.clear();
+  frame.memory.clear();
+}
+
+void NreRenderGraph::execute(VkCommandBuffer commandBuffer) {
+  assert(compiled && "Render graph has to be compiled before execute");
+
+  std::vector<State> states(resources.size());
+  for (size_t i = 0; i < resources.size(); i++) {
+    states[i].layout = resources[i].initialLayout;
+    states[i].writeStages = resources[i].initialStages;
+    states[i].writeAccess = resources[i].initialAccess;
+  }
+
+  stats.barrierBatches = 0;
+  stats.imageBarriers = 0;
+  std::vector<VkImageMemoryBarrier2> imageBarriers;
+  for (uint32_t position = 0; position < order.size(); position++) {
+    const Pass &pass = passes[order[position]];
+
+    std::map<RenderGraphResource, MergedUse> merged;
+    for (const Use &use : pass.uses) {
+      AccessInfo info = accessInfo(use.access);
+      MergedUse &m = merged[use.resource];
+      assert((!resources[use.resource].isImage || m.stages == 0 ||
+              m.layout == info.layout) &&
+             "Pass uses an image in two layouts");
+      m.stages |= info.stages;
+      m.access |= info.readAccess | (use.write ? info.writeAccess : 0);
+      m.writeAccess |= use.write ? info.writeAccess : 0;
+      m.layout = info.layout;
+      m.read = m.read || use.read;
+      m.write = m.write || use.write;
+    }
+
+    imageBarriers.clear();
+    VkMemoryBarrier2 memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    for (const auto &kv : merged) {
+      const Resource &resource = resources[kv.first];
+      const MergedUse &use = kv.second;
+      State &state = states[kv.first];
+
+      // the memory was someone else's until now
+      if (!resource.imported && resource.firstUse == position) {
+        for (RenderGraphResource alias : resource.aliases) {
+          state.writeStages |= states[alias].writeStages |
+                               states[alias].readStages;
+          state.writeAccess |= states[alias].writeAccess;
+        }
+      }
+
+      if (resource.isImage && use.layout != state.layout) {
+        VkImageMemoryBarrier2 barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = state.writeStages | state.readStages;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.dstStageMask = use.stages;
+        barrier.dstAccessMask = use.access;
+        // overwritten anyway, the old contents can go
+        barrier.oldLayout =
+            use.read ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = use.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange.aspectMask = aspectFor(resource.desc.format);
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        imageBarriers.push_back(barrier);
+
+        // the transition counts as a write later accesses wait on
+        state.layout = use.layout;
+        state.writeStages = use.stages;
+        state.writeAccess = use.writeAccess;
+        state.readStages = use.write ? 0 : use.stages;
+        state.readAccess = use.write ? 0 : use.access;
+      } else if (use.write) {
+        // after earlier writes and reads, reads only need the execution
+        // dependency
+        if ((state.writeStages | state.readStages) != 0) {
+          memoryBarrier.srcStageMask |= state.writeStages | state.readStages;
+          memoryBarrier.srcAccessMask |= state.writeAccess;
+          memoryBarrier.dstStageMask |= use.stages;
+          memoryBarrier.dstAccessMask |= use.access;
+        }
+        state.writeStages = use.stages;
+        state.writeAccess = use.writeAccess;
+        state.readStages = 0;
+        state.readAccess = 0;
+      } else {
+        // reads the last write wasn't made visible to yet
+        if (state.writeStages != 0 &&
+            ((use.stages & ~state.readStages) != 0 ||
+             (use.access & ~state.readAccess) != 0)) {
+          memoryBarrier.srcStageMask |= state.writeStages;
+          memoryBarrier.srcAccessMask |= state.writeAccess;
+          memoryBarrier.dstStageMask |= use.stages;
+          memoryBarrier.dstAccessMask |= use.access;
+        }
+        state.readStages |= use.stages;
+        state.readAccess |= use.access;
+      }
+    }
+    recordBarriers(commandBuffer, imageBarriers, memoryBarrier);
+
+    bool rendering = !pass.colorAttachments.empty() || pass.hasDepthAttachment;
+    if (rendering) {
+      beginRendering(commandBuffer, pass);
+    }
+    if (pass.execute) {
+      pass.execute(commandBuffer);
+    }
+    if (rendering) {
+      vkCmdEndRendering(commandBuffer);
+    }
+  }
+
+  // imported images go back to what their owner expects, ie: PRESENT_SRC
+  imageBarriers.clear();
+  for (size_t i = 0; i < resources.size(); i++) {
+    const Resource &resource = resources[i];
+    if (!resource.imported || !resource.isImage ||
+        resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        resource.finalLayout == states[i].layout) {
+      continue;
+    }
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = states[i].writeStages | states[i].readStages;
+    barrier.srcAccessMask = states[i].writeAccess;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = states[i].layout;
+    barrier.newLayout = resource.finalLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = resource.image;
+    barrier.subresourceRange.aspectMask = aspectFor(resource.desc.format);
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    imageBarriers.push_back(barrier);
+  }
+  VkMemoryBarrier2 noMemoryBarrier{};
+  noMemoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+  recordBarriers(commandBuffer, imageBarriers, noMemoryBarrier);
+}
+
+void NreRenderGraph::recordBarriers(
+    VkCommandBuffer commandBuffer,
+    const std::vector<VkImageMemoryBarrier2> &images,
+    const VkMemoryBarrier2 &memory) {
+  bool hasMemoryBarrier = memory.dstStageMask != 0;
+  if (images.empty() && !hasMemoryBarrier) {
+    return;
+  }
+  stats.barrierBatches++;
+  stats.imageBarriers += static_cast<uint32_t>(images.size());
+
+  if (nreDevice.supportsSynchronization2()) {
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.memoryBarrierCount = hasMemoryBarrier ? 1 : 0;
+    dependencyInfo.pMemoryBarriers = &memory;
+    dependencyInfo.imageMemoryBarrierCount =
+        static_cast<uint32_t>(images.size());
+    dependencyInfo.pImageMemoryBarriers = images.data();
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    return;
+  }
+
+  // the same barriers with stage masks merged for the whole batch
+  VkPipelineStageFlags srcStages =
+      static_cast<VkPipelineStageFlags>(memory.srcStageMask);
+  VkPipelineStageFlags dstStages =
+      static_cast<VkPipelineStageFlags>(memory.dstStageMask);
+  std::vector<VkImageMemoryBarrier> legacyImages;
+  for (const auto &barrier : images) {
+    srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+    dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+    VkImageMemoryBarrier legacy{};
+    legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    legacy.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+    legacy.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+    legacy.oldLayout = barrier.oldLayout;
+    legacy.newLayout = barrier.newLayout;
+    legacy.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    legacy.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    legacy.image = barrier.image;
+    legacy.subresourceRange = barrier.subresourceRange;
+    legacyImages.push_back(legacy);
+  }
+  VkMemoryBarrier legacyMemory{};
+  legacyMemory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  legacyMemory.srcAccessMask = static_cast<VkAccessFlags>(memory.srcAccessMask);
+  legacyMemory.dstAccessMask = static_cast<VkAccessFlags>(memory.dstAccessMask);
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      dstStages != 0 ? dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+      hasMemoryBarrier ? 1 : 0, &legacyMemory, 0, nullptr,
+      static_cast<uint32_t>(legacyImages.size()), legacyImages.data());
+}
+
+void NreRenderGraph::beginRendering(VkCommandBuffer commandBuffer,
+                                    const Pass &pass) {
+  auto attachmentInfo = [&](const Attachment &attachment,
+                            VkImageLayout layout) {
+    VkRenderingAttachmentInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    info.imageView = resources[attachment.resource].view;
+    info.imageLayout = layout;
+    info.loadOp = attachment.loadOp;
+    info.storeOp = attachment.storeOp;
+    info.clearValue = attachment.clear;
+    return info;
+  };
+
+  std::vector<VkRenderingAttachmentInfo> colorAttachments;
+  VkExtent2D extent{};
+  for (const Attachment &attachment : pass.colorAttachments) {
+    colorAttachments.push_back(
+        attachmentInfo(attachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL));
+    extent = resources[attachment.resource].desc.extent;
+  }
+  VkRenderingAttachmentInfo depthAttachment{};
+  if (pass.hasDepthAttachment) {
+    depthAttachment = attachmentInfo(
+        pass.depthAttachment, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    extent = resources[pass.depthAttachment.resource].desc.extent;
+  }
+
+  VkRenderingInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+  renderingInfo.renderArea.offset = {0, 0};
+  renderingInfo.renderArea.extent = extent;
+  renderingInfo.layerCount = 1;
+  renderingInfo.colorAttachmentCount =
+      static_cast<uint32_t>(colorAttachments.size());
+  renderingInfo.pColorAttachments = colorAttachments.data();
+  renderingInfo.pDepthAttachment =
+      pass.hasDepthAttachment ? &depthAttachment : nullptr;
+  vkCmdBeginRendering(commandBuffer, &renderingInfo);
+
+  VkViewport viewport{};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = static_cast<float>(extent.width);
+  viewport.height = static_cast<float>(extent.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  VkRect2D scissor{{0, 0}, extent};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+VkImage NreRenderGraph::getImage(RenderGraphResource resource) const {
+  assert(resources[resource].isImage && "Resource isn't an image");
+  return resources[resource].image;
+}
+
+VkImageView NreRenderGraph::getImageView(RenderGraphResource resource) const {
+  assert(resources[resource].isImage && "Resource isn't an image");
+  return resources[resource].view;
+}
+
+VkBuffer NreRenderGraph::getBuffer(RenderGraphResource resource) const {
+  assert(!resources[resource].isImage && "Resource isn't a buffer");
+  return resources[resource].buffer;
+}
+
+} // namespace nre
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "nre_device.hpp"
+
+// std
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace nre {
+
+// handle of an image or buffer in the graph, valid until the next reset
+using RenderGraphResource = uint32_t;
+
+// how a pass touches a resource, each one picks the pipeline stages, access
+// flags, image layout and usage the graph synchronizes and creates images with
+enum class RenderGraphAccess {
+  ColorAttachment,
+  DepthAttachment,
+  // depth test without writes
+  DepthRead,
+  InputAttachment,
+  SampledFragment,
+  SampledCompute,
+  StorageCompute,
+  StorageFragment,
+  UniformRead,
+  VertexInput,
+  IndirectRead,
+  TransferSrc,
+  TransferDst,
+};
+
+// a transient image, created and owned by the graph
+// usage comes from how passes access it
+struct RenderGraphImageDesc {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent{};
+};
+
+// an image owned by someone else, ie: the swap chain's
+struct RenderGraphImportedImage {
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent{};
+  // layout on entry, UNDEFINED when the contents don't matter
+  VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  // what the first barrier waits on, ie: COLOR_ATTACHMENT_OUTPUT for a swap
+  // chain image the submit's acquire semaphore waits for in that stage
+  VkPipelineStageFlags2 initialStages = 0;
+  VkAccessFlags2 initialAccess = 0;
+  // left in this layout after the last pass, UNDEFINED keeps whatever the
+  // last pass used
+  VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+struct RenderGraphStats {
+  uint32_t passes = 0;
+  uint32_t culledPasses = 0;
+  // vkCmdPipelineBarrier2 calls and the image barriers in them
+  uint32_t barrierBatches = 0;
+  uint32_t imageBarriers = 0;
+  uint32_t transientImages = 0;
+  // device memory of the transient images, and what it would be without
+  // aliasing
+  VkDeviceSize transientBytes = 0;
+  VkDeviceSize unaliasedBytes = 0;
+};
+
+// a frame's passes and the resources they read and write
+// every frame: reset, import what lives outside the graph, add passes in the
+// order they'd be recorded by hand, then compile and execute
+// compile drops passes nothing kept depends on (imported resources and passes
+// marked with sideEffects count as kept), orders the rest so independent
+// passes sit between dependent ones and their barriers batch up, and places
+// transient images whose lifetimes don't overlap in the same memory
+// execute records one barrier batch before each pass that needs one, passes
+// with attachments run inside dynamic rendering the graph begins for them
+// transient images are kept per frame in flight and only recreated when the
+// frame's set of images changes, the ones only ever used as attachments are
+// TRANSIENT_ATTACHMENT images in lazily allocated memory where supported
+class NreRenderGraph {
+public:
+  class PassBuilder {
+  public:
+    RenderGraphResource createImage(const std::string &name,
+                                    const RenderGraphImageDesc &desc);
+    void read(RenderGraphResource resource, RenderGraphAccess access);
+    void write(RenderGraphResource resource, RenderGraphAccess access);
+    // LOAD reads the attachment too, DONT_CARE store ops are for attachments
+    // nothing after the pass reads
+    void colorAttachment(
+        RenderGraphResource resource,
+        VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        VkClearColorValue clear = {{0.01f, 0.01f, 0.01f, 1.0f}},
+        VkAttachmentStoreOp storeOp = VK_ATTACHMENT_STORE_OP_STORE);
+    void depthAttachment(
+        RenderGraphResource resource,
+        VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        VkClearDepthStencilValue clear = {1.0f, 0},
+        VkAttachmentStoreOp storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE);
+    // kept even when nothing reads what it writes, ie: readbacks
+    void sideEffects();
+
+  private:
+    friend class NreRenderGraph;
+    PassBuilder(NreRenderGraph &graph, uint32_t pass)
+        : graph{graph}, pass{pass} {}
+
+    NreRenderGraph &graph;
+    uint32_t pass;
+  };
+
+  using SetupFunction = std::function<void(PassBuilder &)>;
+  using ExecuteFunction = std::function<void(VkCommandBuffer)>;
+
+  explicit NreRenderGraph(NreDevice &device);
+  ~NreRenderGraph();
+
+  NreRenderGraph(const NreRenderGraph &) = delete;
+  NreRenderGraph &operator=(const NreRenderGraph &) = delete;
+
+  // drops the previous frame's passes, frameIndex's transient images may be
+  // reused once its fence has signaled
+  void reset(int frameIndex);
+  RenderGraphResource importImage(const std::string &name,
+                                  const RenderGraphImportedImage &image);
+  RenderGraphResource importBuffer(const std::string &name, VkBuffer buffer);
+  // setup runs right away, execute during execute if the pass isn't culled
+  void addPass(const std::string &name, const SetupFunction &setup,
+               ExecuteFunction execute);
+
+  void compile();
+  void execute(VkCommandBuffer commandBuffer);
+
+  // for pass callbacks, transient images only exist after compile
+  VkImage getImage(RenderGraphResource resource) const;
+  VkImageView getImageView(RenderGraphResource resource) const;
+  VkBuffer getBuffer(RenderGraphResource resource) const;
+
+  const RenderGraphStats &getStats() const { return stats; }
+
+private:
+  struct Use {
+    RenderGraphResource resource;
+    RenderGraphAccess access;
+    bool read;
+    bool write;
+  };
+
+  struct Attachment {
+    RenderGraphResource resource;
+    VkAttachmentLoadOp loadOp;
+    VkAttachmentStoreOp storeOp;
+    VkClearValue clear;
+  };
+
+  struct Pass {
+    std::string name;
+    ExecuteFunction execute;
+    std::vector<Use> uses;
+    std::vector<Attachment> colorAttachments;
+    bool hasDepthAttachment = false;
+    Attachment depthAttachment{};
+    bool sideEffects = false;
+    bool culled = false;
+  };
+
+  struct Resource {
+    std::string name;
+    bool isImage = true;
+    bool imported = false;
+    RenderGraphImageDesc desc{};
+    VkImageUsageFlags usage = 0;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 initialStages = 0;
+    VkAccessFlags2 initialAccess = 0;
+    // first and last position in the execution order, transient images only
+    uint32_t firstUse = ~0u;
+    uint32_t lastUse = 0;
+    // transient images that had the memory before this one
+    std::vector<RenderGraphResource> aliases;
+  };
+
+  // what the barrier before the next access has to wait on
+  struct State {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 writeStages = 0;
+    VkAccessFlags2 writeAccess = 0;
+    // reads since the last write that are already made visible
+    VkPipelineStageFlags2 readStages = 0;
+    VkAccessFlags2 readAccess = 0;
+  };
+
+  // the images and memory of one frame in flight
+  struct TransientImage {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    // indices of the images that had the memory before
+    std::vector<uint32_t> aliases;
+  };
+  struct FrameImages {
+    // what the images were created for, compared to skip recreating them
+    std::vector<uint64_t> key;
+    std::vector<TransientImage> images;
+    std::vector<VkDeviceMemory> memory;
+  };
+
+  void cullPasses();
+  void orderPasses();
+  void computeLifetimes();
+  void createTransientImages();
+  // lazily allocated memory for images that are only ever attachments, when
+  // the device has it
+  uint32_t memoryTypeFor(uint32_t memoryTypeBits, bool transientAttachment);
+  void destroyFrameImages(FrameImages &frame);
+  void recordBarriers(VkCommandBuffer commandBuffer,
+                      const std::vector<VkImageMemoryBarrier2> &images,
+                      const VkMemoryBarrier2 &memory);
+  void beginRendering(VkCommandBuffer commandBuffer, const Pass &pass);
+
+  NreDevice &nreDevice;
+  int frameIndex = 0;
+  bool compiled = false;
+  std::vector<Pass> passes;
+  std::vector<Resource> resources;
+  // indices into passes, culled ones left out
+  std::vector<uint32_t> order;
+  std::map<int, FrameImages> frames;
+  RenderGraphStats stats{};
+};
+
+} // namespace nre
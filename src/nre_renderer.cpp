@@ -7,7 +7,48 @@
 namespace nre
 {
 
-    NreRenderer::NreRenderer(NreWindow &window, NreDevice &device) : nreWindow{window}, nreDevice{device}, isFrameStarted{false}, currentImageIndex{0}
+    namespace
+    {
+        // layout transitions a render pass would otherwise do for us
+        void transitionImage(
+            VkCommandBuffer commandBuffer,
+            VkImage image,
+            VkImageAspectFlags aspectMask,
+            VkImageLayout oldLayout,
+            VkImageLayout newLayout,
+            VkPipelineStageFlags srcStage,
+            VkAccessFlags srcAccess,
+            VkPipelineStageFlags dstStage,
+            VkAccessFlags dstAccess)
+        {
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstAccessMask = dstAccess;
+            barrier.oldLayout = oldLayout;
+            barrier.newLayout = newLayout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image;
+            barrier.subresourceRange.aspectMask = aspectMask;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.layerCount = 1;
+            vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+
+        bool hasStencilComponent(VkFormat format)
+        {
+            return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+        }
+    }
+
+    NreRenderer::NreRenderer(NreWindow &window, NreDevice &device, bool dynamicRendering)
+        : nreWindow{window},
+          nreDevice{device},
+          useDynamicRendering{dynamicRendering && device.supportsDynamicRendering()},
+          isFrameStarted{false},
+          currentImageIndex{0},
+          currentFrameIndex{0}
     {
         recreateSwapchain();
         createCommandBuffers();
@@ -16,6 +57,8 @@ namespace nre
     NreRenderer::~NreRenderer()
     {
         freeCommandBuffers();
+        vkDestroyRenderPass(nreDevice.device(), renderPass, nullptr);
+        vkDestroyRenderPass(nreDevice.device(), deferredRenderPass, nullptr);
     }
 
     void NreRenderer::recreateSwapchain()
@@ -46,9 +89,196 @@ namespace nre
             }
         };
 
+        // the render passes only depend on the formats, so they are made for the first swap chain
+        // and kept, pipelines made for them stay valid across recreation
+        if (renderPass == VK_NULL_HANDLE)
+        {
+            createRenderPass();
+            createDeferredRenderPass();
+        }
+        nreSwapChain->createFramebuffers(renderPass);
+
         // tbd
     }
 
+    void NreRenderer::createRenderPass()
+    {
+        VkAttachmentDescription depthAttachment{};
+        depthAttachment.format = nreSwapChain->getSwapChainDepthFormat();
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef{};
+        depthAttachmentRef.attachment = 1;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = nreSwapChain->getSwapChainImageFormat();
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.srcAccessMask = 0;
+        dependency.srcStageMask =
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency.dstSubpass = 0;
+        dependency.dstStageMask =
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency.dstAccessMask =
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies = &dependency;
+
+        if (vkCreateRenderPass(nreDevice.device(), &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create render pass!");
+        }
+    }
+
+    void NreRenderer::createDeferredRenderPass()
+    {
+        // swap chain image, depth, albedo, normal
+        std::array<VkAttachmentDescription, 4> attachments{};
+        for (auto &attachment : attachments)
+        {
+            attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+            attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            // only the swap chain image outlives the render pass
+            attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+        attachments[0].format = nreSwapChain->getSwapChainImageFormat();
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        attachments[1].format = nreSwapChain->getSwapChainDepthFormat();
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        attachments[2].format = NreSwapChain::GBUFFER_ALBEDO_FORMAT;
+        attachments[2].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        attachments[3].format = NreSwapChain::GBUFFER_NORMAL_FORMAT;
+        attachments[3].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        // g-buffer: the light independent part of the color (ambient, emission) goes straight to
+        // the swap chain image, the rest into the g-buffer
+        std::array<VkAttachmentReference, 3> gBufferColorRefs{
+            VkAttachmentReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+            VkAttachmentReference{2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+            VkAttachmentReference{3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}};
+        VkAttachmentReference gBufferDepthRef{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+        // lighting: every pixel read once through input attachments, added onto the swap chain
+        // image, depth is only read to get the position back
+        std::array<VkAttachmentReference, 3> lightingInputRefs{
+            VkAttachmentReference{2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            VkAttachmentReference{3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            VkAttachmentReference{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}};
+        VkAttachmentReference colorRef{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+
+        // forward: whatever isn't in the g-buffer, depth tested against it
+        VkAttachmentReference forwardDepthRef{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+        std::array<VkSubpassDescription, 3> subpasses{};
+        for (auto &subpass : subpasses)
+        {
+            subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        }
+        subpasses[NreSwapChain::GBUFFER_SUBPASS].colorAttachmentCount = static_cast<uint32_t>(gBufferColorRefs.size());
+        subpasses[NreSwapChain::GBUFFER_SUBPASS].pColorAttachments = gBufferColorRefs.data();
+        subpasses[NreSwapChain::GBUFFER_SUBPASS].pDepthStencilAttachment = &gBufferDepthRef;
+        subpasses[NreSwapChain::LIGHTING_SUBPASS].inputAttachmentCount = static_cast<uint32_t>(lightingInputRefs.size());
+        subpasses[NreSwapChain::LIGHTING_SUBPASS].pInputAttachments = lightingInputRefs.data();
+        subpasses[NreSwapChain::LIGHTING_SUBPASS].colorAttachmentCount = 1;
+        subpasses[NreSwapChain::LIGHTING_SUBPASS].pColorAttachments = &colorRef;
+        subpasses[NreSwapChain::FORWARD_SUBPASS].colorAttachmentCount = 1;
+        subpasses[NreSwapChain::FORWARD_SUBPASS].pColorAttachments = &colorRef;
+        subpasses[NreSwapChain::FORWARD_SUBPASS].pDepthStencilAttachment = &forwardDepthRef;
+
+        // by region, each pixel only depends on the same pixel of the previous subpass so tile
+        // based GPUs keep the g-buffer in tile memory
+        std::array<VkSubpassDependency, 3> dependencies{};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].srcStageMask =
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstSubpass = NreSwapChain::GBUFFER_SUBPASS;
+        dependencies[0].dstStageMask =
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstAccessMask =
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        dependencies[1].srcSubpass = NreSwapChain::GBUFFER_SUBPASS;
+        dependencies[1].srcStageMask =
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].srcAccessMask =
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstSubpass = NreSwapChain::LIGHTING_SUBPASS;
+        dependencies[1].dstStageMask =
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT |
+                                        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        // depth goes back to being written after the lighting subpass read it
+        dependencies[2].srcSubpass = NreSwapChain::LIGHTING_SUBPASS;
+        dependencies[2].srcStageMask =
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[2].dstSubpass = NreSwapChain::FORWARD_SUBPASS;
+        dependencies[2].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                       VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[2].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+        renderPassInfo.pSubpasses = subpasses.data();
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+
+        if (vkCreateRenderPass(nreDevice.device(), &renderPassInfo, nullptr, &deferredRenderPass) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create deferred render pass!");
+        }
+    }
+
     void NreRenderer::createCommandBuffers()
     {
 
@@ -126,15 +356,93 @@ namespace nre
         currentFrameIndex = (currentFrameIndex + 1) % NreSwapChain::MAX_FRAMES_IN_FLIGHT;
     }
 
+    PipelineRenderTarget NreRenderer::getSwapChainRenderTarget() const
+    {
+        PipelineRenderTarget target{};
+        if (useDynamicRendering)
+        {
+            target.colorAttachmentFormats = {nreSwapChain->getSwapChainImageFormat()};
+            target.depthAttachmentFormat = nreSwapChain->getSwapChainDepthFormat();
+        }
+        else
+        {
+            target.renderPass = renderPass;
+        }
+        return target;
+    }
+
+    PipelineRenderTarget NreRenderer::getDeferredRenderTarget(uint32_t subpass) const
+    {
+        PipelineRenderTarget target{};
+        target.renderPass = deferredRenderPass;
+        target.subpass = subpass;
+        return target;
+    }
+
+    RenderGraphImportedImage NreRenderer::getSwapChainImage() const
+    {
+        assert(isFrameStarted && "Can't get the swap chain image when frame not in progress");
+        RenderGraphImportedImage image{};
+        image.image = nreSwapChain->getImage(currentImageIndex);
+        image.view = nreSwapChain->getImageView(currentImageIndex);
+        image.format = nreSwapChain->getSwapChainImageFormat();
+        image.extent = nreSwapChain->getSwapChainExtent();
+        // the submit waits for the acquire in this stage
+        image.initialStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+        image.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        return image;
+    }
+
+    RenderGraphImportedImage NreRenderer::getDepthImage() const
+    {
+        assert(isFrameStarted && "Can't get the depth image when frame not in progress");
+        RenderGraphImportedImage image{};
+        image.image = nreSwapChain->getDepthImage(currentFrameIndex);
+        image.view = nreSwapChain->getDepthImageView(currentFrameIndex);
+        image.format = nreSwapChain->getSwapChainDepthFormat();
+        image.extent = nreSwapChain->getSwapChainExtent();
+        // the last frame with this frame index wrote it too
+        image.initialStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+        image.initialAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        return image;
+    }
+
     void NreRenderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer)
     {
         assert(isFrameStarted && "Can't call beginSwapChain if frame is not in progress");
         assert(commandBuffer == getCurrentCommandBuffer() && "Can't begin Render Pass on command buffer from a different frame");
 
+        if (useDynamicRendering)
+        {
+            beginDynamicRendering(commandBuffer);
+        }
+        else
+        {
+            beginRenderPass(commandBuffer);
+        }
+        setViewportAndScissor(commandBuffer);
+    }
+
+    void NreRenderer::setViewportAndScissor(VkCommandBuffer commandBuffer)
+    {
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = static_cast<float>(nreSwapChain->getSwapChainExtent().width);
+        viewport.height = static_cast<float>(nreSwapChain->getSwapChainExtent().height);
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        VkRect2D scissor{{0, 0}, nreSwapChain->getSwapChainExtent()};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+
+    void NreRenderer::beginRenderPass(VkCommandBuffer commandBuffer)
+    {
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = nreSwapChain->getRenderPass();
-        renderPassInfo.framebuffer = nreSwapChain->getFrameBuffer(currentImageIndex);
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = nreSwapChain->getFrameBuffer(currentFrameIndex, currentImageIndex);
 
         renderPassInfo.renderArea.offset = {0, 0};
         renderPassInfo.renderArea.extent = nreSwapChain->getSwapChainExtent();
@@ -146,22 +454,133 @@ namespace nre
         renderPassInfo.pClearValues = clearValues.data();
 
         vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    }
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = static_cast<float>(nreSwapChain->getSwapChainExtent().width);
-        viewport.height = static_cast<float>(nreSwapChain->getSwapChainExtent().height);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        VkRect2D scissor{{0, 0}, nreSwapChain->getSwapChainExtent()};
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    void NreRenderer::beginDeferredRenderPass(VkCommandBuffer commandBuffer)
+    {
+        assert(isFrameStarted && "Can't call beginDeferredRenderPass if frame is not in progress");
+        assert(commandBuffer == getCurrentCommandBuffer() && "Can't begin Render Pass on command buffer from a different frame");
+
+        // the g-buffer only exists once deferred shading is used, and again after every
+        // recreateSwapchain
+        if (!nreSwapChain->hasDeferredResources())
+        {
+            nreSwapChain->createDeferredResources(deferredRenderPass);
+        }
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = deferredRenderPass;
+        renderPassInfo.framebuffer = nreSwapChain->getDeferredFrameBuffer(currentFrameIndex, currentImageIndex);
+
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = nreSwapChain->getSwapChainExtent();
+
+        // same order as the attachments: swap chain, depth, albedo, normal
+        std::array<VkClearValue, 4> clearValues{};
+        clearValues[0].color = {0.01f, 0.01f, 0.01f, 1.0f};
+        clearValues[1].depthStencil = {1.0f, 0};
+        clearValues[2].color = {0.0f, 0.0f, 0.0f, 0.0f};
+        clearValues[3].color = {0.0f, 0.0f, 0.0f, 0.0f};
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        setViewportAndScissor(commandBuffer);
+    }
+
+    void NreRenderer::endDeferredRenderPass(VkCommandBuffer commandBuffer)
+    {
+        assert(isFrameStarted && "Can't call endDeferredRenderPass if frame is not in progress");
+        assert(commandBuffer == getCurrentCommandBuffer() && "Can't end Render Pass on command buffer from a different frame");
+        // the render pass leaves the swap chain image in PRESENT_SRC
+        vkCmdEndRenderPass(commandBuffer);
+    }
+
+    GBufferViews NreRenderer::getGBufferViews() const
+    {
+        assert(isFrameStarted && "Can't get the g-buffer when frame not in progress");
+        assert(nreSwapChain->hasDeferredResources() && "Can't get the g-buffer before beginDeferredRenderPass");
+        return nreSwapChain->getGBufferViews(currentFrameIndex);
+    }
+
+    void NreRenderer::beginDynamicRendering(VkCommandBuffer commandBuffer)
+    {
+        // contents of both are cleared anyway, so the old layout doesn't matter
+        transitionImage(
+            commandBuffer,
+            nreSwapChain->getImage(currentImageIndex),
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            0,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+        VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+        if (hasStencilComponent(nreSwapChain->getSwapChainDepthFormat()))
+        {
+            depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+        transitionImage(
+            commandBuffer,
+            nreSwapChain->getDepthImage(currentFrameIndex),
+            depthAspect,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+        VkRenderingAttachmentInfo colorAttachment{};
+        colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        colorAttachment.imageView = nreSwapChain->getImageView(currentImageIndex);
+        colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.clearValue.color = {0.01f, 0.01f, 0.01f, 1.0f};
+
+        VkRenderingAttachmentInfo depthAttachment{};
+        depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        depthAttachment.imageView = nreSwapChain->getDepthImageView(currentFrameIndex);
+        depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.clearValue.depthStencil = {1.0f, 0};
+
+        VkRenderingInfo renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = nreSwapChain->getSwapChainExtent();
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachments = &colorAttachment;
+        renderingInfo.pDepthAttachment = &depthAttachment;
+
+        vkCmdBeginRendering(commandBuffer, &renderingInfo);
     }
     void NreRenderer::endSwapChainRenderPass(VkCommandBuffer commandBuffer)
     {
         assert(isFrameStarted && "Can't call endSwapChain if frame is not in progress");
         assert(commandBuffer == getCurrentCommandBuffer() && "Can't end Render Pass on command buffer from a different frame");
-        vkCmdEndRenderPass(commandBuffer);
+        if (!useDynamicRendering)
+        {
+            vkCmdEndRenderPass(commandBuffer);
+            return;
+        }
+
+        vkCmdEndRendering(commandBuffer);
+        transitionImage(
+            commandBuffer,
+            nreSwapChain->getImage(currentImageIndex),
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0);
     }
 } // namspace nre
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "nre_window.hpp"
 #include "nre_device.hpp"
+#include "nre_pipeline.hpp"
+#include "nre_render_graph.hpp"
 #include "nre_swap_chain.hpp"
 
 // std
@@ -15,14 +17,22 @@ namespace nre
     {
 
     public:
-        NreRenderer(NreWindow &window, NreDevice &device);
+        // dynamic rendering is only used when the device supports it
+        NreRenderer(NreWindow &window, NreDevice &device, bool dynamicRendering = true);
         ~NreRenderer();
 
         NreRenderer(const NreWindow &) = delete;
         NreRenderer &operator=(const NreWindow &) = delete;
 
-        VkRenderPass getSwapChainRenderPass() const { return nreSwapChain->getRenderPass(); }
+        VkRenderPass getSwapChainRenderPass() const { return renderPass; }
+        // what pipelines drawing between begin/endSwapChainRenderPass have to target, the swap chain
+        // render pass or, with dynamic rendering, only its formats
+        PipelineRenderTarget getSwapChainRenderTarget() const;
+        // one of the deferred render pass's subpasses, see NreSwapChain::GBUFFER_SUBPASS
+        PipelineRenderTarget getDeferredRenderTarget(uint32_t subpass) const;
+        bool usesDynamicRendering() const { return useDynamicRendering; }
         float getAspectRatio() const { return nreSwapChain->extentAspectRatio(); }
+        VkExtent2D getSwapChainExtent() const { return nreSwapChain->getSwapChainExtent(); }
 
         bool isFrameInProgress() const { return isFrameStarted; }
 
@@ -42,16 +52,37 @@ namespace nre
         void endFrame();
         void beginSwapChainRenderPass(VkCommandBuffer commandBuffer);
         void endSwapChainRenderPass(VkCommandBuffer commandBuffer);
+        // starts in the g-buffer subpass, the caller steps through the others, always a render
+        // pass since input attachments need subpasses
+        // the g-buffer is allocated by the first call, so forward only rendering never pays for it
+        void beginDeferredRenderPass(VkCommandBuffer commandBuffer);
+        void endDeferredRenderPass(VkCommandBuffer commandBuffer);
+        GBufferViews getGBufferViews() const;
+
+        // the current frame's swap chain and depth image, for a NreRenderGraph pass to render to
+        // instead of beginSwapChainRenderPass, needs dynamic rendering
+        // the swap chain image is left in PRESENT_SRC after the graph's last pass
+        RenderGraphImportedImage getSwapChainImage() const;
+        RenderGraphImportedImage getDepthImage() const;
 
     private:
         void createCommandBuffers();
         void freeCommandBuffers();
         void recreateSwapchain();
+        void createRenderPass();
+        void createDeferredRenderPass();
+        void beginRenderPass(VkCommandBuffer commandBuffer);
+        void setViewportAndScissor(VkCommandBuffer commandBuffer);
+        void beginDynamicRendering(VkCommandBuffer commandBuffer);
 
         NreWindow &nreWindow;
         NreDevice &nreDevice;
         std::unique_ptr<NreSwapChain> nreSwapChain;
+        // owned here instead of by the swap chain so they survive recreateSwapchain
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        VkRenderPass deferredRenderPass = VK_NULL_HANDLE;
         std::vector<VkCommandBuffer> commandBuffers;
+        bool useDynamicRendering;
 
         uint32_t currentImageIndex;
         int currentFrameIndex;
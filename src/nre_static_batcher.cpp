@@ -0,0 +1,127 @@
+#include "nre_static_batcher.hpp"
+
+// std
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace nre {
+
+namespace {
+// (vertex format key, material, grid cell), ordered so batches come out the
+// same every run
+using CellKey = std::tuple<uint32_t, uint32_t, int32_t, int32_t, int32_t>;
+} // namespace
+
+void appendWorldSpace(NreModel::Builder &batch, const NreModel::Builder &mesh,
+                      TransformComponent &transform) {
+  const glm::mat4 modelMatrix = transform.mat4();
+  const glm::mat3 normalMatrix = transform.normalMatrix();
+  // rotations keep the winding, an odd number of negative scales flips it
+  const glm::vec3 &scale = transform.scale;
+  const bool mirrored = scale.x * scale.y * scale.z < 0.f;
+
+  // coarser levels reuse the same vertices, only copy the ones level 0 uses
+  const uint32_t indexCount =
+      mesh.lods.empty() ? static_cast<uint32_t>(mesh.indices.size())
+                        : mesh.lods[0].indexCount;
+  std::vector<uint32_t> remap(mesh.vertices.size(), ~0u);
+  for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+    uint32_t triangle[3] = {mesh.indices[i], mesh.indices[i + 1],
+                            mesh.indices[i + 2]};
+    if (mirrored) {
+      std::swap(triangle[1], triangle[2]);
+    }
+    for (uint32_t v : triangle) {
+      if (remap[v] == ~0u) {
+        remap[v] = static_cast<uint32_t>(batch.vertices.size());
+        NreModel::Vertex vertex = mesh.vertices[v];
+        vertex.position =
+            glm::vec3{modelMatrix * glm::vec4{vertex.position, 1.f}};
+        glm::vec3 normal = normalMatrix * vertex.normal;
+        float length = glm::length(normal);
+        vertex.normal = length > 0.f ? normal / length : normal;
+        batch.vertices.push_back(vertex);
+      }
+      batch.indices.push_back(remap[v]);
+    }
+  }
+}
+
+StaticBatchStats batchStaticObjects(NreDevice &device,
+                                    NreGameObject::Map &gameObjects,
+                                    const StaticBatchSettings &settings) {
+  StaticBatchStats stats{};
+
+  std::map<CellKey, std::vector<NreGameObject::id_t>> cells{};
+  for (auto &kv : gameObjects) {
+    auto &obj = kv.second;
+    // meshlet models are already culled finer on the GPU than a batch could be
+    // a batch is drawn with a single material, so multi material models stay
+    // on their own
+    if (!obj.isStatic || !obj.visible || obj.model == nullptr ||
+        obj.model->getMeshData() == nullptr || obj.model->hasMeshlets() ||
+        !obj.model->hasSingleMaterial()) {
+      continue;
+    }
+    const auto &sphere = obj.model->getBoundingSphere();
+    glm::vec3 center{obj.transform.mat4() * glm::vec4{sphere.center, 1.f}};
+    glm::vec3 cell = glm::floor(center / settings.cellSize);
+    cells[CellKey{obj.model->getVertexFormat().key(),
+                  obj.model->getSubmeshMaterial(0, obj.material),
+                  static_cast<int32_t>(cell.x), static_cast<int32_t>(cell.y),
+                  static_cast<int32_t>(cell.z)}]
+        .push_back(kv.first);
+  }
+
+  for (auto &kv : cells) {
+    auto &ids = kv.second;
+    // unordered_map order isn't stable either
+    std::sort(ids.begin(), ids.end());
+
+    NreModel::Builder batch{};
+    glm::vec3 color{};
+    auto flush = [&]() {
+      if (batch.indices.empty()) {
+        return;
+      }
+      auto batchObject = NreGameObject::createGameObject();
+      if (settings.keepMeshData) {
+        batchObject.model =
+            NreModel::createWithMeshData(device, std::move(batch));
+      } else {
+        batchObject.model = std::make_shared<NreModel>(device, batch);
+      }
+      batchObject.color = color;
+      batchObject.material = std::get<1>(kv.first);
+      batchObject.isStatic = true;
+      gameObjects.emplace(batchObject.getId(), std::move(batchObject));
+      stats.batches++;
+      batch = NreModel::Builder{};
+    };
+
+    for (NreGameObject::id_t id : ids) {
+      auto &source = gameObjects.at(id);
+      const NreModel::Builder &mesh = *source.model->getMeshData();
+      // a source bigger than maxVertices on its own still gets a batch
+      if (!batch.vertices.empty() &&
+          batch.vertices.size() + mesh.vertices.size() > settings.maxVertices) {
+        flush();
+      }
+      if (batch.vertices.empty()) {
+        batch.format = source.model->getVertexFormat();
+        color = source.color;
+      }
+      appendWorldSpace(batch, mesh, source.transform);
+      source.visible = false;
+      stats.sourceObjects++;
+    }
+    flush();
+  }
+
+  return stats;
+}
+
+} // namespace nre
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "nre_device.hpp"
+#include "nre_game_object.hpp"
+
+// std
+#include <cstdint>
+
+// merges static scenery into a few large models so thousands of small props
+// cost tens of draws, run once after the static objects are loaded
+namespace nre {
+
+struct StaticBatchSettings {
+  // objects are clustered by the grid cell (world units) their bounds center
+  // falls into, smaller cells cull tighter but give more batches
+  float cellSize = 8.f;
+  // a full cell starts a new batch, 65536 keeps 16 bit indices
+  uint32_t maxVertices = 65536;
+  // keep the merged meshes on the CPU, ie: to build HLOD proxies from them
+  bool keepMeshData = false;
+};
+
+struct StaticBatchStats {
+  uint32_t sourceObjects = 0;
+  uint32_t batches = 0;
+};
+
+// appends the full detail level of mesh to batch, pre-transformed into world
+// space by transform
+void appendWorldSpace(NreModel::Builder &batch, const NreModel::Builder &mesh,
+                      TransformComponent &transform);
+
+// every visible, static object whose model kept its mesh data (see
+// ImportOptions::keepMeshData) and has no meshlets is pre-transformed into
+// world space and merged with the others of its cell, vertex format and
+// material (models with several materials are left alone)
+// the batches are added to gameObjects as new static objects with an identity
+// transform, the sources stay in the map for picking but are hidden
+// batches only hold the full detail level of their sources, no LOD chain
+StaticBatchStats batchStaticObjects(NreDevice &device,
+                                    NreGameObject::Map &gameObjects,
+                                    const StaticBatchSettings &settings = {});
+
+} // namespace nre
@@ -4,6 +4,7 @@
 
 // std
 #include <array>
+#include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -33,9 +34,7 @@ namespace nre
     {
         createSwapChain();
         createImageViews();
-        createRenderPass();
         createDepthResources();
-        createFramebuffers();
         createSyncObjects();
     }
 
@@ -53,19 +52,18 @@ namespace nre
             swapChain = nullptr;
         }
 
-        for (int i = 0; i < depthImages.size(); i++)
-        {
-            vkDestroyImageView(device.device(), depthImageViews[i], nullptr);
-            vkDestroyImage(device.device(), depthImages[i], nullptr);
-            vkFreeMemory(device.device(), depthImageMemorys[i], nullptr);
-        }
+        destroyTransientAttachments(depthImages, depthImageViews, depthImageMemory);
+        destroyTransientAttachments(gBufferAlbedoImages, gBufferAlbedoViews, gBufferAlbedoMemory);
+        destroyTransientAttachments(gBufferNormalImages, gBufferNormalViews, gBufferNormalMemory);
 
         for (auto framebuffer : swapChainFramebuffers)
         {
             vkDestroyFramebuffer(device.device(), framebuffer, nullptr);
         }
-
-        vkDestroyRenderPass(device.device(), renderPass, nullptr);
+        for (auto framebuffer : deferredFramebuffers)
+        {
+            vkDestroyFramebuffer(device.device(), framebuffer, nullptr);
+        }
 
         // cleanup synchronization objects
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
@@ -238,75 +236,16 @@ namespace nre
         }
     }
 
-    void NreSwapChain::createRenderPass()
+    void NreSwapChain::createFramebuffers(VkRenderPass renderPass)
     {
-        VkAttachmentDescription depthAttachment{};
-        depthAttachment.format = findDepthFormat();
-        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference depthAttachmentRef{};
-        depthAttachmentRef.attachment = 1;
-        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentDescription colorAttachment = {};
-        colorAttachment.format = getSwapChainImageFormat();
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-        VkAttachmentReference colorAttachmentRef = {};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachmentRef;
-        subpass.pDepthStencilAttachment = &depthAttachmentRef;
-
-        VkSubpassDependency dependency = {};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.srcAccessMask = 0;
-        dependency.srcStageMask =
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        dependency.dstSubpass = 0;
-        dependency.dstStageMask =
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        dependency.dstAccessMask =
-            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-        std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
-        VkRenderPassCreateInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-        renderPassInfo.pAttachments = attachments.data();
-        renderPassInfo.subpassCount = 1;
-        renderPassInfo.pSubpasses = &subpass;
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
-
-        if (vkCreateRenderPass(device.device(), &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to create render pass!");
-        }
-    }
+        assert(swapChainFramebuffers.empty() && "Framebuffers already created");
 
-    void NreSwapChain::createFramebuffers()
-    {
-        swapChainFramebuffers.resize(imageCount());
-        for (size_t i = 0; i < imageCount(); i++)
+        // every swap chain image with every frame in flight's depth image
+        swapChainFramebuffers.resize(MAX_FRAMES_IN_FLIGHT * imageCount());
+        for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
         {
-            std::array<VkImageView, 2> attachments = {swapChainImageViews[i], depthImageViews[i]};
+            std::array<VkImageView, 2> attachments = {
+                swapChainImageViews[i % imageCount()], depthImageViews[i / imageCount()]};
 
             VkExtent2D swapChainExtent = getSwapChainExtent();
             VkFramebufferCreateInfo framebufferInfo = {};
@@ -333,13 +272,84 @@ namespace nre
     {
         VkFormat depthFormat = findDepthFormat();
         swapChainDepthFormat = depthFormat;
-        VkExtent2D swapChainExtent = getSwapChainExtent();
 
-        depthImages.resize(imageCount());
-        depthImageMemorys.resize(imageCount());
-        depthImageViews.resize(imageCount());
+        // depth is never read after the pass, so one image per frame in flight is enough and
+        // tile based GPUs never have to back it with memory
+        // the deferred render pass reads it back as an input attachment
+        createTransientAttachments(
+            depthFormat,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+            VK_IMAGE_ASPECT_DEPTH_BIT,
+            depthImages,
+            depthImageViews,
+            depthImageMemory);
+    }
 
-        for (int i = 0; i < depthImages.size(); i++)
+    void NreSwapChain::createDeferredResources(VkRenderPass deferredRenderPass)
+    {
+        assert(!hasDeferredResources() && "Deferred resources already created");
+
+        // written and read within the deferred render pass, never stored
+        createTransientAttachments(
+            GBUFFER_ALBEDO_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            gBufferAlbedoImages,
+            gBufferAlbedoViews,
+            gBufferAlbedoMemory);
+        createTransientAttachments(
+            GBUFFER_NORMAL_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            gBufferNormalImages,
+            gBufferNormalViews,
+            gBufferNormalMemory);
+
+        // same as swapChainFramebuffers, with the frame's g-buffer
+        deferredFramebuffers.resize(MAX_FRAMES_IN_FLIGHT * imageCount());
+        for (size_t i = 0; i < deferredFramebuffers.size(); i++)
+        {
+            size_t frameIndex = i / imageCount();
+            std::array<VkImageView, 4> attachments = {
+                swapChainImageViews[i % imageCount()],
+                depthImageViews[frameIndex],
+                gBufferAlbedoViews[frameIndex],
+                gBufferNormalViews[frameIndex]};
+
+            VkExtent2D swapChainExtent = getSwapChainExtent();
+            VkFramebufferCreateInfo framebufferInfo = {};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = deferredRenderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            framebufferInfo.pAttachments = attachments.data();
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(
+                    device.device(),
+                    &framebufferInfo,
+                    nullptr,
+                    &deferredFramebuffers[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+        }
+    }
+
+    void NreSwapChain::createTransientAttachments(
+        VkFormat format,
+        VkImageUsageFlags usage,
+        VkImageAspectFlags aspect,
+        std::vector<VkImage> &images,
+        std::vector<VkImageView> &views,
+        VkDeviceMemory &memory)
+    {
+        VkExtent2D swapChainExtent = getSwapChainExtent();
+        images.resize(MAX_FRAMES_IN_FLIGHT);
+        views.resize(MAX_FRAMES_IN_FLIGHT);
+
+        for (size_t i = 0; i < images.size(); i++)
         {
             VkImageCreateInfo imageInfo{};
             imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -349,38 +359,85 @@ namespace nre
             imageInfo.extent.depth = 1;
             imageInfo.mipLevels = 1;
             imageInfo.arrayLayers = 1;
-            imageInfo.format = depthFormat;
+            imageInfo.format = format;
             imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
             imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+            imageInfo.usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
             imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
             imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
             imageInfo.flags = 0;
 
-            device.createImageWithInfo(
-                imageInfo,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                depthImages[i],
-                depthImageMemorys[i]);
+            if (vkCreateImage(device.device(), &imageInfo, nullptr, &images[i]) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create attachment image!");
+            }
+        }
+
+        // every image is the same size, they share one allocation
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device.device(), images[0], &memRequirements);
+        VkDeviceSize stride = (memRequirements.size + memRequirements.alignment - 1) /
+                              memRequirements.alignment * memRequirements.alignment;
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = stride * images.size();
+        try
+        {
+            allocInfo.memoryTypeIndex =
+                device.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+        }
+        catch (const std::exception &)
+        {
+            // desktop GPUs mostly, no lazily allocated memory
+            allocInfo.memoryTypeIndex =
+                device.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+        if (vkAllocateMemory(device.device(), &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate attachment image memory!");
+        }
+
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (vkBindImageMemory(device.device(), images[i], memory, stride * i) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to bind attachment image memory!");
+            }
 
             VkImageViewCreateInfo viewInfo{};
             viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            viewInfo.image = depthImages[i];
+            viewInfo.image = images[i];
             viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            viewInfo.format = depthFormat;
-            viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+            viewInfo.format = format;
+            viewInfo.subresourceRange.aspectMask = aspect;
             viewInfo.subresourceRange.baseMipLevel = 0;
             viewInfo.subresourceRange.levelCount = 1;
             viewInfo.subresourceRange.baseArrayLayer = 0;
             viewInfo.subresourceRange.layerCount = 1;
 
-            if (vkCreateImageView(device.device(), &viewInfo, nullptr, &depthImageViews[i]) != VK_SUCCESS)
+            if (vkCreateImageView(device.device(), &viewInfo, nullptr, &views[i]) != VK_SUCCESS)
             {
                 throw std::runtime_error("failed to create texture image view!");
             }
         }
     }
 
+    void NreSwapChain::destroyTransientAttachments(
+        std::vector<VkImage> &images,
+        std::vector<VkImageView> &views,
+        VkDeviceMemory memory)
+    {
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            vkDestroyImageView(device.device(), views[i], nullptr);
+            vkDestroyImage(device.device(), images[i], nullptr);
+        }
+        images.clear();
+        views.clear();
+        vkFreeMemory(device.device(), memory, nullptr);
+    }
+
     void NreSwapChain::createSyncObjects()
     {
         imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -15,11 +15,28 @@
 namespace nre
 {
 
+    // a frame's g-buffer, the input attachments of the deferred render pass's lighting subpass
+    struct GBufferViews
+    {
+        VkImageView albedo;
+        VkImageView normal;
+        VkImageView depth;
+    };
+
     class NreSwapChain
     {
     public:
         static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
 
+        // rgb albedo, a specular strength
+        static constexpr VkFormat GBUFFER_ALBEDO_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+        // xyz world space normal, w shininess
+        static constexpr VkFormat GBUFFER_NORMAL_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+        // subpasses of the deferred render pass
+        static constexpr uint32_t GBUFFER_SUBPASS = 0;
+        static constexpr uint32_t LIGHTING_SUBPASS = 1;
+        static constexpr uint32_t FORWARD_SUBPASS = 2;
+
         NreSwapChain(NreDevice &deviceRef, VkExtent2D windowExtent);
         NreSwapChain(NreDevice &deviceRef, VkExtent2D windowExtent, std::shared_ptr<NreSwapChain> previous);
         ~NreSwapChain();
@@ -27,9 +44,33 @@ namespace nre
         NreSwapChain(const NreSwapChain &) = delete;
         NreDevice &operator=(const NreSwapChain &) = delete;
 
-        VkFramebuffer getFrameBuffer(int index) { return swapChainFramebuffers[index]; }
-        VkRenderPass getRenderPass() { return renderPass; }
+        // depth images are per frame in flight, swap chain images aren't
+        VkFramebuffer getFrameBuffer(int frameIndex, int imageIndex)
+        {
+            return swapChainFramebuffers[frameIndex * imageCount() + imageIndex];
+        }
+        // the framebuffers for a render pass made with this swap chain's formats, the render pass
+        // outlives the swap chain so the caller owns it
+        void createFramebuffers(VkRenderPass renderPass);
+        // the g-buffer and framebuffers for a deferred render pass made with this swap chain's
+        // formats, not part of init since they are only needed once deferred shading is used
+        void createDeferredResources(VkRenderPass deferredRenderPass);
+        bool hasDeferredResources() const { return !deferredFramebuffers.empty(); }
+        // g-buffer, lighting and forward subpasses, same attachments as getFrameBuffer plus the
+        // g-buffer
+        VkFramebuffer getDeferredFrameBuffer(int frameIndex, int imageIndex)
+        {
+            return deferredFramebuffers[frameIndex * imageCount() + imageIndex];
+        }
+        GBufferViews getGBufferViews(int frameIndex)
+        {
+            return {gBufferAlbedoViews[frameIndex], gBufferNormalViews[frameIndex], depthImageViews[frameIndex]};
+        }
         VkImageView getImageView(int index) { return swapChainImageViews[index]; }
+        VkImage getImage(int index) { return swapChainImages[index]; }
+        VkImage getDepthImage(int frameIndex) { return depthImages[frameIndex]; }
+        VkImageView getDepthImageView(int frameIndex) { return depthImageViews[frameIndex]; }
+        VkFormat getSwapChainDepthFormat() { return swapChainDepthFormat; }
         size_t imageCount() { return swapChainImages.size(); }
         VkFormat getSwapChainImageFormat() { return swapChainImageFormat; }
         VkExtent2D getSwapChainExtent() { return swapChainExtent; }
@@ -55,8 +96,6 @@ namespace nre
         void createSwapChain();
         void createImageViews();
         void createDepthResources();
-        void createRenderPass();
-        void createFramebuffers();
         void createSyncObjects();
 
         // Helper functions
@@ -65,17 +104,38 @@ namespace nre
         VkPresentModeKHR chooseSwapPresentMode(
             const std::vector<VkPresentModeKHR> &availablePresentModes);
         VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);
+        // one image per frame in flight sharing one allocation, lazily allocated where the device
+        // has it
+        void createTransientAttachments(
+            VkFormat format,
+            VkImageUsageFlags usage,
+            VkImageAspectFlags aspect,
+            std::vector<VkImage> &images,
+            std::vector<VkImageView> &views,
+            VkDeviceMemory &memory);
+        void destroyTransientAttachments(
+            std::vector<VkImage> &images,
+            std::vector<VkImageView> &views,
+            VkDeviceMemory memory);
 
         VkFormat swapChainImageFormat;
         VkFormat swapChainDepthFormat;
         VkExtent2D swapChainExtent;
 
         std::vector<VkFramebuffer> swapChainFramebuffers;
-        VkRenderPass renderPass;
 
+        // transient attachments in lazily allocated memory where the device has it
         std::vector<VkImage> depthImages;
-        std::vector<VkDeviceMemory> depthImageMemorys;
+        VkDeviceMemory depthImageMemory;
         std::vector<VkImageView> depthImageViews;
+        // empty until createDeferredResources
+        std::vector<VkImage> gBufferAlbedoImages;
+        VkDeviceMemory gBufferAlbedoMemory = VK_NULL_HANDLE;
+        std::vector<VkImageView> gBufferAlbedoViews;
+        std::vector<VkImage> gBufferNormalImages;
+        VkDeviceMemory gBufferNormalMemory = VK_NULL_HANDLE;
+        std::vector<VkImageView> gBufferNormalViews;
+        std::vector<VkFramebuffer> deferredFramebuffers;
         std::vector<VkImage> swapChainImages;
         std::vector<VkImageView> swapChainImageViews;
 
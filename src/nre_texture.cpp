@@ -0,0 +1,510 @@
+#include "nre_texture.hpp"
+
+#include "nre_buffer.hpp"
+#include "nre_texture_atlas.hpp"
+#include "nre_texture_streamer.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+
+namespace nre {
+
+namespace {
+
+// level offsets in the staging buffer, covers the texel block size of every
+// supported format and optimalBufferCopyOffsetAlignment on common hardware
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+VkDeviceSize stagingSize(const Ktx2File &file) {
+  VkDeviceSize size = 0;
+  for (const auto &level : file.levels) {
+    size = alignUp(size, STAGING_ALIGNMENT) + level.size;
+  }
+  return size;
+}
+
+// the file without its first firstLevel levels, what gets uploaded of a
+// streamed texture
+Ktx2File withoutTopLevels(const Ktx2File &file, uint32_t firstLevel) {
+  Ktx2File tail = file;
+  tail.levels.erase(tail.levels.begin(), tail.levels.begin() + firstLevel);
+  tail.width = tail.levels[0].width;
+  tail.height = tail.levels[0].height;
+  return tail;
+}
+
+// bytes of the file's mip chain as uncompressed RGBA8, for the stats
+VkDeviceSize rgba8Size(const Ktx2File &file) {
+  VkDeviceSize size = 0;
+  for (const auto &level : file.levels) {
+    size += VkDeviceSize{level.width} * level.height * 4;
+  }
+  return size;
+}
+
+} // namespace
+
+TextureFormatInfo TextureFormatInfo::of(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+  case VK_FORMAT_BC4_UNORM_BLOCK:
+  case VK_FORMAT_BC4_SNORM_BLOCK:
+    return {8, 4, 4};
+  case VK_FORMAT_BC2_UNORM_BLOCK:
+  case VK_FORMAT_BC2_SRGB_BLOCK:
+  case VK_FORMAT_BC3_UNORM_BLOCK:
+  case VK_FORMAT_BC3_SRGB_BLOCK:
+  case VK_FORMAT_BC5_UNORM_BLOCK:
+  case VK_FORMAT_BC5_SNORM_BLOCK:
+  case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+  case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+    return {16, 4, 4};
+  case VK_FORMAT_R8_UNORM:
+    return {1};
+  case VK_FORMAT_R8G8_UNORM:
+    return {2};
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+    return {4};
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+    return {8};
+  default:
+    return {};
+  }
+}
+
+// *************** Texture *********************
+
+NreTexture::NreTexture(NreDevice &device, VkFormat format, uint32_t width,
+                       uint32_t height, uint32_t mipLevels,
+                       VkImageUsageFlags extraUsage)
+    : nreDevice{device}, format{format}, width{width}, height{height},
+      mipLevels{mipLevels} {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = width;
+  imageInfo.extent.height = height;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_SAMPLED_BIT | extraUsage;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             image, imageMemory);
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(device.device(), image, &memRequirements);
+  memorySize = memRequirements.size;
+}
+
+NreTexture::~NreTexture() {
+  for (auto &kv : views) {
+    vkDestroyImageView(nreDevice.device(), kv.second, nullptr);
+  }
+  vkDestroyImage(nreDevice.device(), image, nullptr);
+  vkFreeMemory(nreDevice.device(), imageMemory, nullptr);
+}
+
+VkImageView NreTexture::getView(uint32_t baseMip) {
+  assert(baseMip < mipLevels && "View past the last mip level");
+  auto it = views.find(baseMip);
+  if (it != views.end()) {
+    return it->second;
+  }
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = baseMip;
+  viewInfo.subresourceRange.levelCount = mipLevels - baseMip;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  VkImageView view;
+  if (vkCreateImageView(nreDevice.device(), &viewInfo, nullptr, &view) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create texture image view!");
+  }
+  views.emplace(baseMip, view);
+  return view;
+}
+
+// *************** Sampler Settings *********************
+
+bool SamplerSettings::operator<(const SamplerSettings &other) const {
+  return std::make_tuple(static_cast<int>(filter),
+                         static_cast<int>(mipmapMode),
+                         static_cast<int>(addressMode), maxAnisotropy) <
+         std::make_tuple(static_cast<int>(other.filter),
+                         static_cast<int>(other.mipmapMode),
+                         static_cast<int>(other.addressMode),
+                         other.maxAnisotropy);
+}
+
+// *************** Texture Cache *********************
+
+NreTextureCache::NreTextureCache(NreDevice &device,
+                                 NreBindlessTable &bindlessTable,
+                                 NreTextureStreamer *streamer)
+    : nreDevice{device}, bindlessTable{bindlessTable}, streamer{streamer},
+      atlas{std::make_unique<NreTextureAtlas>(device, bindlessTable)} {}
+
+NreTextureCache::~NreTextureCache() {
+  for (auto &kv : samplers) {
+    vkDestroySampler(nreDevice.device(), kv.second, nullptr);
+  }
+}
+
+std::string NreTextureCache::resolvePath(const std::string &path) {
+  size_t dot = path.find_last_of('.');
+  size_t slash = path.find_last_of("/\\");
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    return path + ".ktx2";
+  }
+  return path.substr(0, dot) + ".ktx2";
+}
+
+uint32_t NreTextureCache::generatedMipLevels(const Ktx2File &file) {
+  if (file.levels.size() != 1 ||
+      TextureFormatInfo::of(file.format).isCompressed() ||
+      !nreDevice.supportsFormatlessStorageWrites()) {
+    return 0;
+  }
+  // the shader's last workgroup only covers level 6 of a 4096 image
+  uint32_t maxSize = 1u << (NreDownsampler::MAX_MIP_LEVELS - 1);
+  if (file.width > maxSize || file.height > maxSize ||
+      (file.width == 1 && file.height == 1)) {
+    return 0;
+  }
+  try {
+    nreDevice.findSupportedFormat({file.format}, VK_IMAGE_TILING_OPTIMAL,
+                                  VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+  } catch (const std::exception &) {
+    // sRGB formats mostly, they keep their single level
+    return 0;
+  }
+  return NreDownsampler::mipLevelsFor(file.width, file.height);
+}
+
+uint32_t NreTextureCache::load(const std::string &path,
+                               const SamplerSettings &sampler) {
+  return loadAll({path}, sampler)[0];
+}
+
+std::vector<uint32_t>
+NreTextureCache::loadAll(const std::vector<std::string> &paths,
+                         const SamplerSettings &sampler) {
+  // open everything new first, so the uploads can be batched
+  // files holds what gets uploaded, streamedFiles the whole file of the
+  // ones the streamer takes over (firstLevels > 0)
+  // atlasFiles are packed instead
+  std::vector<std::string> pending;
+  std::vector<std::string> atlasPending;
+  std::vector<Ktx2File> atlasFiles;
+  std::vector<Ktx2File> files;
+  std::vector<Ktx2File> streamedFiles;
+  std::vector<uint32_t> firstLevels;
+  for (const auto &path : paths) {
+    std::string resolved = resolvePath(path);
+    if (entries.count(resolved) != 0 ||
+        std::find(pending.begin(), pending.end(), resolved) != pending.end() ||
+        std::find(atlasPending.begin(), atlasPending.end(), resolved) !=
+            atlasPending.end()) {
+      continue;
+    }
+    try {
+      // throws on formats TextureFormatInfo doesn't know too
+      Ktx2File file = Ktx2File::open(resolved);
+      // throws when the device can't sample the format, ie: BCn without
+      // textureCompressionBC
+      nreDevice.findSupportedFormat({file.format}, VK_IMAGE_TILING_OPTIMAL,
+                                    VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+      // small enough to never be worth streaming
+      if (atlas->accepts(file)) {
+        atlasPending.push_back(resolved);
+        atlasFiles.push_back(std::move(file));
+        continue;
+      }
+      uint32_t firstLevel =
+          streamer != nullptr ? streamer->tailLevel(file) : 0;
+      // a single level tail would get a generated chain on upload
+      if (file.levels.size() - firstLevel < 2) {
+        firstLevel = 0;
+      }
+      pending.push_back(resolved);
+      firstLevels.push_back(firstLevel);
+      if (firstLevel > 0) {
+        files.push_back(withoutTopLevels(file, firstLevel));
+        streamedFiles.push_back(std::move(file));
+      } else {
+        files.push_back(std::move(file));
+        streamedFiles.emplace_back();
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "texture cache: " << e.what() << std::endl;
+      entries[resolved] = Entry{};
+    }
+  }
+
+  // split into batches that fit the staging budget
+  VkSampler vkSampler = getSampler(sampler);
+  size_t first = 0;
+  while (first < files.size()) {
+    size_t last = first;
+    VkDeviceSize batchBytes = 0;
+    do {
+      batchBytes = alignUp(batchBytes, STAGING_ALIGNMENT) +
+                   stagingSize(files[last]);
+      last++;
+    } while (last < files.size() &&
+             alignUp(batchBytes, STAGING_ALIGNMENT) +
+                     stagingSize(files[last]) <=
+                 STAGING_BATCH_BYTES);
+
+    std::vector<Ktx2File> batch(files.begin() + first, files.begin() + last);
+    std::vector<std::unique_ptr<NreTexture>> textures;
+    upload(batch, textures);
+    for (size_t i = 0; i < batch.size(); i++) {
+      Entry &entry = entries[pending[first + i]];
+      entry.slot = bindlessTable.addTexture(textures[i]->getView(), vkSampler);
+      stats.textures++;
+      if (textures[i]->getMipLevels() > batch[i].levels.size()) {
+        stats.generatedMips++;
+      }
+      stats.memoryBytes += textures[i]->getMemorySize();
+      stats.uncompressedBytes += rgba8Size(batch[i]);
+      if (firstLevels[first + i] > 0) {
+        streamer->add(std::move(streamedFiles[first + i]),
+                      std::move(textures[i]), firstLevels[first + i],
+                      entry.slot, vkSampler);
+      } else {
+        entry.texture = std::move(textures[i]);
+      }
+    }
+    first = last;
+  }
+
+  if (!atlasFiles.empty()) {
+    VkDeviceSize atlasBytes = atlas->getMemorySize();
+    std::vector<AtlasEntry> placed = atlas->add(atlasFiles, vkSampler);
+    for (size_t i = 0; i < atlasFiles.size(); i++) {
+      Entry &entry = entries[atlasPending[i]];
+      entry.slot = placed[i].slot;
+      entry.uvTransform = placed[i].uvTransform;
+      stats.textures++;
+      stats.atlasTextures++;
+      stats.uncompressedBytes += rgba8Size(atlasFiles[i]);
+    }
+    stats.memoryBytes += atlas->getMemorySize() - atlasBytes;
+    stats.atlasPages = atlas->getPageCount();
+  }
+
+  std::vector<uint32_t> slots;
+  for (const auto &path : paths) {
+    slots.push_back(entries[resolvePath(path)].slot);
+  }
+  return slots;
+}
+
+void NreTextureCache::upload(
+    const std::vector<Ktx2File> &files,
+    std::vector<std::unique_ptr<NreTexture>> &textures) {
+  VkDeviceSize totalSize = 0;
+  for (const auto &file : files) {
+    totalSize = alignUp(totalSize, STAGING_ALIGNMENT) + stagingSize(file);
+  }
+
+  NreBuffer stagingBuffer{nreDevice, totalSize, 1,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+  stagingBuffer.map();
+  auto *staging = static_cast<uint8_t *>(stagingBuffer.getMappedMemory());
+
+  // every level of every texture, copied straight from the files
+  // targets are set for the textures the downsampler fills in
+  std::vector<std::vector<VkBufferImageCopy>> regions(files.size());
+  std::vector<std::unique_ptr<NreDownsampler::Target>> targets(files.size());
+  VkDeviceSize offset = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    const Ktx2File &file = files[i];
+    uint32_t generated = generatedMipLevels(file);
+    if (generated == 0) {
+      textures.push_back(std::make_unique<NreTexture>(
+          nreDevice, file.format, file.width, file.height,
+          static_cast<uint32_t>(file.levels.size())));
+    } else {
+      if (!downsampler) {
+        downsampler = std::make_unique<NreDownsampler>(nreDevice);
+      }
+      textures.push_back(std::make_unique<NreTexture>(
+          nreDevice, file.format, file.width, file.height, generated,
+          VK_IMAGE_USAGE_STORAGE_BIT));
+      targets[i] = downsampler->createTarget(textures[i]->getImage(),
+                                             file.format, file.width,
+                                             file.height, generated);
+    }
+    for (uint32_t level = 0; level < file.levels.size(); level++) {
+      offset = alignUp(offset, STAGING_ALIGNMENT);
+      file.readLevel(level, staging + offset);
+
+      VkBufferImageCopy region{};
+      region.bufferOffset = offset;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = level;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageExtent = {file.levels[level].width,
+                            file.levels[level].height, 1};
+      regions[i].push_back(region);
+      offset += file.levels[level].size;
+    }
+  }
+
+  std::vector<VkImageMemoryBarrier> barriers(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    VkImageMemoryBarrier &barrier = barriers[i];
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = textures[i]->getImage();
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = textures[i]->getMipLevels();
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+  }
+
+  // one submit for the whole batch
+  VkCommandBuffer commandBuffer = nreDevice.beginSingleTimeCommands();
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+  for (size_t i = 0; i < files.size(); i++) {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.getBuffer(),
+                           textures[i]->getImage(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions[i].size()),
+                           regions[i].data());
+  }
+  // generated chains go to GENERAL for the downsampler instead
+  std::vector<VkImageMemoryBarrier> generatedBarriers;
+  for (size_t i = 0; i < files.size(); i++) {
+    VkImageMemoryBarrier &barrier = barriers[i];
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    if (targets[i]) {
+      barrier.dstAccessMask =
+          VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+      generatedBarriers.push_back(barrier);
+    } else {
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr,
+                       static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+
+  if (!generatedBarriers.empty()) {
+    // one dispatch per texture, they don't depend on each other
+    for (auto &target : targets) {
+      if (target) {
+        downsampler->dispatch(commandBuffer, *target);
+      }
+    }
+    for (auto &barrier : generatedBarriers) {
+      barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr,
+                         static_cast<uint32_t>(generatedBarriers.size()),
+                         generatedBarriers.data());
+  }
+  // waits for the queue, so the targets can go with this scope
+  nreDevice.endSingleTimeCommands(commandBuffer);
+}
+
+NreTexture *NreTextureCache::get(const std::string &path) {
+  auto it = entries.find(resolvePath(path));
+  return it != entries.end() ? it->second.texture.get() : nullptr;
+}
+
+glm::vec4 NreTextureCache::getUvTransform(const std::string &path) const {
+  auto it = entries.find(resolvePath(path));
+  return it != entries.end() ? it->second.uvTransform
+                             : glm::vec4{1.f, 1.f, 0.f, 0.f};
+}
+
+VkSampler NreTextureCache::getSampler(const SamplerSettings &settings) {
+  auto it = samplers.find(settings);
+  if (it != samplers.end()) {
+    return it->second;
+  }
+
+  float maxAnisotropy = std::min(
+      settings.maxAnisotropy, nreDevice.properties.limits.maxSamplerAnisotropy);
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = settings.filter;
+  samplerInfo.minFilter = settings.filter;
+  samplerInfo.mipmapMode = settings.mipmapMode;
+  samplerInfo.addressModeU = settings.addressMode;
+  samplerInfo.addressModeV = settings.addressMode;
+  samplerInfo.addressModeW = settings.addressMode;
+  samplerInfo.anisotropyEnable = maxAnisotropy > 1.f ? VK_TRUE : VK_FALSE;
+  samplerInfo.maxAnisotropy = maxAnisotropy;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.minLod = 0.f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+
+  VkSampler sampler;
+  if (vkCreateSampler(nreDevice.device(), &samplerInfo, nullptr, &sampler) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create texture sampler!");
+  }
+  samplers.emplace(settings, sampler);
+  return sampler;
+}
+
+} // namespace nre
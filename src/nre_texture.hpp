@@ -0,0 +1,169 @@
+#pragma once
+
+#include "nre_bindless.hpp"
+#include "nre_device.hpp"
+#include "nre_downsampler.hpp"
+#include "nre_ktx2.hpp"
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nre {
+
+class NreTextureAtlas;
+class NreTextureStreamer;
+
+// texel blocks, 1x1 for uncompressed formats and 4x4 for BCn
+struct TextureFormatInfo {
+  uint32_t blockBytes = 0;
+  uint32_t blockWidth = 1;
+  uint32_t blockHeight = 1;
+
+  bool isCompressed() const { return blockWidth > 1; }
+  // 0 for formats textures can't be loaded in
+  static TextureFormatInfo of(VkFormat format);
+};
+
+// a sampled 2D image with a full or partial mip chain
+// views are cached per base mip level, so a view skipping the top levels
+// (ie: while they aren't resident) costs one vkCreateImageView
+class NreTexture {
+public:
+  // extraUsage on top of TRANSFER_DST and SAMPLED, ie: STORAGE for the
+  // downsampler
+  NreTexture(NreDevice &device, VkFormat format, uint32_t width,
+             uint32_t height, uint32_t mipLevels,
+             VkImageUsageFlags extraUsage = 0);
+  ~NreTexture();
+
+  NreTexture(const NreTexture &) = delete;
+  NreTexture &operator=(const NreTexture &) = delete;
+
+  VkImage getImage() const { return image; }
+  VkFormat getFormat() const { return format; }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  uint32_t getMipLevels() const { return mipLevels; }
+  // device memory the image takes
+  VkDeviceSize getMemorySize() const { return memorySize; }
+
+  // every level from baseMip down to the smallest one
+  VkImageView getView(uint32_t baseMip = 0);
+
+private:
+  NreDevice &nreDevice;
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipLevels;
+
+  VkImage image;
+  VkDeviceMemory imageMemory;
+  VkDeviceSize memorySize = 0;
+  std::unordered_map<uint32_t, VkImageView> views;
+};
+
+struct SamplerSettings {
+  VkFilter filter = VK_FILTER_LINEAR;
+  VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  // clamped to what the device supports, 1 disables anisotropic filtering
+  float maxAnisotropy = 16.f;
+
+  bool operator<(const SamplerSettings &other) const;
+};
+
+struct TextureStats {
+  uint32_t textures = 0;
+  // mip chains made by the downsampler
+  uint32_t generatedMips = 0;
+  // packed into shared atlas pages instead of an image of their own
+  uint32_t atlasTextures = 0;
+  uint32_t atlasPages = 0;
+  // device memory of the loaded textures
+  VkDeviceSize memoryBytes = 0;
+  // what the same mip chains would take as RGBA8
+  VkDeviceSize uncompressedBytes = 0;
+};
+
+// loads KTX2 textures once per path, uploads them in batches through shared
+// staging buffers and registers each one in the bindless table
+// BCn textures need the device's textureCompressionBC feature, uncompressed
+// ones (R8G8B8A8 and friends) load everywhere
+// uncompressed files with only level 0 get the rest of the chain from the
+// compute downsampler when the device and format allow it (not sRGB)
+// with a streamer, files with a mip chain only load the levels in the
+// streamer's resident tail and are handed over to it for the rest
+// small files with a mip chain go into NreTextureAtlas pages instead, their
+// materials need getUvTransform
+class NreTextureCache {
+public:
+  // staging memory of one upload batch, a texture bigger than that still gets
+  // a batch of its own
+  static constexpr VkDeviceSize STAGING_BATCH_BYTES = 64 * 1024 * 1024;
+
+  NreTextureCache(NreDevice &device, NreBindlessTable &bindlessTable,
+                  NreTextureStreamer *streamer = nullptr);
+  ~NreTextureCache();
+
+  NreTextureCache(const NreTextureCache &) = delete;
+  NreTextureCache &operator=(const NreTextureCache &) = delete;
+
+  // bindless slot of the texture, GpuMaterial::NO_TEXTURE when it can't be
+  // loaded (the reason is printed)
+  // paths without a .ktx2 extension load the .ktx2 file next to them, ie: an
+  // MTL's map_Kd brick.png loads brick.ktx2
+  // the sampler of the first load sticks with the texture
+  uint32_t load(const std::string &path,
+                const SamplerSettings &sampler = SamplerSettings{});
+  // same, but everything not cached yet is uploaded in as few submits as
+  // possible, blocks until the GPU is done
+  std::vector<uint32_t>
+  loadAll(const std::vector<std::string> &paths,
+          const SamplerSettings &sampler = SamplerSettings{});
+
+  // null unless loaded, and for streamed textures (the streamer swaps them)
+  NreTexture *get(const std::string &path);
+  // maps the texture's UVs into its atlas page (xy scale, zw offset), identity
+  // for textures with an image of their own
+  glm::vec4 getUvTransform(const std::string &path) const;
+  VkSampler getSampler(const SamplerSettings &settings);
+
+  const TextureStats &getStats() const { return stats; }
+
+private:
+  struct Entry {
+    std::unique_ptr<NreTexture> texture;
+    uint32_t slot = GpuMaterial::NO_TEXTURE;
+    glm::vec4 uvTransform{1.f, 1.f, 0.f, 0.f};
+  };
+
+  static std::string resolvePath(const std::string &path);
+  // levels the downsampler should make for file, 0 to upload it as is
+  uint32_t generatedMipLevels(const Ktx2File &file);
+  // creates the images of files and fills them from one staging buffer
+  void upload(const std::vector<Ktx2File> &files,
+              std::vector<std::unique_ptr<NreTexture>> &textures);
+
+  NreDevice &nreDevice;
+  NreBindlessTable &bindlessTable;
+  NreTextureStreamer *streamer;
+  // created with the first texture that needs it
+  std::unique_ptr<NreDownsampler> downsampler;
+  std::unique_ptr<NreTextureAtlas> atlas;
+
+  // keyed by the resolved path, failed loads are remembered too
+  std::unordered_map<std::string, Entry> entries;
+  std::map<SamplerSettings, VkSampler> samplers;
+  TextureStats stats{};
+};
+
+} // namespace nre
@@ -0,0 +1,264 @@
+#include "nre_texture_atlas.hpp"
+
+#include "nre_buffer.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <stdexcept>
+
+namespace nre {
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+NreTextureAtlas::NreTextureAtlas(NreDevice &device,
+                                 NreBindlessTable &bindlessTable,
+                                 const AtlasSettings &settings)
+    : nreDevice{device}, bindlessTable{bindlessTable}, settings{settings} {}
+
+uint32_t NreTextureAtlas::levelsFor(VkFormat format) const {
+  uint32_t blockWidth = TextureFormatInfo::of(format).blockWidth;
+  uint32_t levels = std::max(settings.levels, 1u);
+  // every level needs a whole block of guard band at block aligned positions
+  while (levels > 1 &&
+         (settings.padding >> (levels - 1)) < blockWidth) {
+    levels--;
+  }
+  return levels;
+}
+
+uint32_t NreTextureAtlas::alignmentFor(VkFormat format) const {
+  uint32_t blockWidth = TextureFormatInfo::of(format).blockWidth;
+  return blockWidth << (levelsFor(format) - 1);
+}
+
+bool NreTextureAtlas::accepts(const Ktx2File &file) const {
+  TextureFormatInfo info = TextureFormatInfo::of(file.format);
+  if (info.blockBytes == 0 || file.width > settings.maxEntrySize ||
+      file.height > settings.maxEntrySize) {
+    return false;
+  }
+  uint32_t levels = levelsFor(file.format);
+  uint32_t alignment = alignmentFor(file.format);
+  // levels have to halve exactly, the guard band can't wrap more than once
+  // and the padding keeps entries aligned
+  return file.levels.size() >= levels && file.width % alignment == 0 &&
+         file.height % alignment == 0 && file.width >= settings.padding &&
+         file.height >= settings.padding &&
+         settings.padding % alignment == 0 &&
+         file.width + 2 * settings.padding <= settings.pageSize &&
+         file.height + 2 * settings.padding <= settings.pageSize;
+}
+
+VkDeviceSize NreTextureAtlas::getMemorySize() const {
+  VkDeviceSize size = 0;
+  for (const auto &page : pages) {
+    size += page->texture->getMemorySize();
+  }
+  return size;
+}
+
+NreTextureAtlas::Placement NreTextureAtlas::allocate(VkFormat format,
+                                                     VkSampler sampler,
+                                                     uint32_t width,
+                                                     uint32_t height) {
+  uint32_t alignment = alignmentFor(format);
+  uint32_t paddedWidth = static_cast<uint32_t>(
+      alignUp(width + 2 * settings.padding, alignment));
+  uint32_t paddedHeight = static_cast<uint32_t>(
+      alignUp(height + 2 * settings.padding, alignment));
+
+  for (auto &page : pages) {
+    if (page->format != format || page->sampler != sampler) {
+      continue;
+    }
+    // next shelf when the current one is full
+    if (page->cursorX + paddedWidth > settings.pageSize) {
+      page->shelfY += page->shelfHeight;
+      page->shelfHeight = 0;
+      page->cursorX = 0;
+    }
+    if (page->shelfY + paddedHeight > settings.pageSize) {
+      continue;
+    }
+    Placement placement{page.get(), page->cursorX + settings.padding,
+                        page->shelfY + settings.padding};
+    page->cursorX += paddedWidth;
+    page->shelfHeight = std::max(page->shelfHeight, paddedHeight);
+    return placement;
+  }
+
+  auto page = std::make_unique<Page>();
+  page->texture = std::make_unique<NreTexture>(
+      nreDevice, format, settings.pageSize, settings.pageSize,
+      levelsFor(format));
+  page->format = format;
+  page->sampler = sampler;
+  // sampled before the first upload's submit finishes isn't possible, the
+  // slot only reaches materials once add returns
+  page->slot = bindlessTable.addTexture(page->texture->getView(), sampler);
+  page->cursorX = paddedWidth;
+  page->shelfHeight = paddedHeight;
+  pages.push_back(std::move(page));
+  return {pages.back().get(), settings.padding, settings.padding};
+}
+
+std::vector<AtlasEntry>
+NreTextureAtlas::add(const std::vector<Ktx2File> &files, VkSampler sampler) {
+  // tallest first, shelves waste less
+  std::vector<size_t> order(files.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return files[a].height > files[b].height;
+  });
+
+  std::vector<AtlasEntry> entries(files.size());
+  std::vector<Placement> placements(files.size());
+  float pageSize = static_cast<float>(settings.pageSize);
+  for (size_t i : order) {
+    const Ktx2File &file = files[i];
+    assert(accepts(file) && "File can't be packed into an atlas");
+    placements[i] = allocate(file.format, sampler, file.width, file.height);
+    entries[i].slot = placements[i].page->slot;
+    entries[i].uvTransform = {file.width / pageSize, file.height / pageSize,
+                              placements[i].x / pageSize,
+                              placements[i].y / pageSize};
+  }
+
+  // the levels the pages have, straight from the files
+  VkDeviceSize stagingSize = 0;
+  for (const auto &file : files) {
+    for (uint32_t level = 0; level < levelsFor(file.format); level++) {
+      stagingSize = alignUp(stagingSize, 16) + file.levels[level].size;
+    }
+  }
+  NreBuffer stagingBuffer{nreDevice, stagingSize, 1,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+  stagingBuffer.map();
+  auto *staging = static_cast<uint8_t *>(stagingBuffer.getMappedMemory());
+
+  // per page, so each page is copied to with one call
+  std::vector<Page *> touched;
+  std::vector<std::vector<VkBufferImageCopy>> regions;
+  VkDeviceSize offset = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    const Ktx2File &file = files[i];
+    const Placement &placement = placements[i];
+    TextureFormatInfo info = TextureFormatInfo::of(file.format);
+
+    auto it = std::find(touched.begin(), touched.end(), placement.page);
+    size_t pageIndex = static_cast<size_t>(it - touched.begin());
+    if (it == touched.end()) {
+      touched.push_back(placement.page);
+      regions.emplace_back();
+    }
+
+    for (uint32_t level = 0; level < levelsFor(file.format); level++) {
+      offset = alignUp(offset, 16);
+      file.readLevel(level, staging + offset);
+
+      uint32_t width = file.levels[level].width;
+      uint32_t height = file.levels[level].height;
+      uint32_t pad = settings.padding >> level;
+      int32_t x = static_cast<int32_t>(placement.x >> level);
+      int32_t y = static_cast<int32_t>(placement.y >> level);
+      int32_t w = static_cast<int32_t>(width);
+      int32_t h = static_cast<int32_t>(height);
+      int32_t p = static_cast<int32_t>(pad);
+
+      // a rectangle of the staged level to a spot in the page, the guard
+      // band is the opposite edge of the texture
+      auto copy = [&](uint32_t srcX, uint32_t srcY, uint32_t copyWidth,
+                      uint32_t copyHeight, int32_t dstX, int32_t dstY) {
+        VkBufferImageCopy region{};
+        region.bufferOffset =
+            offset + (VkDeviceSize{srcY / info.blockHeight} *
+                          (width / info.blockWidth) +
+                      srcX / info.blockWidth) *
+                         info.blockBytes;
+        region.bufferRowLength = width;
+        region.bufferImageHeight = height;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {dstX, dstY, 0};
+        region.imageExtent = {copyWidth, copyHeight, 1};
+        regions[pageIndex].push_back(region);
+      };
+      copy(0, 0, width, height, x, y);
+      copy(width - pad, 0, pad, height, x - p, y);
+      copy(0, 0, pad, height, x + w, y);
+      copy(0, height - pad, width, pad, x, y - p);
+      copy(0, 0, width, pad, x, y + h);
+      copy(width - pad, height - pad, pad, pad, x - p, y - p);
+      copy(0, height - pad, pad, pad, x + w, y - p);
+      copy(width - pad, 0, pad, pad, x - p, y + h);
+      copy(0, 0, pad, pad, x + w, y + h);
+
+      offset += file.levels[level].size;
+    }
+  }
+
+  // pages that already hold entries keep them
+  std::vector<VkImageMemoryBarrier> barriers;
+  for (Page *page : touched) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = page->fresh ? 0 : VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = page->fresh ? VK_IMAGE_LAYOUT_UNDEFINED
+                                    : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = page->texture->getImage();
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = page->texture->getMipLevels();
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barriers.push_back(barrier);
+  }
+
+  VkCommandBuffer commandBuffer = nreDevice.beginSingleTimeCommands();
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+  for (size_t i = 0; i < touched.size(); i++) {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.getBuffer(),
+                           touched[i]->texture->getImage(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions[i].size()),
+                           regions[i].data());
+  }
+  for (auto &barrier : barriers) {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+  // waits for the queue, frames sampling the pages are done before the copy
+  nreDevice.endSingleTimeCommands(commandBuffer);
+
+  for (Page *page : touched) {
+    page->fresh = false;
+  }
+  return entries;
+}
+
+} // namespace nre
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "nre_bindless.hpp"
+#include "nre_device.hpp"
+#include "nre_ktx2.hpp"
+#include "nre_texture.hpp"
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace nre {
+
+struct AtlasSettings {
+  // pages are square, with settings.levels mip levels
+  uint32_t pageSize = 2048;
+  // textures up to this size on both sides are packed, bigger ones get an
+  // image of their own
+  uint32_t maxEntrySize = 256;
+  // guard band around every entry at level 0, filled with the texture wrapped
+  // around so repeating UVs filter across the edge like a texture of its own
+  uint32_t padding = 8;
+  // mip levels of a page, block compressed formats get fewer so every level
+  // keeps at least one block of guard band
+  uint32_t levels = 4;
+};
+
+// where a texture ended up: the page's bindless slot and what maps the
+// texture's 0-1 UVs into the page (xy scale, zw offset)
+struct AtlasEntry {
+  uint32_t slot = GpuMaterial::NO_TEXTURE;
+  glm::vec4 uvTransform{1.f, 1.f, 0.f, 0.f};
+};
+
+// packs small textures into shared page images, one image, allocation and
+// bindless slot per page instead of per texture
+// entries are shelf packed at positions aligned so each of the page's levels
+// starts on a texel block boundary, every level is copied from the file's
+// own mip chain
+// shaders wrap the UV themselves (fract, then the transform) and sample with
+// the unwrapped derivatives, see material.glsl
+class NreTextureAtlas {
+public:
+  NreTextureAtlas(NreDevice &device, NreBindlessTable &bindlessTable,
+                  const AtlasSettings &settings = AtlasSettings{});
+
+  NreTextureAtlas(const NreTextureAtlas &) = delete;
+  NreTextureAtlas &operator=(const NreTextureAtlas &) = delete;
+
+  // small enough, sizes that stay block aligned down to the page's last level
+  // and at least that many levels in the file
+  bool accepts(const Ktx2File &file) const;
+  // packs and uploads accepted files in one submit, pages are shared by
+  // textures with the same format and sampler
+  std::vector<AtlasEntry> add(const std::vector<Ktx2File> &files,
+                              VkSampler sampler);
+
+  uint32_t getPageCount() const { return static_cast<uint32_t>(pages.size()); }
+  VkDeviceSize getMemorySize() const;
+
+private:
+  struct Page {
+    std::unique_ptr<NreTexture> texture;
+    uint32_t slot = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkSampler sampler = VK_NULL_HANDLE;
+    // the shelf being filled
+    uint32_t shelfY = 0;
+    uint32_t shelfHeight = 0;
+    uint32_t cursorX = 0;
+    // still UNDEFINED, nothing to keep when uploading
+    bool fresh = true;
+  };
+
+  struct Placement {
+    Page *page;
+    // top left of the texture itself, inside its guard band
+    uint32_t x;
+    uint32_t y;
+  };
+
+  uint32_t levelsFor(VkFormat format) const;
+  // entry positions and padded sizes are multiples of this
+  uint32_t alignmentFor(VkFormat format) const;
+  // room for a padded entry in a page of format and sampler, opens a new page
+  // when none has it
+  Placement allocate(VkFormat format, VkSampler sampler, uint32_t width,
+                     uint32_t height);
+
+  NreDevice &nreDevice;
+  NreBindlessTable &bindlessTable;
+  AtlasSettings settings;
+  std::vector<std::unique_ptr<Page>> pages;
+};
+
+} // namespace nre
@@ -0,0 +1,459 @@
+#include "nre_texture_streamer.hpp"
+
+// libs
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+namespace nre {
+
+namespace {
+
+// offsets of the levels in a load and in the staging buffer
+constexpr VkDeviceSize LEVEL_ALIGNMENT = 16;
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+NreTextureStreamer::NreTextureStreamer(NreDevice &device,
+                                       NreBindlessTable &bindlessTable,
+                                       const TextureStreamingSettings &settings)
+    : settings{settings}, nreDevice{device}, bindlessTable{bindlessTable} {
+  reader = std::thread{&NreTextureStreamer::readerLoop, this};
+}
+
+NreTextureStreamer::~NreTextureStreamer() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+    queued.clear();
+  }
+  loadQueued.notify_all();
+  reader.join();
+}
+
+VkDeviceSize NreTextureStreamer::chainBytes(const Ktx2File &file,
+                                            uint32_t firstLevel) {
+  VkDeviceSize size = 0;
+  for (size_t level = firstLevel; level < file.levels.size(); level++) {
+    size += file.levels[level].size;
+  }
+  return size;
+}
+
+uint32_t NreTextureStreamer::tailLevel(const Ktx2File &file) const {
+  for (uint32_t level = 0; level < file.levels.size(); level++) {
+    const auto &l = file.levels[level];
+    if (std::max(l.width, l.height) <= settings.residentTailSize) {
+      return level;
+    }
+  }
+  // even the smallest level is bigger than the tail, keep that one
+  return static_cast<uint32_t>(file.levels.size()) - 1;
+}
+
+void NreTextureStreamer::add(Ktx2File file,
+                             std::unique_ptr<NreTexture> texture,
+                             uint32_t firstLevel, uint32_t slot,
+                             VkSampler sampler) {
+  assert(textures.count(slot) == 0 && "Slot is already streamed");
+  stats.residentBytes += texture->getMemorySize();
+  stats.textures++;
+
+  Texture &entry = textures[slot];
+  entry.file = std::move(file);
+  entry.texture = std::move(texture);
+  entry.slot = slot;
+  entry.sampler = sampler;
+  entry.residentLevel = firstLevel;
+  entry.tailLevel = firstLevel;
+  entry.wantedLevel = firstLevel;
+}
+
+void NreTextureStreamer::update(FrameInfo &frameInfo) {
+  // the frame that last used these has finished
+  retired[frameInfo.frameIndex].textures.clear();
+  retired[frameInfo.frameIndex].stagingBuffers.clear();
+  if (textures.empty()) {
+    return;
+  }
+  computeWantedLevels(frameInfo);
+  applyBudget();
+
+  std::vector<Swap> swaps;
+
+  // drop levels that went unneeded for long enough, right away when over
+  // budget
+  bool overBudget = stats.residentBytes > settings.budgetBytes;
+  for (auto &kv : textures) {
+    Texture &texture = kv.second;
+    if (texture.loading || texture.wantedLevel <= texture.residentLevel) {
+      texture.unneededFrames = 0;
+      continue;
+    }
+    texture.unneededFrames++;
+    if (overBudget || texture.unneededFrames >= settings.evictDelayFrames) {
+      swaps.push_back({&texture, texture.wantedLevel});
+    }
+  }
+
+  queueLoads();
+
+  // finished reads, up to the upload budget
+  std::vector<std::unique_ptr<Load>> loads;
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    VkDeviceSize uploadBytes = 0;
+    while (!finished.empty() &&
+           (loads.empty() ||
+            uploadBytes + finished.front()->data.size() <=
+                settings.uploadBytesPerFrame)) {
+      uploadBytes += finished.front()->data.size();
+      loads.push_back(std::move(finished.front()));
+      finished.pop_front();
+    }
+  }
+  for (auto &load : loads) {
+    Texture &texture = textures.at(load->slot);
+    texture.loading = false;
+    stats.pendingLoads--;
+    if (load->failed) {
+      texture.failed = true;
+      continue;
+    }
+    assert(load->endLevel == texture.residentLevel &&
+           "Resident levels changed during a load");
+    swaps.push_back({&texture, load->firstLevel});
+    swaps.back().load = load.get();
+  }
+
+  if (!swaps.empty()) {
+    swapTextures(frameInfo, swaps);
+  }
+}
+
+void NreTextureStreamer::computeWantedLevels(FrameInfo &frameInfo) {
+  for (auto &kv : textures) {
+    kv.second.wantedLevel = kv.second.tailLevel;
+    kv.second.priority = 0.f;
+  }
+
+  const float viewportHeight = static_cast<float>(frameInfo.extent.height);
+  auto frustumPlanes = frameInfo.camera.getFrustumPlanes();
+  for (auto &kv : frameInfo.gameObjects) {
+    auto &obj = kv.second;
+    if (obj.model == nullptr || !obj.visible || obj.lod.culled ||
+        obj.model->getTextureSlots().empty()) {
+      continue;
+    }
+
+    const auto &sphere = obj.model->getBoundingSphere();
+    glm::vec3 scale = glm::abs(obj.transform.scale);
+    float worldScale = std::max({scale.x, scale.y, scale.z});
+    glm::vec3 center{obj.transform.mat4() * glm::vec4{sphere.center, 1.f}};
+    if (!sphereInFrustum(frustumPlanes, center, sphere.radius * worldScale)) {
+      continue;
+    }
+    // pixels the object covers across, huge when the camera is inside it
+    float diameter = 2.f * sphere.radius *
+                     frameInfo.camera.projectedSize(center, worldScale,
+                                                    viewportHeight);
+    if (diameter <= 0.f) {
+      continue;
+    }
+
+    for (uint32_t slot : obj.model->getTextureSlots()) {
+      auto it = textures.find(slot);
+      if (it == textures.end()) {
+        continue;
+      }
+      Texture &texture = it->second;
+      // one texel per pixel
+      float size = static_cast<float>(
+          std::max(texture.file.width, texture.file.height));
+      float level = std::log2(size / diameter) + settings.mipBias;
+      uint32_t wanted =
+          level <= 0.f
+              ? 0
+              : std::min(static_cast<uint32_t>(level), texture.tailLevel);
+      texture.wantedLevel = std::min(texture.wantedLevel, wanted);
+      texture.priority = std::max(texture.priority, diameter);
+    }
+  }
+}
+
+void NreTextureStreamer::applyBudget() {
+  std::vector<Texture *> byPriority;
+  VkDeviceSize total = 0;
+  for (auto &kv : textures) {
+    byPriority.push_back(&kv.second);
+    total += chainBytes(kv.second.file, kv.second.wantedLevel);
+  }
+  stats.wantedBytes = total;
+  if (total <= settings.budgetBytes) {
+    return;
+  }
+
+  // the smallest on screen give up their top levels first
+  std::sort(byPriority.begin(), byPriority.end(),
+            [](const Texture *a, const Texture *b) {
+              return a->priority < b->priority;
+            });
+  for (Texture *texture : byPriority) {
+    while (total > settings.budgetBytes &&
+           texture->wantedLevel < texture->tailLevel) {
+      total -= texture->file.levels[texture->wantedLevel].size;
+      texture->wantedLevel++;
+    }
+    if (total <= settings.budgetBytes) {
+      break;
+    }
+  }
+}
+
+void NreTextureStreamer::queueLoads() {
+  std::vector<Texture *> candidates;
+  for (auto &kv : textures) {
+    Texture &texture = kv.second;
+    if (!texture.loading && !texture.failed &&
+        texture.wantedLevel < texture.residentLevel) {
+      candidates.push_back(&texture);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Texture *a, const Texture *b) {
+              return a->priority > b->priority;
+            });
+
+  std::lock_guard<std::mutex> lock{mutex};
+  for (Texture *texture : candidates) {
+    if (stats.pendingLoads >= settings.maxPendingLoads) {
+      break;
+    }
+    auto load = std::make_unique<Load>();
+    load->slot = texture->slot;
+    load->file = texture->file;
+    load->firstLevel = texture->wantedLevel;
+    load->endLevel = texture->residentLevel;
+    texture->loading = true;
+    texture->unneededFrames = 0;
+    stats.pendingLoads++;
+    queued.push_back(std::move(load));
+  }
+  loadQueued.notify_one();
+}
+
+void NreTextureStreamer::readerLoop() {
+  while (true) {
+    std::unique_ptr<Load> load;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      loadQueued.wait(lock, [&]() { return stopping || !queued.empty(); });
+      if (stopping) {
+        return;
+      }
+      load = std::move(queued.front());
+      queued.pop_front();
+    }
+
+    try {
+      VkDeviceSize size = 0;
+      for (uint32_t level = load->firstLevel; level < load->endLevel;
+           level++) {
+        size = alignUp(size, LEVEL_ALIGNMENT);
+        load->offsets.push_back(size);
+        size += load->file.levels[level].size;
+      }
+      load->data.resize(size);
+      for (uint32_t level = load->firstLevel; level < load->endLevel;
+           level++) {
+        load->file.readLevel(
+            level, load->data.data() + load->offsets[level - load->firstLevel]);
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "texture streamer: " << e.what() << std::endl;
+      load->data.clear();
+      load->failed = true;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex};
+    finished.push_back(std::move(load));
+  }
+}
+
+void NreTextureStreamer::swapTextures(FrameInfo &frameInfo,
+                                      std::vector<Swap> &swaps) {
+  VkDeviceSize stagingSize = 0;
+  for (auto &swap : swaps) {
+    const Texture &texture = *swap.texture;
+    const Ktx2File &file = texture.file;
+    const auto &top = file.levels[swap.newResidentLevel];
+    swap.newTexture = std::make_unique<NreTexture>(
+        nreDevice, file.format, top.width, top.height,
+        static_cast<uint32_t>(file.levels.size()) - swap.newResidentLevel);
+    if (swap.load != nullptr) {
+      stagingSize = alignUp(stagingSize, LEVEL_ALIGNMENT);
+      swap.stagingOffset = stagingSize;
+      stagingSize += swap.load->data.size();
+    }
+  }
+
+  std::unique_ptr<NreBuffer> stagingBuffer;
+  if (stagingSize > 0) {
+    stagingBuffer = std::make_unique<NreBuffer>(
+        nreDevice, stagingSize, 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    stagingBuffer->map();
+    for (auto &swap : swaps) {
+      if (swap.load != nullptr) {
+        stagingBuffer->writeToBuffer(swap.load->data.data(),
+                                     swap.load->data.size(),
+                                     swap.stagingOffset);
+      }
+    }
+  }
+
+  auto imageBarrier = [](VkImage image, uint32_t levels) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    return barrier;
+  };
+
+  // new images to TRANSFER_DST, old ones to TRANSFER_SRC
+  // the barrier also waits for earlier frames still sampling the old images
+  std::vector<VkImageMemoryBarrier> barriers;
+  for (auto &swap : swaps) {
+    VkImageMemoryBarrier dst =
+        imageBarrier(swap.newTexture->getImage(),
+                     swap.newTexture->getMipLevels());
+    dst.srcAccessMask = 0;
+    dst.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    dst.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    dst.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers.push_back(dst);
+
+    const NreTexture &old = *swap.texture->texture;
+    VkImageMemoryBarrier src =
+        imageBarrier(old.getImage(), old.getMipLevels());
+    src.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    src.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    src.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    src.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers.push_back(src);
+  }
+
+  VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+
+  for (auto &swap : swaps) {
+    const Texture &texture = *swap.texture;
+    const Ktx2File &file = texture.file;
+
+    // new levels from the staging buffer
+    if (swap.load != nullptr) {
+      std::vector<VkBufferImageCopy> regions;
+      for (uint32_t level = swap.load->firstLevel;
+           level < swap.load->endLevel; level++) {
+        VkBufferImageCopy region{};
+        region.bufferOffset =
+            swap.stagingOffset +
+            swap.load->offsets[level - swap.load->firstLevel];
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level - swap.newResidentLevel;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {file.levels[level].width,
+                              file.levels[level].height, 1};
+        regions.push_back(region);
+      }
+      vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->getBuffer(),
+                             swap.newTexture->getImage(),
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             static_cast<uint32_t>(regions.size()),
+                             regions.data());
+    }
+
+    // the levels both chains have never leave the GPU
+    std::vector<VkImageCopy> copies;
+    uint32_t shared = std::max(texture.residentLevel, swap.newResidentLevel);
+    for (uint32_t level = shared; level < file.levels.size(); level++) {
+      VkImageCopy copy{};
+      copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      copy.srcSubresource.mipLevel = level - texture.residentLevel;
+      copy.srcSubresource.baseArrayLayer = 0;
+      copy.srcSubresource.layerCount = 1;
+      copy.dstSubresource = copy.srcSubresource;
+      copy.dstSubresource.mipLevel = level - swap.newResidentLevel;
+      copy.extent = {file.levels[level].width, file.levels[level].height, 1};
+      copies.push_back(copy);
+    }
+    vkCmdCopyImage(commandBuffer, texture.texture->getImage(),
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   swap.newTexture->getImage(),
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(copies.size()), copies.data());
+  }
+
+  barriers.clear();
+  for (auto &swap : swaps) {
+    VkImageMemoryBarrier barrier =
+        imageBarrier(swap.newTexture->getImage(),
+                     swap.newTexture->getMipLevels());
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers.push_back(barrier);
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+  // the old images stay in TRANSFER_SRC, nothing samples them after this
+  // frame's set is repointed below
+  Retired &frameRetired = retired[frameInfo.frameIndex];
+  if (stagingBuffer) {
+    frameRetired.stagingBuffers.push_back(std::move(stagingBuffer));
+  }
+
+  for (auto &swap : swaps) {
+    Texture &texture = *swap.texture;
+    if (swap.newResidentLevel < texture.residentLevel) {
+      stats.levelsLoaded += texture.residentLevel - swap.newResidentLevel;
+    } else {
+      stats.levelsEvicted += swap.newResidentLevel - texture.residentLevel;
+    }
+    stats.residentBytes -= texture.texture->getMemorySize();
+    stats.residentBytes += swap.newTexture->getMemorySize();
+
+    // the other frame indices switch in their beginFrame, by the time this
+    // one comes around again all of them have
+    bindlessTable.updateTexture(frameInfo.frameIndex, texture.slot,
+                                swap.newTexture->getView(), texture.sampler);
+    frameRetired.textures.push_back(std::move(texture.texture));
+    texture.texture = std::move(swap.newTexture);
+    texture.residentLevel = swap.newResidentLevel;
+    texture.unneededFrames = 0;
+  }
+}
+
+} // namespace nre
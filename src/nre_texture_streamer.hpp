@@ -0,0 +1,165 @@
+#pragma once
+
+#include "nre_bindless.hpp"
+#include "nre_buffer.hpp"
+#include "nre_device.hpp"
+#include "nre_frame_info.hpp"
+#include "nre_ktx2.hpp"
+#include "nre_swap_chain.hpp"
+#include "nre_texture.hpp"
+
+// std
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace nre {
+
+struct TextureStreamingSettings {
+  // device memory all streamed textures may take together
+  VkDeviceSize budgetBytes = 256 * 1024 * 1024;
+  // levels at most this wide stay resident from load on, so every texture
+  // always has something to sample
+  uint32_t residentTailSize = 64;
+  // added to the level each texture needs, > 0 trades sharpness for memory
+  float mipBias = 0.f;
+  // updates a level has to go unneeded before it is dropped (unless the
+  // budget is exceeded), stops textures at a boundary from reloading
+  uint32_t evictDelayFrames = 120;
+  // level bytes uploaded per update, bounds the copies added to a frame
+  // a single load bigger than that still goes through on its own
+  VkDeviceSize uploadBytesPerFrame = 16 * 1024 * 1024;
+  // reads queued on the reader thread at once, the rest wait for their turn
+  // so priorities are re-evaluated every update
+  uint32_t maxPendingLoads = 4;
+};
+
+struct TextureStreamingStats {
+  uint32_t textures = 0;
+  // device memory of the streamed textures right now
+  VkDeviceSize residentBytes = 0;
+  // what the levels the screen asks for would take without a budget
+  VkDeviceSize wantedBytes = 0;
+  uint32_t pendingLoads = 0;
+  uint64_t levelsLoaded = 0;
+  uint64_t levelsEvicted = 0;
+};
+
+// keeps only the mip levels of each texture its objects need on screen
+// every update the level a texture needs comes from the projected size of the
+// visible objects sampling it (assuming their UVs span it once), the largest
+// objects win when the budget can't fit everything
+// missing levels are read from the KTX2 file on a reader thread, then the
+// texture is swapped for one with the new chain: shared levels are copied on
+// the GPU and the bindless slot is repointed, so materials never change
+// the copies go into the frame's command buffer, the old image is kept until
+// that frame index comes around again
+// textures are handed over by NreTextureCache with only their tail resident
+class NreTextureStreamer {
+public:
+  NreTextureStreamer(
+      NreDevice &device, NreBindlessTable &bindlessTable,
+      const TextureStreamingSettings &settings = TextureStreamingSettings{});
+  // drops queued reads, waits for the one in progress
+  ~NreTextureStreamer();
+
+  NreTextureStreamer(const NreTextureStreamer &) = delete;
+  NreTextureStreamer &operator=(const NreTextureStreamer &) = delete;
+
+  // first level of file loaded up front, 0 when the whole chain is within
+  // the resident tail and streaming it isn't worth it
+  uint32_t tailLevel(const Ktx2File &file) const;
+  // takes over a texture holding file's levels from firstLevel on, sampled
+  // through slot with sampler
+  void add(Ktx2File file, std::unique_ptr<NreTexture> texture,
+           uint32_t firstLevel, uint32_t slot, VkSampler sampler);
+
+  // picks the levels every texture needs, queues reads and swaps in the ones
+  // that finished
+  // records the swaps into frameInfo.commandBuffer, call it outside a render
+  // pass and before recording anything that samples the textures
+  void update(FrameInfo &frameInfo);
+
+  const TextureStreamingStats &getStats() const { return stats; }
+
+  TextureStreamingSettings settings;
+
+private:
+  struct Texture {
+    Ktx2File file;
+    std::unique_ptr<NreTexture> texture;
+    uint32_t slot = 0;
+    VkSampler sampler = VK_NULL_HANDLE;
+    // file level the texture's level 0 holds
+    uint32_t residentLevel = 0;
+    // never dropped
+    uint32_t tailLevel = 0;
+    // recomputed every update
+    uint32_t wantedLevel = 0;
+    float priority = 0.f;
+    uint32_t unneededFrames = 0;
+    // no eviction while a read is in flight, the load assumes residentLevel
+    bool loading = false;
+    // a read failed, the texture keeps what it has
+    bool failed = false;
+  };
+
+  // levels [firstLevel, endLevel) of a file, read on the reader thread
+  struct Load {
+    uint32_t slot = 0;
+    Ktx2File file;
+    uint32_t firstLevel = 0;
+    uint32_t endLevel = 0;
+    // levels back to back, each at an aligned offset
+    std::vector<uint8_t> data;
+    std::vector<VkDeviceSize> offsets;
+    bool failed = false;
+  };
+
+  // a texture and the chain it is about to be swapped to
+  struct Swap {
+    Texture *texture = nullptr;
+    uint32_t newResidentLevel = 0;
+    // created by swapTextures
+    std::unique_ptr<NreTexture> newTexture{};
+    // null for evictions
+    Load *load = nullptr;
+    VkDeviceSize stagingOffset = 0;
+  };
+
+  static VkDeviceSize chainBytes(const Ktx2File &file, uint32_t firstLevel);
+
+  void computeWantedLevels(FrameInfo &frameInfo);
+  void applyBudget();
+  void queueLoads();
+  void swapTextures(FrameInfo &frameInfo, std::vector<Swap> &swaps);
+  void readerLoop();
+
+  NreDevice &nreDevice;
+  NreBindlessTable &bindlessTable;
+  // keyed by bindless slot
+  std::unordered_map<uint32_t, Texture> textures;
+  // replaced images and used staging buffers, per frame index, released once
+  // its fence signaled again
+  struct Retired {
+    std::vector<std::unique_ptr<NreTexture>> textures;
+    std::vector<std::unique_ptr<NreBuffer>> stagingBuffers;
+  };
+  std::array<Retired, NreSwapChain::MAX_FRAMES_IN_FLIGHT> retired{};
+  TextureStreamingStats stats{};
+
+  std::mutex mutex;
+  std::condition_variable loadQueued;
+  std::deque<std::unique_ptr<Load>> queued;
+  std::deque<std::unique_ptr<Load>> finished;
+  bool stopping = false;
+  std::thread reader;
+};
+
+} // namespace nre
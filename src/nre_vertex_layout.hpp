@@ -0,0 +1,97 @@
+#pragma once
+
+// lib
+#include <vulkan/vulkan.h>
+
+// std
+#include <array>
+#include <cstdint>
+
+namespace nre {
+
+// shader input location of every vertex attribute, shared by all layouts
+enum class VertexSemantic : uint8_t { Position = 0, Color = 1, Normal = 2, Uv = 3 };
+constexpr uint32_t VERTEX_SEMANTIC_COUNT = 4;
+
+// runtime description of which vertex buffer binding (stream) every semantic
+// lives in, this is what models and pipelines carry around
+struct VertexLayoutInfo {
+  std::array<uint8_t, VERTEX_SEMANTIC_COUNT> binding{};
+  uint32_t streamCount = 1;
+
+  constexpr uint32_t bindingOf(VertexSemantic semantic) const {
+    return binding[static_cast<uint32_t>(semantic)];
+  }
+
+  constexpr uint32_t key() const {
+    uint32_t k = streamCount << 8;
+    for (uint32_t i = 0; i < VERTEX_SEMANTIC_COUNT; i++) {
+      k |= static_cast<uint32_t>(binding[i]) << (2 * i);
+    }
+    return k;
+  }
+};
+
+// one vertex buffer holding the listed semantics interleaved
+// attributes inside a stream are laid out in location order
+template <VertexSemantic... Semantics> struct VertexStream {
+  static constexpr std::array<VertexSemantic, sizeof...(Semantics)> semantics{
+      Semantics...};
+};
+
+// compile time vertex layout, a list of VertexStreams
+// every semantic has to appear in exactly one stream
+template <typename... Streams> struct VertexLayout {
+  static constexpr uint32_t streamCount = sizeof...(Streams);
+  static_assert(streamCount >= 1 && streamCount <= VERTEX_SEMANTIC_COUNT,
+                "a vertex layout needs between 1 and 4 streams");
+
+  static constexpr VertexLayoutInfo info() {
+    static_assert(coversEverySemantic(),
+                  "every vertex semantic must be in exactly one stream");
+    VertexLayoutInfo layoutInfo{};
+    layoutInfo.streamCount = streamCount;
+    uint8_t stream = 0;
+    (assignStream<Streams>(layoutInfo, stream++), ...);
+    return layoutInfo;
+  }
+
+private:
+  template <typename Stream>
+  static constexpr void assignStream(VertexLayoutInfo &layoutInfo,
+                                     uint8_t stream) {
+    for (VertexSemantic semantic : Stream::semantics) {
+      layoutInfo.binding[static_cast<uint32_t>(semantic)] = stream;
+    }
+  }
+
+  static constexpr bool coversEverySemantic() {
+    uint32_t mask = 0;
+    uint32_t count = 0;
+    ((countSemantics<Streams>(mask, count)), ...);
+    return mask == (1u << VERTEX_SEMANTIC_COUNT) - 1 &&
+           count == VERTEX_SEMANTIC_COUNT;
+  }
+
+  template <typename Stream>
+  static constexpr void countSemantics(uint32_t &mask, uint32_t &count) {
+    for (VertexSemantic semantic : Stream::semantics) {
+      mask |= 1u << static_cast<uint32_t>(semantic);
+      count++;
+    }
+  }
+};
+
+// everything in one buffer, the original layout
+using InterleavedLayout =
+    VertexLayout<VertexStream<VertexSemantic::Position, VertexSemantic::Color,
+                              VertexSemantic::Normal, VertexSemantic::Uv>>;
+
+// positions in their own buffer so depth only / shadow passes fetch nothing
+// else, shading attributes interleaved in a second buffer
+using PositionSplitLayout =
+    VertexLayout<VertexStream<VertexSemantic::Position>,
+                 VertexStream<VertexSemantic::Color, VertexSemantic::Normal,
+                              VertexSemantic::Uv>>;
+
+} // namespace nre
@@ -0,0 +1,689 @@
+#include "nre_virtual_texture.hpp"
+
+#include "nre_swap_chain.hpp"
+
+// std
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace nre {
+
+namespace {
+
+constexpr uint32_t VTEX_MAGIC = 0x5854564E; // "NVTX" read little endian
+constexpr uint32_t VTEX_VERSION = 1;
+constexpr uint64_t VTEX_HEADER_BYTES = 8 * sizeof(uint32_t);
+
+// feedback buffer header in front of the requests, see Feedback in
+// shaders/material.glsl
+struct FeedbackHeader {
+  uint32_t width;
+  uint32_t frame;
+  uint32_t padding[2];
+};
+
+constexpr uint32_t NO_REQUEST = ~0u;
+
+bool isPowerOfTwo(uint32_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+// one page table texel, RGBA8_UINT
+uint32_t pageTableEntry(uint32_t physicalX, uint32_t physicalY,
+                        uint32_t level) {
+  return physicalX | physicalY << 8 | level << 16 | 1u << 24;
+}
+
+} // namespace
+
+// *************** Virtual Texture File *********************
+
+VirtualTextureFile VirtualTextureFile::open(const std::string &path) {
+  std::ifstream in{path, std::ios::binary | std::ios::ate};
+  if (!in.is_open()) {
+    throw std::runtime_error("failed to open virtual texture: " + path);
+  }
+  uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+  in.seekg(0);
+
+  uint32_t header[8];
+  in.read(reinterpret_cast<char *>(header), sizeof(header));
+  if (!in || header[0] != VTEX_MAGIC || header[1] != VTEX_VERSION) {
+    throw std::runtime_error("not a virtual texture: " + path);
+  }
+
+  VirtualTextureFile file{};
+  file.path = path;
+  file.format = static_cast<VkFormat>(header[2]);
+  file.pageContent = header[3];
+  file.pageBorder = header[4];
+  file.pagesX = header[5];
+  file.pagesY = header[6];
+  file.levels = header[7];
+
+  TextureFormatInfo info = TextureFormatInfo::of(file.format);
+  uint32_t pageSize = file.pageContent + 2 * file.pageBorder;
+  if (info.blockBytes == 0 || pageSize % info.blockWidth != 0 ||
+      pageSize % info.blockHeight != 0) {
+    throw std::runtime_error("unsupported virtual texture format in " + path);
+  }
+  uint32_t maxLevels = 1;
+  for (uint32_t size = std::max(file.pagesX, file.pagesY); size > 1;
+       size >>= 1) {
+    maxLevels++;
+  }
+  if (!isPowerOfTwo(file.pagesX) || !isPowerOfTwo(file.pagesY) ||
+      file.levels == 0 || file.levels > maxLevels) {
+    throw std::runtime_error("bad virtual texture page layout in " + path);
+  }
+  file.pageBytes = uint64_t{pageSize / info.blockWidth} *
+                   (pageSize / info.blockHeight) * info.blockBytes;
+
+  uint32_t last = file.levels - 1;
+  uint64_t end = file.pageOffset(last, file.pagesXAt(last) - 1,
+                                 file.pagesYAt(last) - 1) +
+                 file.pageBytes;
+  if (end > fileSize) {
+    throw std::runtime_error("virtual texture is truncated: " + path);
+  }
+  return file;
+}
+
+uint64_t VirtualTextureFile::pageOffset(uint32_t level, uint32_t x,
+                                        uint32_t y) const {
+  uint64_t page = 0;
+  for (uint32_t l = 0; l < level; l++) {
+    page += uint64_t{pagesXAt(l)} * pagesYAt(l);
+  }
+  page += uint64_t{y} * pagesXAt(level) + x;
+  return VTEX_HEADER_BYTES + page * pageBytes;
+}
+
+void VirtualTextureFile::readPage(uint32_t level, uint32_t x, uint32_t y,
+                                  void *dst) const {
+  std::ifstream in{path, std::ios::binary};
+  in.seekg(static_cast<std::streamoff>(pageOffset(level, x, y)));
+  in.read(static_cast<char *>(dst), static_cast<std::streamsize>(pageBytes));
+  if (!in) {
+    throw std::runtime_error("failed to read virtual texture page of " + path);
+  }
+}
+
+// *************** Virtual Texture System *********************
+
+NreVirtualTextureSystem::NreVirtualTextureSystem(
+    NreDevice &device, NreBindlessTable &bindlessTable,
+    const VirtualTextureSettings &settings)
+    : nreDevice{device}, bindlessTable{bindlessTable}, settings{settings} {
+  assert(settings.physicalPagesPerSide <= 256 &&
+         "Page table entries hold 8 bit physical coordinates");
+  // the page cache and the reader come with the first add
+  createSamplers();
+
+  feedbackBuffers.resize(NreSwapChain::MAX_FRAMES_IN_FLIGHT);
+  feedbackExtents.resize(NreSwapChain::MAX_FRAMES_IN_FLIGHT, VkExtent2D{});
+  stagingBuffers.resize(NreSwapChain::MAX_FRAMES_IN_FLIGHT);
+}
+
+NreVirtualTextureSystem::~NreVirtualTextureSystem() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+    queued.clear();
+  }
+  readQueued.notify_all();
+  if (reader.joinable()) {
+    reader.join();
+  }
+
+  vkDestroySampler(nreDevice.device(), physicalSampler, nullptr);
+  vkDestroySampler(nreDevice.device(), pageTableSampler, nullptr);
+}
+
+uint64_t NreVirtualTextureSystem::pageKey(uint32_t texture, uint32_t level,
+                                          uint32_t x, uint32_t y) {
+  return uint64_t{texture} << 40 | uint64_t{level} << 32 |
+         uint64_t{y} << 16 | x;
+}
+
+void NreVirtualTextureSystem::createPhysicalTexture() {
+  physicalPages.resize(settings.physicalPagesPerSide *
+                       settings.physicalPagesPerSide);
+  uint32_t size = settings.physicalPagesPerSide * PAGE_SIZE;
+  physicalTexture = std::make_unique<NreTexture>(nreDevice, settings.format,
+                                                 size, size, 1);
+
+  // nothing valid in it yet, but the bindless slot expects this layout
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = physicalTexture->getImage();
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  VkCommandBuffer commandBuffer = nreDevice.beginSingleTimeCommands();
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  nreDevice.endSingleTimeCommands(commandBuffer);
+
+  physicalSlot =
+      bindlessTable.addTexture(physicalTexture->getView(), physicalSampler);
+}
+
+void NreVirtualTextureSystem::createSamplers() {
+  // pages are sampled within their border, no mips in the cache
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxAnisotropy = 1.f;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+  if (vkCreateSampler(nreDevice.device(), &samplerInfo, nullptr,
+                      &physicalSampler) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create virtual texture sampler!");
+  }
+
+  // integer texels, only ever fetched
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  if (vkCreateSampler(nreDevice.device(), &samplerInfo, nullptr,
+                      &pageTableSampler) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create page table sampler!");
+  }
+}
+
+uint32_t NreVirtualTextureSystem::add(const std::string &path) {
+  VirtualTextureFile file = VirtualTextureFile::open(path);
+  if (file.format != settings.format || file.pageContent != PAGE_CONTENT ||
+      file.pageBorder != PAGE_BORDER) {
+    throw std::runtime_error(
+        "virtual texture doesn't match the page cache: " + path);
+  }
+  if (file.pagesX > MAX_PAGES_PER_SIDE || file.pagesY > MAX_PAGES_PER_SIDE) {
+    throw std::runtime_error("virtual texture has too many pages: " + path);
+  }
+  if (physicalTexture == nullptr) {
+    createPhysicalTexture();
+    reader = std::thread{&NreVirtualTextureSystem::readerLoop, this};
+  }
+
+  VirtualTexture texture{};
+  texture.file = file;
+  texture.pageTable = std::make_unique<NreTexture>(
+      nreDevice, VK_FORMAT_R8G8B8A8_UINT, file.pagesX, file.pagesY,
+      file.levels);
+  for (uint32_t level = 0; level < file.levels; level++) {
+    texture.entries.emplace_back(
+        uint64_t{file.pagesXAt(level)} * file.pagesYAt(level), 0u);
+  }
+  texture.pageTableSlot =
+      bindlessTable.addTexture(texture.pageTable->getView(), pageTableSampler);
+  // 12 bits of the slot fit in a feedback request
+  if (texture.pageTableSlot >= (1u << 12) - 1) {
+    throw std::runtime_error("page table slot too high for feedback");
+  }
+
+  uint32_t id = static_cast<uint32_t>(textures.size());
+  textureBySlot[texture.pageTableSlot] = id;
+  textures.push_back(std::move(texture));
+
+  // the coarsest level is read right here and pinned
+  std::vector<std::unique_ptr<PageRead>> reads;
+  uint32_t last = file.levels - 1;
+  for (uint32_t y = 0; y < file.pagesYAt(last); y++) {
+    for (uint32_t x = 0; x < file.pagesXAt(last); x++) {
+      auto read = std::make_unique<PageRead>();
+      read->key = pageKey(id, last, x, y);
+      read->data.resize(file.pageBytes);
+      file.readPage(last, x, y, read->data.data());
+      pendingPages.insert(read->key);
+      reads.push_back(std::move(read));
+    }
+  }
+  // load time, so waiting for the queue is fine
+  std::unique_ptr<NreBuffer> stagingBuffer;
+  VkCommandBuffer commandBuffer = nreDevice.beginSingleTimeCommands();
+  upload(commandBuffer, stagingBuffer, reads);
+  nreDevice.endSingleTimeCommands(commandBuffer);
+  for (auto &read : reads) {
+    if (residentPages.count(read->key) == 0) {
+      throw std::runtime_error(
+          "virtual texture page cache is full of pinned pages");
+    }
+  }
+  return id;
+}
+
+void NreVirtualTextureSystem::applyTo(uint32_t id,
+                                      GpuMaterial &material) const {
+  material.pageTableTexture = textures[id].pageTableSlot;
+  material.physicalTexture = physicalSlot;
+}
+
+VkDescriptorBufferInfo
+NreVirtualTextureSystem::getFeedbackInfo(int frameIndex) const {
+  assert(feedbackBuffers[frameIndex] != nullptr &&
+         "update has to run before the feedback buffer is bound");
+  return feedbackBuffers[frameIndex]->descriptorInfo();
+}
+
+void NreVirtualTextureSystem::recordFeedbackBarrier(
+    VkCommandBuffer commandBuffer, int frameIndex) const {
+  if (textures.empty()) {
+    return;
+  }
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = feedbackBuffers[frameIndex]->getBuffer();
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier,
+                       0, nullptr);
+}
+
+void NreVirtualTextureSystem::update(VkCommandBuffer commandBuffer,
+                                     int frameIndex, VkExtent2D extent) {
+  updateCount++;
+  readFeedback(frameIndex, extent);
+  // nothing samples a virtual texture, so there is nothing to read or load
+  if (textures.empty()) {
+    return;
+  }
+
+  // coarse pages first, they stand in for everything below them
+  std::sort(wanted.begin(), wanted.end(), [](uint64_t a, uint64_t b) {
+    return (a >> 32 & 0xFF) > (b >> 32 & 0xFF);
+  });
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    for (uint64_t key : wanted) {
+      if (pendingPages.size() >= settings.maxPendingReads) {
+        break;
+      }
+      if (pendingPages.count(key) != 0) {
+        continue;
+      }
+      const VirtualTextureFile &file = textures[key >> 40].file;
+      auto read = std::make_unique<PageRead>();
+      read->key = key;
+      read->path = file.path;
+      read->offset = file.pageOffset(static_cast<uint32_t>(key >> 32 & 0xFF),
+                                     static_cast<uint32_t>(key & 0xFFFF),
+                                     static_cast<uint32_t>(key >> 16 & 0xFFFF));
+      read->data.resize(file.pageBytes);
+      pendingPages.insert(key);
+      queued.push_back(std::move(read));
+    }
+  }
+  readQueued.notify_one();
+  wanted.clear();
+
+  std::vector<std::unique_ptr<PageRead>> reads;
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    while (!finished.empty() && reads.size() < settings.maxUploadsPerFrame) {
+      reads.push_back(std::move(finished.front()));
+      finished.pop_front();
+    }
+  }
+
+  bool dirty = false;
+  for (const auto &texture : textures) {
+    dirty = dirty || texture.dirty;
+  }
+  if (!reads.empty() || dirty) {
+    // the last frame that used this frame index's staging buffer is done
+    upload(commandBuffer, stagingBuffers[frameIndex], reads);
+  }
+  stats.residentPages = static_cast<uint32_t>(residentPages.size());
+}
+
+void NreVirtualTextureSystem::readFeedback(int frameIndex, VkExtent2D extent) {
+  // the global set still needs a buffer, a header is enough while no shader
+  // can write requests
+  if (textures.empty()) {
+    extent = VkExtent2D{};
+  }
+  uint32_t width = (extent.width + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE;
+  uint32_t height = (extent.height + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE;
+  auto &buffer = feedbackBuffers[frameIndex];
+  VkExtent2D &bufferExtent = feedbackExtents[frameIndex];
+
+  if (buffer != nullptr && bufferExtent.width == extent.width &&
+      bufferExtent.height == extent.height) {
+    // written by this frame index last time around, its fence has signaled
+    auto *requests = reinterpret_cast<const uint32_t *>(
+        static_cast<const uint8_t *>(buffer->getMappedMemory()) +
+        sizeof(FeedbackHeader));
+    std::unordered_set<uint32_t> seen;
+    for (uint32_t i = 0; i < width * height; i++) {
+      uint32_t value = requests[i];
+      if (value == NO_REQUEST || !seen.insert(value).second) {
+        continue;
+      }
+      auto it = textureBySlot.find(value >> 20);
+      if (it == textureBySlot.end()) {
+        continue;
+      }
+      const VirtualTextureFile &file = textures[it->second].file;
+      uint32_t level = value >> 16 & 0xF;
+      uint32_t y = value >> 8 & 0xFF;
+      uint32_t x = value & 0xFF;
+      if (level < file.levels && x < file.pagesXAt(level) &&
+          y < file.pagesYAt(level)) {
+        request(it->second, level, x, y);
+      }
+    }
+    stats.requestedPages = static_cast<uint32_t>(seen.size());
+  } else {
+    // the old buffer belonged to this frame index only, its fence has
+    // signaled so it can go
+    VkDeviceSize requestBytes = VkDeviceSize{width} * height * sizeof(uint32_t);
+    buffer = std::make_unique<NreBuffer>(
+        nreDevice, sizeof(FeedbackHeader) + requestBytes, 1,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    buffer->map();
+    bufferExtent = extent;
+  }
+
+  // a different pixel of every block reports each frame
+  FeedbackHeader header{};
+  header.width = width;
+  header.frame = static_cast<uint32_t>(updateCount);
+  auto *memory = static_cast<uint8_t *>(buffer->getMappedMemory());
+  std::memcpy(memory, &header, sizeof(header));
+  std::memset(memory + sizeof(header), 0xFF,
+              size_t{width} * height * sizeof(uint32_t));
+}
+
+void NreVirtualTextureSystem::request(uint32_t texture, uint32_t level,
+                                      uint32_t x, uint32_t y) {
+  // every resident page up the chain is in use, it stands in for the ones
+  // below, the coarsest missing page is loaded first
+  uint64_t missing = EMPTY_PAGE;
+  for (uint32_t l = level; l < textures[texture].file.levels; l++) {
+    uint64_t key = pageKey(texture, l, x, y);
+    auto it = residentPages.find(key);
+    if (it != residentPages.end()) {
+      physicalPages[it->second].lastUsed = updateCount;
+    } else {
+      missing = key;
+    }
+    x >>= 1;
+    y >>= 1;
+  }
+  if (missing != EMPTY_PAGE) {
+    wanted.push_back(missing);
+  }
+}
+
+uint32_t NreVirtualTextureSystem::allocatePage() {
+  uint32_t oldest = ~0u;
+  for (uint32_t i = 0; i < physicalPages.size(); i++) {
+    const PhysicalPage &page = physicalPages[i];
+    if (page.key == EMPTY_PAGE) {
+      return i;
+    }
+    if (!page.pinned && page.lastUsed < updateCount &&
+        (oldest == ~0u || page.lastUsed < physicalPages[oldest].lastUsed)) {
+      oldest = i;
+    }
+  }
+  if (oldest != ~0u) {
+    PhysicalPage &page = physicalPages[oldest];
+    residentPages.erase(page.key);
+    textures[page.key >> 40].dirty = true;
+    page.key = EMPTY_PAGE;
+    stats.pagesEvicted++;
+  }
+  return oldest;
+}
+
+void NreVirtualTextureSystem::rebuildPageTable(VirtualTexture &texture) {
+  const VirtualTextureFile &file = texture.file;
+  uint32_t id = textureBySlot.at(texture.pageTableSlot);
+  uint32_t pagesPerSide = settings.physicalPagesPerSide;
+
+  // coarsest first, missing pages take their parent's entry
+  for (uint32_t level = file.levels; level-- > 0;) {
+    uint32_t pagesX = file.pagesXAt(level);
+    for (uint32_t y = 0; y < file.pagesYAt(level); y++) {
+      for (uint32_t x = 0; x < pagesX; x++) {
+        uint32_t &entry = texture.entries[level][y * pagesX + x];
+        auto it = residentPages.find(pageKey(id, level, x, y));
+        if (it != residentPages.end()) {
+          entry = pageTableEntry(it->second % pagesPerSide,
+                                 it->second / pagesPerSide, level);
+        } else if (level + 1 < file.levels) {
+          entry = texture.entries[level + 1]
+                                 [(y >> 1) * file.pagesXAt(level + 1) +
+                                  (x >> 1)];
+        } else {
+          entry = 0;
+        }
+      }
+    }
+  }
+  texture.dirty = false;
+}
+
+void NreVirtualTextureSystem::upload(
+    VkCommandBuffer commandBuffer, std::unique_ptr<NreBuffer> &stagingBuffer,
+    std::vector<std::unique_ptr<PageRead>> &reads) {
+  // place the pages first, evictions dirty more page tables
+  std::vector<std::pair<PageRead *, uint32_t>> pages;
+  for (auto &read : reads) {
+    pendingPages.erase(read->key);
+    if (read->failed) {
+      continue;
+    }
+    uint32_t physical = allocatePage();
+    if (physical == ~0u) {
+      // everything is in use, it gets asked for again
+      continue;
+    }
+    PhysicalPage &page = physicalPages[physical];
+    uint32_t texture = static_cast<uint32_t>(read->key >> 40);
+    uint32_t level = static_cast<uint32_t>(read->key >> 32 & 0xFF);
+    page.key = read->key;
+    page.lastUsed = updateCount;
+    page.pinned = level == textures[texture].file.levels - 1;
+    residentPages[read->key] = physical;
+    textures[texture].dirty = true;
+    pages.emplace_back(read.get(), physical);
+    stats.pagesLoaded++;
+  }
+
+  std::vector<VirtualTexture *> tables;
+  for (auto &texture : textures) {
+    if (texture.dirty) {
+      rebuildPageTable(texture);
+      tables.push_back(&texture);
+    }
+  }
+  if (pages.empty() && tables.empty()) {
+    return;
+  }
+
+  VkDeviceSize stagingSize = 0;
+  for (auto &page : pages) {
+    stagingSize += page.first->data.size();
+  }
+  for (VirtualTexture *texture : tables) {
+    for (const auto &level : texture->entries) {
+      stagingSize += level.size() * sizeof(uint32_t);
+    }
+  }
+  // kept and reused, only grows
+  if (stagingBuffer == nullptr ||
+      stagingBuffer->getBufferSize() < stagingSize) {
+    stagingBuffer = std::make_unique<NreBuffer>(
+        nreDevice, stagingSize, 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    stagingBuffer->map();
+  }
+
+  auto imageBarrier = [](VkImage image, uint32_t levels,
+                         VkImageLayout oldLayout, VkImageLayout newLayout) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    return barrier;
+  };
+
+  // images to TRANSFER_DST, the cache keeps its other pages
+  std::vector<VkImageMemoryBarrier> barriers;
+  if (!pages.empty()) {
+    barriers.push_back(imageBarrier(physicalTexture->getImage(), 1,
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+  }
+  for (VirtualTexture *texture : tables) {
+    barriers.push_back(imageBarrier(
+        texture->pageTable->getImage(), texture->file.levels,
+        texture->uploaded ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                          : VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+  }
+  for (auto &barrier : barriers) {
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  }
+
+  // also orders the copies after every earlier submit, so frames still in
+  // flight are done sampling a page before it is overwritten
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+
+  VkDeviceSize offset = 0;
+  std::vector<VkBufferImageCopy> regions;
+  for (auto &page : pages) {
+    stagingBuffer->writeToBuffer(page.first->data.data(),
+                                 page.first->data.size(), offset);
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {
+        static_cast<int32_t>(page.second % settings.physicalPagesPerSide *
+                             PAGE_SIZE),
+        static_cast<int32_t>(page.second / settings.physicalPagesPerSide *
+                             PAGE_SIZE),
+        0};
+    region.imageExtent = {PAGE_SIZE, PAGE_SIZE, 1};
+    regions.push_back(region);
+    offset += page.first->data.size();
+  }
+  if (!regions.empty()) {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->getBuffer(),
+                           physicalTexture->getImage(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+  }
+
+  for (VirtualTexture *texture : tables) {
+    regions.clear();
+    for (uint32_t level = 0; level < texture->file.levels; level++) {
+      auto &entries = texture->entries[level];
+      VkDeviceSize size = entries.size() * sizeof(uint32_t);
+      stagingBuffer->writeToBuffer(entries.data(), size, offset);
+      VkBufferImageCopy region{};
+      region.bufferOffset = offset;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = level;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageExtent = {texture->file.pagesXAt(level),
+                            texture->file.pagesYAt(level), 1};
+      regions.push_back(region);
+      offset += size;
+    }
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer->getBuffer(),
+                           texture->pageTable->getImage(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+    texture->uploaded = true;
+  }
+
+  for (auto &barrier : barriers) {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+}
+
+void NreVirtualTextureSystem::readerLoop() {
+  while (true) {
+    std::unique_ptr<PageRead> read;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      readQueued.wait(lock, [&]() { return stopping || !queued.empty(); });
+      if (stopping) {
+        return;
+      }
+      read = std::move(queued.front());
+      queued.pop_front();
+    }
+
+    std::ifstream in{read->path, std::ios::binary};
+    in.seekg(static_cast<std::streamoff>(read->offset));
+    in.read(reinterpret_cast<char *>(read->data.data()),
+            static_cast<std::streamsize>(read->data.size()));
+    if (!in) {
+      std::cerr << "virtual texture: failed to read a page of " << read->path
+                << std::endl;
+      read->failed = true;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex};
+    finished.push_back(std::move(read));
+  }
+}
+
+} // namespace nre
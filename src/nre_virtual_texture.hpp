@@ -0,0 +1,215 @@
+#pragma once
+
+#include "nre_bindless.hpp"
+#include "nre_buffer.hpp"
+#include "nre_device.hpp"
+#include "nre_texture.hpp"
+
+// std
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace nre {
+
+// a tiled virtual texture on disk (.vtex), written by the offline tools
+// little endian header of 8 uint32: magic "NVTX", version 1, VkFormat, page
+// content size, page border, pages across and down at level 0, level count
+// then every page, level 0 first and row by row, each (content + 2 * border)
+// texels square, so a page's offset follows from its position
+// page counts are powers of two and level n has max(pages >> n, 1) of them
+struct VirtualTextureFile {
+  std::string path;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t pageContent = 0;
+  uint32_t pageBorder = 0;
+  uint32_t pagesX = 0;
+  uint32_t pagesY = 0;
+  uint32_t levels = 0;
+  // bytes of one page, border included
+  uint64_t pageBytes = 0;
+
+  // throws std::runtime_error on anything it can't read
+  static VirtualTextureFile open(const std::string &path);
+
+  uint32_t pagesXAt(uint32_t level) const {
+    return std::max(pagesX >> level, 1u);
+  }
+  uint32_t pagesYAt(uint32_t level) const {
+    return std::max(pagesY >> level, 1u);
+  }
+  uint64_t pageOffset(uint32_t level, uint32_t x, uint32_t y) const;
+  // copies the page's bytes to dst, which has room for pageBytes
+  void readPage(uint32_t level, uint32_t x, uint32_t y, void *dst) const;
+};
+
+struct VirtualTextureSettings {
+  // the physical page cache is this many pages across and down, the only
+  // memory virtual textures take apart from their small page tables
+  uint32_t physicalPagesPerSide = 32;
+  // every virtual texture has to be stored in this format
+  VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+  // pages copied into the cache per update, bounds the staging memory and
+  // the copies recorded into a frame
+  uint32_t maxUploadsPerFrame = 32;
+  // page reads queued on the loader thread at once
+  uint32_t maxPendingReads = 64;
+};
+
+struct VirtualTextureStats {
+  uint32_t residentPages = 0;
+  // distinct pages the last feedback asked for
+  uint32_t requestedPages = 0;
+  uint64_t pagesLoaded = 0;
+  uint64_t pagesEvicted = 0;
+};
+
+// software virtual texturing for textures too big for any single image
+// pages of every virtual texture share one physical cache texture, a page
+// table texture per virtual texture (one texel per page and level) tells
+// shaders where a page sits, or which coarser page stands in for it
+// the forward pass writes one page request per FEEDBACK_SCALE^2 pixels into a
+// storage buffer (global set binding 1), update reads it back once the frame's
+// fence has signaled, loads missing pages on a loader thread and evicts the
+// least recently requested ones when the cache is full
+// the coarsest level of every virtual texture stays resident, so there is
+// always something to sample
+// the cache and the loader thread come with the first add, until then the
+// feedback buffer is only a header and update does nothing else
+class NreVirtualTextureSystem {
+public:
+  // texels of a page, as sampled and with the border bilinear filtering reads
+  static constexpr uint32_t PAGE_CONTENT = 120;
+  static constexpr uint32_t PAGE_BORDER = 4;
+  static constexpr uint32_t PAGE_SIZE = PAGE_CONTENT + 2 * PAGE_BORDER;
+  // matches shaders/material.glsl
+  static constexpr uint32_t FEEDBACK_SCALE = 8;
+  // 8 bits per page coordinate in a feedback request
+  static constexpr uint32_t MAX_PAGES_PER_SIDE = 256;
+
+  NreVirtualTextureSystem(
+      NreDevice &device, NreBindlessTable &bindlessTable,
+      const VirtualTextureSettings &settings = VirtualTextureSettings{});
+  // drops queued reads, waits for the one in progress
+  ~NreVirtualTextureSystem();
+
+  NreVirtualTextureSystem(const NreVirtualTextureSystem &) = delete;
+  NreVirtualTextureSystem &operator=(const NreVirtualTextureSystem &) = delete;
+
+  // loads the coarsest level right away, returns the id for applyTo
+  // the first call allocates the physical cache
+  // throws std::runtime_error for files that don't match the settings
+  uint32_t add(const std::string &path);
+  // makes material sample virtual texture id instead of baseColorTexture
+  void applyTo(uint32_t id, GpuMaterial &material) const;
+
+  // reads back the requests frameIndex's frame wrote last time around, queues
+  // reads and records the copies of finished pages into commandBuffer
+  // call once beginFrame has waited on the frame's fence, before the global
+  // set is written (the feedback buffer follows the extent), outside a render
+  // pass and before anything sampling virtual textures is recorded
+  void update(VkCommandBuffer commandBuffer, int frameIndex, VkExtent2D extent);
+  VkDescriptorBufferInfo getFeedbackInfo(int frameIndex) const;
+  // makes the frame's feedback writes visible to the host read in update,
+  // record it after the last pass that samples virtual textures
+  void recordFeedbackBarrier(VkCommandBuffer commandBuffer,
+                             int frameIndex) const;
+
+  const VirtualTextureStats &getStats() const { return stats; }
+
+private:
+  struct VirtualTexture {
+    VirtualTextureFile file;
+    std::unique_ptr<NreTexture> pageTable;
+    uint32_t pageTableSlot = 0;
+    // RGBA8_UINT texels of every level: physical page x and y, the level of
+    // the page mapped there and 1
+    std::vector<std::vector<uint32_t>> entries;
+    bool dirty = true;
+    // the page table image is still UNDEFINED
+    bool uploaded = false;
+  };
+
+  struct PhysicalPage {
+    // pageKey of the virtual page held, EMPTY_PAGE when free
+    uint64_t key = EMPTY_PAGE;
+    // update the page was last requested in
+    uint64_t lastUsed = 0;
+    // coarsest level pages, never evicted
+    bool pinned = false;
+  };
+
+  struct PageRead {
+    uint64_t key = 0;
+    std::string path;
+    uint64_t offset = 0;
+    std::vector<uint8_t> data;
+    bool failed = false;
+  };
+
+  static constexpr uint64_t EMPTY_PAGE = ~0ull;
+  static uint64_t pageKey(uint32_t texture, uint32_t level, uint32_t x,
+                          uint32_t y);
+
+  void createPhysicalTexture();
+  void createSamplers();
+  void readFeedback(int frameIndex, VkExtent2D extent);
+  void request(uint32_t texture, uint32_t level, uint32_t x, uint32_t y);
+  // a free physical page or the least recently used one, ~0u when every page
+  // is pinned or was requested this update
+  uint32_t allocatePage();
+  void rebuildPageTable(VirtualTexture &texture);
+  // records copies of the pages into the physical cache and of every dirty
+  // page table to its image, stagingBuffer is grown when too small and has
+  // to stay alive until commandBuffer finished
+  void upload(VkCommandBuffer commandBuffer,
+              std::unique_ptr<NreBuffer> &stagingBuffer,
+              std::vector<std::unique_ptr<PageRead>> &reads);
+  void readerLoop();
+
+  NreDevice &nreDevice;
+  NreBindlessTable &bindlessTable;
+  VirtualTextureSettings settings;
+
+  std::unique_ptr<NreTexture> physicalTexture;
+  uint32_t physicalSlot = 0;
+  VkSampler physicalSampler = VK_NULL_HANDLE;
+  VkSampler pageTableSampler = VK_NULL_HANDLE;
+  std::vector<PhysicalPage> physicalPages;
+
+  std::vector<VirtualTexture> textures;
+  // page table slot to texture id, requests name the slot
+  std::unordered_map<uint32_t, uint32_t> textureBySlot;
+  // pageKey to physical page index
+  std::unordered_map<uint64_t, uint32_t> residentPages;
+  std::unordered_set<uint64_t> pendingPages;
+  // pages asked for this update, coarser levels are read first
+  std::vector<uint64_t> wanted;
+  uint64_t updateCount = 0;
+
+  // host visible, one per frame in flight
+  std::vector<std::unique_ptr<NreBuffer>> feedbackBuffers;
+  std::vector<VkExtent2D> feedbackExtents;
+  // upload sources, one per frame in flight, reused once the frame's fence
+  // signaled
+  std::vector<std::unique_ptr<NreBuffer>> stagingBuffers;
+
+  VirtualTextureStats stats{};
+
+  std::mutex mutex;
+  std::condition_variable readQueued;
+  std::deque<std::unique_ptr<PageRead>> queued;
+  std::deque<std::unique_ptr<PageRead>> finished;
+  bool stopping = false;
+  std::thread reader;
+};
+
+} // namespace nre
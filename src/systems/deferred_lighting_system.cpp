@@ -0,0 +1,156 @@
+#include "deferred_lighting_system.hpp"
+
+#define GLM_FORCE_RADIANS // no matter the system, GLM expects radians
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace nre
+{
+
+    namespace
+    {
+
+        // matches Push in shaders/deferred_lighting.frag
+        struct LightingPushConstantData
+        {
+            // pixel and depth back to world space
+            glm::mat4 inverseViewProjection{1.f};
+            // xy one over the extent
+            glm::vec4 inverseExtent{0.f};
+        };
+
+        // the set's bindings in the same order
+        struct GBufferDescriptors
+        {
+            VkDescriptorImageInfo albedo;
+            VkDescriptorImageInfo normal;
+            VkDescriptorImageInfo depth;
+        };
+
+    } // namespace
+
+    DeferredLightingSystem::DeferredLightingSystem(
+        NreDevice &device,
+        const PipelineRenderTarget &renderTarget,
+        VkDescriptorSetLayout globalSetLayout)
+        : nreDevice{device}
+    {
+        createDescriptorSetLayout();
+        createPipelineLayout(globalSetLayout);
+        createPipeline(renderTarget);
+    }
+
+    DeferredLightingSystem::~DeferredLightingSystem()
+    {
+        vkDestroyPipelineLayout(nreDevice.device(), pipelineLayout, nullptr);
+    }
+
+    void DeferredLightingSystem::createDescriptorSetLayout()
+    {
+        gBufferSetLayout = NreDescriptorSetLayout::Builder(nreDevice)
+                               .addBinding(0, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT)
+                               .addBinding(1, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT)
+                               .addBinding(2, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT)
+                               .build();
+        gBufferSetTemplate = NreDescriptorUpdateTemplate::Builder(nreDevice, *gBufferSetLayout)
+                                 .addImage(0, offsetof(GBufferDescriptors, albedo))
+                                 .addImage(1, offsetof(GBufferDescriptors, normal))
+                                 .addImage(2, offsetof(GBufferDescriptors, depth))
+                                 .build();
+    }
+
+    void DeferredLightingSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLayout)
+    {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(LightingPushConstantData);
+
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts{
+            globalSetLayout, gBufferSetLayout->getDescriptorSetLayout()};
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(nreDevice.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create pipeline layout");
+        }
+    }
+
+    void DeferredLightingSystem::createPipeline(const PipelineRenderTarget &renderTarget)
+    {
+        assert(pipelineLayout != nullptr && "Cannot create pipeline before Pipeline layout");
+
+        PipelineConfigInfo pipelineConfig{};
+        NrePipeline::defaultPipelineConfigInfo(pipelineConfig);
+        // the triangle comes from gl_VertexIndex
+        pipelineConfig.attributeDescriptions.clear();
+        pipelineConfig.bindingDescriptions.clear();
+        // the subpass has no depth attachment, depth is an input
+        pipelineConfig.depthStencilInfo.depthTestEnable = VK_FALSE;
+        pipelineConfig.depthStencilInfo.depthWriteEnable = VK_FALSE;
+        // lights add up on top of what the g-buffer subpass wrote (ambient, emission), alpha
+        // stays
+        pipelineConfig.colorBlendAttachment.blendEnable = VK_TRUE;
+        pipelineConfig.colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        pipelineConfig.colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        pipelineConfig.colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        pipelineConfig.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        renderTarget.apply(pipelineConfig);
+        pipelineConfig.pipelineLayout = pipelineLayout;
+        nrePipeline = std::make_unique<NrePipeline>(
+            nreDevice,
+            "shaders/deferred_lighting.vert.spv",
+            "shaders/deferred_lighting.frag.spv",
+            pipelineConfig);
+    }
+
+    void DeferredLightingSystem::render(FrameInfo &frameInfo, const GBufferViews &gBuffer)
+    {
+        VkDescriptorSet gBufferSet = frameInfo.frameDescriptors.allocate(gBufferSetLayout->getDescriptorSetLayout());
+        // input attachments have no sampler, the layouts are the subpass's
+        GBufferDescriptors descriptors{
+            {VK_NULL_HANDLE, gBuffer.albedo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            {VK_NULL_HANDLE, gBuffer.normal, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL},
+            {VK_NULL_HANDLE, gBuffer.depth, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}};
+        gBufferSetTemplate->update(gBufferSet, &descriptors);
+
+        nrePipeline->bind(frameInfo.commandBuffer);
+        std::array<VkDescriptorSet, 2> sets{frameInfo.globalDescriptorSet, gBufferSet};
+        vkCmdBindDescriptorSets(
+            frameInfo.commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipelineLayout,
+            0,
+            static_cast<uint32_t>(sets.size()),
+            sets.data(),
+            0,
+            nullptr);
+
+        LightingPushConstantData push{};
+        push.inverseViewProjection = glm::inverse(frameInfo.camera.getProjection() * frameInfo.camera.getView());
+        push.inverseExtent = {1.f / frameInfo.extent.width, 1.f / frameInfo.extent.height, 0.f, 0.f};
+        vkCmdPushConstants(
+            frameInfo.commandBuffer,
+            pipelineLayout,
+            VK_SHADER_STAGE_FRAGMENT_BIT,
+            0,
+            sizeof(LightingPushConstantData),
+            &push);
+
+        // one triangle covering the screen
+        vkCmdDraw(frameInfo.commandBuffer, 3, 1, 0, 0);
+    }
+
+} // namespace nre
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "nre_descriptors.hpp"
+#include "nre_device.hpp"
+#include "nre_frame_info.hpp"
+#include "nre_pipeline.hpp"
+#include "nre_swap_chain.hpp"
+
+// std
+#include <memory>
+
+namespace nre
+{
+    // the lighting subpass of the deferred render pass: one fullscreen triangle reads the
+    // g-buffer through input attachments and adds the lights onto the swap chain image, so
+    // lighting runs once per pixel no matter how many triangles the g-buffer subpass drew
+    // over it
+    // the g-buffer set is allocated from the frame's allocator every frame, the views change
+    // with the swap chain
+    class DeferredLightingSystem
+    {
+
+    public:
+        DeferredLightingSystem(
+            NreDevice &device,
+            const PipelineRenderTarget &renderTarget,
+            VkDescriptorSetLayout globalSetLayout);
+        ~DeferredLightingSystem();
+
+        DeferredLightingSystem(const DeferredLightingSystem &) = delete;
+        DeferredLightingSystem &operator=(const DeferredLightingSystem &) = delete;
+
+        // has to be recorded inside the lighting subpass
+        void render(FrameInfo &frameInfo, const GBufferViews &gBuffer);
+
+    private:
+        void createDescriptorSetLayout();
+        void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
+        void createPipeline(const PipelineRenderTarget &renderTarget);
+
+        NreDevice &nreDevice;
+        // set 1, albedo, normal and depth input attachments
+        std::unique_ptr<NreDescriptorSetLayout> gBufferSetLayout;
+        std::unique_ptr<NreDescriptorUpdateTemplate> gBufferSetTemplate;
+        VkPipelineLayout pipelineLayout;
+        std::unique_ptr<NrePipeline> nrePipeline;
+    };
+
+}
@@ -0,0 +1,28 @@
+#include "hlod_system.hpp"
+
+namespace nre
+{
+
+    void HlodSystem::update(FrameInfo &frameInfo)
+    {
+        const glm::vec3 cameraPosition = frameInfo.camera.getPosition();
+        const float h = settings.hysteresis;
+
+        for (auto &cluster : clusters)
+        {
+            float distance = glm::length(cluster.bounds.center - cameraPosition) - cluster.bounds.radius;
+            float threshold = settings.switchDistance * (cluster.useProxy ? 1.f - h : 1.f + h);
+            bool useProxy = distance > threshold;
+            if (useProxy == cluster.useProxy)
+                continue;
+
+            cluster.useProxy = useProxy;
+            frameInfo.gameObjects.at(cluster.proxy).visible = useProxy;
+            for (NreGameObject::id_t id : cluster.members)
+            {
+                frameInfo.gameObjects.at(id).visible = !useProxy;
+            }
+        }
+    }
+
+} // namespace nre
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "nre_frame_info.hpp"
+#include "nre_hlod.hpp"
+
+// std
+#include <utility>
+#include <vector>
+
+namespace nre
+{
+    struct HlodSettings
+    {
+        // clusters whose bounds are further than this (world units) from the camera are
+        // drawn as their proxy
+        float switchDistance = 40.f;
+        // fraction the distance has to move past the threshold before a switch
+        float hysteresis = .1f;
+    };
+
+    // swaps whole clusters for their HLOD proxy by distance, runs before the other systems
+    // since it decides which objects are visible
+    // only touches objects when a cluster switches, so far away the per frame cost is one
+    // distance test per cluster
+    class HlodSystem
+    {
+
+    public:
+        explicit HlodSystem(std::vector<HlodCluster> clusters, const HlodSettings &settings = HlodSettings{})
+            : settings{settings}, clusters{std::move(clusters)} {}
+
+        void update(FrameInfo &frameInfo);
+
+        HlodSettings settings;
+
+    private:
+        std::vector<HlodCluster> clusters;
+    };
+
+}
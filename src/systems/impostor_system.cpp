@@ -0,0 +1,247 @@
+#include "impostor_system.hpp"
+
+#include "nre_swap_chain.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+namespace nre
+{
+
+    namespace
+    {
+
+        // matches Push in shaders/impostor.vert
+        struct ImpostorPushConstantData
+        {
+            glm::vec4 cameraPosition{0.f};
+            glm::vec4 atlas{0.f}; // x: frames per side
+        };
+
+    } // namespace
+
+    ImpostorSystem::ImpostorSystem(
+        NreDevice &device,
+        const PipelineRenderTarget &renderTarget,
+        VkDescriptorSetLayout globalSetLayout,
+        const ImpostorSettings &settings)
+        : nreDevice{device}, settings{settings}
+    {
+        createInstanceBuffers();
+        createDescriptorPool();
+        createPipelineLayout(globalSetLayout);
+        createPipeline(renderTarget);
+    }
+
+    ImpostorSystem::~ImpostorSystem()
+    {
+        vkDestroyPipelineLayout(nreDevice.device(), pipelineLayout, nullptr);
+    }
+
+    void ImpostorSystem::createInstanceBuffers()
+    {
+        for (int i = 0; i < NreSwapChain::MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            auto buffer = std::make_unique<NreBuffer>(
+                nreDevice,
+                sizeof(Instance),
+                settings.maxInstances,
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+            buffer->map();
+            instanceBuffers.push_back(std::move(buffer));
+        }
+    }
+
+    void ImpostorSystem::createDescriptorPool()
+    {
+        descriptorPool = NreDescriptorPool::Builder(nreDevice)
+                             .setMaxSets(settings.maxImpostors)
+                             .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * settings.maxImpostors)
+                             .build();
+
+        atlasSetLayout = NreDescriptorSetLayout::Builder(nreDevice)
+                             .addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+                             .addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+                             .build();
+    }
+
+    void ImpostorSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLayout)
+    {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(ImpostorPushConstantData);
+
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts{
+            globalSetLayout, atlasSetLayout->getDescriptorSetLayout()};
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(nreDevice.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create pipeline layout");
+        }
+    }
+
+    void ImpostorSystem::createPipeline(const PipelineRenderTarget &renderTarget)
+    {
+        assert(pipelineLayout != nullptr && "Cannot create pipeline before Pipeline layout");
+
+        PipelineConfigInfo pipelineConfig{};
+        NrePipeline::defaultPipelineConfigInfo(pipelineConfig);
+        // the quad corners come from gl_VertexIndex, only instances are fetched
+        pipelineConfig.bindingDescriptions = {{0, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE}};
+        pipelineConfig.attributeDescriptions = {
+            {0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, centerRadius)},
+            {1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Instance, yaw)}};
+        renderTarget.apply(pipelineConfig);
+        pipelineConfig.pipelineLayout = pipelineLayout;
+        pipelines.push_back(std::make_unique<NrePipeline>(
+            nreDevice,
+            "shaders/impostor.vert.spv",
+            "shaders/impostor.frag.spv",
+            pipelineConfig));
+    }
+
+    uint32_t ImpostorSystem::addRenderTarget(const PipelineRenderTarget &renderTarget)
+    {
+        createPipeline(renderTarget);
+        return static_cast<uint32_t>(pipelines.size() - 1);
+    }
+
+    VkDescriptorSet ImpostorSystem::getAtlasSet(const NreImpostor &impostor)
+    {
+        auto it = atlasSets.find(&impostor);
+        if (it != atlasSets.end())
+        {
+            return it->second;
+        }
+
+        VkDescriptorSet set;
+        auto colorInfo = impostor.colorDescriptorInfo();
+        auto normalDepthInfo = impostor.normalDepthDescriptorInfo();
+        if (!NreDescriptorWriter(*atlasSetLayout, *descriptorPool)
+                 .writeImage(0, &colorInfo)
+                 .writeImage(1, &normalDepthInfo)
+                 .build(set))
+        {
+            throw std::runtime_error("impostor system: more impostors than settings.maxImpostors");
+        }
+        atlasSets.emplace(&impostor, set);
+        return set;
+    }
+
+    void ImpostorSystem::update(FrameInfo &frameInfo)
+    {
+        const float viewportHeight = static_cast<float>(frameInfo.extent.height);
+        const float h = settings.hysteresis;
+
+        for (auto &kv : instances)
+        {
+            kv.second.clear();
+        }
+        uint32_t instanceCount = 0;
+
+        for (auto &kv : frameInfo.gameObjects)
+        {
+            auto &obj = kv.second;
+            if (obj.impostor == nullptr || obj.model == nullptr || !obj.visible || obj.lod.culled)
+            {
+                obj.lod.useImpostor = false;
+                continue;
+            }
+
+            const auto &sphere = obj.impostor->getBounds();
+            const glm::vec3 &scale = obj.transform.scale;
+            float worldScale = std::max({glm::abs(scale.x), glm::abs(scale.y), glm::abs(scale.z)});
+            glm::vec3 center{obj.transform.mat4() * glm::vec4{sphere.center, 1.f}};
+            float diameter = frameInfo.camera.projectedSize(center, 2.f * sphere.radius * worldScale, viewportHeight);
+
+            float threshold = obj.impostor->getFrameResolution() * settings.switchScale;
+            threshold *= obj.lod.useImpostor ? 1.f + h : 1.f - h;
+            obj.lod.useImpostor = diameter < threshold && instanceCount < settings.maxInstances;
+            if (!obj.lod.useImpostor)
+                continue;
+
+            Instance instance{};
+            instance.centerRadius = glm::vec4{center, sphere.radius * worldScale};
+            instance.yaw = {glm::cos(obj.transform.rotation.y), glm::sin(obj.transform.rotation.y)};
+            instances[obj.impostor.get()].push_back(instance);
+            instanceCount++;
+        }
+
+        // contiguous per impostor so each one is a single instanced draw
+        batches.clear();
+        auto *mapped = static_cast<Instance *>(instanceBuffers[frameInfo.frameIndex]->getMappedMemory());
+        uint32_t offset = 0;
+        for (const auto &kv : instances)
+        {
+            if (kv.second.empty())
+                continue;
+            uint32_t count = static_cast<uint32_t>(kv.second.size());
+            std::memcpy(mapped + offset, kv.second.data(), count * sizeof(Instance));
+            batches.push_back({kv.first, offset, count});
+            offset += count;
+        }
+    }
+
+    void ImpostorSystem::render(FrameInfo &frameInfo, uint32_t renderTarget)
+    {
+        assert(renderTarget < pipelines.size() && "Unknown impostor render target");
+        if (batches.empty())
+        {
+            return;
+        }
+
+        pipelines[renderTarget]->bind(frameInfo.commandBuffer);
+        vkCmdBindDescriptorSets(
+            frameInfo.commandBuffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            pipelineLayout,
+            0, 1,
+            &frameInfo.globalDescriptorSet,
+            0,
+            nullptr);
+
+        VkBuffer instanceBuffer = instanceBuffers[frameInfo.frameIndex]->getBuffer();
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(frameInfo.commandBuffer, 0, 1, &instanceBuffer, &offset);
+
+        ImpostorPushConstantData push{};
+        push.cameraPosition = glm::vec4{frameInfo.camera.getPosition(), 1.f};
+        for (const auto &batch : batches)
+        {
+            push.atlas.x = static_cast<float>(batch.impostor->getFramesPerSide());
+            vkCmdPushConstants(
+                frameInfo.commandBuffer,
+                pipelineLayout,
+                VK_SHADER_STAGE_VERTEX_BIT,
+                0,
+                sizeof(ImpostorPushConstantData),
+                &push);
+
+            VkDescriptorSet atlasSet = getAtlasSet(*batch.impostor);
+            vkCmdBindDescriptorSets(
+                frameInfo.commandBuffer,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipelineLayout,
+                1, 1,
+                &atlasSet,
+                0,
+                nullptr);
+
+            // 6 vertices, two triangles per instance
+            vkCmdDraw(frameInfo.commandBuffer, 6, batch.instanceCount, 0, batch.firstInstance);
+        }
+    }
+
+} // namespace nre
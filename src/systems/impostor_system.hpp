@@ -0,0 +1,103 @@
+#pragma once
+
+#include "nre_buffer.hpp"
+#include "nre_descriptors.hpp"
+#include "nre_device.hpp"
+#include "nre_frame_info.hpp"
+#include "nre_game_object.hpp"
+#include "nre_impostor.hpp"
+#include "nre_pipeline.hpp"
+
+// std
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace nre
+{
+    struct ImpostorSettings
+    {
+        // objects switch once their bounding sphere covers fewer pixels than the impostor's
+        // frame resolution times this, so frames are never magnified
+        float switchScale = 1.f;
+        // fraction the projected size has to move past the threshold before a switch, like
+        // LodSettings::hysteresis
+        float hysteresis = .1f;
+        // impostor instances per frame over all impostors, objects that don't fit keep
+        // drawing their mesh
+        uint32_t maxInstances = 1 << 16;
+        // distinct impostors that can be drawn
+        uint32_t maxImpostors = 64;
+    };
+
+    // draws far away objects that have an impostor as camera facing quads, one instanced
+    // draw per impostor
+    // update picks the objects and has to run after LodSystem and before the other render
+    // systems, render draws them inside the render pass
+    // impostors assume upright instances: only rotation.y and the largest scale component of
+    // the transform are used
+    class ImpostorSystem
+    {
+
+    public:
+        ImpostorSystem(
+            NreDevice &device,
+            const PipelineRenderTarget &renderTarget,
+            VkDescriptorSetLayout globalSetLayout,
+            const ImpostorSettings &settings = ImpostorSettings{});
+        ~ImpostorSystem();
+
+        ImpostorSystem(const ImpostorSystem &) = delete;
+        ImpostorSystem &operator=(const ImpostorSystem &) = delete;
+
+        // another pass to draw the same instances in, ie: the deferred render pass's forward
+        // subpass, returns what to pass to render
+        uint32_t addRenderTarget(const PipelineRenderTarget &renderTarget);
+
+        void update(FrameInfo &frameInfo);
+        void render(FrameInfo &frameInfo, uint32_t renderTarget = 0);
+
+    private:
+        // matches the per instance inputs of shaders/impostor.vert
+        struct Instance
+        {
+            glm::vec4 centerRadius{};
+            glm::vec2 yaw{1.f, 0.f}; // cos, sin
+        };
+
+        // one instanced draw
+        struct Batch
+        {
+            const NreImpostor *impostor = nullptr;
+            uint32_t firstInstance = 0;
+            uint32_t instanceCount = 0;
+        };
+
+        void createInstanceBuffers();
+        void createDescriptorPool();
+        void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
+        void createPipeline(const PipelineRenderTarget &renderTarget);
+
+        // impostors stay alive as long as the objects using them, so the set is kept
+        VkDescriptorSet getAtlasSet(const NreImpostor &impostor);
+
+        NreDevice &nreDevice;
+        ImpostorSettings settings;
+
+        std::unique_ptr<NreDescriptorPool> descriptorPool;
+        std::unique_ptr<NreDescriptorSetLayout> atlasSetLayout;
+        std::unordered_map<const NreImpostor *, VkDescriptorSet> atlasSets;
+
+        // one per frame in flight, host visible and persistently mapped
+        std::vector<std::unique_ptr<NreBuffer>> instanceBuffers;
+
+        // this frame's instances grouped by impostor, kept to avoid reallocating
+        std::unordered_map<const NreImpostor *, std::vector<Instance>> instances;
+        std::vector<Batch> batches;
+
+        VkPipelineLayout pipelineLayout;
+        // one per render target, the first one's from the constructor
+        std::vector<std::unique_ptr<NrePipeline>> pipelines;
+    };
+
+}
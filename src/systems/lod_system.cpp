@@ -0,0 +1,62 @@
+#include "lod_system.hpp"
+
+// std
+#include <algorithm>
+
+namespace nre
+{
+
+    void LodSystem::update(FrameInfo &frameInfo)
+    {
+        const float viewportHeight = static_cast<float>(frameInfo.extent.height);
+        const float h = settings.hysteresis;
+
+        for (auto &kv : frameInfo.gameObjects)
+        {
+            auto &obj = kv.second;
+            if (obj.model == nullptr || !obj.visible)
+                continue;
+
+            const auto &sphere = obj.model->getBoundingSphere();
+            const glm::vec3 &scale = obj.transform.scale;
+            float worldScale = std::max({glm::abs(scale.x), glm::abs(scale.y), glm::abs(scale.z)});
+            glm::vec3 center{obj.transform.mat4() * glm::vec4{sphere.center, 1.f}};
+            // pixels per object space unit at the object's distance
+            float pixelsPerUnit = frameInfo.camera.projectedSize(center, worldScale, viewportHeight);
+
+            float diameter = 2.f * sphere.radius * pixelsPerUnit;
+            float cullSize = obj.lod.culled ? settings.cullPixelSize * (1.f + h) : settings.cullPixelSize;
+            obj.lod.culled = diameter < cullSize;
+            if (obj.lod.culled)
+                continue;
+
+            uint32_t lodCount = obj.model->getLodCount();
+            auto coarsestWithin = [&](float pixelError)
+            {
+                uint32_t level = 0;
+                for (uint32_t i = 1; i < lodCount; i++)
+                {
+                    if (obj.model->getLod(i).error * pixelsPerUnit <= pixelError)
+                    {
+                        level = i;
+                    }
+                }
+                return level;
+            };
+
+            uint32_t current = std::min(obj.lod.level, lodCount - 1);
+            float currentError = obj.model->getLod(current).error * pixelsPerUnit;
+            if (currentError > settings.maxPixelError * (1.f + h))
+            {
+                // too coarse now, refine right away
+                obj.lod.level = coarsestWithin(settings.maxPixelError);
+            }
+            else
+            {
+                // only coarsen once clearly past the threshold
+                obj.lod.level = std::max(current, coarsestWithin(settings.maxPixelError * (1.f - h)));
+            }
+        }
+    }
+
+} // namespace nre
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "nre_frame_info.hpp"
+#include "nre_game_object.hpp"
+
+namespace nre
+{
+    struct LodSettings
+    {
+        // coarsest level whose error projects to at most this many pixels is used
+        float maxPixelError = 1.f;
+        // objects whose bounding sphere covers fewer pixels than this are skipped
+        float cullPixelSize = 2.f;
+        // fraction the projected size has to move past a threshold before a switch, stops
+        // objects near a boundary from flickering between levels
+        float hysteresis = .2f;
+    };
+
+    // picks a level of detail per object from its projected size every frame
+    class LodSystem
+    {
+
+    public:
+        explicit LodSystem(const LodSettings &settings = LodSettings{}) : settings{settings} {}
+
+        void update(FrameInfo &frameInfo);
+
+        LodSettings settings;
+    };
+
+}
@@ -0,0 +1,302 @@
+#include "meshlet_cull_system.hpp"
+
+#include "nre_swap_chain.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace nre
+{
+
+    namespace
+    {
+
+        // std140, matches CullUbo in shaders/meshlet_cull.comp
+        struct CullUbo
+        {
+            glm::mat4 viewProjection{1.f};
+            glm::vec4 frustumPlanes[6];
+            glm::vec4 cameraPosition{0.f};
+            float pixelScale = 1.f;
+            float minPixelSize = 0.f;
+            float padding[2];
+        };
+
+        struct MeshletCullPushConstantData
+        {
+            glm::mat4 modelMatrix{1.f};
+            uint32_t meshletCount = 0;
+            uint32_t drawOffset = 0;
+            uint32_t countIndex = 0;
+            uint32_t flags = 0;
+            float scale = 1.f;
+        };
+
+        constexpr uint32_t FLAG_COMPACT = 1;
+        constexpr uint32_t FLAG_CONE_CULLING = 2;
+        constexpr uint32_t WORKGROUP_SIZE = 64;
+
+    } // namespace
+
+    MeshletCullSystem::MeshletCullSystem(NreDevice &device, const MeshletCullSettings &settings)
+        : nreDevice{device}, settings{settings}
+    {
+        createBuffers();
+        createDescriptorSets();
+        createPipelineLayout();
+        createPipeline();
+    }
+
+    MeshletCullSystem::~MeshletCullSystem()
+    {
+        vkDestroyPipelineLayout(nreDevice.device(), pipelineLayout, nullptr);
+    }
+
+    void MeshletCullSystem::createBuffers()
+    {
+        for (int i = 0; i < NreSwapChain::MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            auto ubo = std::make_unique<NreBuffer>(
+                nreDevice,
+                sizeof(CullUbo),
+                1,
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+            ubo->map();
+            uboBuffers.push_back(std::move(ubo));
+
+            drawBuffers.push_back(std::make_unique<NreBuffer>(
+                nreDevice,
+                sizeof(VkDrawIndexedIndirectCommand),
+                settings.maxDraws,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+
+            countBuffers.push_back(std::make_unique<NreBuffer>(
+                nreDevice,
+                sizeof(uint32_t),
+                settings.maxCounts,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+        }
+    }
+
+    void MeshletCullSystem::createDescriptorSets()
+    {
+        const uint32_t frames = NreSwapChain::MAX_FRAMES_IN_FLIGHT;
+        descriptorPool = NreDescriptorPool::Builder(nreDevice)
+                             .setMaxSets(frames + settings.maxModels)
+                             .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frames)
+                             .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * frames + settings.maxModels)
+                             .build();
+
+        frameSetLayout = NreDescriptorSetLayout::Builder(nreDevice)
+                             .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                             .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                             .addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                             .build();
+        meshletSetLayout = NreDescriptorSetLayout::Builder(nreDevice)
+                               .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                               .build();
+
+        frameSets.resize(frames);
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            auto uboInfo = uboBuffers[i]->descriptorInfo();
+            auto drawInfo = drawBuffers[i]->descriptorInfo();
+            auto countInfo = countBuffers[i]->descriptorInfo();
+            NreDescriptorWriter(*frameSetLayout, *descriptorPool)
+                .writeBuffer(0, &uboInfo)
+                .writeBuffer(1, &drawInfo)
+                .writeBuffer(2, &countInfo)
+                .build(frameSets[i]);
+        }
+    }
+
+    void MeshletCullSystem::createPipelineLayout()
+    {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(MeshletCullPushConstantData);
+
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts{
+            frameSetLayout->getDescriptorSetLayout(),
+            meshletSetLayout->getDescriptorSetLayout()};
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(nreDevice.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("Failed to create pipeline layout");
+        }
+    }
+
+    void MeshletCullSystem::createPipeline()
+    {
+        assert(pipelineLayout != nullptr && "Cannot create pipeline before Pipeline layout");
+        cullPipeline = std::make_unique<NreComputePipeline>(
+            nreDevice, "shaders/meshlet_cull.comp.spv", pipelineLayout);
+    }
+
+    VkDescriptorSet MeshletCullSystem::getMeshletSet(const NreModel &model)
+    {
+        auto it = meshletSets.find(&model);
+        if (it != meshletSets.end())
+        {
+            return it->second;
+        }
+
+        VkDescriptorSet set;
+        auto meshletInfo = model.getMeshletBuffer()->descriptorInfo();
+        if (!NreDescriptorWriter(*meshletSetLayout, *descriptorPool)
+                 .writeBuffer(0, &meshletInfo)
+                 .build(set))
+        {
+            throw std::runtime_error("meshlet cull system: more models than settings.maxModels");
+        }
+        meshletSets.emplace(&model, set);
+        return set;
+    }
+
+    void MeshletCullSystem::cull(FrameInfo &frameInfo)
+    {
+        const int frame = frameInfo.frameIndex;
+        VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+        const bool compact = nreDevice.supportsDrawIndirectCount();
+
+        // objects that were culled last frame draw normally unless picked up again
+        std::vector<NreGameObject *> objects{};
+        for (auto &kv : frameInfo.gameObjects)
+        {
+            auto &obj = kv.second;
+            obj.meshletDraws = NreModel::IndirectDraws{};
+            // coarser levels are cheap enough to draw whole
+            if (obj.model != nullptr && obj.visible && obj.model->hasMeshlets() &&
+                !obj.lod.culled && !obj.lod.useImpostor && obj.lod.level == 0)
+            {
+                objects.push_back(&obj);
+            }
+        }
+        if (objects.empty())
+        {
+            return;
+        }
+
+        const auto &projection = frameInfo.camera.getProjection();
+        CullUbo ubo{};
+        ubo.viewProjection = projection * frameInfo.camera.getView();
+        auto planes = frameInfo.camera.getFrustumPlanes();
+        std::copy(planes.begin(), planes.end(), ubo.frustumPlanes);
+        ubo.cameraPosition = glm::vec4{frameInfo.camera.getPosition(), 1.f};
+        ubo.pixelScale = glm::abs(projection[1][1]) * static_cast<float>(frameInfo.extent.height) * .5f;
+        ubo.minPixelSize = settings.minPixelSize;
+        uboBuffers[frame]->writeToBuffer(&ubo);
+        uboBuffers[frame]->flush();
+
+        // counts start at zero every frame
+        VkBuffer countBuffer = countBuffers[frame]->getBuffer();
+        vkCmdFillBuffer(commandBuffer, countBuffer, 0, VK_WHOLE_SIZE, 0);
+        VkBufferMemoryBarrier clearBarrier{};
+        clearBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        clearBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        clearBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        clearBarrier.buffer = countBuffer;
+        clearBarrier.offset = 0;
+        clearBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0, nullptr,
+            1, &clearBarrier,
+            0, nullptr);
+
+        cullPipeline->bind(commandBuffer);
+        vkCmdBindDescriptorSets(
+            commandBuffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            pipelineLayout,
+            0, 1,
+            &frameSets[frame],
+            0,
+            nullptr);
+
+        const VkDeviceSize drawSize = sizeof(VkDrawIndexedIndirectCommand);
+        uint32_t drawOffset = 0;
+        uint32_t objectCount = 0;
+        uint32_t countIndex = 0;
+        for (NreGameObject *obj : objects)
+        {
+            const NreModel &model = *obj->model;
+            uint32_t meshletCount = model.getMeshletCount();
+            uint32_t submeshCount = model.getSubmeshCount();
+            if (drawOffset + meshletCount > settings.maxDraws ||
+                objectCount == settings.maxObjects ||
+                countIndex + submeshCount > settings.maxCounts)
+                continue;
+
+            VkDescriptorSet meshletSet = getMeshletSet(model);
+            vkCmdBindDescriptorSets(
+                commandBuffer,
+                VK_PIPELINE_BIND_POINT_COMPUTE,
+                pipelineLayout,
+                1, 1,
+                &meshletSet,
+                0,
+                nullptr);
+
+            const glm::vec3 &scale = obj->transform.scale;
+            glm::vec3 absScale = glm::abs(scale);
+            float maxScale = std::max({absScale.x, absScale.y, absScale.z});
+            float minScale = std::min({absScale.x, absScale.y, absScale.z});
+
+            MeshletCullPushConstantData push{};
+            push.modelMatrix = obj->transform.mat4();
+            push.meshletCount = meshletCount;
+            push.drawOffset = drawOffset;
+            push.countIndex = countIndex;
+            push.scale = maxScale;
+            push.flags = compact ? FLAG_COMPACT : 0;
+            // the cones are only valid for closed meshes under uniform scale
+            if (model.isClosed() && maxScale - minScale <= 1e-4f * maxScale)
+            {
+                push.flags |= FLAG_CONE_CULLING;
+            }
+            vkCmdPushConstants(
+                commandBuffer,
+                pipelineLayout,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                0,
+                sizeof(MeshletCullPushConstantData),
+                &push);
+            vkCmdDispatch(commandBuffer, (meshletCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+            auto &draws = obj->meshletDraws;
+            draws.drawBuffer = drawBuffers[frame]->getBuffer();
+            draws.drawOffset = drawOffset * drawSize;
+            draws.countBuffer = compact ? countBuffer : VK_NULL_HANDLE;
+            draws.countOffset = countIndex * sizeof(uint32_t);
+            draws.maxDrawCount = meshletCount;
+
+            drawOffset += meshletCount;
+            objectCount++;
+            countIndex += submeshCount;
+        }
+    }
+
+} // namespace nre
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "nre_buffer.hpp"
+#include "nre_compute_pipeline.hpp"
+#include "nre_descriptors.hpp"
+#include "nre_device.hpp"
+#include "nre_frame_info.hpp"
+#include "nre_game_object.hpp"
+
+// std
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace nre
+{
+    struct MeshletCullSettings
+    {
+        // meshlets whose bounding sphere covers fewer pixels are dropped
+        float minPixelSize = 1.f;
+        // meshlet draws per frame over all objects, objects that don't fit anymore are drawn
+        // whole
+        uint32_t maxDraws = 1 << 18;
+        uint32_t maxObjects = 1024;
+        // draw counts over all objects, one per submesh so materials stay apart
+        uint32_t maxCounts = 4096;
+        // distinct models with meshlets that can be culled
+        uint32_t maxModels = 256;
+    };
+
+    // culls the meshlets of every full detail object on the GPU and leaves indirect draws of
+    // the survivors in NreGameObject::meshletDraws
+    // has to run before the render pass begins, in a render graph pass writing getDrawBuffer
+    // and getCountBuffer, the graph makes the draws visible to the indirect reads
+    class MeshletCullSystem
+    {
+
+    public:
+        MeshletCullSystem(NreDevice &device, const MeshletCullSettings &settings = MeshletCullSettings{});
+        ~MeshletCullSystem();
+
+        MeshletCullSystem(const MeshletCullSystem &) = delete;
+        MeshletCullSystem &operator=(const MeshletCullSystem &) = delete;
+
+        void cull(FrameInfo &frameInfo);
+
+        VkBuffer getDrawBuffer(int frameIndex) const { return drawBuffers[frameIndex]->getBuffer(); }
+        VkBuffer getCountBuffer(int frameIndex) const { return countBuffers[frameIndex]->getBuffer(); }
+
+    private:
+        void createBuffers();
+        void createDescriptorSets();
+        void createPipelineLayout();
+        void createPipeline();
+
+        // models stay alive as long as the objects using them, so the set is kept
+        VkDescriptorSet getMeshletSet(const NreModel &model);
+
+        NreDevice &nreDevice;
+        MeshletCullSettings settings;
+
+        std::unique_ptr<NreDescriptorPool> descriptorPool;
+        // set 0: per frame ubo, draws and counts, set 1: meshlets of one model
+        std::unique_ptr<NreDescriptorSetLayout> frameSetLayout;
+        std::unique_ptr<NreDescriptorSetLayout> meshletSetLayout;
+        std::vector<VkDescriptorSet> frameSets;
+        std::unordered_map<const NreModel *, VkDescriptorSet> meshletSets;
+
+        // one of each per frame in flight
+        std::vector<std::unique_ptr<NreBuffer>> uboBuffers;
+        std::vector<std::unique_ptr<NreBuffer>> drawBuffers;
+        std::vector<std::unique_ptr<NreBuffer>> countBuffers;
+
+        VkPipelineLayout pipelineLayout;
+        std::unique_ptr<NreComputePipeline> cullPipeline;
+    };
+
+}
@@ -19,11 +19,12 @@ const glm::vec3 PURPLE = {0.5f, 0.0f, 0.5f};
 
 namespace nre {
 
-PointLightSystem::PointLightSystem(NreDevice &device, VkRenderPass renderPass,
+PointLightSystem::PointLightSystem(NreDevice &device,
+                                   const PipelineRenderTarget &renderTarget,
                                    VkDescriptorSetLayout globalSetLayout)
     : nreDevice{device} {
   createPipelineLayout(globalSetLayout);
-  createPipeline(renderPass);
+  createPipeline(renderTarget);
 }
 
 PointLightSystem::~PointLightSystem() {
@@ -55,7 +56,8 @@ void PointLightSystem::createPipelineLayout(
   }
 };
 
-void PointLightSystem::createPipeline(VkRenderPass renderPass) {
+void PointLightSystem::createPipeline(
+    const PipelineRenderTarget &renderTarget) {
   assert(pipelineLayout != nullptr &&
          "Cannot create pipeline before Pipeline layout");
 
@@ -63,7 +65,7 @@ void PointLightSystem::createPipeline(VkRenderPass renderPass) {
   NrePipeline::defaultPipelineConfigInfo(pipelineConfig);
   pipelineConfig.attributeDescriptions.clear();
   pipelineConfig.bindingDescriptions.clear();
-  pipelineConfig.renderPass = renderPass;
+  renderTarget.apply(pipelineConfig);
   pipelineConfig.pipelineLayout = pipelineLayout;
   nrePipeline = std::make_unique<NrePipeline>(
       nreDevice, "shaders/point_light.vert.spv", "shaders/point_light.frag.spv",
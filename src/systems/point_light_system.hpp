@@ -14,7 +14,7 @@ namespace nre {
 class PointLightSystem {
 
 public:
-  PointLightSystem(NreDevice &device, VkRenderPass renderPass,
+  PointLightSystem(NreDevice &device, const PipelineRenderTarget &renderTarget,
                    VkDescriptorSetLayout globalSetLayout);
   ~PointLightSystem();
 
@@ -25,7 +25,7 @@ public:
 
 private:
   void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
-  void createPipeline(VkRenderPass renderPass);
+  void createPipeline(const PipelineRenderTarget &renderTarget);
 
   NreDevice &nreDevice;
   std::unique_ptr<NrePipeline> nrePipeline;
@@ -6,8 +6,11 @@
 #include <glm/gtc/constants.hpp>
 
 // std
+#include <algorithm>
 #include <stdexcept>
 #include <array>
+#include <cstring>
+#include <tuple>
 
 namespace colors
 {
@@ -25,13 +28,34 @@ namespace nre
     {
         // identity matrix
         glm::mat4 modelMatrix{1.f};
+        // only the upper 3x3 is used for normals
+        // normalMatrix[3].x holds the bits of the material index, 128 bytes is all the push
+        // constant space guaranteed
         glm::mat4 normalMatrix{1.f};
     };
 
-    SimpleRenderSystem::SimpleRenderSystem(NreDevice &device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout) : nreDevice{device}
+    // constant_id values in shaders/simple_shader.vert
+    constexpr uint32_t OCT_NORMALS_CONSTANT = 0;
+
+    SimpleRenderSystem::SimpleRenderSystem(
+        NreDevice &device,
+        NrePipelineManager &pipelineManager,
+        const PipelineRenderTarget &renderTarget,
+        VkDescriptorSetLayout globalSetLayout,
+        NreBindlessTable &bindlessTable,
+        const std::string &fragFilepath,
+        uint32_t colorAttachmentCount)
+        : nreDevice{device},
+          pipelineManager{pipelineManager},
+          bindlessTable{bindlessTable},
+          renderTarget{renderTarget},
+          fragFilepath{fragFilepath},
+          colorAttachmentCount{colorAttachmentCount},
+          dynamicRasterState{device.supportsExtendedDynamicState()}
     {
         createPipelineLayout(globalSetLayout);
-        createPipeline(renderPass);
+        // load time, so waiting is fine, formats seen later compile in the background
+        pipelineManager.wait(requestPipeline(NreModel::VertexFormat{}));
     }
 
     SimpleRenderSystem::~SimpleRenderSystem()
@@ -48,7 +72,7 @@ namespace nre
         pushConstantRange.offset = 0;
         pushConstantRange.size = sizeof(SimplePushConstantData);
 
-        std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout};
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout, bindlessTable.getSetLayout()};
 
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -62,25 +86,47 @@ namespace nre
         }
     };
 
-    void SimpleRenderSystem::createPipeline(VkRenderPass renderPass)
+    NrePipelineManager::Handle SimpleRenderSystem::requestPipeline(const NreModel::VertexFormat &format)
     {
         assert(pipelineLayout != nullptr && "Cannot create pipeline before Pipeline layout");
 
         PipelineConfigInfo pipelineConfig{};
         NrePipeline::defaultPipelineConfigInfo(pipelineConfig);
-        pipelineConfig.renderPass = renderPass;
+        pipelineConfig.bindingDescriptions = format.getBindingDescriptions();
+        pipelineConfig.attributeDescriptions = format.getAttributeDescriptions();
+        // one permutation per vertex format, decoding is compiled out for plain normals
+        pipelineConfig.vertSpecialization.set(
+            OCT_NORMALS_CONSTANT, format.normal == NreModel::VertexFormat::Normal::Octahedral16);
+        if (dynamicRasterState)
+        {
+            NrePipeline::enableExtendedDynamicState(pipelineConfig);
+        }
+        // request copies them, so they only have to live until it returns
+        std::vector<VkPipelineColorBlendAttachmentState> blendAttachments(
+            colorAttachmentCount, pipelineConfig.colorBlendAttachment);
+        pipelineConfig.colorBlendInfo.attachmentCount = colorAttachmentCount;
+        pipelineConfig.colorBlendInfo.pAttachments = blendAttachments.data();
+        renderTarget.apply(pipelineConfig);
         pipelineConfig.pipelineLayout = pipelineLayout;
-        nrePipeline = std::make_unique<NrePipeline>(
-            nreDevice,
+        NrePipelineManager::Handle handle = pipelineManager.request(
             "shaders/simple_shader.vert.spv",
-            "shaders/simple_shader.frag.spv",
+            fragFilepath,
             pipelineConfig);
+        pipelineHandles[format.key()] = handle;
+        return handle;
     }
 
-    void SimpleRenderSystem::renderGameObjects(FrameInfo &frameInfo)
+    NrePipeline *SimpleRenderSystem::getPipeline(const NreModel::VertexFormat &format)
     {
-        nrePipeline->bind(frameInfo.commandBuffer);
+        auto it = pipelineHandles.find(format.key());
+        NrePipelineManager::Handle handle = it != pipelineHandles.end() ? it->second : requestPipeline(format);
+        return pipelineManager.get(handle);
+    }
 
+    void SimpleRenderSystem::renderGameObjects(FrameInfo &frameInfo)
+    {
+        // the pipeline is bound per object below, the descriptor sets stay valid
+        // across them since every pipeline shares pipelineLayout
         vkCmdBindDescriptorSets(
             frameInfo.commandBuffer,
             VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -89,22 +135,152 @@ namespace nre
             &frameInfo.globalDescriptorSet,
             0,
             nullptr);
+        // bound once, materials are picked per draw through the push constant
+        bindlessTable.bind(frameInfo.commandBuffer, pipelineLayout, 1, frameInfo.frameIndex);
 
         // every rendered object will use the same projection and view matrix
+        frustumPlanes = frameInfo.camera.getFrustumPlanes();
+        cameraPosition = frameInfo.camera.getPosition();
 
+        drawItems.clear();
         for (auto &kv : frameInfo.gameObjects)
         {
             auto &obj = kv.second;
             // kv => (objId, gameObj)
-            if (obj.model == nullptr)
+            if (obj.model == nullptr || !obj.visible || obj.lod.culled || obj.lod.useImpostor)
+                continue;
+
+            const auto &sphere = obj.model->getBoundingSphere();
+            glm::vec3 scale = glm::abs(obj.transform.scale);
+            glm::vec3 center{obj.transform.mat4() * glm::vec4{sphere.center, 1.f}};
+            if (!sphereInFrustum(frustumPlanes, center, sphere.radius * std::max({scale.x, scale.y, scale.z})))
                 continue;
-            SimplePushConstantData push{};
-            push.modelMatrix = obj.transform.mat4();
-            push.normalMatrix = obj.transform.normalMatrix();
 
-            vkCmdPushConstants(frameInfo.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(SimplePushConstantData), &push);
-            obj.model->bind(frameInfo.commandBuffer);
-            obj.model->draw(frameInfo.commandBuffer);
+            const auto &format = obj.model->getVertexFormat();
+            NrePipeline *pipeline = getPipeline(format);
+            // still compiling, skipped rather than stalling the frame
+            if (pipeline == nullptr)
+                continue;
+
+            // every level and the meshlet draws keep their submesh ranges, so each submesh is
+            // drawn with its own material
+            if (obj.model->getSubmeshCount() > 1)
+            {
+                addVisibleSubmeshes(obj, pipeline);
+                continue;
+            }
+            glm::vec3 offset = center - cameraPosition;
+            drawItems.push_back(
+                {pipeline,
+                 obj.model->getSubmeshMaterial(0, obj.material),
+                 &obj,
+                 WHOLE_MODEL,
+                 glm::dot(offset, offset)});
         }
+
+        // by pipeline, then material, then model, then front to back so the depth test rejects
+        // more of what is behind
+        // a material change is only a push constant, but keeping them together helps the
+        // texture caches
+        std::sort(
+            drawItems.begin(),
+            drawItems.end(),
+            [](const DrawItem &a, const DrawItem &b)
+            {
+                return std::make_tuple(
+                           reinterpret_cast<uintptr_t>(a.pipeline),
+                           a.material,
+                           reinterpret_cast<uintptr_t>(a.object->model.get()),
+                           a.distance) <
+                       std::make_tuple(
+                           reinterpret_cast<uintptr_t>(b.pipeline),
+                           b.material,
+                           reinterpret_cast<uintptr_t>(b.object->model.get()),
+                           b.distance);
+            });
+
+        NrePipeline *boundPipeline = nullptr;
+        NreModel *boundModel = nullptr;
+        for (const auto &item : drawItems)
+        {
+            if (item.pipeline != boundPipeline)
+            {
+                item.pipeline->bind(frameInfo.commandBuffer);
+                boundPipeline = item.pipeline;
+                if (dynamicRasterState)
+                {
+                    rasterState.apply(frameInfo.commandBuffer);
+                }
+            }
+            // vertex buffers stay bound across pipelines
+            if (item.object->model.get() != boundModel)
+            {
+                item.object->model->bind(frameInfo.commandBuffer);
+                boundModel = item.object->model.get();
+            }
+            drawItem(frameInfo, item);
+        }
+    }
+
+    void SimpleRenderSystem::addVisibleSubmeshes(NreGameObject &obj, NrePipeline *pipeline)
+    {
+        const NreModel &model = *obj.model;
+        glm::mat4 modelMatrix = obj.transform.mat4();
+        glm::vec3 scale = glm::abs(obj.transform.scale);
+        float maxScale = std::max({scale.x, scale.y, scale.z});
+
+        const bool meshlets = obj.meshletDraws.drawBuffer != VK_NULL_HANDLE;
+        size_t firstItem = drawItems.size();
+        for (uint32_t i = 0; i < model.getSubmeshCount(); i++)
+        {
+            // simplified away at this level, or no meshlets
+            if (meshlets ? model.getSubmesh(i).meshletCount == 0 : model.getSubmesh(i, obj.lod.level).indexCount == 0)
+                continue;
+            // coarser levels keep the full detail bounds, they only ever lose vertices
+            const auto &bounds = model.getSubmesh(i).bounds;
+            glm::vec3 center{modelMatrix * glm::vec4{bounds.center, 1.f}};
+            if (!sphereInFrustum(frustumPlanes, center, bounds.radius * maxScale))
+                continue;
+            glm::vec3 offset = center - cameraPosition;
+            drawItems.push_back(
+                {pipeline, model.getSubmeshMaterial(i, obj.material), &obj, i, glm::dot(offset, offset)});
+        }
+
+        // everything in view with one material, one draw is cheaper than many
+        // meshlet draws are counted per submesh on the GPU, so those can't be merged
+        if (!meshlets && drawItems.size() - firstItem == model.getSubmeshCount() && model.hasSingleMaterial())
+        {
+            DrawItem whole = drawItems[firstItem];
+            whole.submesh = WHOLE_MODEL;
+            drawItems.resize(firstItem);
+            drawItems.push_back(whole);
+        }
+    }
+
+    void SimpleRenderSystem::drawItem(FrameInfo &frameInfo, const DrawItem &item)
+    {
+        NreGameObject &obj = *item.object;
+
+        SimplePushConstantData push{};
+        // quantized positions are expanded back to object space before the model transform
+        push.modelMatrix = obj.transform.mat4() * obj.model->getPositionDequantization();
+        push.normalMatrix = obj.transform.normalMatrix();
+        std::memcpy(&push.normalMatrix[3].x, &item.material, sizeof(uint32_t));
+        vkCmdPushConstants(
+            frameInfo.commandBuffer,
+            pipelineLayout,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            0,
+            sizeof(SimplePushConstantData),
+            &push);
+
+        if (item.submesh != WHOLE_MODEL && obj.meshletDraws.drawBuffer != VK_NULL_HANDLE)
+            obj.model->drawSubmeshIndirect(frameInfo.commandBuffer, obj.meshletDraws, item.submesh);
+        else if (item.submesh != WHOLE_MODEL)
+            obj.model->drawSubmesh(frameInfo.commandBuffer, item.submesh, obj.lod.level);
+        else if (obj.meshletDraws.drawBuffer != VK_NULL_HANDLE)
+            obj.model->drawIndirect(frameInfo.commandBuffer, obj.meshletDraws);
+        else
+            obj.model->draw(frameInfo.commandBuffer, obj.lod.level);
     }
 } // namspace nre
\ No newline at end of file
@@ -1,13 +1,19 @@
 #pragma once
 
+#include "nre_bindless.hpp"
 #include "nre_camera.hpp"
 #include "nre_pipeline.hpp"
+#include "nre_pipeline_manager.hpp"
 #include "nre_device.hpp"
 #include "nre_game_object.hpp"
 #include "nre_frame_info.hpp"
+#include "nre_model.hpp"
 
 // std
+#include <array>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace nre
@@ -16,7 +22,16 @@ namespace nre
     {
 
     public:
-        SimpleRenderSystem(NreDevice &device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout);
+        SimpleRenderSystem(
+            NreDevice &device,
+            NrePipelineManager &pipelineManager,
+            const PipelineRenderTarget &renderTarget,
+            VkDescriptorSetLayout globalSetLayout,
+            NreBindlessTable &bindlessTable,
+            // ie: shaders/deferred_gbuffer.frag.spv to fill the g-buffer instead of shading,
+            // with one blend attachment per color attachment of the target's subpass
+            const std::string &fragFilepath = "shaders/simple_shader.frag.spv",
+            uint32_t colorAttachmentCount = 1);
         ~SimpleRenderSystem();
 
         SimpleRenderSystem(const NreWindow &) = delete;
@@ -26,11 +41,50 @@ namespace nre
 
     private:
         void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
-        void createPipeline(VkRenderPass renderPass);
+        NrePipelineManager::Handle requestPipeline(const NreModel::VertexFormat &format);
+
+        // one pipeline per vertex format in use, requested the first time a model needs it
+        // null while it's still compiling, objects using it are skipped until then
+        NrePipeline *getPipeline(const NreModel::VertexFormat &format);
+
+        // one draw of the list, sorted so pipeline and vertex buffer binds happen as rarely
+        // as possible
+        struct DrawItem
+        {
+            NrePipeline *pipeline;
+            uint32_t material;
+            NreGameObject *object;
+            // submesh of the object's lod level (or of its meshlet draws), WHOLE_MODEL draws
+            // all of them at once, only done for single submesh or single material models
+            uint32_t submesh;
+            // squared, from the camera
+            float distance;
+        };
+        static constexpr uint32_t WHOLE_MODEL = ~0u;
+
+        // frustum culls the submeshes of a multi submesh object and queues the rest
+        void addVisibleSubmeshes(NreGameObject &obj, NrePipeline *pipeline);
+        void drawItem(FrameInfo &frameInfo, const DrawItem &item);
 
         NreDevice &nreDevice;
-        std::unique_ptr<NrePipeline> nrePipeline;
+        NrePipelineManager &pipelineManager;
+        // set 1, materials and textures
+        NreBindlessTable &bindlessTable;
+        PipelineRenderTarget renderTarget;
+        std::string fragFilepath;
+        uint32_t colorAttachmentCount;
+        // cull mode, depth state and topology, only set per draw when the device has extended
+        // dynamic state, so pipelines don't multiply with them
+        bool dynamicRasterState;
+        RasterState rasterState{};
+        // vertex format key -> pipeline
+        std::unordered_map<uint32_t, NrePipelineManager::Handle> pipelineHandles;
         VkPipelineLayout pipelineLayout;
+
+        // per frame culling state, kept to avoid reallocating
+        std::array<glm::vec4, 6> frustumPlanes{};
+        glm::vec3 cameraPosition{};
+        std::vector<DrawItem> drawItems;
     };
 
 }
\ No newline at end of file